@@ -0,0 +1,36 @@
+#ifndef GSR_ADAPTIVE_BITRATE_HPP
+#define GSR_ADAPTIVE_BITRATE_HPP
+
+#include "packet_sink.hpp"
+#include <stdint.h>
+
+struct AdaptiveBitrateParams {
+    int64_t max_bitrate = 0; // Bits per second. This is the bitrate the encoder starts at
+    int64_t min_bitrate = 0; // Bits per second
+    double max_write_latency = 0.5; // Seconds. The bitrate is lowered when packets take longer than this to be written
+    double update_interval = 0.5; // Seconds
+    // Seconds the sink has to keep up before the bitrate is raised again, so the bitrate doesn't jump up and down with the network
+    double raise_delay = 5.0;
+};
+
+/*
+    Lowers the bitrate of a livestream encoder when its packet sink can't keep up (the network is slower than the bitrate)
+    and slowly raises it again once the sink keeps up.
+*/
+struct AdaptiveBitrate {
+    AdaptiveBitrateParams params;
+    int64_t bitrate = 0;
+    double last_update_time = 0.0;
+    double keeping_up_since = 0.0;
+    int64_t num_dropped_packets = 0;
+    bool keyframe_requested = false;
+};
+
+void adaptive_bitrate_init(AdaptiveBitrate *self, const AdaptiveBitrateParams &params, double time_now);
+/*
+    Returns true if |self->bitrate| was changed. |request_keyframe| is set to true when the encoder should start a new gop
+    right away, which happens when the sink drops packets and is waiting for a keyframe to continue.
+*/
+bool adaptive_bitrate_update(AdaptiveBitrate *self, const PacketSinkStats &stats, double time_now, bool *request_keyframe);
+
+#endif /* GSR_ADAPTIVE_BITRATE_HPP */
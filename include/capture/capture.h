@@ -1,6 +1,7 @@
 #ifndef GSR_CAPTURE_CAPTURE_H
 #define GSR_CAPTURE_CAPTURE_H
 
+#include "../vec2.h"
 #include <stdbool.h>
 
 typedef struct AVCodecContext AVCodecContext;
@@ -8,12 +9,16 @@ typedef struct AVFrame AVFrame;
 
 typedef struct gsr_capture gsr_capture;
 
+/* Returned by |gsr_capture_capture| when the captured image didn't change since the last capture. The frame still contains the last image */
+#define GSR_CAPTURE_NO_NEW_FRAME 1
+
 struct gsr_capture {
     /* These methods should not be called manually. Call gsr_capture_* instead */
     int (*start)(gsr_capture *cap, AVCodecContext *video_codec_context);
     void (*tick)(gsr_capture *cap, AVCodecContext *video_codec_context, AVFrame **frame); /* can be NULL */
     bool (*should_stop)(gsr_capture *cap, bool *err); /* can be NULL */
     int (*capture)(gsr_capture *cap, AVFrame *frame);
+    int (*add_output)(gsr_capture *cap, AVCodecContext *video_codec_context, vec2i output_resolution, AVFrame **frame); /* can be NULL */
     void (*destroy)(gsr_capture *cap, AVCodecContext *video_codec_context);
 
     void *priv; /* can be NULL */
@@ -23,7 +28,15 @@ struct gsr_capture {
 int gsr_capture_start(gsr_capture *cap, AVCodecContext *video_codec_context);
 void gsr_capture_tick(gsr_capture *cap, AVCodecContext *video_codec_context, AVFrame **frame);
 bool gsr_capture_should_stop(gsr_capture *cap, bool *err);
+/* Returns 0 on success, GSR_CAPTURE_NO_NEW_FRAME if the image didn't change (only reported by some captures) or a negative value on error */
 int gsr_capture_capture(gsr_capture *cap, AVFrame *frame);
+/*
+    Adds another output that |gsr_capture_capture| draws the same captured image to. Has to be called after |gsr_capture_start| and before the first |gsr_capture_tick|.
+    The size and hardware frame context of |video_codec_context| are set and |frame| is allocated by the capture, which also frees them on destroy.
+    The image is scaled to fit inside |output_resolution| (keeping the aspect ratio), or not scaled if it's {0, 0}.
+    Returns 0 on success. Fails if the capture doesn't support multiple outputs.
+*/
+int gsr_capture_add_output(gsr_capture *cap, AVCodecContext *video_codec_context, vec2i output_resolution, AVFrame **frame);
 /* Calls |gsr_capture_stop| as well */
 void gsr_capture_destroy(gsr_capture *cap, AVCodecContext *video_codec_context);
 
@@ -3,6 +3,7 @@
 
 #include "../vec2.h"
 #include "../utils.h"
+#include "../color_conversion.h"
 #include "capture.h"
 #include <X11/X.h>
 
@@ -10,8 +11,13 @@ typedef struct _XDisplay Display;
 
 typedef struct {
     const char *display_to_capture; /* if this is "screen", then the entire x11 screen is captured (all displays). A copy is made of this */
+    vec2i region_pos; /* If |region_size| is not {0, 0} then only this area of the screen is captured. Only used if |display_to_capture| is "screen" */
+    vec2i region_size;
     gsr_gpu_info gpu_inf;
     const char *card_path; /* reference */
+    bool yuv444; /* Output yuv444 instead of nv12 */
+    vec2i output_resolution; /* The capture is scaled to fit inside this size (keeping the aspect ratio). Set to {0, 0} to not scale */
+    gsr_scale_filter scale_filter;
 } gsr_capture_kms_vaapi_params;
 
 gsr_capture* gsr_capture_kms_vaapi_create(const gsr_capture_kms_vaapi_params *params);
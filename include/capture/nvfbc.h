@@ -14,6 +14,8 @@ typedef struct {
     vec2i size;
     bool direct_capture;
     bool overclock;
+    bool yuv444; /* Capture directly to yuv444 instead of bgr0 */
+    vec2i output_resolution; /* NvFBC scales the capture to fit inside this size (keeping the aspect ratio). Set to {0, 0} to not scale */
 } gsr_capture_nvfbc_params;
 
 gsr_capture* gsr_capture_nvfbc_create(const gsr_capture_nvfbc_params *params);
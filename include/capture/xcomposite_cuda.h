@@ -3,6 +3,7 @@
 
 #include "capture.h"
 #include "../vec2.h"
+#include "../color_conversion.h"
 #include <X11/X.h>
 
 typedef struct _XDisplay Display;
@@ -11,7 +12,13 @@ typedef struct {
     Window window;
     bool follow_focused; /* If this is set then |window| is ignored */
     vec2i region_size; /* This is currently only used with |follow_focused| */
+    /* The part of the window that is recorded, for example one monitor of the compositor window. The whole window is recorded if |source_size| is {0, 0} */
+    vec2i source_pos;
+    vec2i source_size;
     bool overclock;
+    bool yuv444; /* Output yuv444 instead of nv12 */
+    vec2i output_resolution; /* The window is scaled to fit inside this size (keeping the aspect ratio). Set to {0, 0} to not scale. Not used with |follow_focused| */
+    gsr_scale_filter scale_filter;
 } gsr_capture_xcomposite_cuda_params;
 
 gsr_capture* gsr_capture_xcomposite_cuda_create(const gsr_capture_xcomposite_cuda_params *params);
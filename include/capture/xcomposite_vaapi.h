@@ -3,6 +3,7 @@
 
 #include "capture.h"
 #include "../vec2.h"
+#include "../color_conversion.h"
 #include <X11/X.h>
 
 typedef struct _XDisplay Display;
@@ -12,6 +13,9 @@ typedef struct {
     bool follow_focused; /* If this is set then |window| is ignored */
     vec2i region_size; /* This is currently only used with |follow_focused| */
     const char *card_path; /* reference */
+    bool yuv444; /* Output yuv444 instead of nv12 */
+    vec2i output_resolution; /* The window is scaled to fit inside this size (keeping the aspect ratio). Set to {0, 0} to not scale. Not used with |follow_focused| */
+    gsr_scale_filter scale_filter; /* Bilinear uses the fast vaapi scaling mode, the other filters use the high quality mode */
 } gsr_capture_xcomposite_vaapi_params;
 
 gsr_capture* gsr_capture_xcomposite_vaapi_create(const gsr_capture_xcomposite_vaapi_params *params);
@@ -9,25 +9,44 @@ typedef enum {
 } gsr_source_color;
 
 typedef enum {
-    GSR_DESTINATION_COLOR_NV12
+    GSR_DESTINATION_COLOR_NV12,   /* Y and UV textures, UV is half the size of Y */
+    GSR_DESTINATION_COLOR_YUV444  /* Y, U and V textures, all the same size */
 } gsr_destination_color;
 
+/* Filter used when the texture is drawn at a different size than its own size */
+typedef enum {
+    GSR_SCALE_FILTER_BILINEAR, /* Fastest, uses the texture sampler directly */
+    GSR_SCALE_FILTER_BICUBIC,  /* Catmull-Rom, 4x4 taps */
+    GSR_SCALE_FILTER_LANCZOS   /* Lanczos with a = 3, 6x6 taps */
+} gsr_scale_filter;
+
 typedef struct {
     gsr_egl *egl;
 
     gsr_source_color source_color;
     gsr_destination_color destination_color;
 
-    unsigned int destination_textures[2];
+    unsigned int destination_textures[3];
     int num_destination_textures;
+
+    gsr_scale_filter scale_filter;
 } gsr_color_conversion_params;
 
+typedef struct {
+    int texel_size;
+    int kernel_scale;
+} gsr_color_uniforms;
+
 typedef struct {
     gsr_color_conversion_params params;
-    int rotation_uniforms[2];
-    gsr_shader shaders[2];
+    gsr_color_uniforms uniforms[3];
+    gsr_shader shaders[3];
+
+    /* Only loaded if |params.scale_filter| is not bilinear. Used instead of |shaders| when the draw scales the texture */
+    gsr_color_uniforms scale_uniforms[3];
+    gsr_shader scale_shaders[3];
 
-    unsigned int framebuffers[2];
+    unsigned int framebuffers[3];
 
     unsigned int vertex_array_object_id;
     unsigned int vertex_buffer_object_id;
@@ -36,6 +55,18 @@ typedef struct {
 int gsr_color_conversion_init(gsr_color_conversion *self, const gsr_color_conversion_params *params);
 void gsr_color_conversion_deinit(gsr_color_conversion *self);
 
+/* Clears the destination textures to black. Used when the final image is drawn from multiple textures (multiple monitors for example) */
+void gsr_color_conversion_clear(gsr_color_conversion *self);
+
+/*
+    Draws the |texture_pos|, |texture_size| area of the texture to the |source_pos|, |source_size| area of the destination textures.
+    The image is rotated by |rotation| around the center of that area, |texture_pos| and |texture_size| are in the rotated orientation.
+*/
 int gsr_color_conversion_draw(gsr_color_conversion *self, unsigned int texture_id, vec2i source_pos, vec2i source_size, vec2i texture_pos, vec2i texture_size, float rotation);
+/*
+    Same as gsr_color_conversion_draw but always scales with bilinear filtering. Used for images in a texture atlas (the cursor),
+    where the wider kernels of the other scale filters would sample the images next to it
+*/
+int gsr_color_conversion_draw_bilinear(gsr_color_conversion *self, unsigned int texture_id, vec2i source_pos, vec2i source_size, vec2i texture_pos, vec2i texture_size, float rotation);
 
 #endif /* GSR_COLOR_CONVERSION_H */
@@ -0,0 +1,21 @@
+#ifndef GSR_COLOR_CONVERSION_QUAD_H
+#define GSR_COLOR_CONVERSION_QUAD_H
+
+#include "vec2.h"
+#include <stdbool.h>
+
+/* Number of floats written by gsr_color_conversion_quad_get_vertices: two triangles of x, y, u, v */
+#define GSR_QUAD_NUM_VERTEX_FLOATS 24
+
+/* True if |rotation| (radians) turns the image on its side (90 or 270 degrees) */
+bool gsr_rotation_is_sideways(float rotation);
+
+/*
+    Gets the vertices that draw the |texture_pos|, |texture_size| area of a texture of size |texture_full_size| to the |dest_pos|, |dest_size| area
+    of a target of size |target_size|. The positions are in normalized device coordinates and the texture coordinates are between 0 and 1.
+    |rotation| is a multiple of 90 degrees (counter clockwise, in radians). The image is rotated around the center of its own area, which stays axis aligned,
+    so |texture_pos| and |texture_size| are in the rotated orientation (the orientation of |dest_size|) while |texture_full_size| is the size of the texture itself.
+*/
+void gsr_color_conversion_quad_get_vertices(float *vertices, vec2i target_size, vec2i dest_pos, vec2i dest_size, vec2i texture_full_size, vec2i texture_pos, vec2i texture_size, float rotation);
+
+#endif /* GSR_COLOR_CONVERSION_QUAD_H */
@@ -5,6 +5,22 @@
 #include "vec2.h"
 
 #include <X11/Xlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define GSR_CURSOR_CACHE_SIZE 16
+/* Cursors larger than this are uploaded to their own texture every time they are shown instead of being cached */
+#define GSR_CURSOR_ATLAS_MAX_CURSOR_SIZE 128
+
+typedef struct {
+    unsigned long serial; /* XFixes cursor serial */
+    vec2i size;
+    vec2i hotspot;
+    uint64_t last_used;
+    bool visible;
+    bool in_use;
+} gsr_cursor_cache_entry;
 
 typedef struct {
     gsr_egl *egl;
@@ -12,12 +28,34 @@ typedef struct {
     Window window;
     int x_fixes_event_base;
 
-    unsigned int texture_id;
+    unsigned int texture_id; /* The texture that has the current cursor image, either |atlas_texture_id| or |large_texture_id| */
+    vec2i texture_pos; /* Position of the current cursor image in |texture_id| */
     vec2i size;
     vec2i hotspot;
     vec2i position;
+    bool visible; /* False if the cursor image is fully transparent (hidden) */
 
     bool cursor_image_set;
+
+    /* Cursor images are cached by their serial in slots of |atlas_texture_id|, so switching between cursors doesn't upload them again */
+    unsigned int atlas_texture_id;
+    unsigned int large_texture_id;
+    gsr_cursor_cache_entry cache[GSR_CURSOR_CACHE_SIZE];
+    uint64_t cache_counter;
+    uint8_t *upload_buffer;
+    size_t upload_buffer_size;
+
+    /*
+        The cursor position is tracked in a thread with its own connection to the X server, which wakes up on XInput2 raw motion events.
+        This way capture doesn't have to do a XQueryPointer round trip every frame. Falls back to XQueryPointer in gsr_cursor_tick if the thread can't be started.
+    */
+    Display *tracker_display;
+    pthread_t tracker_thread;
+    bool tracker_thread_started;
+    int tracker_wakeup_pipe[2];
+    int xi_opcode;
+    bool xi_raw_events_during_grab;
+    _Atomic uint64_t tracked_position; /* x in the high 32 bits, y in the low 32 bits */
 } gsr_cursor;
 
 int gsr_cursor_init(gsr_cursor *self, gsr_egl *egl, Display *display);
@@ -25,6 +63,9 @@ void gsr_cursor_deinit(gsr_cursor *self);
 
 int gsr_cursor_change_window_target(gsr_cursor *self, Window window);
 void gsr_cursor_update(gsr_cursor *self, XEvent *xev);
+/* Updates |position|. This doesn't block on the X server when the cursor tracker thread is running */
 void gsr_cursor_tick(gsr_cursor *self);
+/* Returns false if the cursor is hidden or outside the area (in screen coordinates), in which case it doesn't need to be drawn */
+bool gsr_cursor_is_visible_in_area(const gsr_cursor *self, vec2i area_pos, vec2i area_size);
 
 #endif /* GSR_CURSOR_H */
@@ -0,0 +1,14 @@
+#ifndef GSR_CURSOR_UNPREMULTIPLY_H
+#define GSR_CURSOR_UNPREMULTIPLY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+    Converts a cursor image from premultiplied argb to straight alpha rgba (color = color * 255 / alpha, clamped to 255).
+    |pixels| are premultiplied argb (one pixel per unsigned long, as XFixes returns them). |out| is rgba with |out_stride| bytes per row.
+    Returns false if all pixels are transparent.
+*/
+bool gsr_cursor_unpremultiply(const unsigned long *pixels, int width, int height, uint8_t *out, int out_stride);
+
+#endif /* GSR_CURSOR_UNPREMULTIPLY_H */
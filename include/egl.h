@@ -60,6 +60,10 @@ typedef void (*__eglMustCastToProperFunctionPointerType)(void);
 #define GL_RGB                                  0x1907
 #define GL_RGBA                                 0x1908
 #define GL_RGBA8                                0x8058
+#define GL_RED                                  0x1903
+#define GL_RG                                   0x8227
+#define GL_R8                                   0x8229
+#define GL_RG8                                  0x822B
 #define GL_UNSIGNED_BYTE                        0x1401
 #define GL_COLOR_BUFFER_BIT                     0x00004000
 #define GL_TEXTURE_WRAP_S                       0x2802
@@ -82,6 +86,7 @@ typedef void (*__eglMustCastToProperFunctionPointerType)(void);
 
 #define GL_VENDOR                               0x1F00
 #define GL_RENDERER                             0x1F01
+#define GL_VERSION                              0x1F02
 
 #define GL_COMPILE_STATUS                       0x8B81
 #define GL_INFO_LOG_LENGTH                      0x8B84
@@ -133,6 +138,7 @@ typedef struct {
     void (*glTexParameteri)(unsigned int target, unsigned int pname, int param);
     void (*glGetTexLevelParameteriv)(unsigned int target, int level, unsigned int pname, int *params);
     void (*glTexImage2D)(unsigned int target, int level, int internalFormat, int width, int height, int border, unsigned int format, unsigned int type, const void *pixels);
+    void (*glTexSubImage2D)(unsigned int target, int level, int xoffset, int yoffset, int width, int height, unsigned int format, unsigned int type, const void *pixels);
     void (*glCopyImageSubData)(unsigned int srcName, unsigned int srcTarget, int srcLevel, int srcX, int srcY, int srcZ, unsigned int dstName, unsigned int dstTarget, int dstLevel, int dstX, int dstY, int dstZ, int srcWidth, int srcHeight, int srcDepth);
     void (*glClearTexImage)(unsigned int texture, unsigned int level, unsigned int format, unsigned int type, const void *data);
     void (*glGenFramebuffers)(int n, unsigned int *framebuffers);
@@ -171,6 +177,7 @@ typedef struct {
     void (*glBlendFunc)(unsigned int sfactor, unsigned int dfactor);
     int (*glGetUniformLocation)(unsigned int program, const char *name);
     void (*glUniform1f)(int location, float v0);
+    void (*glUniform2f)(int location, float v0, float v1);
 } gsr_egl;
 
 bool gsr_egl_load(gsr_egl *self, Display *dpy);
@@ -0,0 +1,46 @@
+#ifndef GSR_ENCODER_CAPABILITIES_H
+#define GSR_ENCODER_CAPABILITIES_H
+
+#include "../utils.h"
+#include <stdbool.h>
+
+typedef struct AVCodec AVCodec;
+
+typedef enum {
+    GSR_VIDEO_CODEC_H264,
+    GSR_VIDEO_CODEC_HEVC,
+    GSR_VIDEO_CODEC_AV1,
+    GSR_VIDEO_CODEC_VP9,
+    GSR_VIDEO_CODEC_NUM
+} gsr_video_codec;
+
+typedef struct {
+    bool supported;
+    bool yuv444;    /* false if the encoder only supports yuv420 */
+    bool b_frames;  /* false if the encoder fails to open with b-frames */
+    bool preset_p4; /* nvenc only. The p1-p7 presets are missing in old ffmpeg versions */
+    bool preset_p6; /* nvenc only */
+    bool lookahead; /* nvenc only. false if the gpu doesn't support rc-lookahead */
+    bool temporal_aq; /* nvenc only. false if the gpu doesn't support temporal-aq */
+    bool qvbr;      /* vaapi only. Constant quality with a max bitrate (rc_mode QVBR), the AMD drivers don't support it */
+    int max_width;
+    int max_height;
+} gsr_video_codec_capabilities;
+
+typedef struct {
+    gsr_video_codec_capabilities codecs[GSR_VIDEO_CODEC_NUM];
+} gsr_encoder_capabilities;
+
+/*
+    Opening a hardware encoder is slow (especially nvenc), so the result of probing the encoders is cached in $XDG_CACHE_HOME/gpu-screen-recorder, in one file per gpu.
+    The cache is only used if the gpu vendor, driver version, |card_path|, vaapi driver vendor string (which includes the mesa version) and libavcodec version
+    are the same as when the encoders were probed. |card_path| is only used with vaapi (AMD/Intel).
+    The result is not cached if opening an encoder failed in a way that can be temporary (out of video memory or nvenc sessions).
+*/
+void gsr_encoder_get_capabilities(gsr_encoder_capabilities *capabilities, const gsr_gpu_info *gpu_info, const char *card_path);
+
+/* Returns NULL if ffmpeg was built without the encoder. This doesn't check if the gpu supports the codec, use gsr_encoder_get_capabilities for that */
+const AVCodec* gsr_video_codec_find_encoder(gsr_video_codec codec, gsr_gpu_vendor vendor);
+const char* gsr_video_codec_to_string(gsr_video_codec codec);
+
+#endif /* GSR_ENCODER_CAPABILITIES_H */
@@ -0,0 +1,37 @@
+#ifndef GSR_ENCODER_ENCODER_H
+#define GSR_ENCODER_ENCODER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct AVCodecContext AVCodecContext;
+typedef struct AVFrame AVFrame;
+typedef struct AVPacket AVPacket;
+
+typedef struct gsr_encoder gsr_encoder;
+
+/*
+    A video encoder. The frames come from a gsr_capture and the packets go to the packet sinks.
+    Implementations other than ffmpeg (for example NVENC used directly) only have to produce packets that match |codec_context|.
+*/
+struct gsr_encoder {
+    /* These methods should not be called manually. Call gsr_encoder_* instead */
+    int (*send_frame)(gsr_encoder *encoder, AVFrame *frame);
+    int (*receive_packet)(gsr_encoder *encoder, AVPacket *packet);
+    bool (*set_bitrate)(gsr_encoder *encoder, int64_t bitrate); /* can be NULL */
+    void (*destroy)(gsr_encoder *encoder);
+
+    /* Describes the encoded packets (codec, size, time base and extradata) for the muxers. This is not owned by the encoder */
+    AVCodecContext *codec_context;
+    void *priv; /* can be NULL */
+};
+
+/* Returns 0 on success, otherwise an ffmpeg error code (AVERROR). |frame| NULL flushes the encoder, after which gsr_encoder_receive_packet returns the remaining packets and then AVERROR_EOF */
+int gsr_encoder_send_frame(gsr_encoder *encoder, AVFrame *frame);
+/* Returns 0 if |packet| was filled, AVERROR(EAGAIN) if the encoder needs more frames first, otherwise an ffmpeg error code (AVERROR) */
+int gsr_encoder_receive_packet(gsr_encoder *encoder, AVPacket *packet);
+/* Changes the bitrate (in bits per second) of the running encoder, starting at the next frame. Returns false if the encoder can't do that */
+bool gsr_encoder_set_bitrate(gsr_encoder *encoder, int64_t bitrate);
+void gsr_encoder_destroy(gsr_encoder *encoder);
+
+#endif /* GSR_ENCODER_ENCODER_H */
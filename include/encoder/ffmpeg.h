@@ -0,0 +1,9 @@
+#ifndef GSR_ENCODER_FFMPEG_H
+#define GSR_ENCODER_FFMPEG_H
+
+#include "encoder.h"
+
+/* Encodes with |codec_context|, which has to be opened already. |codec_context| is not owned by the encoder */
+gsr_encoder* gsr_encoder_ffmpeg_create(AVCodecContext *codec_context);
+
+#endif /* GSR_ENCODER_FFMPEG_H */
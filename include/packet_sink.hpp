@@ -0,0 +1,80 @@
+#ifndef GSR_PACKET_SINK_HPP
+#define GSR_PACKET_SINK_HPP
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <stdint.h>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+enum class PacketSinkBackpressure {
+    BLOCK,              // The encoder waits until the sink has room. Used for files and the replay buffer, where packets can't be lost
+    DROP_UNTIL_KEYFRAME // Packets are dropped while the sink is full, and video packets until the next keyframe after that. Used for livestreams, so a slow network doesn't stall the recording
+};
+
+/*
+    Called from the thread of the sink. |packet| is freed by the sink after the call.
+    |time_base| is the time base of the timestamps in |packet| (the time base of the encoder).
+*/
+using PacketSinkWriteCallback = std::function<void(AVPacket *packet, AVRational time_base)>;
+
+struct PacketSinkParams {
+    std::string name; // Used in messages, for example the output file
+    PacketSinkBackpressure backpressure = PacketSinkBackpressure::BLOCK;
+    size_t max_queued_packets = 512;
+    int video_stream_index = 0; // Only keyframes of this stream stop the dropping with DROP_UNTIL_KEYFRAME
+    PacketSinkWriteCallback write;
+};
+
+struct PacketSinkEntry {
+    AVPacket *packet = nullptr;
+    AVRational time_base;
+    double push_time = 0.0; // Monotonic time in seconds
+};
+
+struct PacketSinkStats {
+    size_t num_queued_packets = 0;
+    // Time in seconds between a packet being queued and written (including the write itself), smoothed over the last packets.
+    // This grows when the output (for example the network) is slower than the encoder
+    double write_latency = 0.0;
+    int64_t num_dropped_packets = 0;
+    bool waiting_for_keyframe = false;
+};
+
+// Receives encoded packets and writes them in its own thread, so that a slow output doesn't stall the encoders or the other sinks
+struct PacketSink {
+    PacketSinkParams params;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<PacketSinkEntry> queue;
+    bool running = false;
+    bool waiting_for_keyframe = false;
+    int64_t num_dropped_packets = 0;
+    double write_latency = 0.0;
+};
+
+void packet_sink_start(PacketSink *sink, const PacketSinkParams &params);
+// Writes the packets that are still queued and then stops the thread of the sink
+void packet_sink_stop(PacketSink *sink);
+// Queues a new reference to |packet|. This can be called from multiple threads
+void packet_sink_push(PacketSink *sink, const AVPacket *packet, AVRational time_base);
+void packet_sinks_push(const std::vector<PacketSink*> &sinks, const AVPacket *packet, AVRational time_base);
+/*
+    Sends the packets from |receive_packet| (avcodec_receive_packet or gsr_encoder_receive_packet) to all |sinks| until it returns EAGAIN or EOF.
+    The timestamps are the ones from the encoder, which differ from the frame timestamps when the encoder reorders frames (b-frames) or has a delay (audio).
+    |time_base| is the time base of the encoder
+*/
+void packet_sinks_receive_packets(const std::function<int(AVPacket*)> &receive_packet, AVRational time_base, int stream_index, const std::vector<PacketSink*> &sinks);
+// Can be called from any thread while the sink is running
+PacketSinkStats packet_sink_get_stats(PacketSink *sink);
+
+#endif /* GSR_PACKET_SINK_HPP */
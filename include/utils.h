@@ -14,6 +14,7 @@ typedef enum {
 typedef struct {
     gsr_gpu_vendor vendor;
     int gpu_version; /* 0 if unknown */
+    char driver_version[128]; /* The opengl version string, which includes the driver version. Empty if unknown */
 } gsr_gpu_info;
 
 typedef struct {
@@ -34,8 +35,17 @@ typedef void (*active_monitor_callback)(const XRROutputInfo *output_info, const
 void for_each_active_monitor_output(Display *display, active_monitor_callback callback, void *userdata);
 bool get_monitor_by_name(Display *display, const char *name, gsr_monitor *monitor);
 
+/*
+    Returns the window the compositor draws the whole screen to (the composite overlay window, or the window the compositor
+    created inside it), or None if no compositor is running. Recording this window records the screen without NvFBC.
+*/
+Window get_compositor_window(Display *display);
+
 bool gl_get_gpu_info(Display *dpy, gsr_gpu_info *info);
 
+/* Returns |from| scaled to fit inside |to| while keeping the aspect ratio */
+vec2i scale_keep_aspect_ratio(vec2i from, vec2i to);
+
 /* |output| should be at least 128 bytes in size */
 bool gsr_get_valid_card_path(char *output);
 
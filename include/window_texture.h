@@ -8,6 +8,8 @@ typedef struct {
     Window window;
     Pixmap pixmap;
     unsigned int texture_id;
+    int texture_width; /* Size of the texture (the window pixmap), updated in window_texture_on_resize */
+    int texture_height;
     int redirected;
     gsr_egl *egl;
 } WindowTexture;
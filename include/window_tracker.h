@@ -0,0 +1,37 @@
+#ifndef GSR_WINDOW_TRACKER_H
+#define GSR_WINDOW_TRACKER_H
+
+#include "vec2.h"
+#include <stdbool.h>
+#include <X11/Xlib.h>
+
+/*
+    Tracks the lifecycle of a captured window and tells when the window pixmap has to be acquired again (with window_texture_on_resize).
+    The window gets a new pixmap when it's resized, mapped again (after being unmapped, for example when switching workspace in i3)
+    or reparented. The toplevel window (the window manager frame) is tracked as well, since the window stops being viewable when that is unmapped.
+*/
+typedef struct {
+    Display *display;
+    Window window;
+    Window toplevel; /* The ancestor of |window| that is a child of the root window, or |window| itself */
+    vec2i size;
+    bool viewable;
+    bool destroyed;
+    bool pixmap_invalid;
+    double pixmap_retry_time; /* Acquiring the pixmap failed, don't try again before this time */
+} gsr_window_tracker;
+
+/* Selects StructureNotify and Expose events on the window (and its toplevel window) */
+void gsr_window_tracker_init(gsr_window_tracker *self, Display *display, Window window);
+void gsr_window_tracker_deinit(gsr_window_tracker *self);
+
+/* Should be called with every event received from the display. Returns true if the event was for the tracked window */
+bool gsr_window_tracker_process_event(gsr_window_tracker *self, XEvent *xev);
+
+/* Returns true if the pixmap of the window has to be acquired again. Call one of the functions below after trying */
+bool gsr_window_tracker_should_acquire_pixmap(const gsr_window_tracker *self);
+void gsr_window_tracker_on_pixmap_acquired(gsr_window_tracker *self);
+/* For example when the window is not viewable anymore (XCompositeNameWindowPixmap fails). Tries again later */
+void gsr_window_tracker_on_pixmap_acquire_failed(gsr_window_tracker *self);
+
+#endif /* GSR_WINDOW_TRACKER_H */
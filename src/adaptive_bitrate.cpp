@@ -0,0 +1,54 @@
+#include "../include/adaptive_bitrate.hpp"
+#include <algorithm>
+
+void adaptive_bitrate_init(AdaptiveBitrate *self, const AdaptiveBitrateParams &params, double time_now) {
+    self->params = params;
+    self->params.min_bitrate = std::min(self->params.min_bitrate, self->params.max_bitrate);
+    self->bitrate = self->params.max_bitrate;
+    self->last_update_time = time_now;
+    self->keeping_up_since = time_now;
+    self->num_dropped_packets = 0;
+    self->keyframe_requested = false;
+}
+
+bool adaptive_bitrate_update(AdaptiveBitrate *self, const PacketSinkStats &stats, double time_now, bool *request_keyframe) {
+    *request_keyframe = false;
+
+    // Only one keyframe per drop, the sink continues as soon as it gets it
+    if(stats.waiting_for_keyframe) {
+        if(!self->keyframe_requested)
+            *request_keyframe = true;
+        self->keyframe_requested = true;
+    } else {
+        self->keyframe_requested = false;
+    }
+
+    if(time_now - self->last_update_time < self->params.update_interval)
+        return false;
+    self->last_update_time = time_now;
+
+    const bool dropped_packets = stats.num_dropped_packets != self->num_dropped_packets;
+    self->num_dropped_packets = stats.num_dropped_packets;
+
+    int64_t new_bitrate = self->bitrate;
+    if(dropped_packets) {
+        new_bitrate = self->bitrate / 2;
+        self->keeping_up_since = time_now;
+    } else if(stats.write_latency > self->params.max_write_latency) {
+        new_bitrate = self->bitrate * 3 / 4;
+        self->keeping_up_since = time_now;
+    } else if(stats.write_latency > self->params.max_write_latency * 0.5) {
+        // Close to the limit, keep the current bitrate
+        self->keeping_up_since = time_now;
+    } else if(time_now - self->keeping_up_since >= self->params.raise_delay) {
+        new_bitrate = self->bitrate + self->params.max_bitrate / 10;
+        self->keeping_up_since = time_now;
+    }
+
+    new_bitrate = std::max(self->params.min_bitrate, std::min(self->params.max_bitrate, new_bitrate));
+    if(new_bitrate == self->bitrate)
+        return false;
+
+    self->bitrate = new_bitrate;
+    return true;
+}
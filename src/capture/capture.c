@@ -42,6 +42,20 @@ int gsr_capture_capture(gsr_capture *cap, AVFrame *frame) {
     return cap->capture(cap, frame);
 }
 
+int gsr_capture_add_output(gsr_capture *cap, AVCodecContext *video_codec_context, vec2i output_resolution, AVFrame **frame) {
+    if(!cap->started) {
+        fprintf(stderr, "gsr error: gsr_capture_add_output failed: the gsr capture has not been started\n");
+        return -1;
+    }
+
+    if(!cap->add_output) {
+        fprintf(stderr, "gsr error: gsr_capture_add_output failed: the gsr capture doesn't support multiple outputs\n");
+        return -1;
+    }
+
+    return cap->add_output(cap, video_codec_context, output_resolution, frame);
+}
+
 void gsr_capture_destroy(gsr_capture *cap, AVCodecContext *video_codec_context) {
     cap->destroy(cap, video_codec_context);
 }
@@ -18,12 +18,34 @@
 #include <va/va_drmcommon.h>
 
 #define MAX_CONNECTOR_IDS 32
+#define MAX_OUTPUTS 8
 
 typedef struct {
     uint32_t connector_ids[MAX_CONNECTOR_IDS];
     int num_connector_ids;
 } MonitorId;
 
+/* Position of a connector (monitor) on the x11 screen */
+typedef struct {
+    uint32_t connector_id;
+    vec2i pos;
+    vec2i size;
+    int x11_rot; /* X11Rotation */
+} ConnectorMonitor;
+
+/* A video the captured image is drawn to. The first output is the main output, the others are added with add_output */
+typedef struct {
+    AVCodecContext *video_codec_context;
+    AVFrame *frame; /* Only owned by the capture for the added outputs */
+    vec2i output_size;
+
+    VADRMPRIMESurfaceDescriptor prime;
+    unsigned int target_textures[3];
+    int num_target_textures;
+
+    gsr_color_conversion color_conversion;
+} KmsOutput;
+
 typedef enum {
     X11_ROT_0    = 1 << 0,
     X11_ROT_90   = 1 << 1,
@@ -31,6 +53,15 @@ typedef enum {
     X11_ROT_270  = 1 << 3
 } X11Rotation;
 
+static float x11_rotation_to_radians(int x11_rot) {
+    switch(x11_rot) {
+        case X11_ROT_90:  return M_PI*0.5f;
+        case X11_ROT_180: return M_PI;
+        case X11_ROT_270: return M_PI*1.5f;
+        default:          return 0.0f;
+    }
+}
+
 typedef struct {
     gsr_capture_kms_vaapi_params params;
     Display *dpy;
@@ -49,19 +80,21 @@ typedef struct {
     vec2i capture_pos;
     vec2i capture_size;
     bool screen_capture;
+    bool region_capture;
     MonitorId monitor_id;
+    /* All active monitors, used to composite the screen from the monitor planes when there is no combined plane */
+    ConnectorMonitor connector_monitors[MAX_CONNECTOR_IDS];
+    int num_connector_monitors;
 
     VADisplay va_dpy;
 
     bool requires_rotation;
     X11Rotation x11_rot;
 
-    VADRMPRIMESurfaceDescriptor prime;
-
     unsigned int input_texture;
-    unsigned int target_textures[2];
 
-    gsr_color_conversion color_conversion;
+    KmsOutput outputs[MAX_OUTPUTS];
+    int num_outputs;
 
     gsr_cursor cursor;
 } gsr_capture_kms_vaapi;
@@ -72,9 +105,16 @@ static int max_int(int a, int b) {
 
 static void gsr_capture_kms_vaapi_stop(gsr_capture *cap, AVCodecContext *video_codec_context);
 
-static bool drm_create_codec_context(gsr_capture_kms_vaapi *cap_kms, AVCodecContext *video_codec_context) {
+/* If |shared_device_ctx| is not NULL then the frames are created on that device instead of a new one */
+static bool drm_create_codec_context(gsr_capture_kms_vaapi *cap_kms, AVCodecContext *video_codec_context, AVBufferRef *shared_device_ctx) {
     AVBufferRef *device_ctx;
-    if(av_hwdevice_ctx_create(&device_ctx, AV_HWDEVICE_TYPE_VAAPI, cap_kms->params.card_path, NULL, 0) < 0) {
+    if(shared_device_ctx) {
+        device_ctx = av_buffer_ref(shared_device_ctx);
+        if(!device_ctx) {
+            fprintf(stderr, "Error: Failed to reference hardware device context\n");
+            return false;
+        }
+    } else if(av_hwdevice_ctx_create(&device_ctx, AV_HWDEVICE_TYPE_VAAPI, cap_kms->params.card_path, NULL, 0) < 0) {
         fprintf(stderr, "Error: Failed to create hardware device context\n");
         return false;
     }
@@ -90,7 +130,7 @@ static bool drm_create_codec_context(gsr_capture_kms_vaapi *cap_kms, AVCodecCont
         (AVHWFramesContext *)frame_context->data;
     hw_frame_context->width = video_codec_context->width;
     hw_frame_context->height = video_codec_context->height;
-    hw_frame_context->sw_format = AV_PIX_FMT_NV12;//AV_PIX_FMT_0RGB32;//AV_PIX_FMT_YUV420P;//AV_PIX_FMT_0RGB32;//AV_PIX_FMT_NV12;
+    hw_frame_context->sw_format = cap_kms->params.yuv444 ? AV_PIX_FMT_YUV444P : AV_PIX_FMT_NV12;
     hw_frame_context->format = video_codec_context->pix_fmt;
     hw_frame_context->device_ref = device_ctx;
     hw_frame_context->device_ctx = (AVHWDeviceContext*)device_ctx->data;
@@ -134,11 +174,59 @@ static bool properties_has_atom(Atom *props, int nprop, Atom atom) {
     return false;
 }
 
+static bool get_connector_id(Display *dpy, RROutput output, Atom randr_connector_id_atom, uint32_t *connector_id) {
+    int nprop = 0;
+    Atom *props = XRRListOutputProperties(dpy, output, &nprop);
+    if(!props)
+        return false;
+
+    if(!properties_has_atom(props, nprop, randr_connector_id_atom)) {
+        XFree(props);
+        return false;
+    }
+
+    Atom type = 0;
+    int format = 0;
+    unsigned long bytes_after = 0;
+    unsigned long nitems = 0;
+    unsigned char *prop = NULL;
+    XRRGetOutputProperty(dpy, output,
+        randr_connector_id_atom,
+        0, 128, false, false, AnyPropertyType,
+        &type, &format, &nitems, &bytes_after, &prop);
+
+    bool found = false;
+    if(type == XA_INTEGER && format == 32) {
+        *connector_id = *(long*)prop;
+        found = true;
+    }
+
+    if(prop)
+        XFree(prop);
+    XFree(props);
+    return found;
+}
+
 static void monitor_callback(const XRROutputInfo *output_info, const XRRCrtcInfo *crt_info, const XRRModeInfo *mode_info, void *userdata) {
     (void)mode_info;
     MonitorCallbackUserdata *monitor_callback_userdata = userdata;
+    gsr_capture_kms_vaapi *cap_kms = monitor_callback_userdata->cap_kms;
     ++monitor_callback_userdata->num_monitors;
 
+    for(int i = 0; i < crt_info->noutput && cap_kms->num_connector_monitors < MAX_CONNECTOR_IDS; ++i) {
+        uint32_t connector_id = 0;
+        if(!get_connector_id(cap_kms->dpy, crt_info->outputs[i], monitor_callback_userdata->randr_connector_id_atom, &connector_id))
+            continue;
+
+        cap_kms->connector_monitors[cap_kms->num_connector_monitors] = (ConnectorMonitor){
+            .connector_id = connector_id,
+            .pos = { crt_info->x, crt_info->y },
+            .size = { (int)crt_info->width, (int)crt_info->height },
+            .x11_rot = crt_info->rotation
+        };
+        ++cap_kms->num_connector_monitors;
+    }
+
     if(strcmp(monitor_callback_userdata->monitor_to_capture, "screen") == 0)
         monitor_callback_userdata->rotation = crt_info->rotation;
 
@@ -146,39 +234,29 @@ static void monitor_callback(const XRROutputInfo *output_info, const XRRCrtcInfo
         return;
 
     monitor_callback_userdata->rotation = crt_info->rotation;
-    for(int i = 0; i < crt_info->noutput && monitor_callback_userdata->cap_kms->monitor_id.num_connector_ids < MAX_CONNECTOR_IDS; ++i) {
-        int nprop = 0;
-        Atom *props = XRRListOutputProperties(monitor_callback_userdata->cap_kms->dpy, crt_info->outputs[i], &nprop);
-        if(!props)
-            continue;
-
-        if(!properties_has_atom(props, nprop, monitor_callback_userdata->randr_connector_id_atom)) {
-            XFree(props);
+    for(int i = 0; i < crt_info->noutput && cap_kms->monitor_id.num_connector_ids < MAX_CONNECTOR_IDS; ++i) {
+        uint32_t connector_id = 0;
+        if(!get_connector_id(cap_kms->dpy, crt_info->outputs[i], monitor_callback_userdata->randr_connector_id_atom, &connector_id))
             continue;
-        }
 
-        Atom type = 0;
-        int format = 0;
-        unsigned long bytes_after = 0;
-        unsigned long nitems = 0;
-        unsigned char *prop = NULL;
-        XRRGetOutputProperty(monitor_callback_userdata->cap_kms->dpy, crt_info->outputs[i],
-            monitor_callback_userdata->randr_connector_id_atom,
-            0, 128, false, false, AnyPropertyType,
-            &type, &format, &nitems, &bytes_after, &prop);
-
-        if(type == XA_INTEGER && format == 32) {
-            monitor_callback_userdata->cap_kms->monitor_id.connector_ids[monitor_callback_userdata->cap_kms->monitor_id.num_connector_ids] = *(long*)prop;
-            ++monitor_callback_userdata->cap_kms->monitor_id.num_connector_ids;
-        }
-
-        XFree(props);
+        cap_kms->monitor_id.connector_ids[cap_kms->monitor_id.num_connector_ids] = connector_id;
+        ++cap_kms->monitor_id.num_connector_ids;
     }
 
     if(monitor_callback_userdata->cap_kms->monitor_id.num_connector_ids == MAX_CONNECTOR_IDS)
         fprintf(stderr, "gsr warning: reached max connector ids\n");
 }
 
+/* The size is even because the video size has to be, so that the draw covers the whole video */
+static vec2i get_output_size(const gsr_capture_kms_vaapi *cap_kms, vec2i output_resolution) {
+    vec2i output_size = cap_kms->capture_size;
+    if(output_resolution.x > 0 && output_resolution.y > 0)
+        output_size = scale_keep_aspect_ratio(cap_kms->capture_size, output_resolution);
+    output_size.x = max_int(2, output_size.x & ~1);
+    output_size.y = max_int(2, output_size.y & ~1);
+    return output_size;
+}
+
 static int gsr_capture_kms_vaapi_start(gsr_capture *cap, AVCodecContext *video_codec_context) {
     gsr_capture_kms_vaapi *cap_kms = cap->priv;
 
@@ -188,6 +266,7 @@ static int gsr_capture_kms_vaapi_start(gsr_capture *cap, AVCodecContext *video_c
 
     const Atom randr_connector_id_atom = XInternAtom(cap_kms->dpy, "CONNECTOR_ID", False);
     cap_kms->monitor_id.num_connector_ids = 0;
+    cap_kms->num_connector_monitors = 0;
     MonitorCallbackUserdata monitor_callback_userdata = {
         cap_kms, randr_connector_id_atom,
         cap_kms->params.display_to_capture, strlen(cap_kms->params.display_to_capture),
@@ -205,6 +284,13 @@ static int gsr_capture_kms_vaapi_start(gsr_capture *cap, AVCodecContext *video_c
         monitor.pos.y = 0;
         monitor.size = cap_kms->screen_size;
         cap_kms->screen_capture = true;
+
+        /* The region is cropped from the screen when drawing, so only the region is converted */
+        if(cap_kms->params.region_size.x > 0 && cap_kms->params.region_size.y > 0) {
+            monitor.pos = cap_kms->params.region_pos;
+            monitor.size = cap_kms->params.region_size;
+            cap_kms->region_capture = true;
+        }
     } else if(!get_monitor_by_name(cap_kms->dpy, cap_kms->params.display_to_capture, &monitor)) {
         fprintf(stderr, "gsr error: gsr_capture_kms_vaapi_start: failed to find monitor by name \"%s\"\n", cap_kms->params.display_to_capture);
         gsr_capture_kms_vaapi_stop(cap, video_codec_context);
@@ -225,6 +311,11 @@ static int gsr_capture_kms_vaapi_start(gsr_capture *cap, AVCodecContext *video_c
     cap_kms->capture_pos = monitor.pos;
     cap_kms->capture_size = monitor.size;
 
+    KmsOutput *main_output = &cap_kms->outputs[0];
+    main_output->video_codec_context = video_codec_context;
+    main_output->output_size = get_output_size(cap_kms, cap_kms->params.output_resolution);
+    cap_kms->num_outputs = 1;
+
     if(!gsr_egl_load(&cap_kms->egl, cap_kms->dpy)) {
         fprintf(stderr, "gsr error: gsr_capture_kms_vaapi_start: failed to load opengl\n");
         gsr_capture_kms_vaapi_stop(cap, video_codec_context);
@@ -234,10 +325,10 @@ static int gsr_capture_kms_vaapi_start(gsr_capture *cap, AVCodecContext *video_c
     /* Disable vsync */
     cap_kms->egl.eglSwapInterval(cap_kms->egl.egl_display, 0);
 
-    video_codec_context->width = max_int(2, cap_kms->capture_size.x & ~1);
-    video_codec_context->height = max_int(2, cap_kms->capture_size.y & ~1);
+    video_codec_context->width = main_output->output_size.x;
+    video_codec_context->height = main_output->output_size.y;
 
-    if(!drm_create_codec_context(cap_kms, video_codec_context)) {
+    if(!drm_create_codec_context(cap_kms, video_codec_context, NULL)) {
         gsr_capture_kms_vaapi_stop(cap, video_codec_context);
         return -1;
     }
@@ -258,8 +349,145 @@ static uint32_t fourcc(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
 }
 
 #define FOURCC_NV12 842094158
+#define FOURCC_444P 1345598516
+
+/* Allocates the frame of the output and maps its surface to textures that the color conversion draws to */
+static bool kms_output_init(gsr_capture_kms_vaapi *cap_kms, KmsOutput *output, AVFrame **frame) {
+    AVCodecContext *video_codec_context = output->video_codec_context;
+
+    *frame = av_frame_alloc();
+    if(!*frame) {
+        fprintf(stderr, "gsr error: kms_output_init: failed to allocate frame\n");
+        return false;
+    }
+    (*frame)->format = video_codec_context->pix_fmt;
+    (*frame)->width = video_codec_context->width;
+    (*frame)->height = video_codec_context->height;
+    (*frame)->color_range = video_codec_context->color_range;
+    (*frame)->color_primaries = video_codec_context->color_primaries;
+    (*frame)->color_trc = video_codec_context->color_trc;
+    (*frame)->colorspace = video_codec_context->colorspace;
+    (*frame)->chroma_location = video_codec_context->chroma_sample_location;
+
+    int res = av_hwframe_get_buffer(video_codec_context->hw_frames_ctx, *frame, 0);
+    if(res < 0) {
+        fprintf(stderr, "gsr error: kms_output_init: av_hwframe_get_buffer failed: %d\n", res);
+        return false;
+    }
+
+    VASurfaceID target_surface_id = (uintptr_t)(*frame)->data[3];
+
+    VAStatus va_status = vaExportSurfaceHandle(cap_kms->va_dpy, target_surface_id, VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2, VA_EXPORT_SURFACE_READ_WRITE | VA_EXPORT_SURFACE_SEPARATE_LAYERS, &output->prime);
+    if(va_status != VA_STATUS_SUCCESS) {
+        fprintf(stderr, "gsr error: kms_output_init: vaExportSurfaceHandle failed, error: %d\n", va_status);
+        return false;
+    }
+    vaSyncSurface(cap_kms->va_dpy, target_surface_id);
+
+    const uint32_t expected_fourcc = cap_kms->params.yuv444 ? FOURCC_444P : FOURCC_NV12;
+    if(output->prime.fourcc != expected_fourcc) {
+        fprintf(stderr, "gsr error: kms_output_init: unexpected fourcc %u for output drm fd, expected %s\n", output->prime.fourcc, cap_kms->params.yuv444 ? "444p" : "nv12");
+        return false;
+    }
+
+    /* With separate layers each layer of the surface is a single plane. NV12 has a Y and an interleaved UV layer at half size, 444P has Y, U and V layers at full size */
+    const uint32_t nv12_formats[3] = { fourcc('R', '8', ' ', ' '), fourcc('G', 'R', '8', '8'), 0 };
+    const uint32_t yuv444_formats[3] = { fourcc('R', '8', ' ', ' '), fourcc('R', '8', ' ', ' '), fourcc('R', '8', ' ', ' ') };
+    const int nv12_div[3] = {1, 2, 1}; // divide UV texture size by 2 because chroma is half size
+    const int yuv444_div[3] = {1, 1, 1};
+
+    const uint32_t *formats = cap_kms->params.yuv444 ? yuv444_formats : nv12_formats;
+    const int *div = cap_kms->params.yuv444 ? yuv444_div : nv12_div;
+    const int num_target_textures = cap_kms->params.yuv444 ? 3 : 2;
+
+    if((int)output->prime.num_layers < num_target_textures) {
+        fprintf(stderr, "gsr error: kms_output_init: expected %d layers for output drm fd, got %u\n", num_target_textures, output->prime.num_layers);
+        return false;
+    }
+
+    output->num_target_textures = num_target_textures;
+    cap_kms->egl.glGenTextures(output->num_target_textures, output->target_textures);
+    for(int i = 0; i < output->num_target_textures; ++i) {
+        const int layer = i;
+        const int plane = 0;
+
+        const intptr_t img_attr[] = {
+            EGL_LINUX_DRM_FOURCC_EXT,       formats[i],
+            EGL_WIDTH,                      output->prime.width / div[i],
+            EGL_HEIGHT,                     output->prime.height / div[i],
+            EGL_DMA_BUF_PLANE0_FD_EXT,      output->prime.objects[output->prime.layers[layer].object_index[plane]].fd,
+            EGL_DMA_BUF_PLANE0_OFFSET_EXT,  output->prime.layers[layer].offset[plane],
+            EGL_DMA_BUF_PLANE0_PITCH_EXT,   output->prime.layers[layer].pitch[plane],
+            EGL_NONE
+        };
+
+        while(cap_kms->egl.eglGetError() != EGL_SUCCESS){}
+        EGLImage image = cap_kms->egl.eglCreateImage(cap_kms->egl.egl_display, 0, EGL_LINUX_DMA_BUF_EXT, NULL, img_attr);
+        if(!image) {
+            fprintf(stderr, "gsr error: kms_output_init: failed to create egl image from drm fd for output drm fd, error: %d\n", cap_kms->egl.eglGetError());
+            return false;
+        }
+
+        cap_kms->egl.glBindTexture(GL_TEXTURE_2D, output->target_textures[i]);
+        cap_kms->egl.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        cap_kms->egl.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        cap_kms->egl.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        cap_kms->egl.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        while(cap_kms->egl.glGetError()) {}
+        while(cap_kms->egl.eglGetError() != EGL_SUCCESS){}
+        cap_kms->egl.glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, image);
+        if(cap_kms->egl.glGetError() != 0 || cap_kms->egl.eglGetError() != EGL_SUCCESS) {
+            fprintf(stderr, "gsr error: kms_output_init: failed to bind egl image to gl texture, error: %d\n", cap_kms->egl.eglGetError());
+            cap_kms->egl.eglDestroyImage(cap_kms->egl.egl_display, image);
+            cap_kms->egl.glBindTexture(GL_TEXTURE_2D, 0);
+            return false;
+        }
+
+        cap_kms->egl.eglDestroyImage(cap_kms->egl.egl_display, image);
+        cap_kms->egl.glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    gsr_color_conversion_params color_conversion_params = {0};
+    color_conversion_params.egl = &cap_kms->egl;
+    color_conversion_params.source_color = GSR_SOURCE_COLOR_RGB;
+    color_conversion_params.destination_color = cap_kms->params.yuv444 ? GSR_DESTINATION_COLOR_YUV444 : GSR_DESTINATION_COLOR_NV12;
+
+    for(int i = 0; i < output->num_target_textures; ++i) {
+        color_conversion_params.destination_textures[i] = output->target_textures[i];
+    }
+    color_conversion_params.num_destination_textures = output->num_target_textures;
+    color_conversion_params.scale_filter = cap_kms->params.scale_filter;
+
+    if(gsr_color_conversion_init(&output->color_conversion, &color_conversion_params) != 0) {
+        fprintf(stderr, "gsr error: kms_output_init: failed to create color conversion\n");
+        return false;
+    }
+
+    return true;
+}
+
+static void kms_output_deinit(gsr_capture_kms_vaapi *cap_kms, KmsOutput *output) {
+    gsr_color_conversion_deinit(&output->color_conversion);
+
+    for(uint32_t i = 0; i < output->prime.num_objects; ++i) {
+        if(output->prime.objects[i].fd > 0) {
+            close(output->prime.objects[i].fd);
+            output->prime.objects[i].fd = 0;
+        }
+    }
+
+    if(output->num_target_textures > 0) {
+        cap_kms->egl.glDeleteTextures(output->num_target_textures, output->target_textures);
+        for(int i = 0; i < output->num_target_textures; ++i) {
+            output->target_textures[i] = 0;
+        }
+        output->num_target_textures = 0;
+    }
+}
 
 static void gsr_capture_kms_vaapi_tick(gsr_capture *cap, AVCodecContext *video_codec_context, AVFrame **frame) {
+    (void)video_codec_context;
     gsr_capture_kms_vaapi *cap_kms = cap->priv;
 
     // TODO:
@@ -273,42 +501,6 @@ static void gsr_capture_kms_vaapi_tick(gsr_capture *cap, AVCodecContext *video_c
     if(!cap_kms->created_hw_frame) {
         cap_kms->created_hw_frame = true;
 
-        av_frame_free(frame);
-        *frame = av_frame_alloc();
-        if(!frame) {
-            fprintf(stderr, "gsr error: gsr_capture_kms_vaapi_tick: failed to allocate frame\n");
-            cap_kms->should_stop = true;
-            cap_kms->stop_is_error = true;
-            return;
-        }
-        (*frame)->format = video_codec_context->pix_fmt;
-        (*frame)->width = video_codec_context->width;
-        (*frame)->height = video_codec_context->height;
-        (*frame)->color_range = video_codec_context->color_range;
-        (*frame)->color_primaries = video_codec_context->color_primaries;
-        (*frame)->color_trc = video_codec_context->color_trc;
-        (*frame)->colorspace = video_codec_context->colorspace;
-        (*frame)->chroma_location = video_codec_context->chroma_sample_location;
-
-        int res = av_hwframe_get_buffer(video_codec_context->hw_frames_ctx, *frame, 0);
-        if(res < 0) {
-            fprintf(stderr, "gsr error: gsr_capture_kms_vaapi_tick: av_hwframe_get_buffer failed: %d\n", res);
-            cap_kms->should_stop = true;
-            cap_kms->stop_is_error = true;
-            return;
-        }
-
-        VASurfaceID target_surface_id = (uintptr_t)(*frame)->data[3];
-
-        VAStatus va_status = vaExportSurfaceHandle(cap_kms->va_dpy, target_surface_id, VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2, VA_EXPORT_SURFACE_READ_WRITE | VA_EXPORT_SURFACE_SEPARATE_LAYERS, &cap_kms->prime);
-        if(va_status != VA_STATUS_SUCCESS) {
-            fprintf(stderr, "gsr error: gsr_capture_kms_vaapi_tick: vaExportSurfaceHandle failed, error: %d\n", va_status);
-            cap_kms->should_stop = true;
-            cap_kms->stop_is_error = true;
-            return;
-        }
-        vaSyncSurface(cap_kms->va_dpy, target_surface_id);
-
         cap_kms->egl.glGenTextures(1, &cap_kms->input_texture);
         cap_kms->egl.glBindTexture(GL_TEXTURE_2D, cap_kms->input_texture);
         cap_kms->egl.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -317,73 +509,8 @@ static void gsr_capture_kms_vaapi_tick(gsr_capture *cap, AVCodecContext *video_c
         cap_kms->egl.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         cap_kms->egl.glBindTexture(GL_TEXTURE_2D, 0);
 
-        if(cap_kms->prime.fourcc == FOURCC_NV12) {
-            cap_kms->egl.glGenTextures(2, cap_kms->target_textures);
-            for(int i = 0; i < 2; ++i) {
-                const uint32_t formats[2] = { fourcc('R', '8', ' ', ' '), fourcc('G', 'R', '8', '8') };
-                const int layer = i;
-                const int plane = 0;
-
-                const int div[2] = {1, 2}; // divide UV texture size by 2 because chroma is half size
-
-                const intptr_t img_attr[] = {
-                    EGL_LINUX_DRM_FOURCC_EXT,       formats[i],
-                    EGL_WIDTH,                      cap_kms->prime.width / div[i],
-                    EGL_HEIGHT,                     cap_kms->prime.height / div[i],
-                    EGL_DMA_BUF_PLANE0_FD_EXT,      cap_kms->prime.objects[cap_kms->prime.layers[layer].object_index[plane]].fd,
-                    EGL_DMA_BUF_PLANE0_OFFSET_EXT,  cap_kms->prime.layers[layer].offset[plane],
-                    EGL_DMA_BUF_PLANE0_PITCH_EXT,   cap_kms->prime.layers[layer].pitch[plane],
-                    EGL_NONE
-                };
-
-                while(cap_kms->egl.eglGetError() != EGL_SUCCESS){}
-                EGLImage image = cap_kms->egl.eglCreateImage(cap_kms->egl.egl_display, 0, EGL_LINUX_DMA_BUF_EXT, NULL, img_attr);
-                if(!image) {
-                    fprintf(stderr, "gsr error: gsr_capture_kms_vaapi_tick: failed to create egl image from drm fd for output drm fd, error: %d\n", cap_kms->egl.eglGetError());
-                    cap_kms->should_stop = true;
-                    cap_kms->stop_is_error = true;
-                    return;
-                }
-
-                cap_kms->egl.glBindTexture(GL_TEXTURE_2D, cap_kms->target_textures[i]);
-                cap_kms->egl.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-                cap_kms->egl.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-                cap_kms->egl.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-                cap_kms->egl.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-                while(cap_kms->egl.glGetError()) {}
-                while(cap_kms->egl.eglGetError() != EGL_SUCCESS){}
-                cap_kms->egl.glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, image);
-                if(cap_kms->egl.glGetError() != 0 || cap_kms->egl.eglGetError() != EGL_SUCCESS) {
-                    fprintf(stderr, "gsr error: gsr_capture_kms_vaapi_tick: failed to bind egl image to gl texture, error: %d\n", cap_kms->egl.eglGetError());
-                    cap_kms->should_stop = true;
-                    cap_kms->stop_is_error = true;
-                    cap_kms->egl.eglDestroyImage(cap_kms->egl.egl_display, image);
-                    cap_kms->egl.glBindTexture(GL_TEXTURE_2D, 0);
-                    return;
-                }
-
-                cap_kms->egl.eglDestroyImage(cap_kms->egl.egl_display, image);
-                cap_kms->egl.glBindTexture(GL_TEXTURE_2D, 0);
-            }
-
-            gsr_color_conversion_params color_conversion_params = {0};
-            color_conversion_params.egl = &cap_kms->egl;
-            color_conversion_params.source_color = GSR_SOURCE_COLOR_RGB;
-            color_conversion_params.destination_color = GSR_DESTINATION_COLOR_NV12;
-
-            color_conversion_params.destination_textures[0] = cap_kms->target_textures[0];
-            color_conversion_params.destination_textures[1] = cap_kms->target_textures[1];
-            color_conversion_params.num_destination_textures = 2;
-
-            if(gsr_color_conversion_init(&cap_kms->color_conversion, &color_conversion_params) != 0) {
-                fprintf(stderr, "gsr error: gsr_capture_kms_vaapi_tick: failed to create color conversion\n");
-                cap_kms->should_stop = true;
-                cap_kms->stop_is_error = true;
-                return;
-            }
-        } else {
-            fprintf(stderr, "gsr error: gsr_capture_kms_vaapi_tick: unexpected fourcc %u for output drm fd, expected nv12\n", cap_kms->prime.fourcc);
+        av_frame_free(frame);
+        if(!kms_output_init(cap_kms, &cap_kms->outputs[0], frame)) {
             cap_kms->should_stop = true;
             cap_kms->stop_is_error = true;
             return;
@@ -391,6 +518,34 @@ static void gsr_capture_kms_vaapi_tick(gsr_capture *cap, AVCodecContext *video_c
     }
 }
 
+static int gsr_capture_kms_vaapi_add_output(gsr_capture *cap, AVCodecContext *video_codec_context, vec2i output_resolution, AVFrame **frame) {
+    gsr_capture_kms_vaapi *cap_kms = cap->priv;
+    if(cap_kms->num_outputs == MAX_OUTPUTS) {
+        fprintf(stderr, "gsr error: gsr_capture_kms_vaapi_add_output: reached max outputs (%d)\n", MAX_OUTPUTS);
+        return -1;
+    }
+
+    KmsOutput *output = &cap_kms->outputs[cap_kms->num_outputs];
+    output->video_codec_context = video_codec_context;
+    output->output_size = get_output_size(cap_kms, output_resolution);
+
+    video_codec_context->width = output->output_size.x;
+    video_codec_context->height = output->output_size.y;
+
+    /* The surfaces of all outputs are on the same device as the main output */
+    if(!drm_create_codec_context(cap_kms, video_codec_context, cap_kms->outputs[0].video_codec_context->hw_device_ctx))
+        return -1;
+
+    ++cap_kms->num_outputs;
+    if(!kms_output_init(cap_kms, output, &output->frame)) {
+        *frame = NULL;
+        return -1;
+    }
+
+    *frame = output->frame;
+    return 0;
+}
+
 static bool gsr_capture_kms_vaapi_should_stop(gsr_capture *cap, bool *err) {
     gsr_capture_kms_vaapi *cap_kms = cap->priv;
     if(cap_kms->should_stop) {
@@ -436,6 +591,58 @@ static gsr_kms_response_fd* find_largest_drm(gsr_kms_response *kms_response) {
     return largest_drm;
 }
 
+static bool has_connector_monitor_drm(gsr_capture_kms_vaapi *cap_kms) {
+    for(int i = 0; i < cap_kms->num_connector_monitors; ++i) {
+        if(find_drm_by_connector_id(&cap_kms->kms_response, cap_kms->connector_monitors[i].connector_id))
+            return true;
+    }
+    return false;
+}
+
+static void drm_fd_to_input_texture(gsr_capture_kms_vaapi *cap_kms, const gsr_kms_response_fd *drm_fd) {
+    // TODO: This causes a crash sometimes on steam deck, why? is it a driver bug? a vaapi pure version doesn't cause a crash.
+    // Even ffmpeg kmsgrab causes this crash. The error is:
+    // amdgpu: Failed to allocate a buffer:
+    // amdgpu:    size      : 28508160 bytes
+    // amdgpu:    alignment : 2097152 bytes
+    // amdgpu:    domains   : 4
+    // amdgpu:    flags   : 4
+    // amdgpu: Failed to allocate a buffer:
+    // amdgpu:    size      : 28508160 bytes
+    // amdgpu:    alignment : 2097152 bytes
+    // amdgpu:    domains   : 4
+    // amdgpu:    flags   : 4
+    // EE ../jupiter-mesa/src/gallium/drivers/radeonsi/radeon_vcn_enc.c:516 radeon_create_encoder UVD - Can't create CPB buffer.
+    // [hevc_vaapi @ 0x55ea72b09840] Failed to upload encode parameters: 2 (resource allocation failed).
+    // [hevc_vaapi @ 0x55ea72b09840] Encode failed: -5.
+    // Error: avcodec_send_frame failed, error: Input/output error
+    // Assertion pic->display_order == pic->encode_order failed at libavcodec/vaapi_encode_h265.c:765
+    // kms server info: kms client shutdown, shutting down the server
+    const intptr_t img_attr[] = {
+        EGL_LINUX_DRM_FOURCC_EXT,       drm_fd->pixel_format,
+        EGL_WIDTH,                      drm_fd->width,
+        EGL_HEIGHT,                     drm_fd->height,
+        EGL_DMA_BUF_PLANE0_FD_EXT,      drm_fd->fd,
+        EGL_DMA_BUF_PLANE0_OFFSET_EXT,  drm_fd->offset,
+        EGL_DMA_BUF_PLANE0_PITCH_EXT,   drm_fd->pitch,
+        EGL_NONE
+    };
+
+    EGLImage image = cap_kms->egl.eglCreateImage(cap_kms->egl.egl_display, 0, EGL_LINUX_DMA_BUF_EXT, NULL, img_attr);
+    cap_kms->egl.glBindTexture(GL_TEXTURE_2D, cap_kms->input_texture);
+    cap_kms->egl.glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, image);
+    cap_kms->egl.eglDestroyImage(cap_kms->egl.egl_display, image);
+    cap_kms->egl.glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/* The monitors and cursor are scaled the same way as the captured image */
+static vec2f get_output_scale(const KmsOutput *output, vec2i capture_size) {
+    return (vec2f){
+        capture_size.x == 0 ? 1.0f : (float)output->output_size.x / (float)capture_size.x,
+        capture_size.y == 0 ? 1.0f : (float)output->output_size.y / (float)capture_size.y
+    };
+}
+
 static int gsr_capture_kms_vaapi_capture(gsr_capture *cap, AVFrame *frame) {
     (void)frame;
     gsr_capture_kms_vaapi *cap_kms = cap->priv;
@@ -462,11 +669,15 @@ static int gsr_capture_kms_vaapi_capture(gsr_capture *cap, AVFrame *frame) {
     }
 
     bool requires_rotation = cap_kms->requires_rotation;
+    /* Set when the screen is drawn from the separate monitor planes because there is no combined plane */
+    bool composite_monitors = false;
 
     gsr_kms_response_fd *drm_fd = NULL;
     if(cap_kms->screen_capture) {
         drm_fd = find_first_combined_drm(&cap_kms->kms_response);
-        if(!drm_fd)
+        if(!drm_fd && has_connector_monitor_drm(cap_kms))
+            composite_monitors = true;
+        else if(!drm_fd)
             drm_fd = find_largest_drm(&cap_kms->kms_response);
     } else {
         for(int i = 0; i < cap_kms->monitor_id.num_connector_ids; ++i) {
@@ -484,79 +695,88 @@ static int gsr_capture_kms_vaapi_capture(gsr_capture *cap, AVFrame *frame) {
         }
     }
 
-    bool capture_is_combined_plane = drm_fd->is_combined_plane || ((int)drm_fd->width == cap_kms->screen_size.x && (int)drm_fd->height == cap_kms->screen_size.y);
-
-    // TODO: This causes a crash sometimes on steam deck, why? is it a driver bug? a vaapi pure version doesn't cause a crash.
-    // Even ffmpeg kmsgrab causes this crash. The error is:
-    // amdgpu: Failed to allocate a buffer:
-    // amdgpu:    size      : 28508160 bytes
-    // amdgpu:    alignment : 2097152 bytes
-    // amdgpu:    domains   : 4
-    // amdgpu:    flags   : 4
-    // amdgpu: Failed to allocate a buffer:
-    // amdgpu:    size      : 28508160 bytes
-    // amdgpu:    alignment : 2097152 bytes
-    // amdgpu:    domains   : 4
-    // amdgpu:    flags   : 4
-    // EE ../jupiter-mesa/src/gallium/drivers/radeonsi/radeon_vcn_enc.c:516 radeon_create_encoder UVD - Can't create CPB buffer.
-    // [hevc_vaapi @ 0x55ea72b09840] Failed to upload encode parameters: 2 (resource allocation failed).
-    // [hevc_vaapi @ 0x55ea72b09840] Encode failed: -5.
-    // Error: avcodec_send_frame failed, error: Input/output error
-    // Assertion pic->display_order == pic->encode_order failed at libavcodec/vaapi_encode_h265.c:765
-    // kms server info: kms client shutdown, shutting down the server
-    const intptr_t img_attr[] = {
-        EGL_LINUX_DRM_FOURCC_EXT,       drm_fd->pixel_format,
-        EGL_WIDTH,                      drm_fd->width,
-        EGL_HEIGHT,                     drm_fd->height,
-        EGL_DMA_BUF_PLANE0_FD_EXT,      drm_fd->fd,
-        EGL_DMA_BUF_PLANE0_OFFSET_EXT,  drm_fd->offset,
-        EGL_DMA_BUF_PLANE0_PITCH_EXT,   drm_fd->pitch,
-        EGL_NONE
-    };
-
-    EGLImage image = cap_kms->egl.eglCreateImage(cap_kms->egl.egl_display, 0, EGL_LINUX_DMA_BUF_EXT, NULL, img_attr);
-    cap_kms->egl.glBindTexture(GL_TEXTURE_2D, cap_kms->input_texture);
-    cap_kms->egl.glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, image);
-    cap_kms->egl.eglDestroyImage(cap_kms->egl.egl_display, image);
-    cap_kms->egl.glBindTexture(GL_TEXTURE_2D, 0);
+    bool capture_is_combined_plane = composite_monitors || drm_fd->is_combined_plane || ((int)drm_fd->width == cap_kms->screen_size.x && (int)drm_fd->height == cap_kms->screen_size.y);
 
-    float texture_rotation = 0.0f;
-    if(requires_rotation) {
-        switch(cap_kms->x11_rot) {
-            case X11_ROT_90:
-                texture_rotation = M_PI*0.5f;
-                break;
-            case X11_ROT_180:
-                texture_rotation = M_PI;
-                break;
-            case X11_ROT_270:
-                texture_rotation = M_PI*1.5f;
-                break;
-            default:
-                texture_rotation = 0.0f;
-                break;
-        }
-    }
+    const float texture_rotation = requires_rotation ? x11_rotation_to_radians(cap_kms->x11_rot) : 0.0f;
 
     gsr_cursor_tick(&cap_kms->cursor);
 
     vec2i capture_pos = cap_kms->capture_pos;
     vec2i capture_size = cap_kms->capture_size;
     vec2i cursor_capture_pos = (vec2i){cap_kms->cursor.position.x - cap_kms->cursor.hotspot.x - capture_pos.x, cap_kms->cursor.position.y - cap_kms->cursor.hotspot.y - capture_pos.y};
-    if(!capture_is_combined_plane) {
+    if(!capture_is_combined_plane && !cap_kms->region_capture) {
         capture_pos = (vec2i){0, 0};
         //cursor_capture_pos = (vec2i){cap_kms->cursor.position.x - cap_kms->cursor.hotspot.x, cap_kms->cursor.position.y - cap_kms->cursor.hotspot.y};
     }
 
-    gsr_color_conversion_draw(&cap_kms->color_conversion, cap_kms->input_texture,
-        (vec2i){0, 0}, capture_size,
-        capture_pos, capture_size,
-        texture_rotation);
+    if(composite_monitors) {
+        /* Monitors might not cover the whole screen (different sizes), so the rest is black */
+        for(int i = 0; i < cap_kms->num_outputs; ++i) {
+            if(cap_kms->outputs[i].num_target_textures > 0)
+                gsr_color_conversion_clear(&cap_kms->outputs[i].color_conversion);
+        }
+
+        for(int i = 0; i < cap_kms->num_connector_monitors; ++i) {
+            const ConnectorMonitor *connector_monitor = &cap_kms->connector_monitors[i];
+            gsr_kms_response_fd *monitor_drm_fd = find_drm_by_connector_id(&cap_kms->kms_response, connector_monitor->connector_id);
+            if(!monitor_drm_fd)
+                continue;
+
+            /* Skip monitors that are outside the captured area (region capture) */
+            if(connector_monitor->pos.x + connector_monitor->size.x <= capture_pos.x || connector_monitor->pos.x >= capture_pos.x + capture_size.x
+                || connector_monitor->pos.y + connector_monitor->size.y <= capture_pos.y || connector_monitor->pos.y >= capture_pos.y + capture_size.y)
+            {
+                continue;
+            }
+
+            /* The plane of a rotated monitor isn't rotated, the texture size is given in the rotated (x11) orientation like the monitor size */
+            const float monitor_rotation = x11_rotation_to_radians(connector_monitor->x11_rot);
+            const bool monitor_rotated_sideways = connector_monitor->x11_rot == X11_ROT_90 || connector_monitor->x11_rot == X11_ROT_270;
+            const vec2i monitor_texture_size = monitor_rotated_sideways ? (vec2i){monitor_drm_fd->height, monitor_drm_fd->width} : (vec2i){monitor_drm_fd->width, monitor_drm_fd->height};
+
+            /* The monitor is imported once and drawn to all outputs */
+            drm_fd_to_input_texture(cap_kms, monitor_drm_fd);
+            for(int j = 0; j < cap_kms->num_outputs; ++j) {
+                KmsOutput *output = &cap_kms->outputs[j];
+                if(output->num_target_textures == 0)
+                    continue;
+
+                const vec2f scale = get_output_scale(output, capture_size);
+                gsr_color_conversion_draw(&output->color_conversion, cap_kms->input_texture,
+                    (vec2i){(connector_monitor->pos.x - capture_pos.x) * scale.x, (connector_monitor->pos.y - capture_pos.y) * scale.y},
+                    (vec2i){connector_monitor->size.x * scale.x, connector_monitor->size.y * scale.y},
+                    (vec2i){0, 0}, monitor_texture_size,
+                    monitor_rotation);
+            }
+        }
+    } else {
+        drm_fd_to_input_texture(cap_kms, drm_fd);
+        for(int i = 0; i < cap_kms->num_outputs; ++i) {
+            KmsOutput *output = &cap_kms->outputs[i];
+            if(output->num_target_textures == 0)
+                continue;
+
+            gsr_color_conversion_draw(&output->color_conversion, cap_kms->input_texture,
+                (vec2i){0, 0}, output->output_size,
+                capture_pos, capture_size,
+                texture_rotation);
+        }
+    }
+
+    /* Skip the cursor draws when the cursor is hidden or outside of the captured area (on another monitor for example) */
+    const bool draw_cursor = gsr_cursor_is_visible_in_area(&cap_kms->cursor, cap_kms->capture_pos, capture_size);
+    for(int i = 0; i < cap_kms->num_outputs && draw_cursor; ++i) {
+        KmsOutput *output = &cap_kms->outputs[i];
+        if(output->num_target_textures == 0)
+            continue;
 
-    gsr_color_conversion_draw(&cap_kms->color_conversion, cap_kms->cursor.texture_id,
-        cursor_capture_pos, (vec2i){cap_kms->cursor.size.x, cap_kms->cursor.size.y},
-        (vec2i){0, 0}, (vec2i){cap_kms->cursor.size.x, cap_kms->cursor.size.y},
-        0.0f);
+        const vec2f scale = get_output_scale(output, capture_size);
+        gsr_color_conversion_draw_bilinear(&output->color_conversion, cap_kms->cursor.texture_id,
+            (vec2i){cursor_capture_pos.x * scale.x, cursor_capture_pos.y * scale.y},
+            (vec2i){cap_kms->cursor.size.x * scale.x, cap_kms->cursor.size.y * scale.y},
+            cap_kms->cursor.texture_pos, (vec2i){cap_kms->cursor.size.x, cap_kms->cursor.size.y},
+            0.0f);
+    }
 
     cap_kms->egl.eglSwapBuffers(cap_kms->egl.egl_display, cap_kms->egl.egl_surface);
 
@@ -574,24 +794,28 @@ static void gsr_capture_kms_vaapi_stop(gsr_capture *cap, AVCodecContext *video_c
     gsr_capture_kms_vaapi *cap_kms = cap->priv;
 
     gsr_cursor_deinit(&cap_kms->cursor);
-    gsr_color_conversion_deinit(&cap_kms->color_conversion);
 
-    for(uint32_t i = 0; i < cap_kms->prime.num_objects; ++i) {
-        if(cap_kms->prime.objects[i].fd > 0) {
-            close(cap_kms->prime.objects[i].fd);
-            cap_kms->prime.objects[i].fd = 0;
-        }
+    for(int i = 0; i < cap_kms->num_outputs; ++i) {
+        KmsOutput *output = &cap_kms->outputs[i];
+        kms_output_deinit(cap_kms, output);
+
+        /* The main output is cleaned up below, the frame of the main output is owned by the caller */
+        if(i == 0)
+            continue;
+
+        av_frame_free(&output->frame);
+        if(output->video_codec_context->hw_device_ctx)
+            av_buffer_unref(&output->video_codec_context->hw_device_ctx);
+        if(output->video_codec_context->hw_frames_ctx)
+            av_buffer_unref(&output->video_codec_context->hw_frames_ctx);
     }
+    cap_kms->num_outputs = 0;
 
     if(cap_kms->input_texture) {
         cap_kms->egl.glDeleteTextures(1, &cap_kms->input_texture);
         cap_kms->input_texture = 0;
     }
 
-    cap_kms->egl.glDeleteTextures(2, cap_kms->target_textures);
-    cap_kms->target_textures[0] = 0;
-    cap_kms->target_textures[1] = 0;
-
     for(int i = 0; i < cap_kms->kms_response.num_fds; ++i) {
         if(cap_kms->kms_response.fds[i].fd > 0)
             close(cap_kms->kms_response.fds[i].fd);
@@ -667,6 +891,7 @@ gsr_capture* gsr_capture_kms_vaapi_create(const gsr_capture_kms_vaapi_params *pa
         .tick = gsr_capture_kms_vaapi_tick,
         .should_stop = gsr_capture_kms_vaapi_should_stop,
         .capture = gsr_capture_kms_vaapi_capture,
+        .add_output = gsr_capture_kms_vaapi_add_output,
         .destroy = gsr_capture_kms_vaapi_destroy,
         .priv = cap_kms
     };
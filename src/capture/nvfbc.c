@@ -1,6 +1,7 @@
 #include "../../include/capture/nvfbc.h"
 #include "../../external/NvFBC.h"
 #include "../../include/cuda.h"
+#include "../../include/utils.h"
 #include <dlfcn.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,6 +23,13 @@ typedef struct {
     bool fbc_handle_created;
     bool capture_session_created;
 
+    /* Kept to create the capture session again when NvFBC can't recover from a modeset by itself */
+    NVFBC_CREATE_CAPTURE_SESSION_PARAMS create_capture_params;
+    NVFBC_TOCUDA_SETUP_PARAMS setup_params;
+    double recreate_session_retry_time;
+    vec2i frame_size;
+    bool frame_size_mismatch_shown;
+
     gsr_cuda cuda;
     bool frame_initialized;
 } gsr_capture_nvfbc;
@@ -165,7 +173,7 @@ static bool ffmpeg_create_cuda_contexts(gsr_capture_nvfbc *cap_nvfbc, AVCodecCon
     AVHWFramesContext *hw_frame_context = (AVHWFramesContext*)frame_context->data;
     hw_frame_context->width = video_codec_context->width;
     hw_frame_context->height = video_codec_context->height;
-    hw_frame_context->sw_format = AV_PIX_FMT_BGR0;
+    hw_frame_context->sw_format = cap_nvfbc->params.yuv444 ? AV_PIX_FMT_YUV444P : AV_PIX_FMT_BGR0;
     hw_frame_context->format = video_codec_context->pix_fmt;
     hw_frame_context->device_ref = device_ctx;
     hw_frame_context->device_ctx = (AVHWDeviceContext*)device_ctx->data;
@@ -296,6 +304,17 @@ static int gsr_capture_nvfbc_start(gsr_capture *cap, AVCodecContext *video_codec
     create_capture_params.bWithCursor = (!direct_capture || supports_direct_cursor) ? NVFBC_TRUE : NVFBC_FALSE;
     if(capture_region)
         create_capture_params.captureBox = (NVFBC_BOX){ x, y, width, height };
+
+    vec2i frame_size = capture_region ? (vec2i){ width, height } : (vec2i){ tracking_width, tracking_height };
+    if(cap_nvfbc->params.output_resolution.x > 0 && cap_nvfbc->params.output_resolution.y > 0)
+        frame_size = scale_keep_aspect_ratio(frame_size, cap_nvfbc->params.output_resolution);
+    frame_size.x = max_int(2, frame_size.x & ~1);
+    frame_size.y = max_int(2, frame_size.y & ~1);
+    /*
+        The frame size is always given (even when not scaling) so that the captured frames keep the size of the video when
+        the resolution of the monitor changes (xrandr), NvFBC scales the new resolution to it. The encoder can't change size
+    */
+    create_capture_params.frameSize = (NVFBC_SIZE){ frame_size.x, frame_size.y };
     create_capture_params.eTrackingType = tracking_type;
     create_capture_params.dwSamplingRateMs = 1000u / ((uint32_t)cap_nvfbc->params.fps + 1);
     create_capture_params.bAllowDirectCapture = direct_capture ? NVFBC_TRUE : NVFBC_FALSE;
@@ -310,25 +329,23 @@ static int gsr_capture_nvfbc_start(gsr_capture *cap, AVCodecContext *video_codec
         goto error_cleanup;
     }
     cap_nvfbc->capture_session_created = true;
+    cap_nvfbc->create_capture_params = create_capture_params;
 
     NVFBC_TOCUDA_SETUP_PARAMS setup_params;
     memset(&setup_params, 0, sizeof(setup_params));
     setup_params.dwVersion = NVFBC_TOCUDA_SETUP_PARAMS_VER;
-    setup_params.eBufferFormat = NVFBC_BUFFER_FORMAT_BGRA;
+    setup_params.eBufferFormat = cap_nvfbc->params.yuv444 ? NVFBC_BUFFER_FORMAT_YUV444P : NVFBC_BUFFER_FORMAT_BGRA;
 
     status = cap_nvfbc->nv_fbc_function_list.nvFBCToCudaSetUp(cap_nvfbc->nv_fbc_handle, &setup_params);
     if(status != NVFBC_SUCCESS) {
         fprintf(stderr, "gsr error: gsr_capture_nvfbc_start failed: %s\n", cap_nvfbc->nv_fbc_function_list.nvFBCGetLastErrorStr(cap_nvfbc->nv_fbc_handle));
         goto error_cleanup;
     }
+    cap_nvfbc->setup_params = setup_params;
+    cap_nvfbc->frame_size = frame_size;
 
-    if(capture_region) {
-        video_codec_context->width = width & ~1;
-        video_codec_context->height = height & ~1;
-    } else {
-        video_codec_context->width = tracking_width & ~1;
-        video_codec_context->height = tracking_height & ~1;
-    }
+    video_codec_context->width = frame_size.x & ~1;
+    video_codec_context->height = frame_size.y & ~1;
 
     if(!ffmpeg_create_cuda_contexts(cap_nvfbc, video_codec_context))
         goto error_cleanup;
@@ -383,6 +400,45 @@ static void gsr_capture_nvfbc_destroy_session(gsr_capture *cap) {
     cap_nvfbc->nv_fbc_handle = 0;
 }
 
+/*
+    NvFBC recreates the capture session by itself after a modeset (for example when the monitor is reconfigured with xrandr),
+    but if that fails the grab returns NVFBC_ERR_MUST_RECREATE and the session has to be created again with the same parameters.
+    The encoder and the hardware frames are kept since the frame size doesn't change. Returns true on success.
+*/
+static bool gsr_capture_nvfbc_recreate_capture_session(gsr_capture_nvfbc *cap_nvfbc) {
+    const double now = clock_get_monotonic_seconds();
+    if(now < cap_nvfbc->recreate_session_retry_time)
+        return false;
+    /* The monitor might not be back yet, don't try to recreate the session on every frame */
+    cap_nvfbc->recreate_session_retry_time = now + 1.0;
+
+    if(cap_nvfbc->capture_session_created) {
+        NVFBC_DESTROY_CAPTURE_SESSION_PARAMS destroy_capture_params;
+        memset(&destroy_capture_params, 0, sizeof(destroy_capture_params));
+        destroy_capture_params.dwVersion = NVFBC_DESTROY_CAPTURE_SESSION_PARAMS_VER;
+        cap_nvfbc->nv_fbc_function_list.nvFBCDestroyCaptureSession(cap_nvfbc->nv_fbc_handle, &destroy_capture_params);
+        cap_nvfbc->capture_session_created = false;
+    }
+
+    NVFBC_CREATE_CAPTURE_SESSION_PARAMS create_capture_params = cap_nvfbc->create_capture_params;
+    NVFBCSTATUS status = cap_nvfbc->nv_fbc_function_list.nvFBCCreateCaptureSession(cap_nvfbc->nv_fbc_handle, &create_capture_params);
+    if(status != NVFBC_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_capture_nvfbc_capture: failed to recreate capture session: %s\n", cap_nvfbc->nv_fbc_function_list.nvFBCGetLastErrorStr(cap_nvfbc->nv_fbc_handle));
+        return false;
+    }
+    cap_nvfbc->capture_session_created = true;
+
+    NVFBC_TOCUDA_SETUP_PARAMS setup_params = cap_nvfbc->setup_params;
+    status = cap_nvfbc->nv_fbc_function_list.nvFBCToCudaSetUp(cap_nvfbc->nv_fbc_handle, &setup_params);
+    if(status != NVFBC_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_capture_nvfbc_capture: failed to set up recreated capture session: %s\n", cap_nvfbc->nv_fbc_function_list.nvFBCGetLastErrorStr(cap_nvfbc->nv_fbc_handle));
+        return false;
+    }
+
+    fprintf(stderr, "gsr info: gsr_capture_nvfbc_capture: recreated the capture session after the display was reconfigured\n");
+    return true;
+}
+
 static void gsr_capture_nvfbc_tick(gsr_capture *cap, AVCodecContext *video_codec_context, AVFrame **frame) {
     gsr_capture_nvfbc *cap_nvfbc = cap->priv;
     if(!cap_nvfbc->frame_initialized && video_codec_context->hw_frames_ctx) {
@@ -414,27 +470,58 @@ static int gsr_capture_nvfbc_capture(gsr_capture *cap, AVFrame *frame) {
     grab_params.pCUDADeviceBuffer = &cu_device_ptr;
     grab_params.dwTimeoutMs = 0;
 
-    NVFBCSTATUS status = cap_nvfbc->nv_fbc_function_list.nvFBCToCudaGrabFrame(cap_nvfbc->nv_fbc_handle, &grab_params);
+    NVFBCSTATUS status = NVFBC_ERR_MUST_RECREATE;
+    if(cap_nvfbc->capture_session_created)
+        status = cap_nvfbc->nv_fbc_function_list.nvFBCToCudaGrabFrame(cap_nvfbc->nv_fbc_handle, &grab_params);
+
+    if(status == NVFBC_ERR_MUST_RECREATE) {
+        /* The frame keeps the last captured image until the session is back */
+        if(!gsr_capture_nvfbc_recreate_capture_session(cap_nvfbc))
+            return GSR_CAPTURE_NO_NEW_FRAME;
+        status = cap_nvfbc->nv_fbc_function_list.nvFBCToCudaGrabFrame(cap_nvfbc->nv_fbc_handle, &grab_params);
+    }
+
     if(status != NVFBC_SUCCESS) {
         fprintf(stderr, "gsr error: gsr_capture_nvfbc_capture failed: %s\n", cap_nvfbc->nv_fbc_function_list.nvFBCGetLastErrorStr(cap_nvfbc->nv_fbc_handle));
         return -1;
     }
 
-    /*
-        *byte_size = frame_info.dwByteSize;
+    /* NvFBC scales to the frame size given when creating the session, this only happens if the driver doesn't */
+    if((int)frame_info.dwWidth != cap_nvfbc->frame_size.x || (int)frame_info.dwHeight != cap_nvfbc->frame_size.y) {
+        if(!cap_nvfbc->frame_size_mismatch_shown) {
+            cap_nvfbc->frame_size_mismatch_shown = true;
+            fprintf(stderr, "gsr error: gsr_capture_nvfbc_capture: captured frame is %ux%u but the video is %dx%d, skipping frames until the size matches again\n",
+                frame_info.dwWidth, frame_info.dwHeight, cap_nvfbc->frame_size.x, cap_nvfbc->frame_size.y);
+        }
+        return GSR_CAPTURE_NO_NEW_FRAME;
+    }
+    cap_nvfbc->frame_size_mismatch_shown = false;
+
+    /* NvFBC doesn't report the pitch, it's derived from the size of the buffer. Rows (and planes) can be padded */
+    const uint32_t num_planes = cap_nvfbc->params.yuv444 ? 3 : 1;
+    const uint32_t bytes_per_pixel = cap_nvfbc->params.yuv444 ? 1 : 4;
+    const uint32_t pitch = frame_info.dwHeight > 0 ? frame_info.dwByteSize / (num_planes * frame_info.dwHeight) : 0;
+    if(pitch < frame_info.dwWidth * bytes_per_pixel || (size_t)pitch * frame_info.dwHeight * num_planes != frame_info.dwByteSize) {
+        fprintf(stderr, "gsr error: gsr_capture_nvfbc_capture: unexpected frame buffer size %u for a %ux%u frame\n", frame_info.dwByteSize, frame_info.dwWidth, frame_info.dwHeight);
+        return -1;
+    }
 
-        TODO: Check bIsNewFrame
-        TODO: Check dwWidth and dwHeight and update size in video output in ffmpeg. This can happen when xrandr is used to change monitor resolution
-    */
+    if(cap_nvfbc->params.yuv444) {
+        /* The planes are stored one after another */
+        const size_t plane_size = (size_t)pitch * (size_t)frame_info.dwHeight;
+        frame->data[0] = (uint8_t*)cu_device_ptr;
+        frame->data[1] = (uint8_t*)cu_device_ptr + plane_size;
+        frame->data[2] = (uint8_t*)cu_device_ptr + plane_size * 2;
+        frame->linesize[0] = pitch;
+        frame->linesize[1] = pitch;
+        frame->linesize[2] = pitch;
+    } else {
+        frame->data[0] = (uint8_t*)cu_device_ptr;
+        frame->linesize[0] = pitch;
+    }
 
-    frame->data[0] = (uint8_t*)cu_device_ptr;
-    //frame->data[1] = (uint8_t*)cu_device_ptr;
-    //frame->data[2] = (uint8_t*)cu_device_ptr;
-    frame->linesize[0] = frame->width * 4;
-    // TODO: Use these when outputting yuv444 by changing nvfbc color to YUV444P and sw_format to YUV444P
-    //frame->linesize[1] = frame->width * 1;
-    //frame->linesize[2] = frame->width * 1;
-    return 0;
+    /* NvFBC gives the previous frame again when nothing on the screen changed since the last grab */
+    return frame_info.bIsNewFrame ? 0 : GSR_CAPTURE_NO_NEW_FRAME;
 }
 
 static void gsr_capture_nvfbc_destroy(gsr_capture *cap, AVCodecContext *video_codec_context) {
@@ -2,6 +2,7 @@
 #include "../../include/egl.h"
 #include "../../include/cuda.h"
 #include "../../include/window_texture.h"
+#include "../../include/window_tracker.h"
 #include "../../include/utils.h"
 #include <libavutil/hwcontext.h>
 #include <libavutil/hwcontext_cuda.h>
@@ -15,21 +16,23 @@ typedef struct {
 
     bool should_stop;
     bool stop_is_error;
-    bool window_resized;
     bool created_hw_frame;
     bool follow_focused_initialized;
     double window_resize_timer;
 
-    vec2i window_size;
+    /* The window is converted to yuv into these textures (Y and UV for nv12, Y, U and V for yuv444), which are copied to the frame with cuda */
+    unsigned int target_textures[3];
+    int num_target_textures;
+    gsr_color_conversion color_conversion;
 
-    unsigned int target_texture_id;
-    vec2i texture_size;
+    vec2i texture_size; /* Size of the part of the window texture that is recorded */
     Window window;
     WindowTexture window_texture;
+    gsr_window_tracker window_tracker;
     Atom net_active_window_atom;
 
-    CUgraphicsResource cuda_graphics_resource;
-    CUarray mapped_array;
+    CUgraphicsResource cuda_graphics_resources[3];
+    CUarray mapped_arrays[3];
 
     gsr_egl egl;
     gsr_cuda cuda;
@@ -59,28 +62,30 @@ static Window get_focused_window(Display *display, Atom net_active_window_atom)
 
 static void gsr_capture_xcomposite_cuda_stop(gsr_capture *cap, AVCodecContext *video_codec_context);
 
-static bool cuda_register_opengl_texture(gsr_capture_xcomposite_cuda *cap_xcomp) {
+static bool cuda_register_opengl_textures(gsr_capture_xcomposite_cuda *cap_xcomp) {
     CUresult res;
     CUcontext old_ctx;
     res = cap_xcomp->cuda.cuCtxPushCurrent_v2(cap_xcomp->cuda.cu_ctx);
-    res = cap_xcomp->cuda.cuGraphicsGLRegisterImage(
-        &cap_xcomp->cuda_graphics_resource, cap_xcomp->target_texture_id, GL_TEXTURE_2D,
-        CU_GRAPHICS_REGISTER_FLAGS_READ_ONLY);
-    if (res != CUDA_SUCCESS) {
-        const char *err_str = "unknown";
-        cap_xcomp->cuda.cuGetErrorString(res, &err_str);
-        fprintf(stderr,
-                "Error: cuGraphicsGLRegisterImage failed, error %s, texture "
-                "id: %u\n",
-                err_str, cap_xcomp->target_texture_id);
-        res = cap_xcomp->cuda.cuCtxPopCurrent_v2(&old_ctx);
-        return false;
-    }
+    for(int i = 0; i < cap_xcomp->num_target_textures; ++i) {
+        res = cap_xcomp->cuda.cuGraphicsGLRegisterImage(
+            &cap_xcomp->cuda_graphics_resources[i], cap_xcomp->target_textures[i], GL_TEXTURE_2D,
+            CU_GRAPHICS_REGISTER_FLAGS_READ_ONLY);
+        if (res != CUDA_SUCCESS) {
+            const char *err_str = "unknown";
+            cap_xcomp->cuda.cuGetErrorString(res, &err_str);
+            fprintf(stderr,
+                    "Error: cuGraphicsGLRegisterImage failed, error %s, texture "
+                    "id: %u\n",
+                    err_str, cap_xcomp->target_textures[i]);
+            res = cap_xcomp->cuda.cuCtxPopCurrent_v2(&old_ctx);
+            return false;
+        }
 
-    res = cap_xcomp->cuda.cuGraphicsResourceSetMapFlags(cap_xcomp->cuda_graphics_resource, CU_GRAPHICS_MAP_RESOURCE_FLAGS_READ_ONLY);
-    res = cap_xcomp->cuda.cuGraphicsMapResources(1, &cap_xcomp->cuda_graphics_resource, 0);
+        res = cap_xcomp->cuda.cuGraphicsResourceSetMapFlags(cap_xcomp->cuda_graphics_resources[i], CU_GRAPHICS_MAP_RESOURCE_FLAGS_READ_ONLY);
+        res = cap_xcomp->cuda.cuGraphicsMapResources(1, &cap_xcomp->cuda_graphics_resources[i], 0);
 
-    res = cap_xcomp->cuda.cuGraphicsSubResourceGetMappedArray(&cap_xcomp->mapped_array, cap_xcomp->cuda_graphics_resource, 0, 0);
+        res = cap_xcomp->cuda.cuGraphicsSubResourceGetMappedArray(&cap_xcomp->mapped_arrays[i], cap_xcomp->cuda_graphics_resources[i], 0, 0);
+    }
     res = cap_xcomp->cuda.cuCtxPopCurrent_v2(&old_ctx);
     return true;
 }
@@ -118,7 +123,7 @@ static bool cuda_create_codec_context(gsr_capture_xcomposite_cuda *cap_xcomp, AV
         (AVHWFramesContext *)frame_context->data;
     hw_frame_context->width = video_codec_context->width;
     hw_frame_context->height = video_codec_context->height;
-    hw_frame_context->sw_format = AV_PIX_FMT_BGR0;
+    hw_frame_context->sw_format = cap_xcomp->params.yuv444 ? AV_PIX_FMT_YUV444P : AV_PIX_FMT_NV12;
     hw_frame_context->format = video_codec_context->pix_fmt;
     hw_frame_context->device_ref = device_ctx;
     hw_frame_context->device_ctx = (AVHWDeviceContext*)device_ctx->data;
@@ -137,11 +142,11 @@ static bool cuda_create_codec_context(gsr_capture_xcomposite_cuda *cap_xcomp, AV
     return true;
 }
 
-static unsigned int gl_create_texture(gsr_capture_xcomposite_cuda *cap_xcomp, int width, int height) {
+static unsigned int gl_create_texture(gsr_capture_xcomposite_cuda *cap_xcomp, int width, int height, int internal_format, unsigned int format) {
     unsigned int texture_id = 0;
     cap_xcomp->egl.glGenTextures(1, &texture_id);
     cap_xcomp->egl.glBindTexture(GL_TEXTURE_2D, texture_id);
-    cap_xcomp->egl.glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    cap_xcomp->egl.glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE, NULL);
 
     cap_xcomp->egl.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     cap_xcomp->egl.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -152,6 +157,54 @@ static unsigned int gl_create_texture(gsr_capture_xcomposite_cuda *cap_xcomp, in
     return texture_id;
 }
 
+/* Creates the yuv textures the window is drawn to (and converted) with opengl, and the color conversion that draws to them */
+static bool xcomposite_create_target_textures(gsr_capture_xcomposite_cuda *cap_xcomp, vec2i size) {
+    if(cap_xcomp->params.yuv444) {
+        cap_xcomp->num_target_textures = 3;
+        for(int i = 0; i < 3; ++i) {
+            cap_xcomp->target_textures[i] = gl_create_texture(cap_xcomp, size.x, size.y, GL_R8, GL_RED);
+        }
+    } else {
+        cap_xcomp->num_target_textures = 2;
+        cap_xcomp->target_textures[0] = gl_create_texture(cap_xcomp, size.x, size.y, GL_R8, GL_RED);
+        cap_xcomp->target_textures[1] = gl_create_texture(cap_xcomp, size.x / 2, size.y / 2, GL_RG8, GL_RG);
+    }
+
+    for(int i = 0; i < cap_xcomp->num_target_textures; ++i) {
+        if(cap_xcomp->target_textures[i] == 0) {
+            fprintf(stderr, "gsr error: gsr_capture_xcomposite_cuda_start: failed to create opengl texture\n");
+            return false;
+        }
+    }
+
+    gsr_color_conversion_params color_conversion_params = {0};
+    color_conversion_params.egl = &cap_xcomp->egl;
+    color_conversion_params.source_color = GSR_SOURCE_COLOR_RGB;
+    color_conversion_params.destination_color = cap_xcomp->params.yuv444 ? GSR_DESTINATION_COLOR_YUV444 : GSR_DESTINATION_COLOR_NV12;
+    for(int i = 0; i < cap_xcomp->num_target_textures; ++i) {
+        color_conversion_params.destination_textures[i] = cap_xcomp->target_textures[i];
+    }
+    color_conversion_params.num_destination_textures = cap_xcomp->num_target_textures;
+    color_conversion_params.scale_filter = cap_xcomp->params.scale_filter;
+
+    if(gsr_color_conversion_init(&cap_xcomp->color_conversion, &color_conversion_params) != 0) {
+        fprintf(stderr, "gsr error: gsr_capture_xcomposite_cuda_start: failed to create color conversion\n");
+        return false;
+    }
+
+    return true;
+}
+
+/* The size of the part of the window texture that is copied. This is the whole window unless a part of it is recorded (|source_size|) */
+static vec2i xcomposite_get_source_size(const gsr_capture_xcomposite_cuda *cap_xcomp) {
+    vec2i size = { cap_xcomp->window_texture.texture_width, cap_xcomp->window_texture.texture_height };
+    if(cap_xcomp->params.source_size.x > 0 && cap_xcomp->params.source_size.y > 0) {
+        size.x = max_int(0, min_int(cap_xcomp->params.source_size.x, size.x - cap_xcomp->params.source_pos.x));
+        size.y = max_int(0, min_int(cap_xcomp->params.source_size.y, size.y - cap_xcomp->params.source_pos.y));
+    }
+    return size;
+}
+
 static int gsr_capture_xcomposite_cuda_start(gsr_capture *cap, AVCodecContext *video_codec_context) {
     gsr_capture_xcomposite_cuda *cap_xcomp = cap->priv;
 
@@ -176,13 +229,12 @@ static int gsr_capture_xcomposite_cuda_start(gsr_capture *cap, AVCodecContext *v
         return -1;
     }
 
-    cap_xcomp->window_size.x = max_int(attr.width, 0);
-    cap_xcomp->window_size.y = max_int(attr.height, 0);
-
     if(cap_xcomp->params.follow_focused)
         XSelectInput(cap_xcomp->dpy, DefaultRootWindow(cap_xcomp->dpy), PropertyChangeMask);
 
-    XSelectInput(cap_xcomp->dpy, cap_xcomp->window, StructureNotifyMask | ExposureMask);
+    /* The focused window is tracked once it's known, in tick */
+    if(!cap_xcomp->params.follow_focused)
+        gsr_window_tracker_init(&cap_xcomp->window_tracker, cap_xcomp->dpy, cap_xcomp->window);
 
     if(!gsr_egl_load(&cap_xcomp->egl, cap_xcomp->dpy)) {
         fprintf(stderr, "gsr error: gsr_capture_xcomposite_cuda_start: failed to load opengl\n");
@@ -196,13 +248,7 @@ static int gsr_capture_xcomposite_cuda_start(gsr_capture *cap, AVCodecContext *v
         return -1;
     }
 
-    cap_xcomp->texture_size.x = 0;
-    cap_xcomp->texture_size.y = 0;
-
-    cap_xcomp->egl.glBindTexture(GL_TEXTURE_2D, window_texture_get_opengl_texture_id(&cap_xcomp->window_texture));
-    cap_xcomp->egl.glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &cap_xcomp->texture_size.x);
-    cap_xcomp->egl.glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &cap_xcomp->texture_size.y);
-    cap_xcomp->egl.glBindTexture(GL_TEXTURE_2D, 0);
+    cap_xcomp->texture_size = xcomposite_get_source_size(cap_xcomp);
 
     cap_xcomp->texture_size.x = max_int(2, cap_xcomp->texture_size.x & ~1);
     cap_xcomp->texture_size.y = max_int(2, cap_xcomp->texture_size.y & ~1);
@@ -210,14 +256,18 @@ static int gsr_capture_xcomposite_cuda_start(gsr_capture *cap, AVCodecContext *v
     video_codec_context->width = cap_xcomp->texture_size.x;
     video_codec_context->height = cap_xcomp->texture_size.y;
 
+    if(!cap_xcomp->params.follow_focused && cap_xcomp->params.output_resolution.x > 0 && cap_xcomp->params.output_resolution.y > 0) {
+        const vec2i output_size = scale_keep_aspect_ratio(cap_xcomp->texture_size, cap_xcomp->params.output_resolution);
+        video_codec_context->width = max_int(2, output_size.x & ~1);
+        video_codec_context->height = max_int(2, output_size.y & ~1);
+    }
+
     if(cap_xcomp->params.region_size.x > 0 && cap_xcomp->params.region_size.y > 0) {
         video_codec_context->width = max_int(2, cap_xcomp->params.region_size.x & ~1);
         video_codec_context->height = max_int(2, cap_xcomp->params.region_size.y & ~1);
     }
 
-    cap_xcomp->target_texture_id = gl_create_texture(cap_xcomp, video_codec_context->width, video_codec_context->height);
-    if(cap_xcomp->target_texture_id == 0) {
-        fprintf(stderr, "gsr error: gsr_capture_xcomposite_cuda_start: failed to create opengl texture\n");
+    if(!xcomposite_create_target_textures(cap_xcomp, (vec2i){ video_codec_context->width, video_codec_context->height })) {
         gsr_capture_xcomposite_cuda_stop(cap, video_codec_context);
         return -1;
     }
@@ -232,7 +282,7 @@ static int gsr_capture_xcomposite_cuda_start(gsr_capture *cap, AVCodecContext *v
         return -1;
     }
 
-    if(!cuda_register_opengl_texture(cap_xcomp)) {
+    if(!cuda_register_opengl_textures(cap_xcomp)) {
         gsr_capture_xcomposite_cuda_stop(cap, video_codec_context);
         return -1;
     }
@@ -244,12 +294,10 @@ static int gsr_capture_xcomposite_cuda_start(gsr_capture *cap, AVCodecContext *v
 static void gsr_capture_xcomposite_cuda_stop(gsr_capture *cap, AVCodecContext *video_codec_context) {
     gsr_capture_xcomposite_cuda *cap_xcomp = cap->priv;
 
+    gsr_window_tracker_deinit(&cap_xcomp->window_tracker);
     window_texture_deinit(&cap_xcomp->window_texture);
 
-    if(cap_xcomp->target_texture_id) {
-        cap_xcomp->egl.glDeleteTextures(1, &cap_xcomp->target_texture_id);
-        cap_xcomp->target_texture_id = 0;
-    }
+    gsr_color_conversion_deinit(&cap_xcomp->color_conversion);
 
     if(video_codec_context->hw_device_ctx)
         av_buffer_unref(&video_codec_context->hw_device_ctx);
@@ -260,12 +308,25 @@ static void gsr_capture_xcomposite_cuda_stop(gsr_capture *cap, AVCodecContext *v
         CUcontext old_ctx;
         cap_xcomp->cuda.cuCtxPushCurrent_v2(cap_xcomp->cuda.cu_ctx);
 
-        cap_xcomp->cuda.cuGraphicsUnmapResources(1, &cap_xcomp->cuda_graphics_resource, 0);
-        cap_xcomp->cuda.cuGraphicsUnregisterResource(cap_xcomp->cuda_graphics_resource);
+        for(int i = 0; i < cap_xcomp->num_target_textures; ++i) {
+            if(cap_xcomp->cuda_graphics_resources[i]) {
+                cap_xcomp->cuda.cuGraphicsUnmapResources(1, &cap_xcomp->cuda_graphics_resources[i], 0);
+                cap_xcomp->cuda.cuGraphicsUnregisterResource(cap_xcomp->cuda_graphics_resources[i]);
+                cap_xcomp->cuda_graphics_resources[i] = 0;
+            }
+        }
         cap_xcomp->cuda.cuCtxPopCurrent_v2(&old_ctx);
     }
     gsr_cuda_unload(&cap_xcomp->cuda);
 
+    for(int i = 0; i < cap_xcomp->num_target_textures; ++i) {
+        if(cap_xcomp->target_textures[i]) {
+            cap_xcomp->egl.glDeleteTextures(1, &cap_xcomp->target_textures[i]);
+            cap_xcomp->target_textures[i] = 0;
+        }
+    }
+    cap_xcomp->num_target_textures = 0;
+
     gsr_egl_unload(&cap_xcomp->egl);
     if(cap_xcomp->dpy) {
         // TODO: This causes a crash, why? maybe some other library dlclose xlib and that also happened to unload this???
@@ -282,42 +343,18 @@ static void gsr_capture_xcomposite_cuda_tick(gsr_capture *cap, AVCodecContext *v
     bool init_new_window = false;
     while(XPending(cap_xcomp->dpy)) {
         XNextEvent(cap_xcomp->dpy, &cap_xcomp->xev);
+        if(gsr_window_tracker_process_event(&cap_xcomp->window_tracker, &cap_xcomp->xev))
+            cap_xcomp->window_resize_timer = clock_get_monotonic_seconds();
 
-        switch(cap_xcomp->xev.type) {
-            case DestroyNotify: {
-                /* Window died (when not following focused window), so we stop recording */
-                if(!cap_xcomp->params.follow_focused && cap_xcomp->xev.xdestroywindow.window == cap_xcomp->window) {
-                    cap_xcomp->should_stop = true;
-                    cap_xcomp->stop_is_error = false;
-                }
-                break;
-            }
-            case Expose: {
-                /* Requires window texture recreate */
-                if(cap_xcomp->xev.xexpose.count == 0 && cap_xcomp->xev.xexpose.window == cap_xcomp->window) {
-                    cap_xcomp->window_resize_timer = clock_get_monotonic_seconds();
-                    cap_xcomp->window_resized = true;
-                }
-                break;
-            }
-            case ConfigureNotify: {
-                /* Window resized */
-                if(cap_xcomp->xev.xconfigure.window == cap_xcomp->window && (cap_xcomp->xev.xconfigure.width != cap_xcomp->window_size.x || cap_xcomp->xev.xconfigure.height != cap_xcomp->window_size.y)) {
-                    cap_xcomp->window_size.x = max_int(cap_xcomp->xev.xconfigure.width, 0);
-                    cap_xcomp->window_size.y = max_int(cap_xcomp->xev.xconfigure.height, 0);
-                    cap_xcomp->window_resize_timer = clock_get_monotonic_seconds();
-                    cap_xcomp->window_resized = true;
-                }
-                break;
-            }
-            case PropertyNotify: {
-                /* Focused window changed */
-                if(cap_xcomp->params.follow_focused && cap_xcomp->xev.xproperty.atom == cap_xcomp->net_active_window_atom) {
-                    init_new_window = true;
-                }
-                break;
-            }
-        }
+        /* Focused window changed */
+        if(cap_xcomp->xev.type == PropertyNotify && cap_xcomp->params.follow_focused && cap_xcomp->xev.xproperty.atom == cap_xcomp->net_active_window_atom)
+            init_new_window = true;
+    }
+
+    /* Window died (when not following focused window), so we stop recording */
+    if(!cap_xcomp->params.follow_focused && cap_xcomp->window_tracker.destroyed) {
+        cap_xcomp->should_stop = true;
+        cap_xcomp->stop_is_error = false;
     }
 
     if(cap_xcomp->params.follow_focused && !cap_xcomp->follow_focused_initialized) {
@@ -328,56 +365,28 @@ static void gsr_capture_xcomposite_cuda_tick(gsr_capture *cap, AVCodecContext *v
         Window focused_window = get_focused_window(cap_xcomp->dpy, cap_xcomp->net_active_window_atom);
         if(focused_window != cap_xcomp->window || !cap_xcomp->follow_focused_initialized) {
             cap_xcomp->follow_focused_initialized = true;
-            XSelectInput(cap_xcomp->dpy, cap_xcomp->window, 0);
+            gsr_window_tracker_deinit(&cap_xcomp->window_tracker);
             cap_xcomp->window = focused_window;
-            XSelectInput(cap_xcomp->dpy, cap_xcomp->window, StructureNotifyMask | ExposureMask);
-
-            XWindowAttributes attr;
-            attr.width = 0;
-            attr.height = 0;
-            if(!XGetWindowAttributes(cap_xcomp->dpy, cap_xcomp->window, &attr))
-                fprintf(stderr, "gsr error: gsr_capture_xcomposite_cuda_tick failed: invalid window id: %lu\n", cap_xcomp->window);
-
-            cap_xcomp->window_size.x = max_int(attr.width, 0);
-            cap_xcomp->window_size.y = max_int(attr.height, 0);
-            cap_xcomp->window_resized = true;
+            gsr_window_tracker_init(&cap_xcomp->window_tracker, cap_xcomp->dpy, cap_xcomp->window);
 
             window_texture_deinit(&cap_xcomp->window_texture);
             window_texture_init(&cap_xcomp->window_texture, cap_xcomp->dpy, cap_xcomp->window, &cap_xcomp->egl); // TODO: Do not do the below window_texture_on_resize after this
             
-            cap_xcomp->texture_size.x = 0;
-            cap_xcomp->texture_size.y = 0;
-
-            cap_xcomp->egl.glBindTexture(GL_TEXTURE_2D, window_texture_get_opengl_texture_id(&cap_xcomp->window_texture));
-            cap_xcomp->egl.glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &cap_xcomp->texture_size.x);
-            cap_xcomp->egl.glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &cap_xcomp->texture_size.y);
-            cap_xcomp->egl.glBindTexture(GL_TEXTURE_2D, 0);
-
-            cap_xcomp->texture_size.x = min_int(video_codec_context->width, max_int(2, cap_xcomp->texture_size.x & ~1));
-            cap_xcomp->texture_size.y = min_int(video_codec_context->height, max_int(2, cap_xcomp->texture_size.y & ~1));
+            cap_xcomp->texture_size = xcomposite_get_source_size(cap_xcomp);
         }
     }
 
     const double window_resize_timeout = 1.0; // 1 second
-    if(!cap_xcomp->created_hw_frame || (cap_xcomp->window_resized && clock_get_monotonic_seconds() - cap_xcomp->window_resize_timer >= window_resize_timeout)) {
-        cap_xcomp->window_resized = false;
+    if(!cap_xcomp->created_hw_frame || (gsr_window_tracker_should_acquire_pixmap(&cap_xcomp->window_tracker) && clock_get_monotonic_seconds() - cap_xcomp->window_resize_timer >= window_resize_timeout)) {
+        /* The encoder is kept if this fails (the window isn't viewable for example), it's tried again later */
         if(window_texture_on_resize(&cap_xcomp->window_texture) != 0) {
             fprintf(stderr, "gsr error: gsr_capture_xcomposite_cuda_tick: window_texture_on_resize failed\n");
-            //cap_xcomp->should_stop = true;
-            //cap_xcomp->stop_is_error = true;
+            gsr_window_tracker_on_pixmap_acquire_failed(&cap_xcomp->window_tracker);
             return;
         }
+        gsr_window_tracker_on_pixmap_acquired(&cap_xcomp->window_tracker);
 
-        cap_xcomp->texture_size.x = 0;
-        cap_xcomp->texture_size.y = 0;
-
-        cap_xcomp->egl.glBindTexture(GL_TEXTURE_2D, window_texture_get_opengl_texture_id(&cap_xcomp->window_texture));
-        cap_xcomp->egl.glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &cap_xcomp->texture_size.x);
-        cap_xcomp->egl.glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &cap_xcomp->texture_size.y);
-        cap_xcomp->egl.glBindTexture(GL_TEXTURE_2D, 0);
-
-        cap_xcomp->texture_size.x = min_int(video_codec_context->width, max_int(2, cap_xcomp->texture_size.x & ~1));
-        cap_xcomp->texture_size.y = min_int(video_codec_context->height, max_int(2, cap_xcomp->texture_size.y & ~1));
+        cap_xcomp->texture_size = xcomposite_get_source_size(cap_xcomp);
 
         if(!cap_xcomp->created_hw_frame) {
             cap_xcomp->created_hw_frame = true;
@@ -406,9 +415,8 @@ static void gsr_capture_xcomposite_cuda_tick(gsr_capture *cap, AVCodecContext *v
             }
         }
 
-        // Clear texture with black background because the source texture (window_texture_get_opengl_texture_id(&cap_xcomp->window_texture))
-        // might be smaller than cap_xcomp->target_texture_id
-        cap_xcomp->egl.glClearTexImage(cap_xcomp->target_texture_id, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+        // Clear the target textures with black background because the window might not cover the whole frame anymore
+        gsr_color_conversion_clear(&cap_xcomp->color_conversion);
     }
 }
 
@@ -428,50 +436,61 @@ static bool gsr_capture_xcomposite_cuda_should_stop(gsr_capture *cap, bool *err)
 static int gsr_capture_xcomposite_cuda_capture(gsr_capture *cap, AVFrame *frame) {
     gsr_capture_xcomposite_cuda *cap_xcomp = cap->priv;
 
-    vec2i source_pos = { 0, 0 };
+    const vec2i frame_size = { frame->width, frame->height };
     vec2i source_size = cap_xcomp->texture_size;
+    vec2i output_size = source_size;
+    vec2i output_pos = { 0, 0 };
+
+    /*
+        Without scaling, the part of the window that doesn't fit in the frame is cropped. When following the focused window
+        the frame has a fixed size (-s) and the window is letterboxed in it instead: scaled down if it's larger and centered.
+    */
+    const bool letterbox = cap_xcomp->params.follow_focused;
+    const bool scale_output = (!letterbox && cap_xcomp->params.output_resolution.x > 0 && cap_xcomp->params.output_resolution.y > 0)
+        || (letterbox && (source_size.x > frame_size.x || source_size.y > frame_size.y));
+    if(scale_output) {
+        output_size = scale_keep_aspect_ratio(source_size, frame_size);
+    } else {
+        source_size.x = min_int(source_size.x, frame_size.x);
+        source_size.y = min_int(source_size.y, frame_size.y);
+        output_size = source_size;
+    }
+
+    if(letterbox) {
+        output_pos.x = (frame_size.x - output_size.x) / 2;
+        output_pos.y = (frame_size.y - output_size.y) / 2;
+    }
 
+    /* The window is scaled and converted to yuv in one draw, the result is the only thing that is copied with cuda */
     if(cap_xcomp->window_texture.texture_id != 0) {
-        while(cap_xcomp->egl.glGetError()) {}
-        /* TODO: Remove this copy, which is only possible by using nvenc directly and encoding window_pixmap.target_texture_id */
-        cap_xcomp->egl.glCopyImageSubData(
-            window_texture_get_opengl_texture_id(&cap_xcomp->window_texture), GL_TEXTURE_2D, 0, source_pos.x, source_pos.y, 0,
-            cap_xcomp->target_texture_id, GL_TEXTURE_2D, 0, 0, 0, 0,
-            source_size.x, source_size.y, 1);
-        unsigned int err = cap_xcomp->egl.glGetError();
-        if(err != 0) {
-            static bool error_shown = false;
-            if(!error_shown) {
-                error_shown = true;
-                fprintf(stderr, "gsr error: gsr_capture_xcomposite_cuda_capture: glCopyImageSubData failed, gl error: %d\n", err);
-            }
-        }
+        gsr_color_conversion_draw(&cap_xcomp->color_conversion, window_texture_get_opengl_texture_id(&cap_xcomp->window_texture),
+            output_pos, output_size,
+            cap_xcomp->params.source_pos, source_size,
+            0.0f);
     }
     cap_xcomp->egl.eglSwapBuffers(cap_xcomp->egl.egl_display, cap_xcomp->egl.egl_surface);
 
-    frame->linesize[0] = frame->width * 4;
-    //frame->linesize[0] = frame->width * 1;
-    //frame->linesize[1] = frame->width * 1;
-    //frame->linesize[2] = frame->width * 1;
-
-    CUDA_MEMCPY2D memcpy_struct;
-    memcpy_struct.srcXInBytes = 0;
-    memcpy_struct.srcY = 0;
-    memcpy_struct.srcMemoryType = CU_MEMORYTYPE_ARRAY;
-
-    memcpy_struct.dstXInBytes = 0;
-    memcpy_struct.dstY = 0;
-    memcpy_struct.dstMemoryType = CU_MEMORYTYPE_DEVICE;
-
-    memcpy_struct.srcArray = cap_xcomp->mapped_array;
-    memcpy_struct.dstDevice = (CUdeviceptr)frame->data[0];
-    memcpy_struct.dstPitch = frame->linesize[0];
-    memcpy_struct.WidthInBytes = frame->width * 4;//frame->width * 1;
-    memcpy_struct.Height = frame->height;
-    cap_xcomp->cuda.cuMemcpy2D_v2(&memcpy_struct);
-
-    //frame->data[1] = frame->data[0];
-    //frame->data[2] = frame->data[0];
+    /* The UV plane of nv12 is half the size of the Y plane but has two bytes per pixel */
+    const int nv12_div_y[2] = { 1, 2 };
+    for(int i = 0; i < cap_xcomp->num_target_textures; ++i) {
+        const int plane_height = cap_xcomp->params.yuv444 ? frame->height : frame->height / nv12_div_y[i];
+
+        CUDA_MEMCPY2D memcpy_struct;
+        memcpy_struct.srcXInBytes = 0;
+        memcpy_struct.srcY = 0;
+        memcpy_struct.srcMemoryType = CU_MEMORYTYPE_ARRAY;
+
+        memcpy_struct.dstXInBytes = 0;
+        memcpy_struct.dstY = 0;
+        memcpy_struct.dstMemoryType = CU_MEMORYTYPE_DEVICE;
+
+        memcpy_struct.srcArray = cap_xcomp->mapped_arrays[i];
+        memcpy_struct.dstDevice = (CUdeviceptr)frame->data[i];
+        memcpy_struct.dstPitch = frame->linesize[i];
+        memcpy_struct.WidthInBytes = frame->width;
+        memcpy_struct.Height = plane_height;
+        cap_xcomp->cuda.cuMemcpy2D_v2(&memcpy_struct);
+    }
 
     return 0;
 }
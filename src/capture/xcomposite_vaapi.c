@@ -1,9 +1,11 @@
 #include "../../include/capture/xcomposite_vaapi.h"
 #include "../../include/egl.h"
 #include "../../include/window_texture.h"
+#include "../../include/window_tracker.h"
 #include "../../include/utils.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <assert.h>
 #include <X11/Xlib.h>
@@ -12,6 +14,35 @@
 #include <libavutil/frame.h>
 #include <libavcodec/avcodec.h>
 
+#define MAX_OUTPUTS 8
+
+/* A video the window is copied to with vaapi. The first output is the main output, the others are added with add_output */
+typedef struct {
+    AVCodecContext *video_codec_context;
+    AVFrame *frame; /* Only owned by the capture for the added outputs */
+    vec2i output_resolution; /* The window is scaled to fit inside this size if it's not {0, 0} */
+    VAContextID context_id;
+    VABufferID buffer_id;
+    VARectangle surface_region;
+    VARectangle output_region;
+} XcompositeOutput;
+
+/*
+    When following the focused window, the windows that were focused most recently are kept (redirected, with their texture
+    and imported vaapi surface) so that switching focus back to one of them only changes which surface is copied to the outputs.
+*/
+#define MAX_CACHED_WINDOWS 4
+
+typedef struct {
+    bool in_use;
+    Window window;
+    WindowTexture window_texture;
+    gsr_window_tracker window_tracker;
+    VASurfaceID input_surface; /* 0 if the current window pixmap hasn't been imported yet */
+    int dmabuf_fd;
+    uint64_t last_used;
+} XcompositeWindow;
+
 typedef struct {
     gsr_capture_xcomposite_vaapi_params params;
     Display *dpy;
@@ -19,32 +50,29 @@ typedef struct {
 
     bool should_stop;
     bool stop_is_error;
-    bool window_resized;
     bool created_hw_frame;
     bool follow_focused_initialized;
 
-    Window window;
-    vec2i window_size;
     vec2i texture_size;
-    double window_resize_timer;
-    
-    WindowTexture window_texture;
+
+    XcompositeWindow windows[MAX_CACHED_WINDOWS];
+    XcompositeWindow *current_window; /* The window that should be captured */
+    XcompositeWindow *displayed_window; /* The window whose surface is copied to the outputs right now */
+    uint64_t window_use_counter;
 
     gsr_egl egl;
 
     int fourcc;
     int num_planes;
     uint64_t modifiers;
-    int dmabuf_fd;
     int32_t pitch;
     int32_t offset;
 
     VADisplay va_dpy;
     VAConfigID config_id;
-    VAContextID context_id;
-    VASurfaceID input_surface;
-    VABufferID buffer_id;
-    VARectangle output_region;
+
+    XcompositeOutput outputs[MAX_OUTPUTS];
+    int num_outputs;
 
     Atom net_active_window_atom;
 } gsr_capture_xcomposite_vaapi;
@@ -58,6 +86,7 @@ static int min_int(int a, int b) {
 }
 
 static void gsr_capture_xcomposite_vaapi_stop(gsr_capture *cap, AVCodecContext *video_codec_context);
+static void xcomposite_destroy_window_surface(gsr_capture_xcomposite_vaapi *cap_xcomp, XcompositeWindow *window);
 
 static Window get_focused_window(Display *display, Atom net_active_window_atom) {
     Atom type;
@@ -73,9 +102,76 @@ static Window get_focused_window(Display *display, Atom net_active_window_atom)
     return None;
 }
 
-static bool drm_create_codec_context(gsr_capture_xcomposite_vaapi *cap_xcomp, AVCodecContext *video_codec_context) {
+/*
+    Returns 0 on success. The window is cached even if this fails (the window might not be viewable yet),
+    the window pixmap is acquired again when the window becomes viewable.
+*/
+static int xcomposite_window_init(gsr_capture_xcomposite_vaapi *cap_xcomp, XcompositeWindow *self, Window window) {
+    memset(self, 0, sizeof(*self));
+    self->in_use = true;
+    self->window = window;
+    gsr_window_tracker_init(&self->window_tracker, cap_xcomp->dpy, window);
+
+    if(window_texture_init(&self->window_texture, cap_xcomp->dpy, window, &cap_xcomp->egl) != 0)
+        return -1;
+
+    /* window_texture_init acquires the window pixmap */
+    gsr_window_tracker_on_pixmap_acquired(&self->window_tracker);
+    return 0;
+}
+
+static void xcomposite_window_deinit(gsr_capture_xcomposite_vaapi *cap_xcomp, XcompositeWindow *self) {
+    if(!self->in_use)
+        return;
+
+    xcomposite_destroy_window_surface(cap_xcomp, self);
+    gsr_window_tracker_deinit(&self->window_tracker);
+    window_texture_deinit(&self->window_texture);
+    self->in_use = false;
+}
+
+/* Returns the cached window, or adds the window to the cache. The least recently used window is removed from the cache if it's full */
+static XcompositeWindow* xcomposite_get_cached_window(gsr_capture_xcomposite_vaapi *cap_xcomp, Window window) {
+    XcompositeWindow *free_window = NULL;
+    XcompositeWindow *least_recently_used = NULL;
+    for(int i = 0; i < MAX_CACHED_WINDOWS; ++i) {
+        XcompositeWindow *cached_window = &cap_xcomp->windows[i];
+        if(!cached_window->in_use) {
+            if(!free_window)
+                free_window = cached_window;
+            continue;
+        }
+
+        if(cached_window->window == window)
+            return cached_window;
+
+        /* The surface of the displayed window is used by the outputs until the surface of the new window has been imported */
+        if(cached_window == cap_xcomp->current_window || cached_window == cap_xcomp->displayed_window)
+            continue;
+
+        if(!least_recently_used || cached_window->last_used < least_recently_used->last_used)
+            least_recently_used = cached_window;
+    }
+
+    if(!free_window) {
+        free_window = least_recently_used;
+        xcomposite_window_deinit(cap_xcomp, free_window);
+    }
+
+    xcomposite_window_init(cap_xcomp, free_window, window);
+    return free_window;
+}
+
+/* If |shared_device_ctx| is not NULL then the frames are created on that device instead of a new one */
+static bool drm_create_codec_context(gsr_capture_xcomposite_vaapi *cap_xcomp, AVCodecContext *video_codec_context, AVBufferRef *shared_device_ctx) {
     AVBufferRef *device_ctx;
-    if(av_hwdevice_ctx_create(&device_ctx, AV_HWDEVICE_TYPE_VAAPI, cap_xcomp->params.card_path, NULL, 0) < 0) {
+    if(shared_device_ctx) {
+        device_ctx = av_buffer_ref(shared_device_ctx);
+        if(!device_ctx) {
+            fprintf(stderr, "Error: Failed to reference hardware device context\n");
+            return false;
+        }
+    } else if(av_hwdevice_ctx_create(&device_ctx, AV_HWDEVICE_TYPE_VAAPI, cap_xcomp->params.card_path, NULL, 0) < 0) {
         fprintf(stderr, "Error: Failed to create hardware device context\n");
         return false;
     }
@@ -91,7 +187,7 @@ static bool drm_create_codec_context(gsr_capture_xcomposite_vaapi *cap_xcomp, AV
         (AVHWFramesContext *)frame_context->data;
     hw_frame_context->width = video_codec_context->width;
     hw_frame_context->height = video_codec_context->height;
-    hw_frame_context->sw_format = AV_PIX_FMT_NV12;//AV_PIX_FMT_0RGB32;//AV_PIX_FMT_YUV420P;//AV_PIX_FMT_0RGB32;//AV_PIX_FMT_NV12;
+    hw_frame_context->sw_format = cap_xcomp->params.yuv444 ? AV_PIX_FMT_YUV444P : AV_PIX_FMT_NV12;
     hw_frame_context->format = video_codec_context->pix_fmt;
     hw_frame_context->device_ref = device_ctx;
     hw_frame_context->device_ctx = (AVHWDeviceContext*)device_ctx->data;
@@ -125,28 +221,17 @@ static int gsr_capture_xcomposite_vaapi_start(gsr_capture *cap, AVCodecContext *
             fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_start failed: failed to get _NET_ACTIVE_WINDOW atom\n");
             return -1;
         }
-        cap_xcomp->window = get_focused_window(cap_xcomp->dpy, cap_xcomp->net_active_window_atom);
-    } else {
-        cap_xcomp->window = cap_xcomp->params.window;
     }
 
-    /* TODO: Do these in tick, and allow error if follow_focused */
-
     XWindowAttributes attr;
     if(!XGetWindowAttributes(cap_xcomp->dpy, cap_xcomp->params.window, &attr) && !cap_xcomp->params.follow_focused) {
         fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_start failed: invalid window id: %lu\n", cap_xcomp->params.window);
         return -1;
     }
 
-    cap_xcomp->window_size.x = max_int(attr.width, 0);
-    cap_xcomp->window_size.y = max_int(attr.height, 0);
-
     if(cap_xcomp->params.follow_focused)
         XSelectInput(cap_xcomp->dpy, DefaultRootWindow(cap_xcomp->dpy), PropertyChangeMask);
 
-    // TODO: Get select and add these on top of it and then restore at the end. Also do the same in other xcomposite
-    XSelectInput(cap_xcomp->dpy, cap_xcomp->params.window, StructureNotifyMask | ExposureMask);
-
     if(!gsr_egl_load(&cap_xcomp->egl, cap_xcomp->dpy)) {
         fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_start: failed to load opengl\n");
         return -1;
@@ -166,21 +251,23 @@ static int gsr_capture_xcomposite_vaapi_start(gsr_capture *cap, AVCodecContext *
 
     /* Disable vsync */
     cap_xcomp->egl.eglSwapInterval(cap_xcomp->egl.egl_display, 0);
-    if(window_texture_init(&cap_xcomp->window_texture, cap_xcomp->dpy, cap_xcomp->params.window, &cap_xcomp->egl) != 0 && !cap_xcomp->params.follow_focused) {
-        fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_start: failed get window texture for window %ld\n", cap_xcomp->params.window);
-        gsr_egl_unload(&cap_xcomp->egl);
-        return -1;
-    }
 
     cap_xcomp->texture_size.x = 0;
     cap_xcomp->texture_size.y = 0;
 
-    cap_xcomp->egl.glBindTexture(GL_TEXTURE_2D, window_texture_get_opengl_texture_id(&cap_xcomp->window_texture));
-    cap_xcomp->texture_size.x = 0;
-    cap_xcomp->texture_size.y = 0;
-    cap_xcomp->egl.glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &cap_xcomp->texture_size.x);
-    cap_xcomp->egl.glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &cap_xcomp->texture_size.y);
-    cap_xcomp->egl.glBindTexture(GL_TEXTURE_2D, 0);
+    /* The focused window is added to the cache once it's known, in tick. The video size is given by the user (-s) then */
+    if(!cap_xcomp->params.follow_focused) {
+        XcompositeWindow *window = &cap_xcomp->windows[0];
+        if(xcomposite_window_init(cap_xcomp, window, cap_xcomp->params.window) != 0) {
+            fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_start: failed get window texture for window %ld\n", cap_xcomp->params.window);
+            xcomposite_window_deinit(cap_xcomp, window);
+            gsr_egl_unload(&cap_xcomp->egl);
+            return -1;
+        }
+        cap_xcomp->current_window = window;
+        cap_xcomp->texture_size.x = window->window_texture.texture_width;
+        cap_xcomp->texture_size.y = window->window_texture.texture_height;
+    }
 
     cap_xcomp->texture_size.x = max_int(2, cap_xcomp->texture_size.x & ~1);
     cap_xcomp->texture_size.y = max_int(2, cap_xcomp->texture_size.y & ~1);
@@ -188,261 +275,324 @@ static int gsr_capture_xcomposite_vaapi_start(gsr_capture *cap, AVCodecContext *
     video_codec_context->width = cap_xcomp->texture_size.x;
     video_codec_context->height = cap_xcomp->texture_size.y;
 
+    if(!cap_xcomp->params.follow_focused && cap_xcomp->params.output_resolution.x > 0 && cap_xcomp->params.output_resolution.y > 0) {
+        const vec2i output_size = scale_keep_aspect_ratio(cap_xcomp->texture_size, cap_xcomp->params.output_resolution);
+        video_codec_context->width = max_int(2, output_size.x & ~1);
+        video_codec_context->height = max_int(2, output_size.y & ~1);
+    }
+
     if(cap_xcomp->params.region_size.x > 0 && cap_xcomp->params.region_size.y > 0) {
         video_codec_context->width = max_int(2, cap_xcomp->params.region_size.x & ~1);
         video_codec_context->height = max_int(2, cap_xcomp->params.region_size.y & ~1);
     }
 
-    if(!drm_create_codec_context(cap_xcomp, video_codec_context)) {
+    if(!drm_create_codec_context(cap_xcomp, video_codec_context, NULL)) {
         gsr_capture_xcomposite_vaapi_stop(cap, video_codec_context);
         return -1;
     }
 
-    cap_xcomp->window_resize_timer = clock_get_monotonic_seconds();
+    XcompositeOutput *main_output = &cap_xcomp->outputs[0];
+    main_output->video_codec_context = video_codec_context;
+    if(!cap_xcomp->params.follow_focused)
+        main_output->output_resolution = cap_xcomp->params.output_resolution;
+    cap_xcomp->num_outputs = 1;
+
     return 0;
 }
 
-static void gsr_capture_xcomposite_vaapi_tick(gsr_capture *cap, AVCodecContext *video_codec_context, AVFrame **frame) {
-    gsr_capture_xcomposite_vaapi *cap_xcomp = cap->priv;
+static void xcomposite_output_destroy_pipeline(gsr_capture_xcomposite_vaapi *cap_xcomp, XcompositeOutput *output) {
+    if(output->buffer_id) {
+        vaDestroyBuffer(cap_xcomp->va_dpy, output->buffer_id);
+        output->buffer_id = 0;
+    }
 
-    // TODO:
-    //cap_xcomp->egl.glClear(GL_COLOR_BUFFER_BIT);
+    if(output->context_id) {
+        vaDestroyContext(cap_xcomp->va_dpy, output->context_id);
+        output->context_id = 0;
+    }
+}
 
-    bool init_new_window = false;
-    while(XPending(cap_xcomp->dpy)) {
-        XNextEvent(cap_xcomp->dpy, &cap_xcomp->xev);
+/* The context only depends on the frame of the output, so it's created once and kept when the window is resized */
+static bool xcomposite_output_create_context(gsr_capture_xcomposite_vaapi *cap_xcomp, XcompositeOutput *output) {
+    VASurfaceID target_surface_id = (uintptr_t)output->frame->data[3];
+    VAStatus va_status = vaCreateContext(cap_xcomp->va_dpy, cap_xcomp->config_id, output->frame->width, output->frame->height, VA_PROGRESSIVE, &target_surface_id, 1, &output->context_id);
+    if(va_status != VA_STATUS_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: vaCreateContext failed: %d\n", va_status);
+        return false;
+    }
+    return true;
+}
 
-        switch(cap_xcomp->xev.type) {
-            case DestroyNotify: {
-                /* Window died (when not following focused window), so we stop recording */
-                if(!cap_xcomp->params.follow_focused && cap_xcomp->xev.xdestroywindow.window == cap_xcomp->window) {
-                    cap_xcomp->should_stop = true;
-                    cap_xcomp->stop_is_error = false;
-                }
-                break;
-            }
-            case Expose: {
-                /* Requires window texture recreate */
-                if(cap_xcomp->xev.xexpose.count == 0 && cap_xcomp->xev.xexpose.window == cap_xcomp->window) {
-                    cap_xcomp->window_resize_timer = clock_get_monotonic_seconds();
-                    cap_xcomp->window_resized = true;
-                }
-                break;
-            }
-            case ConfigureNotify: {
-                /* Window resized */
-                if(cap_xcomp->xev.xconfigure.window == cap_xcomp->window && (cap_xcomp->xev.xconfigure.width != cap_xcomp->window_size.x || cap_xcomp->xev.xconfigure.height != cap_xcomp->window_size.y)) {
-                    cap_xcomp->window_size.x = max_int(cap_xcomp->xev.xconfigure.width, 0);
-                    cap_xcomp->window_size.y = max_int(cap_xcomp->xev.xconfigure.height, 0);
-                    cap_xcomp->window_resize_timer = clock_get_monotonic_seconds();
-                    cap_xcomp->window_resized = true;
-                }
-                break;
-            }
-            case PropertyNotify: {
-                /* Focused window changed */
-                if(cap_xcomp->params.follow_focused && cap_xcomp->xev.xproperty.atom == cap_xcomp->net_active_window_atom) {
-                    init_new_window = true;
-                }
-                break;
-            }
-        }
+/*
+    (Re)creates the parameters that copy (and scale) the surface of |window| to the frame of the output.
+    This is all that has to be redone for an output when the window is resized, or when another window is focused.
+*/
+static bool xcomposite_output_update_params(gsr_capture_xcomposite_vaapi *cap_xcomp, XcompositeOutput *output, XcompositeWindow *window) {
+    if(output->buffer_id) {
+        vaDestroyBuffer(cap_xcomp->va_dpy, output->buffer_id);
+        output->buffer_id = 0;
     }
 
-    if(cap_xcomp->params.follow_focused && !cap_xcomp->follow_focused_initialized) {
-        init_new_window = true;
+    const vec2i input_size = { window->window_texture.texture_width, window->window_texture.texture_height };
+    const vec2i frame_size = { output->frame->width, output->frame->height };
+    bool scale_output = output->output_resolution.x > 0 && output->output_resolution.y > 0;
+
+    /*
+        Without scaling, the part of the window that doesn't fit in the frame (the window got larger) is cropped.
+        When following the focused window the frame has a fixed size (-s) and every window is letterboxed in it instead:
+        windows that are larger than the frame are scaled down to fit and all windows are centered.
+    */
+    vec2i source_size = input_size;
+    vec2i output_size = input_size;
+    if(cap_xcomp->params.follow_focused && (input_size.x > frame_size.x || input_size.y > frame_size.y))
+        scale_output = true;
+
+    if(scale_output) {
+        output_size = scale_keep_aspect_ratio(input_size, frame_size);
+    } else {
+        source_size.x = min_int(source_size.x, frame_size.x);
+        source_size.y = min_int(source_size.y, frame_size.y);
+        output_size = source_size;
     }
 
-    if(init_new_window) {
-        Window focused_window = get_focused_window(cap_xcomp->dpy, cap_xcomp->net_active_window_atom);
-        if(focused_window != cap_xcomp->window || !cap_xcomp->follow_focused_initialized) {
-            cap_xcomp->follow_focused_initialized = true;
-            XSelectInput(cap_xcomp->dpy, cap_xcomp->window, 0);
-            cap_xcomp->window = focused_window;
-            XSelectInput(cap_xcomp->dpy, cap_xcomp->window, StructureNotifyMask | ExposureMask);
-
-            XWindowAttributes attr;
-            attr.width = 0;
-            attr.height = 0;
-            if(!XGetWindowAttributes(cap_xcomp->dpy, cap_xcomp->window, &attr))
-                fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick failed: invalid window id: %lu\n", cap_xcomp->window);
-
-            cap_xcomp->window_size.x = max_int(attr.width, 0);
-            cap_xcomp->window_size.y = max_int(attr.height, 0);
-            cap_xcomp->window_resized = true;
-
-            window_texture_deinit(&cap_xcomp->window_texture);
-            window_texture_init(&cap_xcomp->window_texture, cap_xcomp->dpy, cap_xcomp->window, &cap_xcomp->egl); // TODO: Do not do the below window_texture_on_resize after this
-            
-            cap_xcomp->texture_size.x = 0;
-            cap_xcomp->texture_size.y = 0;
-
-            cap_xcomp->egl.glBindTexture(GL_TEXTURE_2D, window_texture_get_opengl_texture_id(&cap_xcomp->window_texture));
-            cap_xcomp->egl.glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &cap_xcomp->texture_size.x);
-            cap_xcomp->egl.glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &cap_xcomp->texture_size.y);
-            cap_xcomp->egl.glBindTexture(GL_TEXTURE_2D, 0);
-
-            cap_xcomp->texture_size.x = min_int(video_codec_context->width, max_int(2, cap_xcomp->texture_size.x & ~1));
-            cap_xcomp->texture_size.y = min_int(video_codec_context->height, max_int(2, cap_xcomp->texture_size.y & ~1));
-        }
+    vec2i output_pos = {0, 0};
+    if(cap_xcomp->params.follow_focused) {
+        output_pos.x = (frame_size.x - output_size.x) / 2;
+        output_pos.y = (frame_size.y - output_size.y) / 2;
     }
 
-    const double window_resize_timeout = 1.0; // 1 second
-    if(!cap_xcomp->created_hw_frame || (cap_xcomp->window_resized && clock_get_monotonic_seconds() - cap_xcomp->window_resize_timer >= window_resize_timeout)) {
-        cap_xcomp->window_resized = false;
+    output->surface_region = (VARectangle){
+        .x = 0,
+        .y = 0,
+        .width = source_size.x,
+        .height = source_size.y
+    };
 
-        if(window_texture_on_resize(&cap_xcomp->window_texture) != 0) {
-            fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: window_texture_on_resize failed\n");
-            //cap_xcomp->should_stop = true;
-            //cap_xcomp->stop_is_error = true;
-            return;
-        }
+    output->output_region = (VARectangle){
+        .x = output_pos.x,
+        .y = output_pos.y,
+        .width = output_size.x,
+        .height = output_size.y
+    };
 
-        cap_xcomp->texture_size.x = 0;
-        cap_xcomp->texture_size.y = 0;
+    // Copying a surface to another surface will automatically perform the color conversion. Thanks vaapi!
+    VAProcPipelineParameterBuffer params = {0};
+    params.surface = window->input_surface;
+    params.surface_region = &output->surface_region;
+    params.output_region = &output->output_region;
+    params.output_background_color = 0; /* The part of the frame outside |output_region| (the window got smaller) is cleared with this */
+    params.filter_flags = VA_FRAME_PICTURE;
+    if(scale_output)
+        params.filter_flags |= cap_xcomp->params.scale_filter == GSR_SCALE_FILTER_BILINEAR ? VA_FILTER_SCALING_FAST : VA_FILTER_SCALING_HQ;
+
+    params.input_color_properties.colour_primaries = 1;
+    params.input_color_properties.transfer_characteristics = 1;
+    params.input_color_properties.matrix_coefficients = 1;
+    params.surface_color_standard = VAProcColorStandardBT709;
+    params.input_color_properties.color_range = output->frame->color_range == AVCOL_RANGE_JPEG ? VA_SOURCE_RANGE_FULL : VA_SOURCE_RANGE_REDUCED;
+
+    params.output_color_properties.colour_primaries = 1;
+    params.output_color_properties.transfer_characteristics = 1;
+    params.output_color_properties.matrix_coefficients = 1;
+    params.output_color_standard = VAProcColorStandardBT709;
+    params.output_color_properties.color_range = output->frame->color_range == AVCOL_RANGE_JPEG ? VA_SOURCE_RANGE_FULL : VA_SOURCE_RANGE_REDUCED;
+
+    params.processing_mode = VAProcPerformanceMode;
+
+    VAStatus va_status = vaCreateBuffer(cap_xcomp->va_dpy, output->context_id, VAProcPipelineParameterBufferType, sizeof(params), 1, &params, &output->buffer_id);
+    if(va_status != VA_STATUS_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: vaCreateBuffer failed: %d\n", va_status);
+        return false;
+    }
 
-        cap_xcomp->egl.glBindTexture(GL_TEXTURE_2D, window_texture_get_opengl_texture_id(&cap_xcomp->window_texture));
-        cap_xcomp->egl.glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &cap_xcomp->texture_size.x);
-        cap_xcomp->egl.glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &cap_xcomp->texture_size.y);
-        cap_xcomp->egl.glBindTexture(GL_TEXTURE_2D, 0);
+    return true;
+}
 
-        cap_xcomp->texture_size.x = min_int(video_codec_context->width, max_int(2, cap_xcomp->texture_size.x & ~1));
-        cap_xcomp->texture_size.y = min_int(video_codec_context->height, max_int(2, cap_xcomp->texture_size.y & ~1));
+static void xcomposite_destroy_window_surface(gsr_capture_xcomposite_vaapi *cap_xcomp, XcompositeWindow *window) {
+    if(window->input_surface) {
+        vaDestroySurfaces(cap_xcomp->va_dpy, &window->input_surface, 1);
+        window->input_surface = 0;
+    }
 
-        if(cap_xcomp->buffer_id) {
-            vaDestroyBuffer(cap_xcomp->va_dpy, cap_xcomp->buffer_id);
-            cap_xcomp->buffer_id = 0;
-        }
+    if(window->dmabuf_fd) {
+        close(window->dmabuf_fd);
+        window->dmabuf_fd = 0;
+    }
+}
 
-        if(cap_xcomp->context_id) {
-            vaDestroyContext(cap_xcomp->va_dpy, cap_xcomp->context_id);
-            cap_xcomp->context_id = 0;
-        }
+/* Imports the window texture as the vaapi input surface of |window|. The window pixmap changes when the window is resized so this is redone then */
+static bool xcomposite_import_window_surface(gsr_capture_xcomposite_vaapi *cap_xcomp, XcompositeWindow *window) {
+    xcomposite_destroy_window_surface(cap_xcomp, window);
+    const vec2i window_texture_size = { window->window_texture.texture_width, window->window_texture.texture_height };
 
-        if(cap_xcomp->config_id) {
-            vaDestroyConfig(cap_xcomp->va_dpy, cap_xcomp->config_id);
-            cap_xcomp->config_id = 0;
-        }
+    const intptr_t pixmap_attrs[] = {
+        EGL_IMAGE_PRESERVED_KHR, EGL_TRUE,
+        EGL_NONE,
+    };
 
-        if(cap_xcomp->input_surface) {
-            vaDestroySurfaces(cap_xcomp->va_dpy, &cap_xcomp->input_surface, 1);
-            cap_xcomp->input_surface = 0;
-        }
+    EGLImage img = cap_xcomp->egl.eglCreateImage(cap_xcomp->egl.egl_display, cap_xcomp->egl.egl_context, EGL_GL_TEXTURE_2D, (EGLClientBuffer)(uint64_t)window_texture_get_opengl_texture_id(&window->window_texture), pixmap_attrs);
+    if(!img) {
+        fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: eglCreateImage failed\n");
+        return false;
+    }
 
-        if(cap_xcomp->dmabuf_fd) {
-            close(cap_xcomp->dmabuf_fd);
-            cap_xcomp->dmabuf_fd = 0;
-        }
+    if(!cap_xcomp->egl.eglExportDMABUFImageQueryMESA(cap_xcomp->egl.egl_display, img, &cap_xcomp->fourcc, &cap_xcomp->num_planes, &cap_xcomp->modifiers)) {
+        fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: eglExportDMABUFImageQueryMESA failed\n");
+        cap_xcomp->egl.eglDestroyImage(cap_xcomp->egl.egl_display, img);
+        return false;
+    }
 
-        if(!cap_xcomp->created_hw_frame) {
-            cap_xcomp->created_hw_frame = true;
-            av_frame_free(frame);
-            *frame = av_frame_alloc();
-            if(!frame) {
-                fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: failed to allocate frame\n");
-                cap_xcomp->should_stop = true;
-                cap_xcomp->stop_is_error = true;
-                return;
-            }
-            (*frame)->format = video_codec_context->pix_fmt;
-            (*frame)->width = video_codec_context->width;
-            (*frame)->height = video_codec_context->height;
-            (*frame)->color_range = video_codec_context->color_range;
-            (*frame)->color_primaries = video_codec_context->color_primaries;
-            (*frame)->color_trc = video_codec_context->color_trc;
-            (*frame)->colorspace = video_codec_context->colorspace;
-            (*frame)->chroma_location = video_codec_context->chroma_sample_location;
-
-            int res = av_hwframe_get_buffer(video_codec_context->hw_frames_ctx, *frame, 0);
-            if(res < 0) {
-                fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: av_hwframe_get_buffer failed: %d\n", res);
-                cap_xcomp->should_stop = true;
-                cap_xcomp->stop_is_error = true;
-                return;
-            }
-        }
+    if(cap_xcomp->num_planes != 1) {
+        fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: expected 1 plane for drm buf, got %d planes\n", cap_xcomp->num_planes);
+        cap_xcomp->egl.eglDestroyImage(cap_xcomp->egl.egl_display, img);
+        return false;
+    }
 
-        int xx = 0, yy = 0;
-        cap_xcomp->egl.glBindTexture(GL_TEXTURE_2D, window_texture_get_opengl_texture_id(&cap_xcomp->window_texture));
-        cap_xcomp->egl.glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &xx);
-        cap_xcomp->egl.glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &yy);
-        cap_xcomp->egl.glBindTexture(GL_TEXTURE_2D, 0);
+    if(!cap_xcomp->egl.eglExportDMABUFImageMESA(cap_xcomp->egl.egl_display, img, &window->dmabuf_fd, &cap_xcomp->pitch, &cap_xcomp->offset)) {
+        fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: eglExportDMABUFImageMESA failed\n");
+        cap_xcomp->egl.eglDestroyImage(cap_xcomp->egl.egl_display, img);
+        return false;
+    }
 
-        const intptr_t pixmap_attrs[] = {
-            EGL_IMAGE_PRESERVED_KHR, EGL_TRUE,
-            EGL_NONE,
-        };
+    cap_xcomp->egl.eglDestroyImage(cap_xcomp->egl.egl_display, img);
+
+    uintptr_t dmabuf = window->dmabuf_fd;
+
+    VASurfaceAttribExternalBuffers buf = {0};
+    buf.pixel_format = VA_FOURCC_BGRX;
+    buf.width = window_texture_size.x;
+    buf.height = window_texture_size.y;
+    buf.data_size = window_texture_size.y * cap_xcomp->pitch;
+    buf.num_planes = 1;
+    buf.pitches[0] = cap_xcomp->pitch;
+    buf.offsets[0] = cap_xcomp->offset;
+    buf.buffers = &dmabuf;
+    buf.num_buffers = 1;
+    buf.flags = 0;
+    buf.private_data = 0;
+
+    #define VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME        0x20000000
+
+    VASurfaceAttrib attribs[2] = {0};
+    attribs[0].type = VASurfaceAttribMemoryType;
+    attribs[0].flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attribs[0].value.type = VAGenericValueTypeInteger;
+    attribs[0].value.value.i = VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME;
+    attribs[1].type = VASurfaceAttribExternalBufferDescriptor;
+    attribs[1].flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attribs[1].value.type = VAGenericValueTypePointer;
+    attribs[1].value.value.p = &buf;
+
+    VAStatus va_status = vaCreateSurfaces(cap_xcomp->va_dpy, VA_RT_FORMAT_RGB32, window_texture_size.x, window_texture_size.y, &window->input_surface, 1, attribs, 2);
+    if(va_status != VA_STATUS_SUCCESS) {
+        fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: vaCreateSurfaces failed: %d\n", va_status);
+        return false;
+    }
 
-        EGLImage img = cap_xcomp->egl.eglCreateImage(cap_xcomp->egl.egl_display, cap_xcomp->egl.egl_context, EGL_GL_TEXTURE_2D, (EGLClientBuffer)(uint64_t)window_texture_get_opengl_texture_id(&cap_xcomp->window_texture), pixmap_attrs);
-        if(!img) {
-            fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: eglCreateImage failed\n");
-            cap_xcomp->should_stop = true;
-            cap_xcomp->stop_is_error = true;
-            return;
+    return true;
+}
+
+static void gsr_capture_xcomposite_vaapi_tick(gsr_capture *cap, AVCodecContext *video_codec_context, AVFrame **frame) {
+    gsr_capture_xcomposite_vaapi *cap_xcomp = cap->priv;
+
+    // TODO:
+    //cap_xcomp->egl.glClear(GL_COLOR_BUFFER_BIT);
+
+    bool init_new_window = false;
+    while(XPending(cap_xcomp->dpy)) {
+        XNextEvent(cap_xcomp->dpy, &cap_xcomp->xev);
+        for(int i = 0; i < MAX_CACHED_WINDOWS; ++i) {
+            if(cap_xcomp->windows[i].in_use)
+                gsr_window_tracker_process_event(&cap_xcomp->windows[i].window_tracker, &cap_xcomp->xev);
         }
 
-        if(!cap_xcomp->egl.eglExportDMABUFImageQueryMESA(cap_xcomp->egl.egl_display, img, &cap_xcomp->fourcc, &cap_xcomp->num_planes, &cap_xcomp->modifiers)) {
-            fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: eglExportDMABUFImageQueryMESA failed\n");
-            cap_xcomp->should_stop = true;
-            cap_xcomp->stop_is_error = true;
-            cap_xcomp->egl.eglDestroyImage(cap_xcomp->egl.egl_display, img);
-            return;
+        /* Focused window changed */
+        if(cap_xcomp->xev.type == PropertyNotify && cap_xcomp->params.follow_focused && cap_xcomp->xev.xproperty.atom == cap_xcomp->net_active_window_atom)
+            init_new_window = true;
+    }
+
+    /* Window died (when not following focused window), so we stop recording */
+    if(!cap_xcomp->params.follow_focused && cap_xcomp->windows[0].window_tracker.destroyed) {
+        cap_xcomp->should_stop = true;
+        cap_xcomp->stop_is_error = false;
+    }
+
+    if(cap_xcomp->params.follow_focused) {
+        /* Closed windows are removed from the cache. The displayed window is kept until another window is focused */
+        for(int i = 0; i < MAX_CACHED_WINDOWS; ++i) {
+            XcompositeWindow *cached_window = &cap_xcomp->windows[i];
+            if(cached_window->in_use && cached_window->window_tracker.destroyed && cached_window != cap_xcomp->current_window && cached_window != cap_xcomp->displayed_window)
+                xcomposite_window_deinit(cap_xcomp, cached_window);
         }
 
-        if(cap_xcomp->num_planes != 1) {
-            fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: expected 1 plane for drm buf, got %d planes\n", cap_xcomp->num_planes);
-            cap_xcomp->should_stop = true;
-            cap_xcomp->stop_is_error = true;
-            cap_xcomp->egl.eglDestroyImage(cap_xcomp->egl.egl_display, img);
+        if(!cap_xcomp->follow_focused_initialized)
+            init_new_window = true;
+    }
+
+    /* Switching to a window that is in the cache doesn't create anything, the outputs just copy from the surface of that window from now on */
+    if(init_new_window) {
+        cap_xcomp->follow_focused_initialized = true;
+        Window focused_window = get_focused_window(cap_xcomp->dpy, cap_xcomp->net_active_window_atom);
+        if(focused_window && (!cap_xcomp->current_window || focused_window != cap_xcomp->current_window->window))
+            cap_xcomp->current_window = xcomposite_get_cached_window(cap_xcomp, focused_window);
+    }
+
+    XcompositeWindow *window = cap_xcomp->current_window;
+    if(!window)
+        return;
+    window->last_used = ++cap_xcomp->window_use_counter;
+
+    /*
+        A resize only requires a new window pixmap and importing it again. The vaapi config and contexts are kept
+        and the parameters of the copy are updated, so the new size shows up in the video on the next frame.
+    */
+    if(gsr_window_tracker_should_acquire_pixmap(&window->window_tracker)) {
+        /* The encoder and the vaapi pipeline are kept if this fails (the window isn't viewable for example), it's tried again later */
+        if(window_texture_on_resize(&window->window_texture) != 0) {
+            fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: window_texture_on_resize failed\n");
+            gsr_window_tracker_on_pixmap_acquire_failed(&window->window_tracker);
             return;
         }
+        gsr_window_tracker_on_pixmap_acquired(&window->window_tracker);
+        /* The surface was imported from the previous pixmap. It's imported again below, before the outputs copy from it again */
+        xcomposite_destroy_window_surface(cap_xcomp, window);
+    }
+
+    /* The window pixmap hasn't been acquired yet, the outputs keep copying the previously displayed window until then */
+    if(window_texture_get_opengl_texture_id(&window->window_texture) == 0)
+        return;
 
-        if(!cap_xcomp->egl.eglExportDMABUFImageMESA(cap_xcomp->egl.egl_display, img, &cap_xcomp->dmabuf_fd, &cap_xcomp->pitch, &cap_xcomp->offset)) {
-            fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: eglExportDMABUFImageMESA failed\n");
+    bool update_params = window != cap_xcomp->displayed_window;
+
+    if(!cap_xcomp->created_hw_frame) {
+        cap_xcomp->created_hw_frame = true;
+        av_frame_free(frame);
+        *frame = av_frame_alloc();
+        if(!frame) {
+            fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: failed to allocate frame\n");
             cap_xcomp->should_stop = true;
             cap_xcomp->stop_is_error = true;
-            cap_xcomp->egl.eglDestroyImage(cap_xcomp->egl.egl_display, img);
             return;
         }
-
-        cap_xcomp->egl.eglDestroyImage(cap_xcomp->egl.egl_display, img);
-
-        uintptr_t dmabuf = cap_xcomp->dmabuf_fd;
-
-        VASurfaceAttribExternalBuffers buf = {0};
-        buf.pixel_format = VA_FOURCC_BGRX;
-        buf.width = xx;
-        buf.height = yy;
-        buf.data_size = yy * cap_xcomp->pitch;
-        buf.num_planes = 1;
-        buf.pitches[0] = cap_xcomp->pitch;
-        buf.offsets[0] = cap_xcomp->offset;
-        buf.buffers = &dmabuf;
-        buf.num_buffers = 1;
-        buf.flags = 0;
-        buf.private_data = 0;
-
-        #define VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME        0x20000000
-
-        VASurfaceAttrib attribs[2] = {0};
-        attribs[0].type = VASurfaceAttribMemoryType;
-        attribs[0].flags = VA_SURFACE_ATTRIB_SETTABLE;
-        attribs[0].value.type = VAGenericValueTypeInteger;
-        attribs[0].value.value.i = VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME;
-        attribs[1].type = VASurfaceAttribExternalBufferDescriptor;
-        attribs[1].flags = VA_SURFACE_ATTRIB_SETTABLE;
-        attribs[1].value.type = VAGenericValueTypePointer;
-        attribs[1].value.value.p = &buf;
-        
-        VAStatus va_status = vaCreateSurfaces(cap_xcomp->va_dpy, VA_RT_FORMAT_RGB32, xx, yy, &cap_xcomp->input_surface, 1, attribs, 2);
-        if(va_status != VA_STATUS_SUCCESS) {
-            fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: vaCreateSurfaces failed: %d\n", va_status);
+        (*frame)->format = video_codec_context->pix_fmt;
+        (*frame)->width = video_codec_context->width;
+        (*frame)->height = video_codec_context->height;
+        (*frame)->color_range = video_codec_context->color_range;
+        (*frame)->color_primaries = video_codec_context->color_primaries;
+        (*frame)->color_trc = video_codec_context->color_trc;
+        (*frame)->colorspace = video_codec_context->colorspace;
+        (*frame)->chroma_location = video_codec_context->chroma_sample_location;
+
+        int res = av_hwframe_get_buffer(video_codec_context->hw_frames_ctx, *frame, 0);
+        if(res < 0) {
+            fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: av_hwframe_get_buffer failed: %d\n", res);
             cap_xcomp->should_stop = true;
             cap_xcomp->stop_is_error = true;
             return;
         }
+        cap_xcomp->outputs[0].frame = *frame;
 
-        va_status = vaCreateConfig(cap_xcomp->va_dpy, VAProfileNone, VAEntrypointVideoProc, NULL, 0, &cap_xcomp->config_id);
+        VAStatus va_status = vaCreateConfig(cap_xcomp->va_dpy, VAProfileNone, VAEntrypointVideoProc, NULL, 0, &cap_xcomp->config_id);
         if(va_status != VA_STATUS_SUCCESS) {
             fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: vaCreateConfig failed: %d\n", va_status);
             cap_xcomp->should_stop = true;
@@ -450,56 +600,33 @@ static void gsr_capture_xcomposite_vaapi_tick(gsr_capture *cap, AVCodecContext *
             return;
         }
 
-        VASurfaceID target_surface_id = (uintptr_t)(*frame)->data[3];
-        va_status = vaCreateContext(cap_xcomp->va_dpy, cap_xcomp->config_id, xx, yy, VA_PROGRESSIVE, &target_surface_id, 1, &cap_xcomp->context_id);
-        if(va_status != VA_STATUS_SUCCESS) {
-            fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: vaCreateContext failed: %d\n", va_status);
-            cap_xcomp->should_stop = true;
-            cap_xcomp->stop_is_error = true;
-            return;
+        for(int i = 0; i < cap_xcomp->num_outputs; ++i) {
+            if(!xcomposite_output_create_context(cap_xcomp, &cap_xcomp->outputs[i])) {
+                cap_xcomp->should_stop = true;
+                cap_xcomp->stop_is_error = true;
+                return;
+            }
         }
+    }
 
-        cap_xcomp->output_region = (VARectangle){
-            .x = 0,
-            .y = 0,
-            .width = xx,
-            .height = yy
-        };
-
-        // Copying a surface to another surface will automatically perform the color conversion. Thanks vaapi!
-        VAProcPipelineParameterBuffer params = {0};
-        params.surface = cap_xcomp->input_surface;
-        params.surface_region = NULL;
-        params.output_region = &cap_xcomp->output_region;
-        params.output_background_color = 0;
-        params.filter_flags = VA_FRAME_PICTURE;
-
-        params.input_color_properties.colour_primaries = 1;
-        params.input_color_properties.transfer_characteristics = 1;
-        params.input_color_properties.matrix_coefficients = 1;
-        params.surface_color_standard = VAProcColorStandardBT709;
-        params.input_color_properties.color_range = (*frame)->color_range == AVCOL_RANGE_JPEG ? VA_SOURCE_RANGE_FULL : VA_SOURCE_RANGE_REDUCED;
-
-        params.output_color_properties.colour_primaries = 1;
-        params.output_color_properties.transfer_characteristics = 1;
-        params.output_color_properties.matrix_coefficients = 1;
-        params.output_color_standard = VAProcColorStandardBT709;
-        params.output_color_properties.color_range = (*frame)->color_range == AVCOL_RANGE_JPEG ? VA_SOURCE_RANGE_FULL : VA_SOURCE_RANGE_REDUCED;
-
-        params.processing_mode = VAProcPerformanceMode;
-
-        va_status = vaCreateBuffer(cap_xcomp->va_dpy, cap_xcomp->context_id, VAProcPipelineParameterBufferType, sizeof(params), 1, &params, &cap_xcomp->buffer_id);
-        if(va_status != VA_STATUS_SUCCESS) {
-            fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_tick: vaCreateBuffer failed: %d\n", va_status);
+    if(!window->input_surface) {
+        if(!xcomposite_import_window_surface(cap_xcomp, window)) {
             cap_xcomp->should_stop = true;
             cap_xcomp->stop_is_error = true;
             return;
         }
+        update_params = true;
+    }
 
-        // Clear texture with black background because the source texture (window_texture_get_opengl_texture_id(&cap_xcomp->window_texture))
-        // might be smaller than cap_xcomp->target_texture_id
-        // TODO:
-        //cap_xcomp->egl.glClearTexImage(cap_xcomp->target_texture_id, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    if(update_params) {
+        for(int i = 0; i < cap_xcomp->num_outputs; ++i) {
+            if(!xcomposite_output_update_params(cap_xcomp, &cap_xcomp->outputs[i], window)) {
+                cap_xcomp->should_stop = true;
+                cap_xcomp->stop_is_error = true;
+                return;
+            }
+        }
+        cap_xcomp->displayed_window = window;
     }
 }
 
@@ -516,12 +643,10 @@ static bool gsr_capture_xcomposite_vaapi_should_stop(gsr_capture *cap, bool *err
     return false;
 }
 
-static int gsr_capture_xcomposite_vaapi_capture(gsr_capture *cap, AVFrame *frame) {
-    gsr_capture_xcomposite_vaapi *cap_xcomp = cap->priv;
-
+static int xcomposite_output_copy(gsr_capture_xcomposite_vaapi *cap_xcomp, XcompositeOutput *output, AVFrame *frame) {
     VASurfaceID target_surface_id = (uintptr_t)frame->data[3];
 
-    VAStatus va_status = vaBeginPicture(cap_xcomp->va_dpy, cap_xcomp->context_id, target_surface_id);
+    VAStatus va_status = vaBeginPicture(cap_xcomp->va_dpy, output->context_id, target_surface_id);
     if(va_status != VA_STATUS_SUCCESS) {
         static bool error_printed = false;
         if(!error_printed) {
@@ -531,9 +656,9 @@ static int gsr_capture_xcomposite_vaapi_capture(gsr_capture *cap, AVFrame *frame
         return -1;
     }
 
-    va_status = vaRenderPicture(cap_xcomp->va_dpy, cap_xcomp->context_id, &cap_xcomp->buffer_id, 1);
+    va_status = vaRenderPicture(cap_xcomp->va_dpy, output->context_id, &output->buffer_id, 1);
     if(va_status != VA_STATUS_SUCCESS) {
-        vaEndPicture(cap_xcomp->va_dpy, cap_xcomp->context_id);
+        vaEndPicture(cap_xcomp->va_dpy, output->context_id);
         static bool error_printed = false;
         if(!error_printed) {
             error_printed = true;
@@ -542,7 +667,7 @@ static int gsr_capture_xcomposite_vaapi_capture(gsr_capture *cap, AVFrame *frame
         return -1;
     }
 
-    va_status = vaEndPicture(cap_xcomp->va_dpy, cap_xcomp->context_id);
+    va_status = vaEndPicture(cap_xcomp->va_dpy, output->context_id);
     if(va_status != VA_STATUS_SUCCESS) {
         static bool error_printed = false;
         if(!error_printed) {
@@ -555,41 +680,118 @@ static int gsr_capture_xcomposite_vaapi_capture(gsr_capture *cap, AVFrame *frame
     // TODO: Needed?
     //vaSyncSurface(cap_xcomp->va_dpy, target_surface_id);
 
+    return 0;
+}
+
+static int gsr_capture_xcomposite_vaapi_capture(gsr_capture *cap, AVFrame *frame) {
+    gsr_capture_xcomposite_vaapi *cap_xcomp = cap->priv;
+
+    /* The window surface is imported once and copied to all outputs */
+    int res = 0;
+    for(int i = 0; i < cap_xcomp->num_outputs; ++i) {
+        XcompositeOutput *output = &cap_xcomp->outputs[i];
+        if(!output->context_id)
+            continue;
+
+        if(xcomposite_output_copy(cap_xcomp, output, i == 0 ? frame : output->frame) != 0)
+            res = -1;
+    }
+
     // TODO: Remove
     //cap_xcomp->egl.eglSwapBuffers(cap_xcomp->egl.egl_display, cap_xcomp->egl.egl_surface);
 
+    return res;
+}
+
+static int gsr_capture_xcomposite_vaapi_add_output(gsr_capture *cap, AVCodecContext *video_codec_context, vec2i output_resolution, AVFrame **frame) {
+    gsr_capture_xcomposite_vaapi *cap_xcomp = cap->priv;
+    *frame = NULL;
+
+    if(cap_xcomp->params.follow_focused) {
+        fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_add_output: multiple outputs are not supported when following the focused window\n");
+        return -1;
+    }
+
+    if(cap_xcomp->created_hw_frame) {
+        fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_add_output: outputs have to be added before the capture is ticked\n");
+        return -1;
+    }
+
+    if(cap_xcomp->num_outputs == MAX_OUTPUTS) {
+        fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_add_output: reached max outputs (%d)\n", MAX_OUTPUTS);
+        return -1;
+    }
+
+    XcompositeOutput *output = &cap_xcomp->outputs[cap_xcomp->num_outputs];
+    output->video_codec_context = video_codec_context;
+    output->output_resolution = output_resolution;
+
+    vec2i output_size = cap_xcomp->texture_size;
+    if(output_resolution.x > 0 && output_resolution.y > 0)
+        output_size = scale_keep_aspect_ratio(cap_xcomp->texture_size, output_resolution);
+
+    video_codec_context->width = max_int(2, output_size.x & ~1);
+    video_codec_context->height = max_int(2, output_size.y & ~1);
+
+    /* The surfaces of all outputs are on the same device as the main output */
+    if(!drm_create_codec_context(cap_xcomp, video_codec_context, cap_xcomp->outputs[0].video_codec_context->hw_device_ctx))
+        return -1;
+
+    ++cap_xcomp->num_outputs;
+
+    output->frame = av_frame_alloc();
+    if(!output->frame) {
+        fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_add_output: failed to allocate frame\n");
+        return -1;
+    }
+    output->frame->format = video_codec_context->pix_fmt;
+    output->frame->width = video_codec_context->width;
+    output->frame->height = video_codec_context->height;
+    output->frame->color_range = video_codec_context->color_range;
+    output->frame->color_primaries = video_codec_context->color_primaries;
+    output->frame->color_trc = video_codec_context->color_trc;
+    output->frame->colorspace = video_codec_context->colorspace;
+    output->frame->chroma_location = video_codec_context->chroma_sample_location;
+
+    int res = av_hwframe_get_buffer(video_codec_context->hw_frames_ctx, output->frame, 0);
+    if(res < 0) {
+        fprintf(stderr, "gsr error: gsr_capture_xcomposite_vaapi_add_output: av_hwframe_get_buffer failed: %d\n", res);
+        return -1;
+    }
+
+    *frame = output->frame;
     return 0;
 }
 
 static void gsr_capture_xcomposite_vaapi_stop(gsr_capture *cap, AVCodecContext *video_codec_context) {
     gsr_capture_xcomposite_vaapi *cap_xcomp = cap->priv;
 
-    if(cap_xcomp->buffer_id) {
-        vaDestroyBuffer(cap_xcomp->va_dpy, cap_xcomp->buffer_id);
-        cap_xcomp->buffer_id = 0;
-    }
+    for(int i = 0; i < cap_xcomp->num_outputs; ++i) {
+        XcompositeOutput *output = &cap_xcomp->outputs[i];
+        xcomposite_output_destroy_pipeline(cap_xcomp, output);
+
+        /* The main output is cleaned up below, the frame of the main output is owned by the caller */
+        if(i == 0)
+            continue;
 
-    if(cap_xcomp->context_id) {
-        vaDestroyContext(cap_xcomp->va_dpy, cap_xcomp->context_id);
-        cap_xcomp->context_id = 0;
+        av_frame_free(&output->frame);
+        if(output->video_codec_context->hw_device_ctx)
+            av_buffer_unref(&output->video_codec_context->hw_device_ctx);
+        if(output->video_codec_context->hw_frames_ctx)
+            av_buffer_unref(&output->video_codec_context->hw_frames_ctx);
     }
+    cap_xcomp->num_outputs = 0;
 
     if(cap_xcomp->config_id) {
         vaDestroyConfig(cap_xcomp->va_dpy, cap_xcomp->config_id);
         cap_xcomp->config_id = 0;
     }
 
-    if(cap_xcomp->input_surface) {
-        vaDestroySurfaces(cap_xcomp->va_dpy, &cap_xcomp->input_surface, 1);
-        cap_xcomp->input_surface = 0;
+    for(int i = 0; i < MAX_CACHED_WINDOWS; ++i) {
+        xcomposite_window_deinit(cap_xcomp, &cap_xcomp->windows[i]);
     }
-
-    if(cap_xcomp->dmabuf_fd) {
-        close(cap_xcomp->dmabuf_fd);
-        cap_xcomp->dmabuf_fd = 0;
-    }
-
-    window_texture_deinit(&cap_xcomp->window_texture);
+    cap_xcomp->current_window = NULL;
+    cap_xcomp->displayed_window = NULL;
 
     if(video_codec_context->hw_device_ctx)
         av_buffer_unref(&video_codec_context->hw_device_ctx);
@@ -646,6 +848,7 @@ gsr_capture* gsr_capture_xcomposite_vaapi_create(const gsr_capture_xcomposite_va
         .tick = gsr_capture_xcomposite_vaapi_tick,
         .should_stop = gsr_capture_xcomposite_vaapi_should_stop,
         .capture = gsr_capture_xcomposite_vaapi_capture,
+        .add_output = gsr_capture_xcomposite_vaapi_add_output,
         .destroy = gsr_capture_xcomposite_vaapi_destroy,
         .priv = cap_xcomp
     };
@@ -1,122 +1,158 @@
 #include "../include/color_conversion.h"
+#include "../include/color_conversion_quad.h"
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
 #include <assert.h>
 
-#define MAX_SHADERS 2
-#define MAX_FRAMEBUFFERS 2
+#define MAX_SHADERS 3
+#define MAX_FRAMEBUFFERS 3
 
-static float abs_f(float v) {
-    return v >= 0.0f ? v : -v;
+static float max_f(float a, float b) {
+    return a > b ? a : b;
 }
 
-#define ROTATE_Z   "mat4 rotate_z(in float angle) {\n"                        \
-                   "    return mat4(cos(angle), -sin(angle), 0.0, 0.0,\n"     \
-                   "                sin(angle),  cos(angle), 0.0, 0.0,\n"     \
-                   "                0.0,           0.0,      1.0, 0.0,\n"     \
-                   "                0.0,           0.0,      0.0, 1.0);\n"    \
-                   "}\n"
-
 #define RGB_TO_YUV "const mat4 RGBtoYUV = mat4(0.257,  0.439, -0.148, 0.0,\n" \
                    "                           0.504, -0.368, -0.291, 0.0,\n" \
                    "                           0.098, -0.071,  0.439, 0.0,\n" \
                    "                           0.0625, 0.500,  0.500, 1.0);"
 
-static int load_shader_y(gsr_shader *shader, gsr_egl *egl, int *rotation_uniform) {
-    char vertex_shader[2048];
-    snprintf(vertex_shader, sizeof(vertex_shader),
-        "#version 300 es                                   \n"
-        "in vec2 pos;                                      \n"
-        "in vec2 texcoords;                                \n"
-        "out vec2 texcoords_out;                           \n"
-        "uniform float rotation;                           \n"
-        ROTATE_Z
-        "void main()                                       \n"
-        "{                                                 \n"
-        "  texcoords_out = texcoords;                      \n"
-        "  gl_Position = vec4(pos.x, pos.y, 0.0, 1.0) * rotate_z(rotation);    \n"
-        "}                                                 \n");
-
-    char fragment_shader[] =
-        "#version 300 es                                                                 \n"
-        "precision mediump float;                                                        \n"
-        "in vec2 texcoords_out;                                                          \n"
-        "uniform sampler2D tex1;                                                         \n"
-        "out vec4 FragColor;                                                             \n"
-        RGB_TO_YUV
-        "void main()                                                                     \n"
-        "{                                                                               \n"
-        "  vec4 pixel = texture(tex1, texcoords_out);                                    \n"
-        "  FragColor.x = (RGBtoYUV * vec4(pixel.rgb, 1.0)).x;                            \n"
-        "  FragColor.w = pixel.a;                                                        \n"
-        "}                                                                               \n";
-
-    if(gsr_shader_init(shader, egl, vertex_shader, fragment_shader) != 0)
-        return -1;
-
-    gsr_shader_bind_attribute_location(shader, "pos", 0);
-    gsr_shader_bind_attribute_location(shader, "texcoords", 1);
-    *rotation_uniform = egl->glGetUniformLocation(shader->program_id, "rotation");
-    return 0;
+#define SAMPLE_BILINEAR "vec4 sample_texture(vec2 uv) {\n"                     \
+                        "  return texture(tex1, uv);\n"                        \
+                        "}\n"
+
+/* Catmull-Rom */
+#define KERNEL_BICUBIC "float kernel(float x) {\n"                                      \
+                       "  x = abs(x);\n"                                                \
+                       "  if(x < 1.0) return (1.5 * x - 2.5) * x * x + 1.0;\n"          \
+                       "  if(x < 2.0) return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;\n" \
+                       "  return 0.0;\n"                                                \
+                       "}\n"
+
+#define KERNEL_LANCZOS "const float PI = 3.14159265359;\n"                       \
+                       "float kernel(float x) {\n"                               \
+                       "  x = abs(x);\n"                                         \
+                       "  if(x < 0.00001) return 1.0;\n"                         \
+                       "  if(x >= 3.0) return 0.0;\n"                            \
+                       "  float px = PI * x;\n"                                  \
+                       "  return 3.0 * sin(px) * sin(px / 3.0) / (px * px);\n"   \
+                       "}\n"
+
+/*
+    Separable kernel with |radius| taps on each side. When downscaling the kernel is stretched by |kernel_scale|
+    and the linear texture sampler averages the texels between the taps.
+*/
+#define SAMPLE_KERNEL(radius) "vec4 sample_texture(vec2 uv) {\n"                                                 \
+                              "  vec2 step_size = texel_size * kernel_scale;\n"                                  \
+                              "  vec2 pos = uv / step_size - 0.5;\n"                                             \
+                              "  vec2 base = floor(pos);\n"                                                      \
+                              "  vec2 f = pos - base;\n"                                                         \
+                              "  vec4 sum = vec4(0.0);\n"                                                        \
+                              "  float weight_sum = 0.0;\n"                                                      \
+                              "  for(int y = 1 - " radius "; y <= " radius "; ++y) {\n"                          \
+                              "    float weight_y = kernel(float(y) - f.y);\n"                                   \
+                              "    for(int x = 1 - " radius "; x <= " radius "; ++x) {\n"                        \
+                              "      float weight = kernel(float(x) - f.x) * weight_y;\n"                        \
+                              "      sum += texture(tex1, (base + vec2(float(x), float(y)) + 0.5) * step_size) * weight;\n" \
+                              "      weight_sum += weight;\n"                                                    \
+                              "    }\n"                                                                          \
+                              "  }\n"                                                                            \
+                              "  return clamp(sum / weight_sum, 0.0, 1.0);\n"                                    \
+                              "}\n"
+
+static const char* scale_filter_get_sample_function(gsr_scale_filter scale_filter) {
+    switch(scale_filter) {
+        case GSR_SCALE_FILTER_BILINEAR: return SAMPLE_BILINEAR;
+        case GSR_SCALE_FILTER_BICUBIC:  return KERNEL_BICUBIC SAMPLE_KERNEL("2");
+        case GSR_SCALE_FILTER_LANCZOS:  return KERNEL_LANCZOS SAMPLE_KERNEL("3");
+    }
+    assert(false);
+    return SAMPLE_BILINEAR;
 }
 
-static unsigned int load_shader_uv(gsr_shader *shader, gsr_egl *egl, int *rotation_uniform) {
+/*
+    |half_size| should be set for planes that are half the size of the Y plane (UV in NV12).
+    |yuv_components| are the components of the RGBtoYUV output that are written to |output_components|.
+    RGBtoYUV outputs Y in x, V in y and U in z.
+*/
+static int load_shader(gsr_shader *shader, gsr_egl *egl, gsr_color_uniforms *uniforms, bool half_size, const char *output_components, const char *yuv_components, gsr_scale_filter scale_filter) {
     char vertex_shader[2048];
     snprintf(vertex_shader, sizeof(vertex_shader),
         "#version 300 es                                 \n"
         "in vec2 pos;                                    \n"
         "in vec2 texcoords;                              \n"
         "out vec2 texcoords_out;                         \n"
-        "uniform float rotation;                         \n"
-        ROTATE_Z
         "void main()                                     \n"
         "{                                               \n"
         "  texcoords_out = texcoords;                    \n"
-        "  gl_Position = vec4(pos.x, pos.y, 0.0, 1.0) * rotate_z(rotation) * vec4(0.5, 0.5, 1.0, 1.0) - vec4(0.5, 0.5, 0.0, 0.0);   \n"
-        "}                                               \n");
-
-    char fragment_shader[] =
+        "  gl_Position = %s;                             \n"
+        "}                                               \n",
+        half_size
+            ? "vec4(pos.x, pos.y, 0.0, 1.0) * vec4(0.5, 0.5, 1.0, 1.0) - vec4(0.5, 0.5, 0.0, 0.0)"
+            : "vec4(pos.x, pos.y, 0.0, 1.0)");
+
+    char fragment_shader[4096];
+    snprintf(fragment_shader, sizeof(fragment_shader),
         "#version 300 es                                                                       \n"
-        "precision mediump float;                                                              \n"
+        "precision highp float;                                                                \n"
         "in vec2 texcoords_out;                                                                \n"
         "uniform sampler2D tex1;                                                               \n"
+        "uniform vec2 texel_size;                                                              \n"
+        "uniform vec2 kernel_scale;                                                            \n"
         "out vec4 FragColor;                                                                   \n"
         RGB_TO_YUV
+        "%s"
         "void main()                                                                           \n"
         "{                                                                                     \n"
-        "  vec4 pixel = texture(tex1, texcoords_out);                                          \n"
-        "  FragColor.xy = (RGBtoYUV * vec4(pixel.rgb, 1.0)).zy;                                \n"
+        "  vec4 pixel = sample_texture(texcoords_out);                                         \n"
+        "  FragColor.%s = (RGBtoYUV * vec4(pixel.rgb, 1.0)).%s;                                \n"
         "  FragColor.w = pixel.a;                                                              \n"
-        "}                                                                                     \n";
+        "}                                                                                     \n",
+        scale_filter_get_sample_function(scale_filter), output_components, yuv_components);
 
     if(gsr_shader_init(shader, egl, vertex_shader, fragment_shader) != 0)
         return -1;
 
     gsr_shader_bind_attribute_location(shader, "pos", 0);
     gsr_shader_bind_attribute_location(shader, "texcoords", 1);
-    *rotation_uniform = egl->glGetUniformLocation(shader->program_id, "rotation");
+    uniforms->texel_size = egl->glGetUniformLocation(shader->program_id, "texel_size");
+    uniforms->kernel_scale = egl->glGetUniformLocation(shader->program_id, "kernel_scale");
+    return 0;
+}
+
+/* Loads the shader for the plane at |index|, and the scale shader for it if the scale filter is not bilinear */
+static int load_plane_shaders(gsr_color_conversion *self, int index, bool half_size, const char *output_components, const char *yuv_components, const char *plane_name) {
+    if(load_shader(&self->shaders[index], self->params.egl, &self->uniforms[index], half_size, output_components, yuv_components, GSR_SCALE_FILTER_BILINEAR) != 0) {
+        fprintf(stderr, "gsr error: gsr_color_conversion_init: failed to load %s shader\n", plane_name);
+        return -1;
+    }
+
+    if(self->params.scale_filter != GSR_SCALE_FILTER_BILINEAR) {
+        if(load_shader(&self->scale_shaders[index], self->params.egl, &self->scale_uniforms[index], half_size, output_components, yuv_components, self->params.scale_filter) != 0) {
+            fprintf(stderr, "gsr error: gsr_color_conversion_init: failed to load %s scale shader\n", plane_name);
+            return -1;
+        }
+    }
+
     return 0;
 }
 
 static int loader_framebuffers(gsr_color_conversion *self) {
+    const char *nv12_plane_names[] = { "Y", "UV" };
+    const char *yuv444_plane_names[] = { "Y", "U", "V" };
+    const char **plane_names = self->params.destination_color == GSR_DESTINATION_COLOR_YUV444 ? yuv444_plane_names : nv12_plane_names;
+
     const unsigned int draw_buffer = GL_COLOR_ATTACHMENT0;
     self->params.egl->glGenFramebuffers(MAX_FRAMEBUFFERS, self->framebuffers);
 
-    self->params.egl->glBindFramebuffer(GL_FRAMEBUFFER, self->framebuffers[0]);
-    self->params.egl->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, self->params.destination_textures[0], 0);
-    self->params.egl->glDrawBuffers(1, &draw_buffer);
-    if(self->params.egl->glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-        fprintf(stderr, "gsr error: gsr_color_conversion_init: failed to create framebuffer for Y\n");
-        goto err;
-    }
-
-    self->params.egl->glBindFramebuffer(GL_FRAMEBUFFER, self->framebuffers[1]);
-    self->params.egl->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, self->params.destination_textures[1], 0);
-    self->params.egl->glDrawBuffers(1, &draw_buffer);
-    if(self->params.egl->glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-        fprintf(stderr, "gsr error: gsr_color_conversion_init: failed to create framebuffer for UV\n");
-        goto err;
+    for(int i = 0; i < self->params.num_destination_textures; ++i) {
+        self->params.egl->glBindFramebuffer(GL_FRAMEBUFFER, self->framebuffers[i]);
+        self->params.egl->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, self->params.destination_textures[i], 0);
+        self->params.egl->glDrawBuffers(1, &draw_buffer);
+        if(self->params.egl->glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            fprintf(stderr, "gsr error: gsr_color_conversion_init: failed to create framebuffer for %s\n", plane_names[i]);
+            goto err;
+        }
     }
 
     self->params.egl->glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -152,19 +188,36 @@ int gsr_color_conversion_init(gsr_color_conversion *self, const gsr_color_conver
     self->params.egl = params->egl;
     self->params = *params;
 
-    if(self->params.num_destination_textures != 2) {
-        fprintf(stderr, "gsr error: gsr_color_conversion_init: expected 2 destination textures for destination color NV12, got %d destination texture(s)\n", self->params.num_destination_textures);
-        return -1;
-    }
-
-    if(load_shader_y(&self->shaders[0], self->params.egl, &self->rotation_uniforms[0]) != 0) {
-        fprintf(stderr, "gsr error: gsr_color_conversion_init: failed to load Y shader\n");
-        goto err;
-    }
-
-    if(load_shader_uv(&self->shaders[1], self->params.egl, &self->rotation_uniforms[1]) != 0) {
-        fprintf(stderr, "gsr error: gsr_color_conversion_init: failed to load UV shader\n");
-        goto err;
+    switch(self->params.destination_color) {
+        case GSR_DESTINATION_COLOR_NV12: {
+            if(self->params.num_destination_textures != 2) {
+                fprintf(stderr, "gsr error: gsr_color_conversion_init: expected 2 destination textures for destination color NV12, got %d destination texture(s)\n", self->params.num_destination_textures);
+                return -1;
+            }
+
+            if(load_plane_shaders(self, 0, false, "x", "x", "Y") != 0)
+                goto err;
+
+            if(load_plane_shaders(self, 1, true, "xy", "zy", "UV") != 0)
+                goto err;
+            break;
+        }
+        case GSR_DESTINATION_COLOR_YUV444: {
+            if(self->params.num_destination_textures != 3) {
+                fprintf(stderr, "gsr error: gsr_color_conversion_init: expected 3 destination textures for destination color YUV444, got %d destination texture(s)\n", self->params.num_destination_textures);
+                return -1;
+            }
+
+            if(load_plane_shaders(self, 0, false, "x", "x", "Y") != 0)
+                goto err;
+
+            if(load_plane_shaders(self, 1, false, "x", "z", "U") != 0)
+                goto err;
+
+            if(load_plane_shaders(self, 2, false, "x", "y", "V") != 0)
+                goto err;
+            break;
+        }
     }
 
     if(loader_framebuffers(self) != 0)
@@ -202,13 +255,33 @@ void gsr_color_conversion_deinit(gsr_color_conversion *self) {
 
     for(int i = 0; i < MAX_SHADERS; ++i) {
         gsr_shader_deinit(&self->shaders[i]);
+        gsr_shader_deinit(&self->scale_shaders[i]);
     }
 
     self->params.egl = NULL;
 }
 
+void gsr_color_conversion_clear(gsr_color_conversion *self) {
+    /* Black in limited range yuv */
+    const float y_black = 0.0625f;
+    const float chroma_black = 0.5f;
+
+    for(int i = 0; i < self->params.num_destination_textures; ++i) {
+        self->params.egl->glBindFramebuffer(GL_FRAMEBUFFER, self->framebuffers[i]);
+        if(i == 0)
+            self->params.egl->glClearColor(y_black, 0.0f, 0.0f, 1.0f);
+        else
+            self->params.egl->glClearColor(chroma_black, chroma_black, 0.0f, 1.0f);
+        self->params.egl->glClear(GL_COLOR_BUFFER_BIT);
+    }
+
+    self->params.egl->glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    self->params.egl->glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
 /* |source_pos| is in pixel coordinates and |source_size|  */
-int gsr_color_conversion_draw(gsr_color_conversion *self, unsigned int texture_id, vec2i source_pos, vec2i source_size, vec2i texture_pos, vec2i texture_size, float rotation) {
+/* The texture is scaled with |params.scale_filter| if |source_size| is different from |texture_size| */
+static int gsr_color_conversion_draw_with_filter(gsr_color_conversion *self, unsigned int texture_id, vec2i source_pos, vec2i source_size, vec2i texture_pos, vec2i texture_size, float rotation, bool allow_scale_filter) {
     /* TODO: Do not call this every frame? */
     vec2i dest_texture_size = {0, 0};
     self->params.egl->glBindTexture(GL_TEXTURE_2D, self->params.destination_textures[0]);
@@ -221,41 +294,25 @@ int gsr_color_conversion_draw(gsr_color_conversion *self, unsigned int texture_i
     self->params.egl->glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &source_texture_size.x);
     self->params.egl->glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &source_texture_size.y);
 
-    if(abs_f(M_PI * 0.5f - rotation) <= 0.001f || abs_f(M_PI * 1.5f - rotation) <= 0.001f) {
-        float tmp = source_texture_size.x;
-        source_texture_size.x = source_texture_size.y;
-        source_texture_size.y = tmp;
-    }
-
-    const vec2f pos_norm = {
-        ((float)source_pos.x / (dest_texture_size.x == 0 ? 1.0f : (float)dest_texture_size.x)) * 2.0f,
-        ((float)source_pos.y / (dest_texture_size.y == 0 ? 1.0f : (float)dest_texture_size.y)) * 2.0f,
+    const vec2f texel_size = {
+        1.0f / (source_texture_size.x == 0 ? 1.0f : (float)source_texture_size.x),
+        1.0f / (source_texture_size.y == 0 ? 1.0f : (float)source_texture_size.y)
     };
 
-    const vec2f size_norm = {
-        ((float)source_size.x / (dest_texture_size.x == 0 ? 1.0f : (float)dest_texture_size.x)) * 2.0f,
-        ((float)source_size.y / (dest_texture_size.y == 0 ? 1.0f : (float)dest_texture_size.y)) * 2.0f,
+    /* |texture_size| and |source_size| are in the rotated orientation, the kernel of the scale shader works along the axes of the texture */
+    const bool scaled = source_size.x != texture_size.x || source_size.y != texture_size.y;
+    const bool use_scale_shaders = scaled && allow_scale_filter && self->params.scale_filter != GSR_SCALE_FILTER_BILINEAR;
+    /* Stretch the kernel when downscaling so that all source texels are taken into account */
+    vec2f kernel_scale = {
+        max_f(1.0f, (float)texture_size.x / (source_size.x == 0 ? 1.0f : (float)source_size.x)),
+        max_f(1.0f, (float)texture_size.y / (source_size.y == 0 ? 1.0f : (float)source_size.y))
     };
+    if(gsr_rotation_is_sideways(rotation))
+        kernel_scale = (vec2f){ kernel_scale.y, kernel_scale.x };
 
-    const vec2f texture_pos_norm = {
-        (float)texture_pos.x / (source_texture_size.x == 0 ? 1.0f : (float)source_texture_size.x),
-        (float)texture_pos.y / (source_texture_size.y == 0 ? 1.0f : (float)source_texture_size.y),
-    };
-
-    const vec2f texture_size_norm = {
-        (float)texture_size.x / (source_texture_size.x == 0 ? 1.0f : (float)source_texture_size.x),
-        (float)texture_size.y / (source_texture_size.y == 0 ? 1.0f : (float)source_texture_size.y),
-    };
-
-    const float vertices[] = {
-        -1.0f + pos_norm.x,               -1.0f + pos_norm.y + size_norm.y, texture_pos_norm.x,                       texture_pos_norm.y + texture_size_norm.y,
-        -1.0f + pos_norm.x,               -1.0f + pos_norm.y,               texture_pos_norm.x,                       texture_pos_norm.y,
-        -1.0f + pos_norm.x + size_norm.x, -1.0f + pos_norm.y,               texture_pos_norm.x + texture_size_norm.x, texture_pos_norm.y,
-
-        -1.0f + pos_norm.x,               -1.0f + pos_norm.y + size_norm.y, texture_pos_norm.x,                       texture_pos_norm.y + texture_size_norm.y,
-        -1.0f + pos_norm.x + size_norm.x, -1.0f + pos_norm.y,               texture_pos_norm.x + texture_size_norm.x, texture_pos_norm.y,
-        -1.0f + pos_norm.x + size_norm.x, -1.0f + pos_norm.y + size_norm.y, texture_pos_norm.x + texture_size_norm.x, texture_pos_norm.y + texture_size_norm.y
-    };
+    /* The quad is rotated around its own center, so a rotated monitor that is drawn next to other monitors stays in its own area */
+    float vertices[GSR_QUAD_NUM_VERTEX_FLOATS];
+    gsr_color_conversion_quad_get_vertices(vertices, dest_texture_size, source_pos, source_size, source_texture_size, texture_pos, texture_size, rotation);
 
     self->params.egl->glBindVertexArray(self->vertex_array_object_id);
     self->params.egl->glViewport(0, 0, dest_texture_size.x, dest_texture_size.y);
@@ -263,23 +320,21 @@ int gsr_color_conversion_draw(gsr_color_conversion *self, unsigned int texture_i
 
     /* TODO: this, also cleanup */
     //self->params.egl->glBindBuffer(GL_ARRAY_BUFFER, self->vertex_buffer_object_id);
-    self->params.egl->glBufferSubData(GL_ARRAY_BUFFER, 0, 24 * sizeof(float), vertices);
+    self->params.egl->glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
 
-    {
-        self->params.egl->glBindFramebuffer(GL_FRAMEBUFFER, self->framebuffers[0]);
-        //cap_xcomp->egl.glClear(GL_COLOR_BUFFER_BIT); // TODO: Do this in a separate clear_ function. We want to do that when using multiple drm to create the final image (multiple monitors for example)
+    for(int i = 0; i < self->params.num_destination_textures; ++i) {
+        self->params.egl->glBindFramebuffer(GL_FRAMEBUFFER, self->framebuffers[i]);
 
-        gsr_shader_use(&self->shaders[0]);
-        self->params.egl->glUniform1f(self->rotation_uniforms[0], rotation);
-        self->params.egl->glDrawArrays(GL_TRIANGLES, 0, 6);
-    }
+        gsr_shader *shader = use_scale_shaders ? &self->scale_shaders[i] : &self->shaders[i];
+        const gsr_color_uniforms *uniforms = use_scale_shaders ? &self->scale_uniforms[i] : &self->uniforms[i];
+        /* The UV plane of NV12 is half the size so the kernel covers twice as many source texels */
+        const float plane_scale = (self->params.destination_color == GSR_DESTINATION_COLOR_NV12 && i == 1) ? 2.0f : 1.0f;
 
-    {
-        self->params.egl->glBindFramebuffer(GL_FRAMEBUFFER, self->framebuffers[1]);
-        //cap_xcomp->egl.glClear(GL_COLOR_BUFFER_BIT);
-
-        gsr_shader_use(&self->shaders[1]);
-        self->params.egl->glUniform1f(self->rotation_uniforms[1], rotation);
+        gsr_shader_use(shader);
+        if(use_scale_shaders) {
+            self->params.egl->glUniform2f(uniforms->texel_size, texel_size.x, texel_size.y);
+            self->params.egl->glUniform2f(uniforms->kernel_scale, kernel_scale.x * plane_scale, kernel_scale.y * plane_scale);
+        }
         self->params.egl->glDrawArrays(GL_TRIANGLES, 0, 6);
     }
 
@@ -289,3 +344,11 @@ int gsr_color_conversion_draw(gsr_color_conversion *self, unsigned int texture_i
     self->params.egl->glBindFramebuffer(GL_FRAMEBUFFER, 0);
     return 0;
 }
+
+int gsr_color_conversion_draw(gsr_color_conversion *self, unsigned int texture_id, vec2i source_pos, vec2i source_size, vec2i texture_pos, vec2i texture_size, float rotation) {
+    return gsr_color_conversion_draw_with_filter(self, texture_id, source_pos, source_size, texture_pos, texture_size, rotation, true);
+}
+
+int gsr_color_conversion_draw_bilinear(gsr_color_conversion *self, unsigned int texture_id, vec2i source_pos, vec2i source_size, vec2i texture_pos, vec2i texture_size, float rotation) {
+    return gsr_color_conversion_draw_with_filter(self, texture_id, source_pos, source_size, texture_pos, texture_size, rotation, false);
+}
@@ -0,0 +1,59 @@
+#include "../include/color_conversion_quad.h"
+#include <math.h>
+
+/* Number of 90 degree counter clockwise turns in |rotation|, between 0 and 3 */
+static int rotation_to_quarter_turns(float rotation) {
+    return (int)lroundf(rotation / (float)(M_PI * 0.5)) & 3;
+}
+
+bool gsr_rotation_is_sideways(float rotation) {
+    return rotation_to_quarter_turns(rotation) % 2 == 1;
+}
+
+static float safe_div(float a, int b) {
+    return a / (b == 0 ? 1.0f : (float)b);
+}
+
+/* Rotates the texture coordinate |uv| clockwise around the center of the texture, which takes a point of the rotated image back to the texture */
+static vec2f unrotate_texcoord(vec2f uv, int quarter_turns) {
+    for(int i = 0; i < quarter_turns; ++i) {
+        const vec2f centered = { uv.x - 0.5f, uv.y - 0.5f };
+        uv = (vec2f){ 0.5f + centered.y, 0.5f - centered.x };
+    }
+    return uv;
+}
+
+void gsr_color_conversion_quad_get_vertices(float *vertices, vec2i target_size, vec2i dest_pos, vec2i dest_size, vec2i texture_full_size, vec2i texture_pos, vec2i texture_size, float rotation) {
+    const int quarter_turns = rotation_to_quarter_turns(rotation);
+    /* The size of the texture as it's seen after the rotation */
+    const vec2i rotated_full_size = quarter_turns % 2 == 1 ? (vec2i){ texture_full_size.y, texture_full_size.x } : texture_full_size;
+
+    const float left   = -1.0f + safe_div(dest_pos.x * 2.0f, target_size.x);
+    const float bottom = -1.0f + safe_div(dest_pos.y * 2.0f, target_size.y);
+    const float right  = left + safe_div(dest_size.x * 2.0f, target_size.x);
+    const float top    = bottom + safe_div(dest_size.y * 2.0f, target_size.y);
+
+    const float u0 = safe_div(texture_pos.x, rotated_full_size.x);
+    const float v0 = safe_div(texture_pos.y, rotated_full_size.y);
+    const float u1 = u0 + safe_div(texture_size.x, rotated_full_size.x);
+    const float v1 = v0 + safe_div(texture_size.y, rotated_full_size.y);
+
+    const vec2f top_left     = unrotate_texcoord((vec2f){ u0, v1 }, quarter_turns);
+    const vec2f bottom_left  = unrotate_texcoord((vec2f){ u0, v0 }, quarter_turns);
+    const vec2f bottom_right = unrotate_texcoord((vec2f){ u1, v0 }, quarter_turns);
+    const vec2f top_right    = unrotate_texcoord((vec2f){ u1, v1 }, quarter_turns);
+
+    const float quad[GSR_QUAD_NUM_VERTEX_FLOATS] = {
+        left,  top,    top_left.x,     top_left.y,
+        left,  bottom, bottom_left.x,  bottom_left.y,
+        right, bottom, bottom_right.x, bottom_right.y,
+
+        left,  top,    top_left.x,     top_left.y,
+        right, bottom, bottom_right.x, bottom_right.y,
+        right, top,    top_right.x,    top_right.y
+    };
+
+    for(int i = 0; i < GSR_QUAD_NUM_VERTEX_FLOATS; ++i) {
+        vertices[i] = quad[i];
+    }
+}
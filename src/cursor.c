@@ -1,66 +1,262 @@
 #include "../include/cursor.h"
+#include "../include/cursor_unpremultiply.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <poll.h>
 
 #include <X11/extensions/Xfixes.h>
+#include <X11/extensions/XInput2.h>
 
-static bool gsr_cursor_set_from_x11_cursor_image(gsr_cursor *self, XFixesCursorImage *x11_cursor_image) {
-    uint8_t *cursor_data = NULL;
-    uint8_t *out = NULL;
+/*
+    How long the cursor tracker waits for motion events before it queries the pointer position anyways.
+    That catches warped pointers and, with XInput2 older than 2.1, pointer grabs (raw events are not sent while the pointer is grabbed)
+*/
+#define CURSOR_TRACKER_TIMEOUT_MS 100
+#define CURSOR_TRACKER_TIMEOUT_NO_RAW_EVENTS_MS 8
+
+/* Each atlas slot has a 1 pixel transparent border so that linear filtering doesn't sample the cursor next to it. The cursor is always drawn with linear filtering */
+#define CURSOR_ATLAS_SLOT_SIZE (GSR_CURSOR_ATLAS_MAX_CURSOR_SIZE + 2)
+#define CURSOR_ATLAS_SLOTS_PER_ROW 4
+#define CURSOR_ATLAS_SIZE (CURSOR_ATLAS_SLOT_SIZE * CURSOR_ATLAS_SLOTS_PER_ROW)
+
+static void cursor_set_texture_params(gsr_egl *egl) {
+    egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+}
+
+static vec2i cursor_atlas_slot_pos(int slot) {
+    return (vec2i){ (slot % CURSOR_ATLAS_SLOTS_PER_ROW) * CURSOR_ATLAS_SLOT_SIZE, (slot / CURSOR_ATLAS_SLOTS_PER_ROW) * CURSOR_ATLAS_SLOT_SIZE };
+}
 
+static void gsr_cursor_use_cache_entry(gsr_cursor *self, int slot) {
+    gsr_cursor_cache_entry *entry = &self->cache[slot];
+    entry->last_used = ++self->cache_counter;
+
+    const vec2i slot_pos = cursor_atlas_slot_pos(slot);
+    self->texture_id = self->atlas_texture_id;
+    self->texture_pos = (vec2i){ slot_pos.x + 1, slot_pos.y + 1 };
+    self->size = entry->size;
+    self->hotspot = entry->hotspot;
+    self->visible = entry->visible;
+}
+
+/* Returns true if the cursor with |serial| is in the cache, in which case it's made the current cursor */
+static bool gsr_cursor_set_from_cache(gsr_cursor *self, unsigned long serial) {
+    for(int i = 0; i < GSR_CURSOR_CACHE_SIZE; ++i) {
+        if(self->cache[i].in_use && self->cache[i].serial == serial) {
+            gsr_cursor_use_cache_entry(self, i);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* An unused slot or the least recently used one */
+static int gsr_cursor_get_free_cache_slot(gsr_cursor *self) {
+    int slot = 0;
+    for(int i = 0; i < GSR_CURSOR_CACHE_SIZE; ++i) {
+        if(!self->cache[i].in_use)
+            return i;
+        if(self->cache[i].last_used < self->cache[slot].last_used)
+            slot = i;
+    }
+    return slot;
+}
+
+static bool gsr_cursor_set_from_x11_cursor_image(gsr_cursor *self, XFixesCursorImage *x11_cursor_image) {
     if(!x11_cursor_image)
-        goto err;
-        
-    if(!x11_cursor_image->pixels)
-        goto err;
-
-    self->hotspot.x = x11_cursor_image->xhot;
-    self->hotspot.y = x11_cursor_image->yhot;
-    self->egl->glBindTexture(GL_TEXTURE_2D, self->texture_id);
-
-    self->size.x = x11_cursor_image->width;
-    self->size.y = x11_cursor_image->height;
-    const unsigned long *pixels = x11_cursor_image->pixels;
-    cursor_data = malloc(self->size.x * self->size.y * 4);
-    if(!cursor_data)
-        goto err;
-    out = cursor_data;
-    /* Un-premultiply alpha */
-    for(int y = 0; y < self->size.y; ++y) {
-        for(int x = 0; x < self->size.x; ++x) {
-            uint32_t pixel = *pixels++;
-            uint8_t *in = (uint8_t*)&pixel;
-            uint8_t alpha = in[3];
-            if(alpha == 0)
-                alpha = 1;
-
-            *out++ = (unsigned)*in++ * 255/alpha;
-            *out++ = (unsigned)*in++ * 255/alpha;
-            *out++ = (unsigned)*in++ * 255/alpha;
-            *out++ = *in++;
+        return false;
+
+    if(!x11_cursor_image->pixels) {
+        XFree(x11_cursor_image);
+        return false;
+    }
+
+    if(gsr_cursor_set_from_cache(self, x11_cursor_image->cursor_serial)) {
+        XFree(x11_cursor_image);
+        return true;
+    }
+
+    const vec2i size = { x11_cursor_image->width, x11_cursor_image->height };
+    const vec2i upload_size = { size.x + 2, size.y + 2 };
+    const size_t upload_data_size = (size_t)upload_size.x * (size_t)upload_size.y * 4;
+    if(upload_data_size > self->upload_buffer_size) {
+        uint8_t *new_upload_buffer = realloc(self->upload_buffer, upload_data_size);
+        if(!new_upload_buffer) {
+            fprintf(stderr, "gsr error: gsr_cursor_set_from_x11_cursor_image: failed to allocate %dx%d cursor image\n", size.x, size.y);
+            XFree(x11_cursor_image);
+            return false;
         }
+        self->upload_buffer = new_upload_buffer;
+        self->upload_buffer_size = upload_data_size;
     }
 
-    self->egl->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, self->size.x, self->size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, cursor_data);
-    free(cursor_data);
+    /* The image is surrounded by a transparent border */
+    memset(self->upload_buffer, 0, upload_data_size);
+    /* Applications usually hide the cursor by setting a transparent cursor. XFixes doesn't tell other clients about XFixesHideCursor */
+    const bool visible = gsr_cursor_unpremultiply(x11_cursor_image->pixels, size.x, size.y, self->upload_buffer + (upload_size.x + 1) * 4, upload_size.x * 4);
 
-    self->egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    self->egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    self->egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    self->egl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    if(size.x <= GSR_CURSOR_ATLAS_MAX_CURSOR_SIZE && size.y <= GSR_CURSOR_ATLAS_MAX_CURSOR_SIZE) {
+        const int slot = gsr_cursor_get_free_cache_slot(self);
+        const vec2i slot_pos = cursor_atlas_slot_pos(slot);
+        self->egl->glBindTexture(GL_TEXTURE_2D, self->atlas_texture_id);
+        self->egl->glTexSubImage2D(GL_TEXTURE_2D, 0, slot_pos.x, slot_pos.y, upload_size.x, upload_size.y, GL_RGBA, GL_UNSIGNED_BYTE, self->upload_buffer);
+        self->egl->glBindTexture(GL_TEXTURE_2D, 0);
+
+        gsr_cursor_cache_entry *entry = &self->cache[slot];
+        entry->serial = x11_cursor_image->cursor_serial;
+        entry->size = size;
+        entry->hotspot = (vec2i){ x11_cursor_image->xhot, x11_cursor_image->yhot };
+        entry->visible = visible;
+        entry->in_use = true;
+        gsr_cursor_use_cache_entry(self, slot);
+    } else {
+        /* Cursors that are too large for the atlas are not cached */
+        self->egl->glBindTexture(GL_TEXTURE_2D, self->large_texture_id);
+        self->egl->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, upload_size.x, upload_size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, self->upload_buffer);
+        cursor_set_texture_params(self->egl);
+        self->egl->glBindTexture(GL_TEXTURE_2D, 0);
+
+        self->texture_id = self->large_texture_id;
+        self->texture_pos = (vec2i){ 1, 1 };
+        self->size = size;
+        self->hotspot = (vec2i){ x11_cursor_image->xhot, x11_cursor_image->yhot };
+        self->visible = visible;
+    }
 
-    self->egl->glBindTexture(GL_TEXTURE_2D, 0);
     XFree(x11_cursor_image);
     return true;
+}
 
-    err:
-    self->egl->glBindTexture(GL_TEXTURE_2D, 0);
-    if(x11_cursor_image)
-        XFree(x11_cursor_image);
-    return false;
+static uint64_t cursor_position_pack(int x, int y) {
+    return ((uint64_t)(uint32_t)x << 32) | (uint64_t)(uint32_t)y;
+}
+
+static vec2i cursor_position_unpack(uint64_t position) {
+    return (vec2i){ (int32_t)(uint32_t)(position >> 32), (int32_t)(uint32_t)(position & 0xFFFFFFFF) };
+}
+
+static void cursor_query_position(Display *display, vec2i *position) {
+    Window dummy_window;
+    int dummy_i;
+    unsigned int dummy_u;
+    XQueryPointer(display, DefaultRootWindow(display), &dummy_window, &dummy_window, &dummy_i, &dummy_i, &position->x, &position->y, &dummy_u);
+}
+
+static void* gsr_cursor_tracker_thread(void *userdata) {
+    gsr_cursor *self = userdata;
+    Display *display = self->tracker_display;
+    const int timeout_ms = self->xi_raw_events_during_grab ? CURSOR_TRACKER_TIMEOUT_MS : CURSOR_TRACKER_TIMEOUT_NO_RAW_EVENTS_MS;
+
+    struct pollfd poll_fds[2] = {
+        { .fd = ConnectionNumber(display), .events = POLLIN, .revents = 0 },
+        { .fd = self->tracker_wakeup_pipe[0], .events = POLLIN, .revents = 0 }
+    };
+
+    for(;;) {
+        bool query_position = false;
+        if(XPending(display) == 0) {
+            const int num_ready = poll(poll_fds, 2, timeout_ms);
+            if(num_ready > 0 && (poll_fds[1].revents & POLLIN))
+                break;
+            if(num_ready == 0)
+                query_position = true;
+        }
+
+        while(XPending(display) > 0) {
+            XEvent xev;
+            XNextEvent(display, &xev);
+            if(xev.xcookie.type == GenericEvent && xev.xcookie.extension == self->xi_opcode && xev.xcookie.evtype == XI_RawMotion)
+                query_position = true;
+        }
+
+        /* Raw events only have the motion delta, so the position still has to be queried. This happens here instead of in the capture thread */
+        if(query_position) {
+            vec2i position = {0, 0};
+            cursor_query_position(display, &position);
+            atomic_store(&self->tracked_position, cursor_position_pack(position.x, position.y));
+        }
+    }
+
+    return NULL;
+}
+
+static bool gsr_cursor_start_tracker(gsr_cursor *self) {
+    self->tracker_display = XOpenDisplay(DisplayString(self->display));
+    if(!self->tracker_display) {
+        fprintf(stderr, "gsr warning: gsr_cursor_start_tracker: failed to open a connection to the X server, the cursor position will be queried every frame\n");
+        return false;
+    }
+
+    self->xi_raw_events_during_grab = false;
+    int xi_event_base = 0;
+    int xi_error_base = 0;
+    if(XQueryExtension(self->tracker_display, "XInputExtension", &self->xi_opcode, &xi_event_base, &xi_error_base)) {
+        int major = 2;
+        int minor = 1;
+        if(XIQueryVersion(self->tracker_display, &major, &minor) == Success) {
+            unsigned char mask_data[XIMaskLen(XI_LASTEVENT)];
+            memset(mask_data, 0, sizeof(mask_data));
+            XISetMask(mask_data, XI_RawMotion);
+
+            XIEventMask event_mask;
+            event_mask.deviceid = XIAllMasterDevices;
+            event_mask.mask_len = sizeof(mask_data);
+            event_mask.mask = mask_data;
+            XISelectEvents(self->tracker_display, DefaultRootWindow(self->tracker_display), &event_mask, 1);
+            self->xi_raw_events_during_grab = major > 2 || (major == 2 && minor >= 1);
+        }
+    }
+
+    if(!self->xi_raw_events_during_grab)
+        fprintf(stderr, "gsr warning: gsr_cursor_start_tracker: XInput 2.1 is not available, the cursor position will be polled\n");
+
+    /* The round trip also sends the XISelectEvents request. Only the tracker thread uses |tracker_display| after this, Xlib isn't initialized for threads */
+    vec2i position = {0, 0};
+    cursor_query_position(self->tracker_display, &position);
+    atomic_store(&self->tracked_position, cursor_position_pack(position.x, position.y));
+
+    if(pipe(self->tracker_wakeup_pipe) != 0) {
+        fprintf(stderr, "gsr warning: gsr_cursor_start_tracker: failed to create pipe, the cursor position will be queried every frame\n");
+        XCloseDisplay(self->tracker_display);
+        self->tracker_display = NULL;
+        return false;
+    }
+
+    if(pthread_create(&self->tracker_thread, NULL, gsr_cursor_tracker_thread, self) != 0) {
+        fprintf(stderr, "gsr warning: gsr_cursor_start_tracker: failed to create thread, the cursor position will be queried every frame\n");
+        close(self->tracker_wakeup_pipe[0]);
+        close(self->tracker_wakeup_pipe[1]);
+        XCloseDisplay(self->tracker_display);
+        self->tracker_display = NULL;
+        return false;
+    }
+
+    self->tracker_thread_started = true;
+    return true;
+}
+
+static void gsr_cursor_stop_tracker(gsr_cursor *self) {
+    if(self->tracker_thread_started) {
+        const char stop = 1;
+        if(write(self->tracker_wakeup_pipe[1], &stop, 1) != 1)
+            fprintf(stderr, "gsr warning: gsr_cursor_stop_tracker: failed to wake up cursor tracker thread\n");
+        pthread_join(self->tracker_thread, NULL);
+        close(self->tracker_wakeup_pipe[0]);
+        close(self->tracker_wakeup_pipe[1]);
+        self->tracker_thread_started = false;
+    }
+
+    if(self->tracker_display) {
+        XCloseDisplay(self->tracker_display);
+        self->tracker_display = NULL;
+    }
 }
 
 int gsr_cursor_init(gsr_cursor *self, gsr_egl *egl, Display *display) {
@@ -79,7 +275,16 @@ int gsr_cursor_init(gsr_cursor *self, gsr_egl *egl, Display *display) {
         return -1;
     }
 
-    self->egl->glGenTextures(1, &self->texture_id);
+    self->egl->glGenTextures(1, &self->atlas_texture_id);
+    self->egl->glBindTexture(GL_TEXTURE_2D, self->atlas_texture_id);
+    self->egl->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, CURSOR_ATLAS_SIZE, CURSOR_ATLAS_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    cursor_set_texture_params(self->egl);
+    self->egl->glBindTexture(GL_TEXTURE_2D, 0);
+
+    self->egl->glGenTextures(1, &self->large_texture_id);
+    self->texture_id = self->atlas_texture_id;
+
+    gsr_cursor_start_tracker(self);
     return 0;
 }
 
@@ -87,10 +292,22 @@ void gsr_cursor_deinit(gsr_cursor *self) {
     if(!self->egl)
         return;
 
-    if(self->texture_id) {
-        self->egl->glDeleteTextures(1, &self->texture_id);
-        self->texture_id = 0;
+    gsr_cursor_stop_tracker(self);
+
+    if(self->atlas_texture_id) {
+        self->egl->glDeleteTextures(1, &self->atlas_texture_id);
+        self->atlas_texture_id = 0;
+    }
+
+    if(self->large_texture_id) {
+        self->egl->glDeleteTextures(1, &self->large_texture_id);
+        self->large_texture_id = 0;
     }
+    self->texture_id = 0;
+
+    free(self->upload_buffer);
+    self->upload_buffer = NULL;
+    self->upload_buffer_size = 0;
 
     if(self->window) {
         XFixesSelectCursorInput(self->display, self->window, 0);
@@ -116,7 +333,9 @@ void gsr_cursor_update(gsr_cursor *self, XEvent *xev) {
         XFixesCursorNotifyEvent *cursor_notify_event = (XFixesCursorNotifyEvent*)xev;
         if(cursor_notify_event->subtype == XFixesDisplayCursorNotify && cursor_notify_event->window == self->window) {
             self->cursor_image_set = true;
-            gsr_cursor_set_from_x11_cursor_image(self, XFixesGetCursorImage(self->display));
+            /* Cursors that have been seen before don't need to be fetched from the X server or uploaded again */
+            if(!gsr_cursor_set_from_cache(self, cursor_notify_event->cursor_serial))
+                gsr_cursor_set_from_x11_cursor_image(self, XFixesGetCursorImage(self->display));
         }
     }
 
@@ -127,9 +346,17 @@ void gsr_cursor_update(gsr_cursor *self, XEvent *xev) {
 }
 
 void gsr_cursor_tick(gsr_cursor *self) {
-    /* TODO: Use XInput2 instead. However that doesn't work when the pointer is grabbed. Maybe check for focused window change and XSelectInput PointerMask */
-    Window dummy_window;
-    int dummy_i;
-    unsigned int dummy_u;
-    XQueryPointer(self->display, DefaultRootWindow(self->display), &dummy_window, &dummy_window, &dummy_i, &dummy_i, &self->position.x, &self->position.y, &dummy_u);
+    if(self->tracker_thread_started)
+        self->position = cursor_position_unpack(atomic_load(&self->tracked_position));
+    else
+        cursor_query_position(self->display, &self->position);
+}
+
+bool gsr_cursor_is_visible_in_area(const gsr_cursor *self, vec2i area_pos, vec2i area_size) {
+    if(!self->visible || self->size.x <= 0 || self->size.y <= 0)
+        return false;
+
+    const vec2i cursor_pos = { self->position.x - self->hotspot.x, self->position.y - self->hotspot.y };
+    return cursor_pos.x < area_pos.x + area_size.x && cursor_pos.x + self->size.x > area_pos.x
+        && cursor_pos.y < area_pos.y + area_size.y && cursor_pos.y + self->size.y > area_pos.y;
 }
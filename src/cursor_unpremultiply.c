@@ -0,0 +1,102 @@
+#include "../include/cursor_unpremultiply.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* unpremultiply_table[alpha][color] = color * 255 / alpha. Replaces the three divides per pixel with lookups */
+static uint8_t unpremultiply_table[256][256];
+static bool unpremultiply_table_initialized = false;
+
+static void unpremultiply_table_init(void) {
+    if(unpremultiply_table_initialized)
+        return;
+
+    for(int alpha = 0; alpha < 256; ++alpha) {
+        for(int color = 0; color < 256; ++color) {
+            const int value = alpha == 0 ? 0 : color * 255 / alpha;
+            unpremultiply_table[alpha][color] = value > 255 ? 255 : value;
+        }
+    }
+    unpremultiply_table_initialized = true;
+}
+
+static inline uint32_t unpremultiply_pixel(uint32_t pixel) {
+    const uint8_t alpha = pixel >> 24;
+    const uint8_t *table = unpremultiply_table[alpha];
+    return (uint32_t)table[pixel & 0xFF]
+        | ((uint32_t)table[(pixel >> 8) & 0xFF] << 8)
+        | ((uint32_t)table[(pixel >> 16) & 0xFF] << 16)
+        | (pixel & 0xFF000000);
+}
+
+#ifdef __SSE2__
+/*
+    color * 255 / alpha for 4 pixels. color * 255 and alpha are exact in a float and the division is correctly rounded,
+    and a quotient that isn't a whole number is at least 1/255 away from one, so truncating gives the same result as the integer division
+*/
+static inline __m128i unpremultiply_channel(__m128i pixels, int shift, __m128 alpha, __m128 zero_alpha_mask) {
+    const __m128 color = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixels, shift), _mm_set1_epi32(0xFF)));
+    __m128 value = _mm_div_ps(_mm_mul_ps(color, _mm_set1_ps(255.0f)), alpha);
+    value = _mm_min_ps(value, _mm_set1_ps(255.0f));
+    value = _mm_andnot_ps(zero_alpha_mask, value);
+    return _mm_slli_epi32(_mm_cvttps_epi32(value), shift);
+}
+
+/* Converts 4 pixels. Returns the pixels as they were read (for the alpha check) */
+static inline __m128i unpremultiply_4_pixels(const unsigned long *pixels, uint8_t *out) {
+    uint32_t pixels32[4];
+    for(int i = 0; i < 4; ++i) {
+        pixels32[i] = (uint32_t)pixels[i];
+    }
+
+    const __m128i pixels_v = _mm_loadu_si128((const __m128i*)pixels32);
+    const __m128 alpha = _mm_cvtepi32_ps(_mm_srli_epi32(pixels_v, 24));
+    const __m128 zero_alpha_mask = _mm_cmpeq_ps(alpha, _mm_setzero_ps());
+
+    __m128i result = _mm_and_si128(pixels_v, _mm_set1_epi32((int)0xFF000000));
+    result = _mm_or_si128(result, unpremultiply_channel(pixels_v, 0, alpha, zero_alpha_mask));
+    result = _mm_or_si128(result, unpremultiply_channel(pixels_v, 8, alpha, zero_alpha_mask));
+    result = _mm_or_si128(result, unpremultiply_channel(pixels_v, 16, alpha, zero_alpha_mask));
+    _mm_storeu_si128((__m128i*)out, result);
+    return pixels_v;
+}
+#endif
+
+bool gsr_cursor_unpremultiply(const unsigned long *pixels, int width, int height, uint8_t *out, int out_stride) {
+    unpremultiply_table_init();
+
+    uint32_t alpha_mask = 0;
+#ifdef __SSE2__
+    __m128i alpha_mask_v = _mm_setzero_si128();
+#endif
+    for(int y = 0; y < height; ++y) {
+        uint8_t *out_row = out + y * out_stride;
+        int x = 0;
+#ifdef __SSE2__
+        for(; x + 4 <= width; x += 4) {
+            alpha_mask_v = _mm_or_si128(alpha_mask_v, unpremultiply_4_pixels(pixels, out_row));
+            pixels += 4;
+            out_row += 16;
+        }
+#endif
+        for(; x < width; ++x) {
+            const uint32_t pixel = (uint32_t)*pixels++;
+            const uint32_t result = unpremultiply_pixel(pixel);
+            /* Written byte by byte so that the output is rgba in memory regardless of endian */
+            out_row[0] = result & 0xFF;
+            out_row[1] = (result >> 8) & 0xFF;
+            out_row[2] = (result >> 16) & 0xFF;
+            out_row[3] = result >> 24;
+            out_row += 4;
+            alpha_mask |= pixel;
+        }
+    }
+
+#ifdef __SSE2__
+    uint32_t alpha_mask_lanes[4];
+    _mm_storeu_si128((__m128i*)alpha_mask_lanes, alpha_mask_v);
+    alpha_mask |= alpha_mask_lanes[0] | alpha_mask_lanes[1] | alpha_mask_lanes[2] | alpha_mask_lanes[3];
+#endif
+    return (alpha_mask >> 24) != 0;
+}
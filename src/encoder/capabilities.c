@@ -0,0 +1,427 @@
+#include "../../include/encoder/capabilities.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/hwcontext_vaapi.h>
+#include <libavutil/opt.h>
+#include <va/va.h>
+
+/* Increase this when the content of the cache changes, to make old caches invalid */
+#define GSR_CAPABILITIES_CACHE_VERSION 4
+/* How long to wait before opening an encoder again after it failed in a way that can be temporary */
+#define GSR_PROBE_RETRY_DELAY_USEC (200 * 1000)
+
+/* Sizes are tested from small to large until one fails */
+static const int probe_sizes[][2] = {
+    { 2048, 2048 },
+    { 4096, 4096 },
+    { 8192, 8192 }
+};
+
+const char* gsr_video_codec_to_string(gsr_video_codec codec) {
+    switch(codec) {
+        case GSR_VIDEO_CODEC_H264: return "h264";
+        case GSR_VIDEO_CODEC_HEVC: return "hevc";
+        case GSR_VIDEO_CODEC_AV1:  return "av1";
+        case GSR_VIDEO_CODEC_VP9:  return "vp9";
+        case GSR_VIDEO_CODEC_NUM:  break;
+    }
+    return "unknown";
+}
+
+const AVCodec* gsr_video_codec_find_encoder(gsr_video_codec codec, gsr_gpu_vendor vendor) {
+    const bool nvidia = vendor == GSR_GPU_VENDOR_NVIDIA;
+    const char *name = NULL;
+    const char *old_name = NULL; /* Name used by older ffmpeg versions */
+    switch(codec) {
+        case GSR_VIDEO_CODEC_H264:
+            name = nvidia ? "h264_nvenc" : "h264_vaapi";
+            old_name = nvidia ? "nvenc_h264" : "vaapi_h264";
+            break;
+        case GSR_VIDEO_CODEC_HEVC:
+            name = nvidia ? "hevc_nvenc" : "hevc_vaapi";
+            old_name = nvidia ? "nvenc_hevc" : "vaapi_hevc";
+            break;
+        case GSR_VIDEO_CODEC_AV1:
+            name = nvidia ? "av1_nvenc" : "av1_vaapi";
+            break;
+        case GSR_VIDEO_CODEC_VP9:
+            /* NVENC can't encode vp9 */
+            if(nvidia)
+                return NULL;
+            name = "vp9_vaapi";
+            break;
+        case GSR_VIDEO_CODEC_NUM:
+            return NULL;
+    }
+
+    const AVCodec *av_codec = avcodec_find_encoder_by_name(name);
+    if(!av_codec && old_name)
+        av_codec = avcodec_find_encoder_by_name(old_name);
+    return av_codec;
+}
+
+/*
+    |vaapi_device| is NULL for nvenc. |options| (can be NULL) are the codec options to open the encoder with, they are not modified.
+    Returns 0 on success, otherwise an ffmpeg error code (AVERROR)
+*/
+static int gsr_encoder_try_open(const AVCodec *codec, AVBufferRef *vaapi_device, bool yuv444, int b_frames, int width, int height, const AVDictionary *options) {
+    AVCodecContext *codec_context = avcodec_alloc_context3(codec);
+    if(!codec_context)
+        return AVERROR(ENOMEM);
+
+    codec_context->width = width;
+    codec_context->height = height;
+    codec_context->time_base = (AVRational){ 1, 60 };
+    codec_context->framerate = (AVRational){ 60, 1 };
+    codec_context->gop_size = 120;
+    codec_context->max_b_frames = b_frames;
+
+    int ret = 0;
+    if(vaapi_device) {
+        AVBufferRef *frame_context = av_hwframe_ctx_alloc(vaapi_device);
+        if(!frame_context) {
+            ret = AVERROR(ENOMEM);
+            goto done;
+        }
+
+        AVHWFramesContext *hw_frame_context = (AVHWFramesContext*)frame_context->data;
+        hw_frame_context->width = width;
+        hw_frame_context->height = height;
+        hw_frame_context->sw_format = yuv444 ? AV_PIX_FMT_YUV444P : AV_PIX_FMT_NV12;
+        hw_frame_context->format = AV_PIX_FMT_VAAPI;
+        hw_frame_context->initial_pool_size = 1;
+        ret = av_hwframe_ctx_init(frame_context);
+        if(ret < 0) {
+            av_buffer_unref(&frame_context);
+            goto done;
+        }
+
+        codec_context->pix_fmt = AV_PIX_FMT_VAAPI;
+        codec_context->hw_frames_ctx = frame_context;
+    } else {
+        // Do not use AV_PIX_FMT_CUDA because we dont want to do full check with hardware context
+        codec_context->pix_fmt = yuv444 ? AV_PIX_FMT_YUV444P : AV_PIX_FMT_YUV420P;
+        // Only one input surface so that probing large sizes doesn't allocate a lot of video memory. B-frames need more surfaces, the encoder chooses how many
+        if(b_frames == 0)
+            av_opt_set_int(codec_context->priv_data, "surfaces", 1, 0);
+    }
+
+    /* avcodec_open2 removes the options it used from the dictionary */
+    AVDictionary *options_copy = NULL;
+    if(options)
+        av_dict_copy(&options_copy, options, 0);
+    ret = avcodec_open2(codec_context, codec, &options_copy);
+    av_dict_free(&options_copy);
+
+    done:
+    if(codec_context->hw_frames_ctx)
+        av_buffer_unref(&codec_context->hw_frames_ctx);
+    avcodec_free_context(&codec_context);
+    return ret;
+}
+
+/*
+    Running out of (video) memory, or of nvenc sessions when other programs are encoding at the same time, goes away later.
+    An unsupported size, format or option fails with other errors (usually ENOSYS or EINVAL)
+*/
+static bool is_temporary_open_error(int err) {
+    return err == AVERROR(ENOMEM) || err == AVERROR(EAGAIN) || err == AVERROR(EBUSY);
+}
+
+/*
+    Tries again once if opening the encoder fails with a temporary error. |temporary_failure| is set to true if it still fails with a temporary error,
+    then the result is not the capability of the encoder and shouldn't be cached
+*/
+static bool gsr_encoder_probe_open(const AVCodec *codec, AVBufferRef *vaapi_device, bool yuv444, int b_frames, int width, int height, const AVDictionary *options, bool *temporary_failure) {
+    int ret = gsr_encoder_try_open(codec, vaapi_device, yuv444, b_frames, width, height, options);
+    if(ret == 0)
+        return true;
+
+    if(!is_temporary_open_error(ret))
+        return false;
+
+    usleep(GSR_PROBE_RETRY_DELAY_USEC);
+    ret = gsr_encoder_try_open(codec, vaapi_device, yuv444, b_frames, width, height, options);
+    if(ret == 0)
+        return true;
+
+    if(is_temporary_open_error(ret)) {
+        fprintf(stderr, "gsr warning: gsr_encoder_probe: failed to open %s at %dx%d, error: %s. The encoder capabilities will be probed again next time\n", codec->name, width, height, av_err2str(ret));
+        *temporary_failure = true;
+    }
+    return false;
+}
+
+static void gsr_encoder_probe_codec(gsr_video_codec_capabilities *caps, const AVCodec *codec, AVBufferRef *vaapi_device, bool *temporary_failure) {
+    memset(caps, 0, sizeof(*caps));
+    if(!codec)
+        return;
+
+    if(!gsr_encoder_probe_open(codec, vaapi_device, false, 0, 512, 512, NULL, temporary_failure))
+        return;
+
+    caps->supported = true;
+    caps->max_width = 512;
+    caps->max_height = 512;
+    for(size_t i = 0; i < sizeof(probe_sizes)/sizeof(probe_sizes[0]); ++i) {
+        if(!gsr_encoder_probe_open(codec, vaapi_device, false, 0, probe_sizes[i][0], probe_sizes[i][1], NULL, temporary_failure))
+            break;
+        caps->max_width = probe_sizes[i][0];
+        caps->max_height = probe_sizes[i][1];
+    }
+
+    caps->yuv444 = gsr_encoder_probe_open(codec, vaapi_device, true, 0, 512, 512, NULL, temporary_failure);
+    /* Some encoders (and some vaapi drivers) fail to open with b-frames instead of ignoring them */
+    caps->b_frames = gsr_encoder_probe_open(codec, vaapi_device, false, 2, 512, 512, NULL, temporary_failure);
+
+    /* vaapi fails to open with a rate control mode that the driver doesn't support (AMD doesn't support QVBR) */
+    if(vaapi_device) {
+        AVDictionary *options = NULL;
+        av_dict_set(&options, "rc_mode", "QVBR", 0);
+        av_dict_set_int(&options, "global_quality", 25, 0);
+        av_dict_set_int(&options, "b", 5000000, 0);
+        av_dict_set_int(&options, "maxrate", 5000000, 0);
+        caps->qvbr = gsr_encoder_probe_open(codec, vaapi_device, false, 0, 512, 512, options, temporary_failure);
+        av_dict_free(&options);
+    }
+
+    /* nvenc fails to open (ENOSYS) with lookahead or temporal aq if the gpu doesn't support them, for example temporal aq with av1 or on older gpus */
+    if(!vaapi_device) {
+        AVDictionary *options = NULL;
+        av_dict_set_int(&options, "rc-lookahead", 16, 0);
+        caps->lookahead = gsr_encoder_probe_open(codec, vaapi_device, false, 0, 512, 512, options, temporary_failure);
+        av_dict_free(&options);
+
+        av_dict_set_int(&options, "temporal-aq", 1, 0);
+        caps->temporal_aq = gsr_encoder_probe_open(codec, vaapi_device, false, 0, 512, 512, options, temporary_failure);
+        av_dict_free(&options);
+    }
+
+    if(codec->priv_class) {
+        const AVOption *opt = NULL;
+        while((opt = av_opt_next(&codec->priv_class, opt))) {
+            if(opt->type == AV_OPT_TYPE_CONST) {
+                if(strcmp(opt->name, "p4") == 0)
+                    caps->preset_p4 = true;
+                else if(strcmp(opt->name, "p6") == 0)
+                    caps->preset_p6 = true;
+            }
+        }
+    }
+}
+
+/* |vaapi_device| is NULL for nvenc. Returns false if the result shouldn't be cached because probing an encoder failed in a way that can be temporary */
+static bool gsr_encoder_probe(gsr_encoder_capabilities *capabilities, gsr_gpu_vendor vendor, AVBufferRef *vaapi_device) {
+    memset(capabilities, 0, sizeof(*capabilities));
+    bool temporary_failure = false;
+    for(int i = 0; i < GSR_VIDEO_CODEC_NUM; ++i) {
+        gsr_encoder_probe_codec(&capabilities->codecs[i], gsr_video_codec_find_encoder(i, vendor), vaapi_device, &temporary_failure);
+    }
+    return !temporary_failure;
+}
+
+/* Returns false if there is no home directory */
+static bool get_cache_dir(char *output, size_t output_size) {
+    const char *xdg_cache_home = getenv("XDG_CACHE_HOME");
+    if(xdg_cache_home && xdg_cache_home[0] == '/') {
+        snprintf(output, output_size, "%s/gpu-screen-recorder", xdg_cache_home);
+        return true;
+    }
+
+    const char *home = getenv("HOME");
+    if(!home || home[0] == '\0')
+        return false;
+
+    snprintf(output, output_size, "%s/.cache/gpu-screen-recorder", home);
+    return true;
+}
+
+static bool create_directory_recursive(char *path) {
+    for(char *p = path + 1; *p; ++p) {
+        if(*p != '/')
+            continue;
+
+        *p = '\0';
+        const int err = mkdir(path, S_IRWXU);
+        *p = '/';
+        if(err == -1 && errno != EEXIST)
+            return false;
+    }
+    return mkdir(path, S_IRWXU) == 0 || errno == EEXIST;
+}
+
+/* FNV-1a */
+static uint64_t hash_string(uint64_t hash, const char *str) {
+    for(const unsigned char *p = (const unsigned char*)str; *p; ++p) {
+        hash ^= *p;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/*
+    Each gpu gets its own cache file, so that a machine that records from multiple gpus doesn't probe again every time it switches between them.
+    The name doesn't include the driver version, a driver update replaces the cache of the gpu instead of adding a new file
+*/
+static void get_cache_filepath(char *output, size_t output_size, const char *dir, const gsr_gpu_info *gpu_info, const char *card_path) {
+    char vendor_str[16];
+    snprintf(vendor_str, sizeof(vendor_str), "%d", (int)gpu_info->vendor);
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hash = hash_string(hash, vendor_str);
+    hash = hash_string(hash, card_path ? card_path : "");
+    snprintf(output, output_size, "%s/encoder_capabilities_%016llx", dir, (unsigned long long)hash);
+}
+
+/* |vaapi_vendor| is the vendor string of the vaapi driver (which includes the mesa version), it's empty for nvenc */
+static void get_cache_key(char *output, size_t output_size, const gsr_gpu_info *gpu_info, const char *card_path, const char *vaapi_vendor) {
+    snprintf(output, output_size, "version=%d\nvendor=%d\ndriver=%s\ncard=%s\nvaapi_vendor=%s\navcodec=%u\n",
+        GSR_CAPABILITIES_CACHE_VERSION, (int)gpu_info->vendor, gpu_info->driver_version, card_path ? card_path : "", vaapi_vendor, avcodec_version());
+}
+
+/* The vendor string is written on one line in the cache key */
+static void get_vaapi_vendor(char *output, size_t output_size, AVBufferRef *vaapi_device) {
+    const AVHWDeviceContext *device_context = (const AVHWDeviceContext*)vaapi_device->data;
+    const AVVAAPIDeviceContext *vaapi_device_context = device_context->hwctx;
+    const char *vendor = vaQueryVendorString(vaapi_device_context->display);
+    snprintf(output, output_size, "%s", vendor ? vendor : "");
+    for(char *p = output; *p; ++p) {
+        if(*p == '\n' || *p == '\r')
+            *p = ' ';
+    }
+}
+
+static bool gsr_encoder_capabilities_load(gsr_encoder_capabilities *capabilities, const char *filepath, const char *key) {
+    FILE *file = fopen(filepath, "rb");
+    if(!file)
+        return false;
+
+    char data[4096];
+    const size_t data_size = fread(data, 1, sizeof(data) - 1, file);
+    fclose(file);
+    data[data_size] = '\0';
+
+    const size_t key_len = strlen(key);
+    if(data_size < key_len || memcmp(data, key, key_len) != 0)
+        return false;
+
+    memset(capabilities, 0, sizeof(*capabilities));
+    int num_codecs_found = 0;
+    const char *line = data + key_len;
+    while(*line) {
+        char codec_name[32];
+        int supported = 0, yuv444 = 0, b_frames = 0, preset_p4 = 0, preset_p6 = 0, lookahead = 0, temporal_aq = 0, qvbr = 0, max_width = 0, max_height = 0;
+        if(sscanf(line, "%31s %d %d %d %d %d %d %d %d %d %d", codec_name, &supported, &yuv444, &b_frames, &preset_p4, &preset_p6, &lookahead, &temporal_aq, &qvbr, &max_width, &max_height) == 11) {
+            for(int i = 0; i < GSR_VIDEO_CODEC_NUM; ++i) {
+                if(strcmp(codec_name, gsr_video_codec_to_string(i)) == 0) {
+                    capabilities->codecs[i] = (gsr_video_codec_capabilities){
+                        .supported = supported,
+                        .yuv444 = yuv444,
+                        .b_frames = b_frames,
+                        .preset_p4 = preset_p4,
+                        .preset_p6 = preset_p6,
+                        .lookahead = lookahead,
+                        .temporal_aq = temporal_aq,
+                        .qvbr = qvbr,
+                        .max_width = max_width,
+                        .max_height = max_height
+                    };
+                    ++num_codecs_found;
+                    break;
+                }
+            }
+        }
+
+        const char *next_line = strchr(line, '\n');
+        if(!next_line)
+            break;
+        line = next_line + 1;
+    }
+
+    return num_codecs_found == GSR_VIDEO_CODEC_NUM;
+}
+
+static void gsr_encoder_capabilities_save(const gsr_encoder_capabilities *capabilities, const char *dir, const char *filepath, const char *key) {
+    char tmp_filepath[PATH_MAX];
+    snprintf(tmp_filepath, sizeof(tmp_filepath), "%s.%d.tmp", filepath, (int)getpid());
+
+    char dir_tmp[PATH_MAX];
+    snprintf(dir_tmp, sizeof(dir_tmp), "%s", dir);
+    if(!create_directory_recursive(dir_tmp)) {
+        fprintf(stderr, "gsr warning: gsr_encoder_capabilities_save: failed to create directory %s\n", dir);
+        return;
+    }
+
+    FILE *file = fopen(tmp_filepath, "wb");
+    if(!file) {
+        fprintf(stderr, "gsr warning: gsr_encoder_capabilities_save: failed to create %s\n", tmp_filepath);
+        return;
+    }
+
+    fputs(key, file);
+    for(int i = 0; i < GSR_VIDEO_CODEC_NUM; ++i) {
+        const gsr_video_codec_capabilities *caps = &capabilities->codecs[i];
+        fprintf(file, "%s %d %d %d %d %d %d %d %d %d %d\n", gsr_video_codec_to_string(i), caps->supported, caps->yuv444, caps->b_frames, caps->preset_p4, caps->preset_p6, caps->lookahead, caps->temporal_aq, caps->qvbr, caps->max_width, caps->max_height);
+    }
+
+    const bool write_failed = ferror(file);
+    if(fclose(file) != 0 || write_failed) {
+        remove(tmp_filepath);
+        return;
+    }
+
+    /* Renamed so that another instance that starts at the same time never reads a partially written file */
+    if(rename(tmp_filepath, filepath) != 0)
+        remove(tmp_filepath);
+}
+
+void gsr_encoder_get_capabilities(gsr_encoder_capabilities *capabilities, const gsr_gpu_info *gpu_info, const char *card_path) {
+    memset(capabilities, 0, sizeof(*capabilities));
+
+    /* A failure to create the vaapi device could be temporary, nothing is cached then */
+    AVBufferRef *vaapi_device = NULL;
+    char vaapi_vendor[256];
+    vaapi_vendor[0] = '\0';
+    if(gpu_info->vendor != GSR_GPU_VENDOR_NVIDIA) {
+        if(av_hwdevice_ctx_create(&vaapi_device, AV_HWDEVICE_TYPE_VAAPI, card_path, NULL, 0) < 0) {
+            fprintf(stderr, "gsr error: gsr_encoder_get_capabilities: failed to create vaapi device for %s\n", card_path);
+            return;
+        }
+        get_vaapi_vendor(vaapi_vendor, sizeof(vaapi_vendor), vaapi_device);
+    }
+
+    char key[1024];
+    get_cache_key(key, sizeof(key), gpu_info, card_path, vaapi_vendor);
+
+    char dir[PATH_MAX];
+    char filepath[PATH_MAX];
+    const bool has_cache_dir = get_cache_dir(dir, sizeof(dir));
+    if(has_cache_dir) {
+        get_cache_filepath(filepath, sizeof(filepath), dir, gpu_info, card_path);
+        if(gsr_encoder_capabilities_load(capabilities, filepath, key))
+            goto done;
+    }
+
+    const bool cacheable = gsr_encoder_probe(capabilities, gpu_info->vendor, vaapi_device);
+
+    /* Nothing found could also be temporary */
+    bool any_supported = false;
+    for(int i = 0; i < GSR_VIDEO_CODEC_NUM; ++i) {
+        if(capabilities->codecs[i].supported)
+            any_supported = true;
+    }
+
+    if(has_cache_dir && cacheable && any_supported)
+        gsr_encoder_capabilities_save(capabilities, dir, filepath, key);
+
+    done:
+    if(vaapi_device)
+        av_buffer_unref(&vaapi_device);
+}
@@ -0,0 +1,19 @@
+#include "../../include/encoder/encoder.h"
+
+int gsr_encoder_send_frame(gsr_encoder *encoder, AVFrame *frame) {
+    return encoder->send_frame(encoder, frame);
+}
+
+int gsr_encoder_receive_packet(gsr_encoder *encoder, AVPacket *packet) {
+    return encoder->receive_packet(encoder, packet);
+}
+
+bool gsr_encoder_set_bitrate(gsr_encoder *encoder, int64_t bitrate) {
+    if(!encoder->set_bitrate)
+        return false;
+    return encoder->set_bitrate(encoder, bitrate);
+}
+
+void gsr_encoder_destroy(gsr_encoder *encoder) {
+    encoder->destroy(encoder);
+}
@@ -0,0 +1,57 @@
+#include "../../include/encoder/ffmpeg.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <libavcodec/avcodec.h>
+
+static int gsr_encoder_ffmpeg_send_frame(gsr_encoder *encoder, AVFrame *frame) {
+    return avcodec_send_frame(encoder->codec_context, frame);
+}
+
+static int gsr_encoder_ffmpeg_receive_packet(gsr_encoder *encoder, AVPacket *packet) {
+    return avcodec_receive_packet(encoder->codec_context, packet);
+}
+
+/*
+    Only nvenc reconfigures the encoder when the bitrate in the codec context changes, vaapi uses the bitrate it was opened with.
+    The max bitrate and buffer size keep their ratio to the bitrate, so vbr stays vbr. Encoders without an average bitrate (constant qp or quality) are not changed.
+*/
+static bool gsr_encoder_ffmpeg_set_bitrate(gsr_encoder *encoder, int64_t bitrate) {
+    AVCodecContext *codec_context = encoder->codec_context;
+    if(!codec_context->codec || !strstr(codec_context->codec->name, "nvenc") || codec_context->bit_rate <= 0 || bitrate <= 0)
+        return false;
+
+    const double scale = (double)bitrate / (double)codec_context->bit_rate;
+    codec_context->bit_rate = bitrate;
+    if(codec_context->rc_max_rate > 0)
+        codec_context->rc_max_rate = (int64_t)(codec_context->rc_max_rate * scale);
+    if(codec_context->rc_buffer_size > 0)
+        codec_context->rc_buffer_size = (int)(codec_context->rc_buffer_size * scale);
+    return true;
+}
+
+static void gsr_encoder_ffmpeg_destroy(gsr_encoder *encoder) {
+    free(encoder);
+}
+
+gsr_encoder* gsr_encoder_ffmpeg_create(AVCodecContext *codec_context) {
+    if(!codec_context) {
+        fprintf(stderr, "gsr error: gsr_encoder_ffmpeg_create codec_context is NULL\n");
+        return NULL;
+    }
+
+    gsr_encoder *encoder = calloc(1, sizeof(gsr_encoder));
+    if(!encoder)
+        return NULL;
+
+    *encoder = (gsr_encoder) {
+        .send_frame = gsr_encoder_ffmpeg_send_frame,
+        .receive_packet = gsr_encoder_ffmpeg_receive_packet,
+        .set_bitrate = gsr_encoder_ffmpeg_set_bitrate,
+        .destroy = gsr_encoder_ffmpeg_destroy,
+        .codec_context = codec_context,
+        .priv = NULL
+    };
+
+    return encoder;
+}
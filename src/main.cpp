@@ -3,11 +3,15 @@ extern "C" {
 #include "../include/capture/xcomposite_cuda.h"
 #include "../include/capture/xcomposite_vaapi.h"
 #include "../include/capture/kms_vaapi.h"
+#include "../include/encoder/ffmpeg.h"
+#include "../include/encoder/capabilities.h"
 #include "../include/egl.h"
 #include "../include/utils.h"
 }
 
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
@@ -20,6 +24,8 @@ extern "C" {
 #include <sys/stat.h>
 
 #include "../include/sound.hpp"
+#include "../include/packet_sink.hpp"
+#include "../include/adaptive_bitrate.hpp"
 
 extern "C" {
 #include <libavutil/pixfmt.h>
@@ -36,6 +42,7 @@ extern "C" {
 
 #include <deque>
 #include <future>
+#include <memory>
 
 // TODO: If options are not supported then they are returned (allocated) in the options. This should be free'd.
 
@@ -66,7 +73,9 @@ enum class VideoQuality {
 
 enum class VideoCodec {
     H264,
-    H265
+    H265,
+    AV1,
+    VP9
 };
 
 enum class AudioCodec {
@@ -80,6 +89,15 @@ enum class PixelFormat {
     YUV444
 };
 
+// How the encoder decides the size of each frame
+enum class BitrateMode {
+    AUTO, // QP for files and the replay buffer, CBR for livestreams
+    QP,   // Constant quantizer. Same quality for every frame, the file size depends on the content
+    CQ,   // Constant quality, but the bitrate never goes above the max bitrate
+    VBR,  // Variable bitrate that averages to the bitrate
+    CBR   // Constant bitrate with a one second buffer (VBV). The bitrate is predictable, as livestreaming services require
+};
+
 enum class FramerateMode {
     CONSTANT,
     VARIABLE
@@ -93,62 +111,68 @@ static int x11_io_error_handler(Display*) {
     return 0;
 }
 
-// |stream| is only required for non-replay mode
-static void receive_frames(AVCodecContext *av_codec_context, int stream_index, AVStream *stream, int64_t pts,
-                           AVFormatContext *av_format_context,
-                           double replay_start_time,
-                           std::deque<AVPacket> &frame_data_queue,
-                           int replay_buffer_size_secs,
-                           bool &frames_erased,
-                           std::mutex &write_output_mutex) {
-    for (;;) {
-        // TODO: Use av_packet_alloc instead because sizeof(av_packet) might not be future proof(?)
-        AVPacket *av_packet = av_packet_alloc();
-        if(!av_packet)
-            break;
+static void receive_frames(AVCodecContext *av_codec_context, int stream_index, const std::vector<PacketSink*> &sinks) {
+    packet_sinks_receive_packets([av_codec_context](AVPacket *av_packet) {
+        return avcodec_receive_packet(av_codec_context, av_packet);
+    }, av_codec_context->time_base, stream_index, sinks);
+}
 
-        av_packet->data = NULL;
-        av_packet->size = 0;
-        int res = avcodec_receive_packet(av_codec_context, av_packet);
-        if (res == 0) { // we have a packet, send the packet to the muxer
-            av_packet->stream_index = stream_index;
-            av_packet->pts = pts;
-            av_packet->dts = pts;
+static void receive_frames(gsr_encoder *encoder, int stream_index, const std::vector<PacketSink*> &sinks) {
+    packet_sinks_receive_packets([encoder](AVPacket *av_packet) {
+        return gsr_encoder_receive_packet(encoder, av_packet);
+    }, encoder->codec_context->time_base, stream_index, sinks);
+}
 
-            std::lock_guard<std::mutex> lock(write_output_mutex);
-            if(replay_buffer_size_secs != -1) {
-                double time_now = clock_get_monotonic_seconds();
-                double replay_time_elapsed = time_now - replay_start_time;
-
-                AVPacket new_pack;
-                av_packet_move_ref(&new_pack, av_packet);
-                frame_data_queue.push_back(std::move(new_pack));
-                if(replay_time_elapsed >= replay_buffer_size_secs) {
-                    av_packet_unref(&frame_data_queue.front());
-                    frame_data_queue.pop_front();
-                    frames_erased = true;
-                }
-            } else {
-                av_packet_rescale_ts(av_packet, av_codec_context->time_base, stream->time_base);
-                av_packet->stream_index = stream->index;
-                // TODO: Is av_interleaved_write_frame needed?
-                int ret = av_interleaved_write_frame(av_format_context, av_packet);
-                if(ret < 0) {
-                    fprintf(stderr, "Error: Failed to write frame index %d to muxer, reason: %s (%d)\n", av_packet->stream_index, av_error_to_string(ret), ret);
-                }
-            }
-        } else if (res == AVERROR(EAGAIN)) { // we have no packet
-                                             // fprintf(stderr, "No packet!\n");
-            break;
-        } else if (res == AVERROR_EOF) { // this is the end of the stream
-            fprintf(stderr, "End of stream!\n");
-            break;
-        } else {
-            fprintf(stderr, "Unexpected error: %d\n", res);
-            break;
+// The capture times of the last video frames, to trace the latency from the capture of a frame to its packet being written (-trace)
+struct LatencyTrace {
+    std::mutex mutex;
+    std::deque<std::pair<int64_t, double>> frame_capture_times; // The pts of the frame and the monotonic time in seconds when its capture started
+};
+
+static void latency_trace_add_frame(LatencyTrace *trace, int64_t pts, double capture_time) {
+    std::lock_guard<std::mutex> lock(trace->mutex);
+    trace->frame_capture_times.emplace_back(pts, capture_time);
+    // More than the frames that can be in the encoders and the queues of the sinks at the same time
+    while(trace->frame_capture_times.size() > 512)
+        trace->frame_capture_times.pop_front();
+}
+
+static bool latency_trace_get_capture_time(LatencyTrace *trace, int64_t pts, double *capture_time) {
+    std::lock_guard<std::mutex> lock(trace->mutex);
+    for(auto it = trace->frame_capture_times.rbegin(); it != trace->frame_capture_times.rend(); ++it) {
+        if(it->first == pts) {
+            *capture_time = it->second;
+            return true;
         }
-        av_packet_free(&av_packet);
     }
+    return false;
+}
+
+// The streams of |av_format_context| have to be in the same order as the stream indices of the packets (video first, then the audio tracks).
+// With |low_latency| the packets are written as they come instead of being held back by the muxer until the other streams catch up.
+// |trace| can be NULL, otherwise the latency of each video packet is printed after it has been written
+static PacketSinkWriteCallback muxer_write_callback(AVFormatContext *av_format_context, bool low_latency, LatencyTrace *trace, std::string name) {
+    return [av_format_context, low_latency, trace, name](AVPacket *av_packet, AVRational time_base) {
+        if(av_packet->stream_index < 0 || av_packet->stream_index >= (int)av_format_context->nb_streams)
+            return;
+
+        double capture_time = 0.0;
+        const bool traced = trace && av_packet->stream_index == VIDEO_STREAM_INDEX && latency_trace_get_capture_time(trace, av_packet->pts, &capture_time);
+
+        AVStream *stream = av_format_context->streams[av_packet->stream_index];
+        av_packet_rescale_ts(av_packet, time_base, stream->time_base);
+        // The audio and video packets are pushed in about the order they were captured, so the muxer doesn't need to interleave them for low latency
+        int ret = low_latency ? av_write_frame(av_format_context, av_packet) : av_interleaved_write_frame(av_format_context, av_packet);
+        if(ret < 0) {
+            fprintf(stderr, "Error: Failed to write frame index %d to muxer, reason: %s (%d)\n", av_packet->stream_index, av_error_to_string(ret), ret);
+            return;
+        }
+
+        if(traced) {
+            const double time_now = clock_get_monotonic_seconds();
+            fprintf(stderr, "trace: %.6f %s: capture to written: %ld us\n", time_now, name.c_str(), (long)((time_now - capture_time) * 1000000.0));
+        }
+    };
 }
 
 static const char* audio_codec_get_name(AudioCodec audio_codec) {
@@ -269,9 +293,9 @@ static AVCodecContext* create_audio_codec_context(int fps, AudioCodec audio_code
     return codec_context;
 }
 
+// |keyint| is the time between keyframes in seconds. |b_frames| is the max number of b-frames in a row
 static AVCodecContext *create_video_codec_context(AVPixelFormat pix_fmt,
-                            VideoQuality video_quality,
-                            int fps, const AVCodec *codec, bool is_livestream, gsr_gpu_vendor vendor, FramerateMode framerate_mode) {
+                            int fps, double keyint, int b_frames, const AVCodec *codec, bool is_livestream, gsr_gpu_vendor vendor, FramerateMode framerate_mode) {
 
     AVCodecContext *codec_context = avcodec_alloc_context3(codec);
 
@@ -289,47 +313,26 @@ static AVCodecContext *create_video_codec_context(AVPixelFormat pix_fmt,
     codec_context->framerate.den = 1;
     codec_context->sample_aspect_ratio.num = 0;
     codec_context->sample_aspect_ratio.den = 0;
-    // High values reeduce file size but increases time it takes to seek
+    // High values reeduce file size but increases time it takes to seek, and how far a replay can be from the requested length
+    codec_context->gop_size = std::max(1, (int)std::round(fps * keyint));
     if(is_livestream) {
         codec_context->flags |= (AV_CODEC_FLAG_CLOSED_GOP | AV_CODEC_FLAG_LOW_DELAY);
         codec_context->flags2 |= AV_CODEC_FLAG2_FAST;
         //codec_context->gop_size = std::numeric_limits<int>::max();
         //codec_context->keyint_min = std::numeric_limits<int>::max();
-        codec_context->gop_size = fps * 2;
-    } else {
-        codec_context->gop_size = fps * 2;
     }
-    codec_context->max_b_frames = 0;
+    codec_context->max_b_frames = b_frames;
+    // Frames after a keyframe can't reference frames before it, so that replays and livestreams can start at any keyframe
+    if(b_frames > 0)
+        codec_context->flags |= AV_CODEC_FLAG_CLOSED_GOP;
     codec_context->pix_fmt = pix_fmt;
     //codec_context->color_range = AVCOL_RANGE_JPEG; // TODO: Amd/nvidia?
     //codec_context->color_primaries = AVCOL_PRI_BT709;
     //codec_context->color_trc = AVCOL_TRC_BT709;
     //codec_context->colorspace = AVCOL_SPC_BT709;
     //codec_context->chroma_sample_location = AVCHROMA_LOC_CENTER;
-    if(codec->id == AV_CODEC_ID_HEVC)
-        codec_context->codec_tag = MKTAG('h', 'v', 'c', '1');
-    switch(video_quality) {
-        case VideoQuality::MEDIUM:
-            //codec_context->qmin = 35;
-            //codec_context->qmax = 35;
-            codec_context->bit_rate = 100000;//4500000 + (codec_context->width * codec_context->height)*0.75;
-            break;
-        case VideoQuality::HIGH:
-            //codec_context->qmin = 34;
-            //codec_context->qmax = 34;
-            codec_context->bit_rate = 100000;//10000000-9000000 + (codec_context->width * codec_context->height)*0.75;
-            break;
-        case VideoQuality::VERY_HIGH:
-            //codec_context->qmin = 28;
-            //codec_context->qmax = 28;
-            codec_context->bit_rate = 100000;//10000000-9000000 + (codec_context->width * codec_context->height)*0.75;
-            break;
-        case VideoQuality::ULTRA:
-            //codec_context->qmin = 22;
-            //codec_context->qmax = 22;
-            codec_context->bit_rate = 100000;//10000000-9000000 + (codec_context->width * codec_context->height)*0.75;
-            break;
-    }
+    // Set by open_video for the bitrate modes that have a bitrate
+    codec_context->bit_rate = 0;
     //codec_context->profile = FF_PROFILE_H264_MAIN;
     if (codec_context->codec_id == AV_CODEC_ID_MPEG1VIDEO)
         codec_context->mb_decision = 2;
@@ -359,7 +362,8 @@ static AVCodecContext *create_video_codec_context(AVPixelFormat pix_fmt,
     if(vendor != GSR_GPU_VENDOR_NVIDIA) {
         // TODO: More options, better options
         //codec_context->bit_rate = codec_context->width * codec_context->height;
-        av_opt_set(codec_context->priv_data, "rc_mode", "CQP", 0);
+        // Livestreams use a bitrate (set in open_video) because the network can only take so much, everything else uses constant quality
+        av_opt_set(codec_context->priv_data, "rc_mode", is_livestream ? "CBR" : "CQP", 0);
         //codec_context->global_quality = 4;
         //codec_context->compression_level = 2;
     }
@@ -373,104 +377,92 @@ static AVCodecContext *create_video_codec_context(AVPixelFormat pix_fmt,
     return codec_context;
 }
 
-static bool vaapi_create_codec_context(AVCodecContext *video_codec_context, const char *card_path) {
-    AVBufferRef *device_ctx;
-    if(av_hwdevice_ctx_create(&device_ctx, AV_HWDEVICE_TYPE_VAAPI, card_path, NULL, 0) < 0) {
-        fprintf(stderr, "Error: Failed to create hardware device context\n");
-        return false;
+static gsr_video_codec video_codec_to_gsr_video_codec(VideoCodec video_codec) {
+    switch(video_codec) {
+        case VideoCodec::H264: return GSR_VIDEO_CODEC_H264;
+        case VideoCodec::H265: return GSR_VIDEO_CODEC_HEVC;
+        case VideoCodec::AV1:  return GSR_VIDEO_CODEC_AV1;
+        case VideoCodec::VP9:  return GSR_VIDEO_CODEC_VP9;
     }
+    return GSR_VIDEO_CODEC_H264;
+}
 
-    AVBufferRef *frame_context = av_hwframe_ctx_alloc(device_ctx);
-    if(!frame_context) {
-        fprintf(stderr, "Error: Failed to create hwframe context\n");
-        av_buffer_unref(&device_ctx);
-        return false;
+static const char* video_codec_to_string(VideoCodec video_codec) {
+    switch(video_codec) {
+        case VideoCodec::H264: return "h264";
+        case VideoCodec::H265: return "h265";
+        case VideoCodec::AV1:  return "av1";
+        case VideoCodec::VP9:  return "vp9";
     }
+    return "h264";
+}
 
-    AVHWFramesContext *hw_frame_context =
-        (AVHWFramesContext *)frame_context->data;
-    hw_frame_context->width = video_codec_context->width;
-    hw_frame_context->height = video_codec_context->height;
-    hw_frame_context->sw_format = AV_PIX_FMT_NV12;
-    hw_frame_context->format = video_codec_context->pix_fmt;
-    hw_frame_context->device_ref = device_ctx;
-    hw_frame_context->device_ctx = (AVHWDeviceContext*)device_ctx->data;
-
-    hw_frame_context->initial_pool_size = 1;
-
-    if (av_hwframe_ctx_init(frame_context) < 0) {
-        fprintf(stderr, "Error: Failed to initialize hardware frame context "
-                        "(note: ffmpeg version needs to be > 4.0)\n");
-        av_buffer_unref(&device_ctx);
-        //av_buffer_unref(&frame_context);
+static bool parse_video_codec(const char *str, VideoCodec &video_codec) {
+    if(strcmp(str, "h264") == 0)
+        video_codec = VideoCodec::H264;
+    else if(strcmp(str, "h265") == 0)
+        video_codec = VideoCodec::H265;
+    else if(strcmp(str, "av1") == 0)
+        video_codec = VideoCodec::AV1;
+    else if(strcmp(str, "vp9") == 0)
+        video_codec = VideoCodec::VP9;
+    else
         return false;
-    }
-
-    video_codec_context->hw_device_ctx = av_buffer_ref(device_ctx);
-    video_codec_context->hw_frames_ctx = av_buffer_ref(frame_context);
     return true;
 }
 
-static bool check_if_codec_valid_for_hardware(const AVCodec *codec, gsr_gpu_vendor vendor, const char *card_path) {
-    // Do not use AV_PIX_FMT_CUDA because we dont want to do full check with hardware context
-    AVCodecContext *codec_context = create_video_codec_context(vendor == GSR_GPU_VENDOR_NVIDIA ? AV_PIX_FMT_YUV420P : AV_PIX_FMT_VAAPI, VideoQuality::VERY_HIGH, 60, codec, false, vendor, FramerateMode::CONSTANT);
-    if(!codec_context)
-        return false;
-
-    codec_context->width = 512;
-    codec_context->height = 512;
-
-    if(vendor != GSR_GPU_VENDOR_NVIDIA) {
-        if(!vaapi_create_codec_context(codec_context, card_path)) {
-            avcodec_free_context(&codec_context);
-            return false;
-        }
-    }
-
-    bool success = false;
-    success = avcodec_open2(codec_context, codec_context->codec, NULL) == 0;
-    if(codec_context->hw_device_ctx)
-        av_buffer_unref(&codec_context->hw_device_ctx);
-    if(codec_context->hw_frames_ctx)
-        av_buffer_unref(&codec_context->hw_frames_ctx);
-    avcodec_free_context(&codec_context);
-    return success;
+// Returns nullptr if the gpu (or the driver) can't encode |video_codec|
+static const AVCodec* find_video_encoder(VideoCodec video_codec, gsr_gpu_vendor vendor, const gsr_encoder_capabilities &encoder_caps) {
+    const gsr_video_codec codec = video_codec_to_gsr_video_codec(video_codec);
+    if(!encoder_caps.codecs[codec].supported)
+        return nullptr;
+    return gsr_video_codec_find_encoder(codec, vendor);
 }
 
-static const AVCodec* find_h264_encoder(gsr_gpu_vendor vendor, const char *card_path) {
-    const AVCodec *codec = avcodec_find_encoder_by_name(vendor == GSR_GPU_VENDOR_NVIDIA ? "h264_nvenc" : "h264_vaapi");
-    if(!codec)
-        codec = avcodec_find_encoder_by_name(vendor == GSR_GPU_VENDOR_NVIDIA ? "nvenc_h264" : "vaapi_h264");
+// flv only supports h264 and webm only supports vp8, vp9 and av1
+static bool is_video_codec_supported_by_container(VideoCodec video_codec, const AVFormatContext *format_context) {
+    const char *format_name = format_context->oformat->name;
+    if(strcmp(format_name, "flv") == 0)
+        return video_codec == VideoCodec::H264;
+    else if(strcmp(format_name, "webm") == 0)
+        return video_codec == VideoCodec::AV1 || video_codec == VideoCodec::VP9;
+    return true;
+}
 
-    if(!codec)
-        return nullptr;
+// The codec that is used instead when the requested codec isn't supported by the container
+static VideoCodec get_container_fallback_video_codec(const AVFormatContext *format_context, gsr_gpu_vendor vendor, const gsr_encoder_capabilities &encoder_caps) {
+    if(strcmp(format_context->oformat->name, "webm") == 0)
+        return find_video_encoder(VideoCodec::AV1, vendor, encoder_caps) ? VideoCodec::AV1 : VideoCodec::VP9;
+    return VideoCodec::H264;
+}
 
-    static bool checked = false;
-    static bool checked_success = true;
-    if(!checked) {
-        checked = true;
-        if(!check_if_codec_valid_for_hardware(codec, vendor, card_path))
-            checked_success = false;
-    }
-    return checked_success ? codec : nullptr;
+// webm only supports opus (and vorbis) audio and -ac is always set to aac for now, because opus gets static noise when audio inputs are merged
+static bool is_audio_supported_by_container(const AVOutputFormat *output_format) {
+    return strcmp(output_format->name, "webm") != 0;
 }
 
-static const AVCodec* find_h265_encoder(gsr_gpu_vendor vendor, const char *card_path) {
-    const AVCodec *codec = avcodec_find_encoder_by_name(vendor == GSR_GPU_VENDOR_NVIDIA ? "hevc_nvenc" : "hevc_vaapi");
-    if(!codec)
-        codec = avcodec_find_encoder_by_name(vendor == GSR_GPU_VENDOR_NVIDIA ? "nvenc_hevc" : "vaapi_hevc");
+static bool is_mov_container(const AVFormatContext *format_context) {
+    const char *format_name = format_context->oformat->name;
+    return strcmp(format_name, "mp4") == 0 || strcmp(format_name, "mov") == 0;
+}
 
-    if(!codec)
-        return nullptr;
+// hevc in mp4/mov is tagged hvc1 (instead of the default hev1) because some players (apple) only play hvc1. Other codecs and containers use the default tag
+static void set_video_stream_parameters(AVStream *stream, const AVFormatContext *format_context, const AVCodecContext *codec_context) {
+    avcodec_parameters_from_context(stream->codecpar, codec_context);
+    stream->codecpar->codec_tag = 0;
+    if(codec_context->codec_id == AV_CODEC_ID_HEVC && is_mov_container(format_context))
+        stream->codecpar->codec_tag = MKTAG('h', 'v', 'c', '1');
+}
 
-    static bool checked = false;
-    static bool checked_success = true;
-    if(!checked) {
-        checked = true;
-        if(!check_if_codec_valid_for_hardware(codec, vendor, card_path))
-            checked_success = false;
+// av1 and vp9 use a quantizer index in the range 0-255, instead of the 0-51 qp of h264 and hevc
+static int video_quality_to_qindex(VideoQuality video_quality) {
+    switch(video_quality) {
+        case VideoQuality::MEDIUM:    return 180;
+        case VideoQuality::HIGH:      return 150;
+        case VideoQuality::VERY_HIGH: return 120;
+        case VideoQuality::ULTRA:     return 80;
     }
-    return checked_success ? codec : nullptr;
+    return 120;
 }
 
 static AVFrame* open_audio(AVCodecContext *audio_codec_context) {
@@ -509,62 +501,138 @@ static AVFrame* open_audio(AVCodecContext *audio_codec_context) {
     return frame;
 }
 
-static void open_video(AVCodecContext *codec_context, VideoQuality video_quality, bool very_old_gpu, gsr_gpu_vendor vendor, PixelFormat pixel_format) {
-    AVDictionary *options = nullptr;
-    if(vendor == GSR_GPU_VENDOR_NVIDIA) {
-        bool supports_p4 = false;
-        bool supports_p6 = false;
-
-        const AVOption *opt = nullptr;
-        while((opt = av_opt_next(codec_context->priv_data, opt))) {
-            if(opt->type == AV_OPT_TYPE_CONST) {
-                if(strcmp(opt->name, "p4") == 0)
-                    supports_p4 = true;
-                else if(strcmp(opt->name, "p6") == 0)
-                    supports_p6 = true;
-            }
+static void set_video_bitrate(AVCodecContext *codec_context, int64_t bitrate) {
+    codec_context->bit_rate = bitrate;
+    codec_context->rc_max_rate = bitrate;
+    codec_context->rc_buffer_size = bitrate; // One second
+}
+
+// The bitrate (max bitrate with BitrateMode::CQ) that is used when no bitrate is specified, in bits per second.
+// The bitrate of a livestream is lowered from this if the network can't keep up
+static int64_t get_default_video_bitrate(const AVCodecContext *codec_context, VideoQuality video_quality) {
+    double bits_per_pixel = 0.0;
+    switch(video_quality) {
+        case VideoQuality::MEDIUM:
+            bits_per_pixel = 0.04;
+            break;
+        case VideoQuality::HIGH:
+            bits_per_pixel = 0.06;
+            break;
+        case VideoQuality::VERY_HIGH:
+            bits_per_pixel = 0.08;
+            break;
+        case VideoQuality::ULTRA:
+            bits_per_pixel = 0.11;
+            break;
+    }
+    const double fps = codec_context->framerate.den > 0 ? av_q2d(codec_context->framerate) : 60.0;
+    return std::max((int64_t)500000, (int64_t)((double)codec_context->width * (double)codec_context->height * fps * bits_per_pixel));
+}
+
+// The h264/hevc quantizer for |video_quality|. Also used as the target quality with BitrateMode::CQ
+static int video_quality_to_qp(VideoQuality video_quality, gsr_gpu_vendor vendor, bool very_old_gpu) {
+    if(vendor == GSR_GPU_VENDOR_NVIDIA && very_old_gpu) {
+        switch(video_quality) {
+            case VideoQuality::MEDIUM:    return 37;
+            case VideoQuality::HIGH:      return 32;
+            case VideoQuality::VERY_HIGH: return 27;
+            case VideoQuality::ULTRA:     return 21;
         }
+    } else if(vendor == GSR_GPU_VENDOR_NVIDIA) {
+        switch(video_quality) {
+            case VideoQuality::MEDIUM:    return 40;
+            case VideoQuality::HIGH:      return 35;
+            case VideoQuality::VERY_HIGH: return 30;
+            case VideoQuality::ULTRA:     return 24;
+        }
+    } else {
+        switch(video_quality) {
+            case VideoQuality::MEDIUM:    return 32;
+            case VideoQuality::HIGH:      return 28;
+            case VideoQuality::VERY_HIGH: return 24;
+            case VideoQuality::ULTRA:     return 18;
+        }
+    }
+    return 24;
+}
 
-        if(very_old_gpu) {
-            switch(video_quality) {
-                case VideoQuality::MEDIUM:
-                    av_dict_set_int(&options, "qp", 37, 0);
-                    break;
-                case VideoQuality::HIGH:
-                    av_dict_set_int(&options, "qp", 32, 0);
-                    break;
-                case VideoQuality::VERY_HIGH:
-                    av_dict_set_int(&options, "qp", 27, 0);
-                    break;
-                case VideoQuality::ULTRA:
-                    av_dict_set_int(&options, "qp", 21, 0);
-                    break;
-            }
-        } else {
-            switch(video_quality) {
-                case VideoQuality::MEDIUM:
-                    av_dict_set_int(&options, "qp", 40, 0);
-                    break;
-                case VideoQuality::HIGH:
-                    av_dict_set_int(&options, "qp", 35, 0);
-                    break;
-                case VideoQuality::VERY_HIGH:
-                    av_dict_set_int(&options, "qp", 30, 0);
-                    break;
-                case VideoQuality::ULTRA:
-                    av_dict_set_int(&options, "qp", 24, 0);
-                    break;
-            }
+static bool parse_bitrate_mode(const char *str, BitrateMode &bitrate_mode) {
+    if(strcmp(str, "auto") == 0)
+        bitrate_mode = BitrateMode::AUTO;
+    else if(strcmp(str, "qp") == 0)
+        bitrate_mode = BitrateMode::QP;
+    else if(strcmp(str, "cq") == 0)
+        bitrate_mode = BitrateMode::CQ;
+    else if(strcmp(str, "vbr") == 0)
+        bitrate_mode = BitrateMode::VBR;
+    else if(strcmp(str, "cbr") == 0)
+        bitrate_mode = BitrateMode::CBR;
+    else
+        return false;
+    return true;
+}
+
+// |bitrate| is set in bits per second
+static bool parse_bitrate_kbps(const char *str, int64_t &bitrate) {
+    char *end = nullptr;
+    errno = 0;
+    const long long bitrate_kbps = strtoll(str, &end, 10);
+    if(errno != 0 || end == str || *end != '\0' || bitrate_kbps <= 0 || bitrate_kbps > 1000000)
+        return false;
+    bitrate = (int64_t)bitrate_kbps * 1000;
+    return true;
+}
+
+// |bitrate| is in bits per second, 0 to use get_default_video_bitrate. It's not used with BitrateMode::QP
+static void open_video(AVCodecContext *codec_context, VideoQuality video_quality, bool very_old_gpu, gsr_gpu_vendor vendor, PixelFormat pixel_format, bool is_livestream, BitrateMode bitrate_mode, int64_t bitrate, int lookahead, bool low_latency, const gsr_video_codec_capabilities &codec_caps) {
+    AVDictionary *options = nullptr;
+    const bool auto_bitrate_mode = bitrate_mode == BitrateMode::AUTO;
+    if(bitrate_mode == BitrateMode::AUTO)
+        bitrate_mode = is_livestream ? BitrateMode::CBR : BitrateMode::QP;
+    if(bitrate_mode == BitrateMode::QP && bitrate > 0) {
+        fprintf(stderr, "Warning: the bitrate %lld kbps is ignored because the bitrate mode is 'qp'%s, which only uses the quality. Use the 'cq', 'vbr' or 'cbr' bitrate mode to limit the bitrate\n",
+            (long long)(bitrate / 1000), auto_bitrate_mode ? " ('auto' uses 'qp' when recording to a file)" : "");
+    }
+    if(bitrate <= 0)
+        bitrate = get_default_video_bitrate(codec_context, video_quality);
+
+    // av1 and vp9 use a quantizer index (0-255) for constant qp
+    const bool uses_qindex = codec_context->codec_id == AV_CODEC_ID_AV1 || codec_context->codec_id == AV_CODEC_ID_VP9;
+    const int qp = uses_qindex ? video_quality_to_qindex(video_quality) : video_quality_to_qp(video_quality, vendor, very_old_gpu);
+
+    if(vendor == GSR_GPU_VENDOR_NVIDIA) {
+        const bool supports_p4 = codec_caps.preset_p4;
+        const bool supports_p6 = codec_caps.preset_p6;
+
+        switch(bitrate_mode) {
+            case BitrateMode::AUTO:
+            case BitrateMode::QP:
+                av_dict_set(&options, "rc", "constqp", 0);
+                av_dict_set_int(&options, "qp", qp, 0);
+                break;
+            case BitrateMode::CQ:
+                // With no average bitrate nvenc only targets the quality, limited by the max bitrate
+                av_dict_set(&options, "rc", "vbr", 0);
+                av_dict_set_int(&options, "cq", video_quality_to_qp(video_quality, vendor, very_old_gpu), 0);
+                codec_context->bit_rate = 0;
+                codec_context->rc_max_rate = bitrate;
+                codec_context->rc_buffer_size = bitrate * 2;
+                break;
+            case BitrateMode::VBR:
+                av_dict_set(&options, "rc", "vbr", 0);
+                codec_context->bit_rate = bitrate;
+                codec_context->rc_max_rate = bitrate * 3 / 2;
+                codec_context->rc_buffer_size = bitrate * 2;
+                break;
+            case BitrateMode::CBR:
+                av_dict_set(&options, "rc", "cbr", 0);
+                set_video_bitrate(codec_context, bitrate);
+                break;
         }
 
         if(!supports_p4 && !supports_p6)
             fprintf(stderr, "Info: your ffmpeg version is outdated. It's recommended that you use the flatpak version of gpu-screen-recorder version instead, which you can find at https://flathub.org/apps/details/com.dec05eba.gpu_screen_recorder\n");
 
-        //if(is_livestream) {
-        //    av_dict_set_int(&options, "zerolatency", 1, 0);
-        //    //av_dict_set(&options, "preset", "llhq", 0);
-        //}
-
         // I want to use a good preset for the gpu but all gpus prefer different
         // presets. Nvidia and ffmpeg used to support "hq" preset that chose the best preset for the gpu
         // with pretty good performance but you now have to choose p1-p7, which are gpu agnostic and on
@@ -576,9 +644,37 @@ static void open_video(AVCodecContext *codec_context, VideoQuality video_quality
         else
             av_dict_set(&options, "preset", supports_p6 ? "p6" : "slow", 0);
 
-        av_dict_set(&options, "tune", "hq", 0);
-        av_dict_set(&options, "rc", "constqp", 0);
+        if(low_latency) {
+            // The packet of a frame is output as soon as the frame has been encoded, without waiting for more frames
+            if(supports_p4 || supports_p6)
+                av_dict_set(&options, "tune", "ull", 0);
+            else
+                av_dict_set(&options, "preset", "llhq", 0);
+            av_dict_set_int(&options, "zerolatency", 1, 0);
+            av_dict_set_int(&options, "delay", 0, 0);
+        } else {
+            av_dict_set(&options, "tune", "hq", 0);
+        }
 
+        // Keyframes that are requested (to recover from dropped packets, or with SIGUSR2) have to be idr frames for the video to be decodable from them
+        av_dict_set_int(&options, "forced-idr", 1, 0);
+
+        // The encoder looks at the next |lookahead| frames to decide where to put b-frames and how to spread the bitrate.
+        // Temporal aq needs the lookahead, it gives more bits to the parts of the image that stay the same over time
+        // The gpu might not support them, nvenc fails to open then
+        if(lookahead > 0) {
+            if(codec_caps.lookahead) {
+                av_dict_set_int(&options, "rc-lookahead", lookahead, 0);
+                if(codec_caps.temporal_aq)
+                    av_dict_set_int(&options, "temporal-aq", 1, 0);
+                else
+                    fprintf(stderr, "Warning: your gpu doesn't support temporal aq with the %s codec, recording with only the lookahead\n", codec_context->codec->name);
+            } else {
+                fprintf(stderr, "Warning: your gpu doesn't support lookahead with the %s codec, -lookahead is ignored\n", codec_context->codec->name);
+            }
+        }
+
+        // The av1 profile is selected by nvenc from the pixel format
         if(codec_context->codec_id == AV_CODEC_ID_H264) {
             switch(pixel_format) {
                 case PixelFormat::YUV420:
@@ -588,35 +684,65 @@ static void open_video(AVCodecContext *codec_context, VideoQuality video_quality
                     av_dict_set(&options, "profile", "high444p", 0);
                     break;
             }
-        } else {
-            //av_dict_set(&options, "profile", "main10", 0);
-            //av_dict_set(&options, "pix_fmt", "yuv420p16le", 0);
+        } else if(codec_context->codec_id == AV_CODEC_ID_HEVC) {
+            switch(pixel_format) {
+                case PixelFormat::YUV420:
+                    //av_dict_set(&options, "profile", "main10", 0);
+                    //av_dict_set(&options, "pix_fmt", "yuv420p16le", 0);
+                    break;
+                case PixelFormat::YUV444:
+                    av_dict_set(&options, "profile", "rext", 0);
+                    break;
+            }
         }
     } else {
-        switch(video_quality) {
-            case VideoQuality::MEDIUM:
-                av_dict_set_int(&options, "qp", 32, 0);
+        switch(bitrate_mode) {
+            case BitrateMode::AUTO:
+            case BitrateMode::QP:
+                av_dict_set(&options, "rc_mode", "CQP", 0);
+                // The av1 and vp9 vaapi encoders don't have a qp option, they use the global quality as the quantizer index
+                if(uses_qindex)
+                    codec_context->global_quality = qp;
+                else
+                    av_dict_set_int(&options, "qp", qp, 0);
                 break;
-            case VideoQuality::HIGH:
-                av_dict_set_int(&options, "qp", 28, 0);
+            case BitrateMode::CQ:
+                // QVBR targets the quality and never goes above the max bitrate. Drivers without QVBR (AMD) would use CQP if rc_mode is left to ffmpeg,
+                // so VBR is used explicitly instead, which averages to a lower bitrate than the max
+                if(codec_caps.qvbr) {
+                    av_dict_set(&options, "rc_mode", "QVBR", 0);
+                    codec_context->global_quality = qp;
+                    codec_context->bit_rate = bitrate;
+                } else {
+                    av_dict_set(&options, "rc_mode", "VBR", 0);
+                    codec_context->bit_rate = bitrate * 2 / 3;
+                }
+                codec_context->rc_max_rate = bitrate;
+                codec_context->rc_buffer_size = bitrate * 2;
                 break;
-            case VideoQuality::VERY_HIGH:
-                av_dict_set_int(&options, "qp", 24, 0);
+            case BitrateMode::VBR:
+                av_dict_set(&options, "rc_mode", "VBR", 0);
+                codec_context->bit_rate = bitrate;
+                codec_context->rc_max_rate = bitrate * 3 / 2;
+                codec_context->rc_buffer_size = bitrate * 2;
                 break;
-            case VideoQuality::ULTRA:
-                av_dict_set_int(&options, "qp", 18, 0);
+            case BitrateMode::CBR:
+                av_dict_set(&options, "rc_mode", "CBR", 0);
+                set_video_bitrate(codec_context, bitrate);
                 break;
         }
-
-        // TODO: More quality options
-        av_dict_set(&options, "rc_mode", "CQP", 0);
         //av_dict_set_int(&options, "low_power", 1, 0);
 
+        // Only one frame in the driver at a time, so the packet of a frame can be received before the next frame is sent
+        if(low_latency)
+            av_dict_set_int(&options, "async_depth", 1, 0);
+
+        // The av1 and vp9 profiles are selected by vaapi from the pixel format of the frames
         if(codec_context->codec_id == AV_CODEC_ID_H264) {
             av_dict_set(&options, "profile", "high", 0);
             av_dict_set_int(&options, "quality", 7, 0);
-        } else {
-            av_dict_set(&options, "profile", "main", 0);
+        } else if(codec_context->codec_id == AV_CODEC_ID_HEVC) {
+            av_dict_set(&options, "profile", pixel_format == PixelFormat::YUV444 ? "rext" : "main", 0);
         }
     }
 
@@ -634,27 +760,33 @@ static void open_video(AVCodecContext *codec_context, VideoQuality video_quality
 }
 
 static void usage_header() {
-    fprintf(stderr, "usage: gpu-screen-recorder -w <window_id|monitor|focused> [-c <container_format>] [-s WxH] -f <fps> [-a <audio_input>] [-q <quality>] [-r <replay_buffer_size_sec>] [-k h264|h265] [-ac aac|opus|flac] [-oc yes|no] [-fm cfr|vfr] [-v yes|no] [-h|--help] [-o <output_file>]\n");
+    fprintf(stderr, "usage: gpu-screen-recorder -w <window_id|monitor|focused> [-c <container_format>] [-s WxH] [-sf bilinear|bicubic|lanczos] -f <fps> [-a <audio_input>] [-q <quality>] [-r <replay_buffer_size_sec>] [-ro <output_file>] [-k h264|h265|av1|vp9] [-ac aac|opus|flac] [-oc yes|no] [-fm cfr|vfr] [-pixfmt yuv420|yuv444] [-keyint <seconds>] [-bf <0-4>] [-lookahead <frames>] [-tune quality|latency] [-frag <seconds>] [-faststart <minutes>] [-bm auto|qp|cq|vbr|cbr] [-b <bitrate_kbps>] [-so <output>|<WxH>|<quality>|<codec>|<bitrate_mode>|<bitrate_kbps>] [-trace yes|no] [-v yes|no] [-h|--help] [-o <output_file>]\n");
 }
 
 static void usage_full() {
     usage_header();
     fprintf(stderr, "\n");
     fprintf(stderr, "OPTIONS:\n");
-    fprintf(stderr, "  -w    Window to record, a display, \"screen\", \"screen-direct\", \"screen-direct-force\" or \"focused\".\n");
+    fprintf(stderr, "  -w    Window to record, a display, \"screen\", \"screen-direct\", \"screen-direct-force\", \"focused\" or a region in the format region:X,Y,WxH.\n");
     fprintf(stderr, "        The display is the display (monitor) name in xrandr and if \"screen\", \"screen-direct\" or \"screen-direct-force\" is selected then all displays are recorded.\n");
     fprintf(stderr, "        If this is \"focused\" then the currently focused window is recorded. When recording the focused window then the -s option has to be used as well.\n");
+    fprintf(stderr, "        The focused window is centered in the video and scaled down if it's larger than the size given with -s.\n");
     fprintf(stderr, "        \"screen-direct\"/\"screen-direct-force\" skips one texture copy for fullscreen applications so it may lead to better performance and it works with VRR monitors\n");
     fprintf(stderr, "        when recording fullscreen application but may break some applications, such as mpv in fullscreen mode. Direct mode doesn't capture cursor either.\n");
     fprintf(stderr, "        \"screen-direct-force\" is not recommended unless you use a VRR monitor because there might be driver issues that cause the video to stutter or record a black screen.\n");
     fprintf(stderr, "        On AMD/Intel, capturing a monitor might have better performance than recording a single window.\n");
+    fprintf(stderr, "        A region records part of the screen, for example region:100,200,1280x720 records a 1280x720 area at position 100,200. Only the pixels inside the region are converted and encoded.\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "  -c    Container format for output file, for example mp4, or flv. Only required if no output file is specified or if recording in replay buffer mode.\n");
     fprintf(stderr, "        If an output file is specified and -c is not used then the container format is determined from the output filename extension.\n");
-    fprintf(stderr, "        Only containers that support h264 or hevc are supported, which means that only mp4, mkv, flv (and some others) are supported.\n");
-    fprintf(stderr, "        WebM is not supported yet.\n");
+    fprintf(stderr, "        Only containers that support h264, hevc, av1 or vp9 are supported, for example mp4, mkv, webm and flv.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -s    The size (area) to record at in the format WxH, for example 1920x1080. This option is required when -w is \"focused\".\n");
+    fprintf(stderr, "        When recording a monitor, \"screen\" or a window the video is scaled down/up on the gpu to fit inside this size (keeping the aspect ratio),\n");
+    fprintf(stderr, "        for example to record a 4k monitor at 1080p. Optional, the video is not scaled by default.\n");
     fprintf(stderr, "\n");
-    fprintf(stderr, "  -s    The size (area) to record at in the format WxH, for example 1920x1080. This option is only supported (and required) when -w is \"focused\".\n");
+    fprintf(stderr, "  -sf   Scaling filter to use when the video is scaled with -s. Should be either 'bilinear', 'bicubic' or 'lanczos'. 'bilinear' is the fastest and 'lanczos' is the sharpest.\n");
+    fprintf(stderr, "        NvFBC (monitor capture on NVIDIA) uses its own scaling and ignores this option. Optional, set to 'bicubic' by default.\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "  -f    Framerate to record at.\n");
     fprintf(stderr, "\n");
@@ -664,17 +796,22 @@ static void usage_full() {
     fprintf(stderr, "        Optional, no audio track is added by default.\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "  -q    Video quality. Should be either 'medium', 'high', 'very_high' or 'ultra'. 'high' is the recommended option when live streaming or when you have a slower harddrive.\n");
-    fprintf(stderr, "        Optional, set to 'very_high' be default.\n");
+    fprintf(stderr, "        When live streaming the video is encoded at a bitrate instead, which the quality sets the highest value of. On NVIDIA the bitrate is lowered\n");
+    fprintf(stderr, "        automatically when the network can't keep up and raised again when it can. Optional, set to 'very_high' be default.\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "  -r    Replay buffer size in seconds. If this is set, then only the last seconds as set by this option will be stored\n");
     fprintf(stderr, "        and the video will only be saved when the gpu-screen-recorder is closed. This feature is similar to Nvidia's instant replay feature.\n");
-    fprintf(stderr, "        This option has be between 5 and 1200. Note that the replay buffer size will not always be precise, because of keyframes. Optional, disabled by default.\n");
+    fprintf(stderr, "        This option has be between 5 and 1200. A replay starts at a keyframe, so it can be up to one keyframe interval (-keyint) longer. Optional, disabled by default.\n");
     fprintf(stderr, "\n");
-    fprintf(stderr, "  -k    Video codec to use. Should be either 'auto', 'h264' or 'h265'. Defaults to 'auto' which defaults to 'h265' unless recording at fps higher than 60. Defaults to 'h264' on intel.\n");
-    fprintf(stderr, "        Forcefully set to 'h264' if -c is 'flv'.\n");
+    fprintf(stderr, "  -ro   Also record the whole video to this file (or livestream url) in replay mode (when using -r). The recording uses the same encoded video as the replay buffer,\n");
+    fprintf(stderr, "        so the video is only encoded once. The container format is determined from the file extension (flv for livestream urls). Optional, disabled by default.\n");
     fprintf(stderr, "\n");
-    fprintf(stderr, "  -ac   Audio codec to use. Should be either 'aac', 'opus' or 'flac'. Defaults to 'opus' for .mp4/.mkv files, otherwise defaults to 'aac'.\n");
-    fprintf(stderr, "        'opus' and 'flac' is only supported by .mp4/.mkv files. 'opus' is recommended for best performance and smallest audio size.\n");
+    fprintf(stderr, "  -k    Video codec to use. Should be either 'auto', 'h264', 'h265', 'av1' or 'vp9'. Defaults to 'auto' which defaults to 'h265' unless recording at fps higher than 60. Defaults to 'h264' on intel.\n");
+    fprintf(stderr, "        Forcefully set to 'h264' if -c is 'flv'. Defaults to 'av1' (or 'vp9' if av1 isn't supported) if -c is 'webm', which only supports these codecs.\n");
+    fprintf(stderr, "        av1 requires a recent gpu (NVIDIA RTX 40 series, AMD RX 7000 series or Intel Arc). vp9 is only supported on AMD/Intel.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -ac   Audio codec to use. Should be either 'aac', 'opus' or 'flac'. At the moment 'aac' is always used because of issues with 'opus' and 'flac'.\n");
+    fprintf(stderr, "        'opus' and 'flac' is only supported by .mp4/.mkv files. webm files only support 'opus' audio, so they can't have audio (-a) at the moment.\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "  -oc   Overclock memory transfer rate to the maximum performance level. This only applies to NVIDIA and exists to overcome a bug in NVIDIA driver where performance level\n");
     fprintf(stderr, "        is dropped when you record a game. Only needed if you are recording a game that is bottlenecked by GPU.\n");
@@ -682,22 +819,65 @@ static void usage_full() {
     fprintf(stderr, "\n");
     fprintf(stderr, "  -fm   Framerate mode. Should be either 'cfr' or 'vfr'. Defaults to 'cfr' on NVIDIA and 'vfr' on AMD/Intel.\n");
     fprintf(stderr, "\n");
+    fprintf(stderr, "  -pixfmt  The pixel format to use for the output video. yuv420 is the most common format and is best supported, but the color is compressed, so colors can look washed out and certain colors of text can look bad.\n");
+    fprintf(stderr, "        Use yuv444 for no color compression, but the video may not work everywhere and it may not work with hardware video decoding. yuv444 can't be used when live streaming.\n");
+    fprintf(stderr, "        On AMD/Intel yuv444 requires h265 and a gpu that supports h265 range extension encoding. Optional, defaults to yuv420\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -keyint  The time between keyframes in seconds. A video can only be cut or seeked at a keyframe, so a shorter interval allows more precise replays and seeking\n");
+    fprintf(stderr, "        and lets a livestream recover faster after lost packets, but makes the video larger. Optional, set to 2 by default.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -bf   The max number of b-frames in a row, between 0 and 4. B-frames are predicted from both the frames before and after them, which makes the video smaller at the same quality\n");
+    fprintf(stderr, "        but delays the encoding by a few frames. Disabled if your gpu doesn't support b-frames for the video codec. Optional, set to 0 by default.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -lookahead  The number of frames the encoder looks ahead to decide where to put b-frames and how to spread the bitrate, between 0 and 32. Also enables temporal adaptive quantization.\n");
+    fprintf(stderr, "        Improves the quality but delays the encoding by this many frames. Only supported on NVIDIA, it's ignored (with a warning) on gpus that don't support it. Optional, set to 0 (disabled) by default.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -tune  Should be either 'quality' or 'latency'. 'latency' makes the encoder output the packet of a frame as soon as it has been encoded and writes it to the output right away,\n");
+    fprintf(stderr, "        which is useful for game streaming where the delay matters more than the quality. -bf and -lookahead are ignored with 'latency'. Optional, set to 'quality' by default.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -frag  Write mp4/mov files in fragments and mkv/webm files in clusters of at most this many seconds (a new fragment also starts at every keyframe).\n");
+    fprintf(stderr, "        A fragmented file can be played up to the last fragment even if gpu-screen-recorder crashes or is killed, but some video players and editors don't support fragmented mp4.\n");
+    fprintf(stderr, "        Doesn't apply to livestreams and saved replays. Optional, disabled by default.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -faststart  Reserve space at the start of mp4/mov files for the index of a recording of up to this many minutes, so the file can be played while it's downloaded (web streamable)\n");
+    fprintf(stderr, "        without rewriting the whole file at the end. About 25MB is reserved for an hour at 60 fps with one audio track. If the recording is longer, the index is written at the end as usual.\n");
+    fprintf(stderr, "        Saved replays get the space they need. Ignored with -frag, where the index is always at the start. Optional, disabled by default.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -bm   Bitrate mode. Should be either 'auto', 'qp', 'cq', 'vbr' or 'cbr'. 'qp' encodes every frame at the same quality (-q), the file size depends on what is recorded.\n");
+    fprintf(stderr, "        'cq' also targets the quality but never goes above the bitrate (-b), which gives smaller files than 'qp'. 'vbr' averages to the bitrate and 'cbr' keeps the bitrate constant,\n");
+    fprintf(stderr, "        which livestreaming services require. With vaapi drivers that don't support constant quality with a max bitrate (AMD) 'cq' uses 'vbr' with the bitrate (-b) as the max bitrate.\n");
+    fprintf(stderr, "        Optional, set to 'auto' by default, which is 'cbr' when live streaming and 'qp' otherwise.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -b    The bitrate in kbps for the 'cq', 'vbr' and 'cbr' bitrate modes (-bm), it's ignored with 'qp' (which 'auto' uses when recording to a file). Optional, by default the bitrate is based on the quality (-q), the video size and the framerate.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -so   Additional output, in the format <output>|<WxH>|<quality>|<codec>|<bitrate_mode>|<bitrate_kbps>. Can be specified multiple times. The captured video is encoded once more for each -so output,\n");
+    fprintf(stderr, "        for example to record a high quality local file with -o while live streaming at a lower resolution with -so. The capture is shared by all outputs.\n");
+    fprintf(stderr, "        <output> is a file path or a livestream url, the container format is determined from the file extension (flv for livestream urls).\n");
+    fprintf(stderr, "        <WxH> is the size the video is scaled to fit inside (as with -s), <quality> is as -q and <codec> is either 'h264', 'h265', 'av1' or 'vp9'.\n");
+    fprintf(stderr, "        <bitrate_mode> and <bitrate_kbps> are as -bm and -b.\n");
+    fprintf(stderr, "        All fields except <output> are optional, for example \"video.mp4||high\". Empty fields are the same as for the main output, the video is not scaled if <WxH> is empty.\n");
+    fprintf(stderr, "        The audio tracks (-a) are added to all outputs. Only supported on AMD/Intel and not when -w is \"focused\". Optional, disabled by default.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -trace  Prints the time in microseconds from the start of the capture of a frame until its packet has been written, for each video packet and output (except the replay buffer).\n");
+    fprintf(stderr, "        Each line starts with the time it was printed (monotonic, in seconds). Optional, set to 'no' by default.\n");
+    fprintf(stderr, "\n");
     fprintf(stderr, "  -v    Prints per second, fps updates. Optional, set to 'yes' by default.\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "  -h    Show this help.\n");
     fprintf(stderr, "\n");
-    //fprintf(stderr, "  -pixfmt  The pixel format to use for the output video. yuv420 is the most common format and is best supported, but the color is compressed, so colors can look washed out and certain colors of text can look bad. Use yuv444 for no color compression, but the video may not work everywhere and it may not work with hardware video decoding. Optional, defaults to yuv420\n");
     fprintf(stderr, "  -o    The output file path. If omitted then the encoded data is sent to stdout. Required in replay mode (when using -r).\n");
     fprintf(stderr, "        In replay mode this has to be an existing directory instead of a file.\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "NOTES:\n");
     fprintf(stderr, "  Send signal SIGINT to gpu-screen-recorder (Ctrl+C, or killall gpu-screen-recorder) to stop and save the recording (when not using replay mode).\n");
     fprintf(stderr, "  Send signal SIGUSR1 to gpu-screen-recorder (killall -SIGUSR1 gpu-screen-recorder) to save a replay (when in replay mode).\n");
+    fprintf(stderr, "  Send signal SIGUSR2 to gpu-screen-recorder (killall -SIGUSR2 gpu-screen-recorder) to start a new keyframe in all outputs right away, for example where a video should be cut later.\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "EXAMPLES\n");
     fprintf(stderr, "  gpu-screen-recorder -w screen -f 60 -a \"$(pactl get-default-sink).monitor\" -o video.mp4\n");
     fprintf(stderr, "  gpu-screen-recorder -w screen -f 60 -a \"$(pactl get-default-sink).monitor|$(pactl get-default-source)\" -o video.mp4\n");
-    //fprintf(stderr, "  gpu-screen-recorder -w screen -f 60 -q ultra -pixfmt yuv444 -o video.mp4\n");
+    fprintf(stderr, "  gpu-screen-recorder -w screen -f 60 -q ultra -pixfmt yuv444 -o video.mp4\n");
+    fprintf(stderr, "  gpu-screen-recorder -w screen -f 60 -a \"$(pactl get-default-sink).monitor\" -o video.mp4 -so \"rtmp://live.twitch.tv/app/<stream_key>|1920x1080|high|h264\"\n");
     _exit(1);
 }
 
@@ -708,6 +888,7 @@ static void usage() {
 
 static sig_atomic_t running = 1;
 static sig_atomic_t save_replay = 0;
+static sig_atomic_t request_keyframe = 0;
 
 static void int_handler(int) {
     running = 0;
@@ -717,6 +898,10 @@ static void save_replay_handler(int) {
     save_replay = 1;
 }
 
+static void request_keyframe_handler(int) {
+    request_keyframe = 1;
+}
+
 struct Arg {
     std::vector<const char*> values;
     bool optional = false;
@@ -776,6 +961,132 @@ static AVStream* create_stream(AVFormatContext *av_format_context, AVCodecContex
     return stream;
 }
 
+// Opens the output file (unless the container doesn't use a file) and writes the header. Exits on failure.
+// With |low_latency| every packet is flushed to the file or network as soon as it has been written.
+// With |fragment_duration| (in seconds) > 0 the file is written in fragments (mp4/mov) or clusters (mkv/webm) of at most that length,
+// so that it can be played up to the last fragment if the recording is interrupted (crash or killed) before the trailer is written.
+// With |reserved_moov_size| > 0 space is reserved at the start of mp4/mov files for the moov atom (the index of the file), so that it can be
+// written there at the end and the file can be played while it's downloaded, without moving the whole file to make room for it (faststart).
+// Returns the size that was reserved, which has to be passed to close_output_file
+static int64_t open_output_file(AVFormatContext *av_format_context, const char *filename, bool low_latency, double fragment_duration, int64_t reserved_moov_size) {
+    if(low_latency)
+        av_format_context->flags |= AVFMT_FLAG_FLUSH_PACKETS;
+
+    if(!(av_format_context->oformat->flags & AVFMT_NOFILE)) {
+        int ret = avio_open(&av_format_context->pb, filename, AVIO_FLAG_WRITE);
+        if(ret < 0) {
+            fprintf(stderr, "Error: Could not open '%s': %s\n", filename, av_error_to_string(ret));
+            _exit(1);
+        }
+    }
+
+    AVDictionary *options = nullptr;
+    av_dict_set(&options, "strict", "experimental", 0);
+    //av_dict_set_int(&av_format_context->metadata, "video_full_range_flag", 1, 0);
+
+    if(fragment_duration > 0.0) {
+        const char *format_name = av_format_context->oformat->name;
+        if(is_mov_container(av_format_context)) {
+            // A new fragment starts at every keyframe, and before that if the fragment gets longer than |fragment_duration|
+            av_dict_set(&options, "movflags", "+frag_keyframe+empty_moov+default_base_moof", 0);
+            av_dict_set_int(&options, "frag_duration", fragment_duration * 1000000.0, 0);
+        } else if(strcmp(format_name, "matroska") == 0 || strcmp(format_name, "webm") == 0) {
+            av_dict_set_int(&options, "cluster_time_limit", fragment_duration * 1000.0, 0);
+        } else {
+            fprintf(stderr, "Warning: -frag is only supported by mp4, mov, mkv and webm files, '%s' is written without fragments\n", filename);
+        }
+    }
+
+    if(reserved_moov_size > 0) {
+        if(!is_mov_container(av_format_context)) {
+            fprintf(stderr, "Warning: -faststart is only supported by mp4 and mov files, ignoring it for '%s'\n", filename);
+            reserved_moov_size = 0;
+        } else if(fragment_duration > 0.0) {
+            // Fragmented files already have the moov at the start
+            reserved_moov_size = 0;
+        } else {
+            av_dict_set_int(&options, "moov_size", reserved_moov_size, 0);
+        }
+    }
+
+    int ret = avformat_write_header(av_format_context, &options);
+    if(ret < 0) {
+        fprintf(stderr, "Error occurred when writing header to output file '%s': %s\n", filename, av_error_to_string(ret));
+        _exit(1);
+    }
+
+    av_dict_free(&options);
+    return reserved_moov_size;
+}
+
+// An upper bound of the size of the moov atom of an mp4/mov file with |num_packets| packets in total (all streams).
+// Each packet adds at most about 50 bytes to the sample tables (size, duration, composition offset, sync, chunk and chunk offset)
+static int64_t get_max_moov_size(int64_t num_packets) {
+    return std::min((int64_t)INT_MAX, 65536 + num_packets * 64);
+}
+
+// The space reserved for the moov atom is left as zeros when the moov didn't fit in it and was written at the end of the file instead.
+// Players read that as an atom that goes to the end of the file, so it's replaced with a free atom. Only the atoms before the mdat are looked at
+static void mov_fill_reserved_moov_space(const char *filename, int64_t reserved_moov_size) {
+    FILE *file = fopen(filename, "r+b");
+    if(!file) {
+        fprintf(stderr, "Error: failed to open '%s' to mark the space reserved by -faststart as unused, the file might not be playable\n", filename);
+        return;
+    }
+
+    int64_t offset = 0;
+    for(;;) {
+        unsigned char header[8];
+        if(fseeko(file, offset, SEEK_SET) != 0 || fread(header, 1, sizeof(header), file) != sizeof(header))
+            break;
+
+        const uint32_t atom_size = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) | ((uint32_t)header[2] << 8) | (uint32_t)header[3];
+        if(atom_size == 0 && memcmp(header + 4, "\0\0\0\0", 4) == 0) {
+            const unsigned char free_header[8] = {
+                (unsigned char)(reserved_moov_size >> 24), (unsigned char)(reserved_moov_size >> 16), (unsigned char)(reserved_moov_size >> 8), (unsigned char)reserved_moov_size,
+                'f', 'r', 'e', 'e'
+            };
+            if(fseeko(file, offset, SEEK_SET) != 0 || fwrite(free_header, 1, sizeof(free_header), file) != sizeof(free_header))
+                fprintf(stderr, "Error: failed to mark the space reserved by -faststart as unused in '%s', the file might not be playable\n", filename);
+            break;
+        }
+
+        // Either the mdat (which comes after the reserved space) or an atom with a 64-bit size, which isn't used before the mdat
+        if(atom_size < 8 || memcmp(header + 4, "mdat", 4) == 0)
+            break;
+        offset += atom_size;
+    }
+
+    fclose(file);
+}
+
+// Writes the trailer and closes the file. |reserved_moov_size| is the size returned by open_output_file
+static void close_output_file(AVFormatContext *av_format_context, const char *filename, int64_t reserved_moov_size) {
+    bool moov_fits = true;
+    if(reserved_moov_size > 0) {
+        int64_t num_packets = 0;
+        for(unsigned int i = 0; i < av_format_context->nb_streams; ++i) {
+            num_packets += av_format_context->streams[i]->nb_frames;
+        }
+
+        // The muxer would overwrite the start of the video if it tried to write a moov that doesn't fit in the reserved space
+        if(get_max_moov_size(num_packets) > reserved_moov_size) {
+            fprintf(stderr, "Warning: the recording '%s' is longer than the -faststart duration, the index of the file is written at the end of the file instead\n", filename);
+            av_opt_set_int(av_format_context->priv_data, "moov_size", 0, 0);
+            moov_fits = false;
+        }
+    }
+
+    if(av_write_trailer(av_format_context) != 0)
+        fprintf(stderr, "Failed to write trailer for output '%s'\n", filename);
+
+    if(!(av_format_context->oformat->flags & AVFMT_NOFILE))
+        avio_close(av_format_context->pb);
+
+    if(!moov_fits)
+        mov_fill_reserved_moov_space(filename, reserved_moov_size);
+}
+
 struct AudioDevice {
     SoundDevice sound_device;
     AudioInput audio_input;
@@ -799,7 +1110,7 @@ static std::future<void> save_replay_thread;
 static std::vector<AVPacket> save_replay_packets;
 static std::string save_replay_output_filepath;
 
-static void save_replay_async(AVCodecContext *video_codec_context, int video_stream_index, std::vector<AudioTrack> &audio_tracks, const std::deque<AVPacket> &frame_data_queue, bool frames_erased, std::string output_dir, const char *container_format, const std::string &file_extension, std::mutex &write_output_mutex) {
+static void save_replay_async(AVCodecContext *video_codec_context, int video_stream_index, std::vector<AudioTrack> &audio_tracks, const std::deque<AVPacket> &frame_data_queue, const bool &frames_erased, std::string output_dir, const char *container_format, const std::string &file_extension, bool faststart, std::mutex &write_output_mutex) {
     if(save_replay_thread.valid())
         return;
     
@@ -843,12 +1154,12 @@ static void save_replay_async(AVCodecContext *video_codec_context, int video_str
     }
 
     save_replay_output_filepath = output_dir + "/Replay_" + get_date_str() + "." + file_extension;
-    save_replay_thread = std::async(std::launch::async, [video_stream_index, container_format, start_index, video_pts_offset, audio_pts_offset, video_codec_context, &audio_tracks]() mutable {
+    save_replay_thread = std::async(std::launch::async, [video_stream_index, container_format, start_index, video_pts_offset, audio_pts_offset, video_codec_context, faststart, &audio_tracks]() mutable {
         AVFormatContext *av_format_context;
         avformat_alloc_output_context2(&av_format_context, nullptr, container_format, nullptr);
 
         AVStream *video_stream = create_stream(av_format_context, video_codec_context);
-        avcodec_parameters_from_context(video_stream->codecpar, video_codec_context);
+        set_video_stream_parameters(video_stream, av_format_context, video_codec_context);
 
         std::unordered_map<int, AudioTrack*> stream_index_to_audio_track_map;
         for(AudioTrack &audio_track : audio_tracks) {
@@ -866,6 +1177,9 @@ static void save_replay_async(AVCodecContext *video_codec_context, int video_str
 
         AVDictionary *options = nullptr;
         av_dict_set(&options, "strict", "experimental", 0);
+        // All the packets are known, so the moov always fits in the reserved space
+        if(faststart && is_mov_container(av_format_context))
+            av_dict_set_int(&options, "moov_size", get_max_moov_size(save_replay_packets.size() - start_index), 0);
 
         ret = avformat_write_header(av_format_context, &options);
         if (ret < 0) {
@@ -953,6 +1267,97 @@ static bool is_livestream_path(const char *str) {
         return false;
 }
 
+static bool parse_video_quality(const char *str, VideoQuality &quality) {
+    if(strcmp(str, "medium") == 0) {
+        quality = VideoQuality::MEDIUM;
+    } else if(strcmp(str, "high") == 0) {
+        quality = VideoQuality::HIGH;
+    } else if(strcmp(str, "very_high") == 0) {
+        quality = VideoQuality::VERY_HIGH;
+    } else if(strcmp(str, "ultra") == 0) {
+        quality = VideoQuality::ULTRA;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// An additional encode of the captured video (-so)
+struct ExtraOutput {
+    std::string filename;
+    vec2i resolution = {0, 0};
+    VideoQuality quality = VideoQuality::VERY_HIGH;
+    VideoCodec codec = VideoCodec::H264;
+    BitrateMode bitrate_mode = BitrateMode::AUTO;
+    int64_t bitrate = 0; // In bits per second, 0 to use the default
+    bool is_livestream = false;
+
+    AVCodecContext *codec_context = nullptr;
+    gsr_encoder *encoder = nullptr;
+    AVFormatContext *format_context = nullptr;
+    AVStream *video_stream = nullptr;
+    AVFrame *frame = nullptr;
+    std::vector<PacketSink*> video_sinks;
+    int64_t reserved_moov_size = 0;
+};
+
+// A livestream encoder whose packets only go to one (network) sink
+struct LivestreamBitrateControl {
+    std::string name;
+    gsr_encoder *encoder = nullptr;
+    AVFrame **frame = nullptr; // The capture can reallocate the frame (in gsr_capture_tick), so this points to where the current frame is stored
+    PacketSink *sink = nullptr;
+    AdaptiveBitrate adaptive_bitrate;
+};
+
+// Format: <output>|<WxH>|<quality>|<codec>|<bitrate_mode>|<bitrate_kbps>. Empty fields keep the values already in |extra_output|
+static bool parse_extra_output_arg(const char *str, ExtraOutput &extra_output) {
+    std::vector<std::string> fields;
+    split_string(str, '|', [&fields](const char *sub, size_t size) {
+        fields.emplace_back(sub, size);
+        return true;
+    });
+
+    if(fields.empty() || fields[0].empty() || fields.size() > 6) {
+        fprintf(stderr, "Error: invalid value for option -so '%s', expected a value in format <output>|<WxH>|<quality>|<codec>|<bitrate_mode>|<bitrate_kbps>\n", str);
+        return false;
+    }
+
+    extra_output.filename = fields[0];
+    extra_output.is_livestream = is_livestream_path(extra_output.filename.c_str());
+
+    if(fields.size() > 1 && !fields[1].empty()) {
+        if(sscanf(fields[1].c_str(), "%dx%d", &extra_output.resolution.x, &extra_output.resolution.y) != 2 || extra_output.resolution.x <= 0 || extra_output.resolution.y <= 0) {
+            fprintf(stderr, "Error: invalid size '%s' for option -so '%s', expected a value in format WxH\n", fields[1].c_str(), str);
+            return false;
+        }
+    }
+
+    if(fields.size() > 2 && !fields[2].empty() && !parse_video_quality(fields[2].c_str(), extra_output.quality)) {
+        fprintf(stderr, "Error: invalid quality '%s' for option -so '%s', expected either 'medium', 'high', 'very_high' or 'ultra'\n", fields[2].c_str(), str);
+        return false;
+    }
+
+    if(fields.size() > 3 && !fields[3].empty()) {
+        if(!parse_video_codec(fields[3].c_str(), extra_output.codec)) {
+            fprintf(stderr, "Error: invalid codec '%s' for option -so '%s', expected either 'h264', 'h265', 'av1' or 'vp9'\n", fields[3].c_str(), str);
+            return false;
+        }
+    }
+
+    if(fields.size() > 4 && !fields[4].empty() && !parse_bitrate_mode(fields[4].c_str(), extra_output.bitrate_mode)) {
+        fprintf(stderr, "Error: invalid bitrate mode '%s' for option -so '%s', expected either 'auto', 'qp', 'cq', 'vbr' or 'cbr'\n", fields[4].c_str(), str);
+        return false;
+    }
+
+    if(fields.size() > 5 && !fields[5].empty() && !parse_bitrate_kbps(fields[5].c_str(), extra_output.bitrate)) {
+        fprintf(stderr, "Error: invalid bitrate '%s' for option -so '%s', expected a number in kbps\n", fields[5].c_str(), str);
+        return false;
+    }
+
+    return true;
+}
+
 // TODO: Proper cleanup
 static int init_filter_graph(AVCodecContext *audio_codec_context, AVFilterGraph **graph, AVFilterContext **sink, std::vector<AVFilterContext*> &src_filter_ctx, size_t num_sources) {
     char ch_layout[64];
@@ -1072,6 +1477,40 @@ static bool is_xwayland(Display *display) {
     return xwayland_found;
 }
 
+// Replaces |nvfbc_capture| (that failed to start) with a capture of |area| of the compositor window. |area| is the whole screen if its size is 0
+static gsr_capture* create_compositor_capture(gsr_capture *nvfbc_capture, AVCodecContext *video_codec_context, Display *dpy, gsr_monitor area, vec2i output_resolution, gsr_scale_filter scale_filter, bool yuv444, bool overclock) {
+    gsr_capture_destroy(nvfbc_capture, video_codec_context);
+
+    const Window compositor_window = get_compositor_window(dpy);
+    if(!compositor_window) {
+        fprintf(stderr, "Error: failed to start NvFBC and there is no compositor running. Without NvFBC the screen can only be recorded when a compositor is running\n");
+        return nullptr;
+    }
+
+    fprintf(stderr, "Warning: failed to start NvFBC, recording the compositor window (0x%lx) instead\n", compositor_window);
+
+    gsr_capture_xcomposite_cuda_params xcomposite_params;
+    xcomposite_params.window = compositor_window;
+    xcomposite_params.follow_focused = false;
+    xcomposite_params.region_size = { 0, 0 };
+    xcomposite_params.source_pos = area.pos;
+    xcomposite_params.source_size = area.size;
+    xcomposite_params.overclock = overclock;
+    xcomposite_params.yuv444 = yuv444;
+    xcomposite_params.output_resolution = output_resolution;
+    xcomposite_params.scale_filter = scale_filter;
+    gsr_capture *capture = gsr_capture_xcomposite_cuda_create(&xcomposite_params);
+    if(!capture)
+        return nullptr;
+
+    if(gsr_capture_start(capture, video_codec_context) != 0) {
+        fprintf(stderr, "gsr error: gsr_capture_start failed\n");
+        return nullptr;
+    }
+
+    return capture;
+}
+
 struct ReceivePacketData {
     AVCodecContext *codec_context;
     int stream_index;
@@ -1081,7 +1520,9 @@ struct ReceivePacketData {
 
 int main(int argc, char **argv) {
     signal(SIGINT, int_handler);
+    signal(SIGTERM, int_handler);
     signal(SIGUSR1, save_replay_handler);
+    signal(SIGUSR2, request_keyframe_handler);
 
     if(argc <= 1)
         usage_full();
@@ -1096,6 +1537,7 @@ int main(int argc, char **argv) {
         { "-c", Arg { {}, true, false } },
         { "-f", Arg { {}, false, false } },
         { "-s", Arg { {}, true, false } },
+        { "-sf", Arg { {}, true, false } },
         { "-a", Arg { {}, true, true } },
         { "-q", Arg { {}, true, false } },
         { "-o", Arg { {}, true, false } },
@@ -1105,6 +1547,17 @@ int main(int argc, char **argv) {
         { "-oc", Arg { {}, true, false } },
         { "-fm", Arg { {}, true, false } },
         { "-pixfmt", Arg { {}, true, false } },
+        { "-keyint", Arg { {}, true, false } },
+        { "-bf", Arg { {}, true, false } },
+        { "-lookahead", Arg { {}, true, false } },
+        { "-tune", Arg { {}, true, false } },
+        { "-frag", Arg { {}, true, false } },
+        { "-faststart", Arg { {}, true, false } },
+        { "-trace", Arg { {}, true, false } },
+        { "-bm", Arg { {}, true, false } },
+        { "-b", Arg { {}, true, false } },
+        { "-so", Arg { {}, true, true } },
+        { "-ro", Arg { {}, true, false } },
         { "-v", Arg { {}, true, false } },
     };
 
@@ -1140,12 +1593,8 @@ int main(int argc, char **argv) {
     if(!video_codec_to_use)
         video_codec_to_use = "auto";
 
-    if(strcmp(video_codec_to_use, "h264") == 0) {
-        video_codec = VideoCodec::H264;
-    } else if(strcmp(video_codec_to_use, "h265") == 0) {
-        video_codec = VideoCodec::H265;
-    } else if(strcmp(video_codec_to_use, "auto") != 0) {
-        fprintf(stderr, "Error: -k should either be either 'auto', 'h264' or 'h265', got: '%s'\n", video_codec_to_use);
+    if(strcmp(video_codec_to_use, "auto") != 0 && !parse_video_codec(video_codec_to_use, video_codec)) {
+        fprintf(stderr, "Error: -k should either be either 'auto', 'h264', 'h265', 'av1' or 'vp9', got: '%s'\n", video_codec_to_use);
         usage();
     }
 
@@ -1261,19 +1710,25 @@ int main(int argc, char **argv) {
         quality_str = "very_high";
 
     VideoQuality quality;
-    if(strcmp(quality_str, "medium") == 0) {
-        quality = VideoQuality::MEDIUM;
-    } else if(strcmp(quality_str, "high") == 0) {
-        quality = VideoQuality::HIGH;
-    } else if(strcmp(quality_str, "very_high") == 0) {
-        quality = VideoQuality::VERY_HIGH;
-    } else if(strcmp(quality_str, "ultra") == 0) {
-        quality = VideoQuality::ULTRA;
-    } else {
+    if(!parse_video_quality(quality_str, quality)) {
         fprintf(stderr, "Error: -q should either be either 'medium', 'high', 'very_high' or 'ultra', got: '%s'\n", quality_str);
         usage();
     }
 
+    BitrateMode bitrate_mode = BitrateMode::AUTO;
+    const char *bitrate_mode_str = args["-bm"].value();
+    if(bitrate_mode_str && !parse_bitrate_mode(bitrate_mode_str, bitrate_mode)) {
+        fprintf(stderr, "Error: -bm should either be either 'auto', 'qp', 'cq', 'vbr' or 'cbr', got: '%s'\n", bitrate_mode_str);
+        usage();
+    }
+
+    int64_t bitrate = 0;
+    const char *bitrate_str = args["-b"].value();
+    if(bitrate_str && !parse_bitrate_kbps(bitrate_str, bitrate)) {
+        fprintf(stderr, "Error: -b should be a bitrate in kbps, got: '%s'\n", bitrate_str);
+        usage();
+    }
+
     int replay_buffer_size_secs = -1;
     const char *replay_buffer_size_secs_str = args["-r"].value();
     if(replay_buffer_size_secs_str) {
@@ -1282,7 +1737,93 @@ int main(int argc, char **argv) {
             fprintf(stderr, "Error: option -r has to be between 5 and 1200, was: %s\n", replay_buffer_size_secs_str);
             _exit(1);
         }
-        replay_buffer_size_secs += 5; // Add a few seconds to account of lost packets because of non-keyframe packets skipped
+    }
+
+    double keyint = 2.0;
+    const char *keyint_str = args["-keyint"].value();
+    if(keyint_str) {
+        char *end = nullptr;
+        keyint = strtod(keyint_str, &end);
+        if(end == keyint_str || *end != '\0' || keyint < 0.1 || keyint > 60.0) {
+            fprintf(stderr, "Error: option -keyint has to be between 0.1 and 60, was: %s\n", keyint_str);
+            usage();
+        }
+    }
+
+    int b_frames = 0;
+    const char *b_frames_str = args["-bf"].value();
+    if(b_frames_str) {
+        b_frames = atoi(b_frames_str);
+        if(b_frames < 0 || b_frames > 4) {
+            fprintf(stderr, "Error: option -bf has to be between 0 and 4, was: %s\n", b_frames_str);
+            usage();
+        }
+    }
+
+    int lookahead = 0;
+    const char *lookahead_str = args["-lookahead"].value();
+    if(lookahead_str) {
+        lookahead = atoi(lookahead_str);
+        if(lookahead < 0 || lookahead > 32) {
+            fprintf(stderr, "Error: option -lookahead has to be between 0 and 32, was: %s\n", lookahead_str);
+            usage();
+        }
+    }
+
+    bool low_latency = false;
+    const char *tune_str = args["-tune"].value();
+    if(!tune_str)
+        tune_str = "quality";
+
+    if(strcmp(tune_str, "quality") == 0) {
+        low_latency = false;
+    } else if(strcmp(tune_str, "latency") == 0) {
+        low_latency = true;
+    } else {
+        fprintf(stderr, "Error: -tune should either be either 'quality' or 'latency', got: '%s'\n", tune_str);
+        usage();
+    }
+
+    // B-frames and lookahead make the encoder wait for later frames before it can output a packet
+    if(low_latency && (b_frames > 0 || lookahead > 0)) {
+        fprintf(stderr, "Warning: -bf and -lookahead are ignored with -tune latency\n");
+        b_frames = 0;
+        lookahead = 0;
+    }
+
+    int faststart_minutes = 0;
+    const char *faststart_minutes_str = args["-faststart"].value();
+    if(faststart_minutes_str) {
+        faststart_minutes = atoi(faststart_minutes_str);
+        if(faststart_minutes < 1 || faststart_minutes > 1440) {
+            fprintf(stderr, "Error: option -faststart has to be between 1 and 1440, was: %s\n", faststart_minutes_str);
+            usage();
+        }
+    }
+
+    double fragment_duration = 0.0;
+    const char *fragment_duration_str = args["-frag"].value();
+    if(fragment_duration_str) {
+        char *end = nullptr;
+        fragment_duration = strtod(fragment_duration_str, &end);
+        if(end == fragment_duration_str || *end != '\0' || fragment_duration < 0.1 || fragment_duration > 60.0) {
+            fprintf(stderr, "Error: option -frag has to be between 0.1 and 60, was: %s\n", fragment_duration_str);
+            usage();
+        }
+    }
+
+    bool trace = false;
+    const char *trace_str = args["-trace"].value();
+    if(!trace_str)
+        trace_str = "no";
+
+    if(strcmp(trace_str, "yes") == 0) {
+        trace = true;
+    } else if(strcmp(trace_str, "no") == 0) {
+        trace = false;
+    } else {
+        fprintf(stderr, "Error: -trace should either be either 'yes' or 'no', got: '%s'\n", trace_str);
+        usage();
     }
 
     Display *dpy = XOpenDisplay(nullptr);
@@ -1339,17 +1880,45 @@ int main(int argc, char **argv) {
         usage();
     }
 
-    const char *screen_region = args["-s"].value();
-    const char *window_str = args["-w"].value();
+    gsr_scale_filter scale_filter = GSR_SCALE_FILTER_BICUBIC;
+    const char *scale_filter_str = args["-sf"].value();
+    if(!scale_filter_str)
+        scale_filter_str = "bicubic";
 
-    if(screen_region && strcmp(window_str, "focused") != 0) {
-        fprintf(stderr, "Error: option -s is only available when using -w focused\n");
+    if(strcmp(scale_filter_str, "bilinear") == 0) {
+        scale_filter = GSR_SCALE_FILTER_BILINEAR;
+    } else if(strcmp(scale_filter_str, "bicubic") == 0) {
+        scale_filter = GSR_SCALE_FILTER_BICUBIC;
+    } else if(strcmp(scale_filter_str, "lanczos") == 0) {
+        scale_filter = GSR_SCALE_FILTER_LANCZOS;
+    } else {
+        fprintf(stderr, "Error: -sf should either be either 'bilinear', 'bicubic' or 'lanczos', got: '%s'\n", scale_filter_str);
         usage();
     }
 
+    const char *screen_region = args["-s"].value();
+    const char *window_str = args["-w"].value();
+
     vec2i region_size = { 0, 0 };
+    if(screen_region) {
+        if(sscanf(screen_region, "%dx%d", &region_size.x, &region_size.y) != 2) {
+            fprintf(stderr, "Error: invalid value for option -s '%s', expected a value in format WxH\n", screen_region);
+            usage();
+        }
+
+        if(region_size.x <= 0 || region_size.y <= 0) {
+            fprintf(stderr, "Error: invalud value for option -s '%s', expected width and height to be greater than 0\n", screen_region);
+            usage();
+        }
+    }
+
+    // With -w focused, -s is the size of the recorded area. Otherwise it's the resolution the video is scaled to
+    vec2i output_resolution = { 0, 0 };
     Window src_window_id = None;
     bool follow_focused = false;
+    // The area of the screen that is recorded with NvFBC. It's recorded from the compositor window instead if NvFBC isn't available
+    bool nvfbc_capture = false;
+    gsr_monitor nvfbc_capture_area = { {0, 0}, {0, 0} };
 
     gsr_capture *capture = nullptr;
     if(strcmp(window_str, "focused") == 0) {
@@ -1358,20 +1927,31 @@ int main(int argc, char **argv) {
             usage();
         }
 
-        if(sscanf(screen_region, "%dx%d", &region_size.x, &region_size.y) != 2) {
-            fprintf(stderr, "Error: invalid value for option -s '%s', expected a value in format WxH\n", screen_region);
-            usage();
-        }
+        follow_focused = true;
+    } else if(contains_non_hex_number(window_str)) {
+        output_resolution = region_size;
+        region_size = { 0, 0 };
+
+        // Part of the screen, in the format region:X,Y,WxH
+        gsr_monitor capture_region = { {0, 0}, {0, 0} };
+        const bool is_region = strncmp(window_str, "region:", 7) == 0;
+        if(is_region) {
+            if(sscanf(window_str + 7, "%d,%d,%dx%d", &capture_region.pos.x, &capture_region.pos.y, &capture_region.size.x, &capture_region.size.y) != 4) {
+                fprintf(stderr, "Error: invalid value for option -w '%s', expected a region in format region:X,Y,WxH\n", window_str);
+                usage();
+            }
 
-        if(region_size.x <= 0 || region_size.y <= 0) {
-            fprintf(stderr, "Error: invalud value for option -s '%s', expected width and height to be greater than 0\n", screen_region);
-            usage();
+            const vec2i screen_size = { XWidthOfScreen(DefaultScreenOfDisplay(dpy)), XHeightOfScreen(DefaultScreenOfDisplay(dpy)) };
+            if(capture_region.pos.x < 0 || capture_region.pos.y < 0 || capture_region.size.x <= 0 || capture_region.size.y <= 0
+                || capture_region.pos.x + capture_region.size.x > screen_size.x || capture_region.pos.y + capture_region.size.y > screen_size.y)
+            {
+                fprintf(stderr, "Error: region '%s' is not inside the screen (%dx%d+%d+%d)\n", window_str, screen_size.x, screen_size.y, 0, 0);
+                _exit(1);
+            }
         }
 
-        follow_focused = true;
-    } else if(contains_non_hex_number(window_str)) {
-        if(strcmp(window_str, "screen") != 0 && strcmp(window_str, "screen-direct") != 0 && strcmp(window_str, "screen-direct-force") != 0) {
-            gsr_monitor gmon;
+        gsr_monitor gmon = { {0, 0}, {0, 0} };
+        if(!is_region && strcmp(window_str, "screen") != 0 && strcmp(window_str, "screen-direct") != 0 && strcmp(window_str, "screen-direct-force") != 0) {
             if(!get_monitor_by_name(dpy, window_str, &gmon)) {
                 fprintf(stderr, "gsr error: display \"%s\" not found, expected one of:\n", window_str);
                 fprintf(stderr, "    \"screen\"    (%dx%d+%d+%d)\n", XWidthOfScreen(DefaultScreenOfDisplay(dpy)), XHeightOfScreen(DefaultScreenOfDisplay(dpy)), 0, 0);
@@ -1397,27 +1977,44 @@ int main(int argc, char **argv) {
                 capture_target = "screen";
             }
 
+            // The region is cropped by NvFBC with a capture box of the screen
+            if(is_region)
+                capture_target = "screen";
+
             gsr_capture_nvfbc_params nvfbc_params;
             nvfbc_params.dpy = dpy;
             nvfbc_params.display_to_capture = capture_target;
             nvfbc_params.fps = fps;
-            nvfbc_params.pos = { 0, 0 };
-            nvfbc_params.size = { 0, 0 };
+            nvfbc_params.pos = capture_region.pos;
+            nvfbc_params.size = capture_region.size;
             nvfbc_params.direct_capture = direct_capture;
             nvfbc_params.overclock = overclock;
+            nvfbc_params.yuv444 = pixel_format == PixelFormat::YUV444;
+            nvfbc_params.output_resolution = output_resolution;
             capture = gsr_capture_nvfbc_create(&nvfbc_params);
             if(!capture)
                 _exit(1);
+
+            nvfbc_capture = true;
+            if(is_region)
+                nvfbc_capture_area = capture_region;
+            else if(strcmp(capture_target, "screen") != 0)
+                nvfbc_capture_area = gmon;
         } else {
             const char *capture_target = window_str;
-            if(strcmp(window_str, "screen-direct") == 0 || strcmp(window_str, "screen-direct-force") == 0) {
+            if(is_region || strcmp(window_str, "screen-direct") == 0 || strcmp(window_str, "screen-direct-force") == 0) {
                 capture_target = "screen";
             }
 
             gsr_capture_kms_vaapi_params kms_params;
             kms_params.display_to_capture = capture_target;
+            kms_params.region_pos = capture_region.pos;
+            kms_params.region_size = capture_region.size;
             kms_params.gpu_inf = gpu_inf;
             kms_params.card_path = card_path;
+            kms_params.yuv444 = pixel_format == PixelFormat::YUV444;
+            kms_params.output_resolution = output_resolution;
+            kms_params.scale_filter = scale_filter;
             capture = gsr_capture_kms_vaapi_create(&kms_params);
             if(!capture)
                 _exit(1);
@@ -1429,6 +2026,9 @@ int main(int argc, char **argv) {
             fprintf(stderr, "Invalid window number %s\n", window_str);
             usage();
         }
+
+        output_resolution = region_size;
+        region_size = { 0, 0 };
     }
 
     if(!capture) {
@@ -1439,6 +2039,9 @@ int main(int argc, char **argv) {
                 xcomposite_params.follow_focused = follow_focused;
                 xcomposite_params.region_size = region_size;
                 xcomposite_params.card_path = card_path;
+                xcomposite_params.yuv444 = pixel_format == PixelFormat::YUV444;
+                xcomposite_params.output_resolution = output_resolution;
+                xcomposite_params.scale_filter = scale_filter;
                 capture = gsr_capture_xcomposite_vaapi_create(&xcomposite_params);
                 if(!capture)
                     _exit(1);
@@ -1450,6 +2053,9 @@ int main(int argc, char **argv) {
                 xcomposite_params.follow_focused = follow_focused;
                 xcomposite_params.region_size = region_size;
                 xcomposite_params.card_path = card_path;
+                xcomposite_params.yuv444 = pixel_format == PixelFormat::YUV444;
+                xcomposite_params.output_resolution = output_resolution;
+                xcomposite_params.scale_filter = scale_filter;
                 capture = gsr_capture_xcomposite_vaapi_create(&xcomposite_params);
                 if(!capture)
                     _exit(1);
@@ -1460,7 +2066,12 @@ int main(int argc, char **argv) {
                 xcomposite_params.window = src_window_id;
                 xcomposite_params.follow_focused = follow_focused;
                 xcomposite_params.region_size = region_size;
+                xcomposite_params.source_pos = { 0, 0 };
+                xcomposite_params.source_size = { 0, 0 };
                 xcomposite_params.overclock = overclock;
+                xcomposite_params.yuv444 = pixel_format == PixelFormat::YUV444;
+                xcomposite_params.output_resolution = output_resolution;
+                xcomposite_params.scale_filter = scale_filter;
                 capture = gsr_capture_xcomposite_cuda_create(&xcomposite_params);
                 if(!capture)
                     _exit(1);
@@ -1469,6 +2080,12 @@ int main(int argc, char **argv) {
         }
     }
 
+    const char *record_filename = args["-ro"].value();
+    if(record_filename && replay_buffer_size_secs == -1) {
+        fprintf(stderr, "Error: option -ro can only be used in replay mode (with option -r). Use -o to record without a replay buffer\n");
+        usage();
+    }
+
     const char *filename = args["-o"].value();
     if(filename) {
         if(replay_buffer_size_secs != -1) {
@@ -1522,10 +2139,10 @@ int main(int argc, char **argv) {
             break;
         }
         case AudioCodec::OPUS: {
-            if(file_extension != "mp4" && file_extension != "mkv") {
+            if(file_extension != "mp4" && file_extension != "mkv" && file_extension != "webm") {
                 audio_codec_to_use = "aac";
                 audio_codec = AudioCodec::AAC;
-                fprintf(stderr, "Warning: opus audio codec is only supported by .mp4 and .mkv files, falling back to aac instead\n");
+                fprintf(stderr, "Warning: opus audio codec is only supported by .mp4, .mkv and .webm files, falling back to aac instead\n");
             }
             break;
         }
@@ -1539,11 +2156,24 @@ int main(int argc, char **argv) {
         }
     }
 
+    if(!requested_audio_inputs.empty() && !is_audio_supported_by_container(output_format)) {
+        fprintf(stderr, "Error: webm files can't have audio at the moment because webm only supports opus audio, which is disabled for now. Record without -a or use a different container, for example mkv\n");
+        _exit(1);
+    }
+
     const double target_fps = 1.0 / (double)fps;
 
+    // Probed once per driver version and then loaded from the cache, because opening the hardware encoders to check what they support is slow
+    gsr_encoder_capabilities encoder_caps;
+    gsr_encoder_get_capabilities(&encoder_caps, &gpu_inf, card_path);
+
     if(strcmp(video_codec_to_use, "auto") == 0) {
-        if(gpu_inf.vendor == GSR_GPU_VENDOR_INTEL) {
-            const AVCodec *h264_codec = find_h264_encoder(gpu_inf.vendor, card_path);
+        if(strcmp(output_format->name, "webm") == 0) {
+            video_codec = get_container_fallback_video_codec(av_format_context, gpu_inf.vendor, encoder_caps);
+            video_codec_to_use = video_codec_to_string(video_codec);
+            fprintf(stderr, "Info: using %s encoder because a codec was not specified and webm only supports av1 and vp9\n", video_codec_to_use);
+        } else if(gpu_inf.vendor == GSR_GPU_VENDOR_INTEL) {
+            const AVCodec *h264_codec = find_video_encoder(VideoCodec::H264, gpu_inf.vendor, encoder_caps);
             if(!h264_codec) {
                 fprintf(stderr, "Info: using h265 encoder because a codec was not specified and your gpu does not support h264\n");
                 video_codec_to_use = "h265";
@@ -1554,7 +2184,7 @@ int main(int argc, char **argv) {
                 video_codec = VideoCodec::H264;
             }
         } else {
-            const AVCodec *h265_codec = find_h265_encoder(gpu_inf.vendor, card_path);
+            const AVCodec *h265_codec = find_video_encoder(VideoCodec::H265, gpu_inf.vendor, encoder_caps);
 
             // h265 generally allows recording at a higher resolution than h264 on nvidia cards. On a gtx 1080 4k is the max resolution for h264 but for h265 it's 8k.
             // Another important info is that when recording at a higher fps than.. 60? h265 has very bad performance. For example when recording at 144 fps the fps drops to 1
@@ -1576,24 +2206,16 @@ int main(int argc, char **argv) {
     }
 
     //bool use_hevc = strcmp(window_str, "screen") == 0 || strcmp(window_str, "screen-direct") == 0;
-    if(video_codec != VideoCodec::H264 && strcmp(file_extension.c_str(), "flv") == 0) {
-        video_codec_to_use = "h264";
-        video_codec = VideoCodec::H264;
-        fprintf(stderr, "Warning: h265 is not compatible with flv, falling back to h264 instead.\n");
-    }
-
-    const AVCodec *video_codec_f = nullptr;
-    switch(video_codec) {
-        case VideoCodec::H264:
-            video_codec_f = find_h264_encoder(gpu_inf.vendor, card_path);
-            break;
-        case VideoCodec::H265:
-            video_codec_f = find_h265_encoder(gpu_inf.vendor, card_path);
-            break;
+    if(!is_video_codec_supported_by_container(video_codec, av_format_context)) {
+        const VideoCodec fallback_video_codec = get_container_fallback_video_codec(av_format_context, gpu_inf.vendor, encoder_caps);
+        fprintf(stderr, "Warning: %s is not compatible with %s, falling back to %s instead.\n", video_codec_to_use, file_extension.c_str(), video_codec_to_string(fallback_video_codec));
+        video_codec = fallback_video_codec;
+        video_codec_to_use = video_codec_to_string(video_codec);
     }
 
+    const AVCodec *video_codec_f = find_video_encoder(video_codec, gpu_inf.vendor, encoder_caps);
     if(!video_codec_f) {
-        const char *video_codec_name = video_codec == VideoCodec::H264 ? "h264" : "h265";
+        const char *video_codec_name = video_codec_to_string(video_codec);
         fprintf(stderr, "Error: your gpu does not support '%s' video codec. If you are sure that your gpu does support '%s' video encoding and you are using an AMD/Intel GPU,\n"
             "  then it's possible that your distro has disabled hardware accelerated video encoding for '%s' video codec.\n"
             "  This may be the case on corporate distros such as Manjaro.\n"
@@ -1602,10 +2224,60 @@ int main(int argc, char **argv) {
         _exit(2);
     }
 
+    const gsr_video_codec_capabilities &video_codec_caps = encoder_caps.codecs[video_codec_to_gsr_video_codec(video_codec)];
+    if(pixel_format == PixelFormat::YUV444 && !video_codec_caps.yuv444) {
+        const char *video_codec_name = video_codec_to_string(video_codec);
+        fprintf(stderr, "Error: your gpu does not support yuv444 encoding with the '%s' video codec.", video_codec_name);
+        if(gpu_inf.vendor != GSR_GPU_VENDOR_NVIDIA && video_codec == VideoCodec::H264)
+            fprintf(stderr, " On AMD/Intel yuv444 is only supported with h265 (-k h265).");
+        fprintf(stderr, " Use -pixfmt yuv420 instead\n");
+        _exit(2);
+    }
+
+    const int requested_b_frames = b_frames;
+    if(b_frames > 0 && !video_codec_caps.b_frames) {
+        fprintf(stderr, "Warning: your gpu does not support b-frames with the '%s' video codec, recording without b-frames\n", video_codec_to_string(video_codec));
+        b_frames = 0;
+    }
+
     const bool is_livestream = is_livestream_path(filename);
+    if((is_livestream || (record_filename && is_livestream_path(record_filename))) && pixel_format == PixelFormat::YUV444) {
+        fprintf(stderr, "Error: -pixfmt yuv444 can't be used when live streaming, livestreaming services only support yuv420\n");
+        _exit(2);
+    }
+
+    std::vector<ExtraOutput> extra_outputs;
+    for(const char *extra_output_str : args["-so"].values) {
+        ExtraOutput extra_output;
+        extra_output.quality = quality;
+        extra_output.codec = video_codec;
+        extra_output.bitrate_mode = bitrate_mode;
+        extra_output.bitrate = bitrate;
+        if(!parse_extra_output_arg(extra_output_str, extra_output))
+            usage();
+
+        if(extra_output.is_livestream && pixel_format == PixelFormat::YUV444) {
+            fprintf(stderr, "Error: -pixfmt yuv444 can't be used when live streaming (-so '%s'), livestreaming services only support yuv420\n", extra_output_str);
+            _exit(2);
+        }
+
+        extra_outputs.push_back(std::move(extra_output));
+    }
+
+    if(!extra_outputs.empty() && gpu_inf.vendor == GSR_GPU_VENDOR_NVIDIA) {
+        fprintf(stderr, "Error: option -so is not supported on NVIDIA yet\n");
+        _exit(2);
+    }
+
     // (Some?) livestreaming services require at least one audio track to work.
     // If not audio is provided then create one silent audio track.
-    if(is_livestream && requested_audio_inputs.empty()) {
+    bool has_livestream_output = is_livestream || (record_filename && is_livestream_path(record_filename));
+    for(const ExtraOutput &extra_output : extra_outputs) {
+        if(extra_output.is_livestream)
+            has_livestream_output = true;
+    }
+
+    if(has_livestream_output && requested_audio_inputs.empty()) {
         fprintf(stderr, "Info: live streaming but no audio track was added. Adding a silent audio track\n");
         MergedAudioInputs mai;
         mai.audio_inputs.push_back({ "", "gsr-silent" });
@@ -1615,18 +2287,44 @@ int main(int argc, char **argv) {
     AVStream *video_stream = nullptr;
     std::vector<AudioTrack> audio_tracks;
 
-    AVCodecContext *video_codec_context = create_video_codec_context(gpu_inf.vendor == GSR_GPU_VENDOR_NVIDIA ? AV_PIX_FMT_CUDA : AV_PIX_FMT_VAAPI, quality, fps, video_codec_f, is_livestream, gpu_inf.vendor, framerate_mode);
+    AVCodecContext *video_codec_context = create_video_codec_context(gpu_inf.vendor == GSR_GPU_VENDOR_NVIDIA ? AV_PIX_FMT_CUDA : AV_PIX_FMT_VAAPI, fps, keyint, b_frames, video_codec_f, is_livestream, gpu_inf.vendor, framerate_mode);
     if(replay_buffer_size_secs == -1)
         video_stream = create_stream(av_format_context, video_codec_context);
 
     if(gsr_capture_start(capture, video_codec_context) != 0) {
-        fprintf(stderr, "gsr error: gsr_capture_start failed\n");
-        _exit(1);
+        if(!nvfbc_capture) {
+            fprintf(stderr, "gsr error: gsr_capture_start failed\n");
+            _exit(1);
+        }
+
+        // NvFBC isn't available on all cards and drivers. The screen can still be recorded from the window the compositor draws to,
+        // by only copying the part of that window that is the recorded monitor (or region)
+        capture = create_compositor_capture(capture, video_codec_context, dpy, nvfbc_capture_area, output_resolution, scale_filter, pixel_format == PixelFormat::YUV444, overclock);
+        if(!capture)
+            _exit(1);
+    }
+
+    // The encoder of the replay buffer is shared with the -ro output, so it keeps constant quality even if -ro is a livestream
+    if(video_codec_context->width > video_codec_caps.max_width || video_codec_context->height > video_codec_caps.max_height) {
+        fprintf(stderr, "Warning: the video size %dx%d is larger than the largest size your gpu was able to encode with the '%s' video codec (%dx%d), encoding might fail.",
+            video_codec_context->width, video_codec_context->height, video_codec_to_string(video_codec), video_codec_caps.max_width, video_codec_caps.max_height);
+        if(video_codec == VideoCodec::H264 && encoder_caps.codecs[GSR_VIDEO_CODEC_HEVC].supported
+            && video_codec_context->width <= encoder_caps.codecs[GSR_VIDEO_CODEC_HEVC].max_width && video_codec_context->height <= encoder_caps.codecs[GSR_VIDEO_CODEC_HEVC].max_height)
+        {
+            fprintf(stderr, " Use -k h265 to record at this size.");
+        }
+        fprintf(stderr, "\n");
     }
 
-    open_video(video_codec_context, quality, very_old_gpu, gpu_inf.vendor, pixel_format);
+    open_video(video_codec_context, quality, very_old_gpu, gpu_inf.vendor, pixel_format, is_livestream && replay_buffer_size_secs == -1, bitrate_mode, bitrate, lookahead, low_latency, video_codec_caps);
     if(video_stream)
-        avcodec_parameters_from_context(video_stream->codecpar, video_codec_context);
+        set_video_stream_parameters(video_stream, av_format_context, video_codec_context);
+
+    gsr_encoder *video_encoder = gsr_encoder_ffmpeg_create(video_codec_context);
+    if(!video_encoder) {
+        fprintf(stderr, "Error: failed to create video encoder\n");
+        _exit(1);
+    }
 
     int audio_stream_index = VIDEO_STREAM_INDEX + 1;
     for(const MergedAudioInputs &merged_audio_inputs : requested_audio_inputs) {
@@ -1698,30 +2396,106 @@ int main(int argc, char **argv) {
         ++audio_stream_index;
     }
 
-    //av_dump_format(av_format_context, 0, filename, 1);
+    // Room for the moov of a recording of |faststart_minutes|, with at most 50 audio packets per second for each audio track
+    const int64_t reserved_moov_size = faststart_minutes > 0 ? get_max_moov_size((int64_t)faststart_minutes * 60 * (fps + (int64_t)audio_tracks.size() * 50)) : 0;
+    int64_t output_reserved_moov_size = 0;
+    int64_t record_reserved_moov_size = 0;
 
-    if (replay_buffer_size_secs == -1 && !(output_format->flags & AVFMT_NOFILE)) {
-        int ret = avio_open(&av_format_context->pb, filename, AVIO_FLAG_WRITE);
-        if (ret < 0) {
-            fprintf(stderr, "Error: Could not open '%s': %s\n", filename, av_error_to_string(ret));
+    // The extra outputs are added after the audio tracks because the audio streams are added to all outputs
+    for(ExtraOutput &extra_output : extra_outputs) {
+        const char *extra_output_filename = extra_output.filename.c_str();
+        avformat_alloc_output_context2(&extra_output.format_context, nullptr, extra_output.is_livestream ? "flv" : nullptr, extra_output_filename);
+        if(!extra_output.format_context) {
+            fprintf(stderr, "Error: Failed to deduce container format from file extension of -so output '%s'\n", extra_output_filename);
+            _exit(1);
+        }
+
+        if(!is_video_codec_supported_by_container(extra_output.codec, extra_output.format_context)) {
+            const VideoCodec fallback_video_codec = get_container_fallback_video_codec(extra_output.format_context, gpu_inf.vendor, encoder_caps);
+            fprintf(stderr, "Warning: %s is not compatible with %s, falling back to %s instead for output '%s'.\n",
+                video_codec_to_string(extra_output.codec), extra_output.format_context->oformat->name, video_codec_to_string(fallback_video_codec), extra_output_filename);
+            extra_output.codec = fallback_video_codec;
+        }
+
+        if(!audio_tracks.empty() && !is_audio_supported_by_container(extra_output.format_context->oformat)) {
+            fprintf(stderr, "Error: webm files can't have audio at the moment because webm only supports opus audio, which is disabled for now. Use a different container for output '%s', for example mkv\n", extra_output_filename);
+            _exit(1);
+        }
+
+        const AVCodec *extra_video_codec_f = find_video_encoder(extra_output.codec, gpu_inf.vendor, encoder_caps);
+        if(!extra_video_codec_f) {
+            fprintf(stderr, "Error: your gpu does not support '%s' video codec (-so '%s')\n", video_codec_to_string(extra_output.codec), extra_output_filename);
+            _exit(2);
+        }
+
+        const gsr_video_codec_capabilities &extra_video_codec_caps = encoder_caps.codecs[video_codec_to_gsr_video_codec(extra_output.codec)];
+        int extra_b_frames = requested_b_frames;
+        if(extra_b_frames > 0 && !extra_video_codec_caps.b_frames) {
+            fprintf(stderr, "Warning: your gpu does not support b-frames with the '%s' video codec, output '%s' is encoded without b-frames\n", video_codec_to_string(extra_output.codec), extra_output_filename);
+            extra_b_frames = 0;
+        }
+
+        extra_output.codec_context = create_video_codec_context(gpu_inf.vendor == GSR_GPU_VENDOR_NVIDIA ? AV_PIX_FMT_CUDA : AV_PIX_FMT_VAAPI, fps, keyint, extra_b_frames, extra_video_codec_f, extra_output.is_livestream, gpu_inf.vendor, framerate_mode);
+        extra_output.video_stream = create_stream(extra_output.format_context, extra_output.codec_context);
+
+        if(gsr_capture_add_output(capture, extra_output.codec_context, extra_output.resolution, &extra_output.frame) != 0) {
+            fprintf(stderr, "Error: failed to add output '%s'\n", extra_output_filename);
             _exit(1);
         }
+
+        open_video(extra_output.codec_context, extra_output.quality, very_old_gpu, gpu_inf.vendor, pixel_format, extra_output.is_livestream, extra_output.bitrate_mode, extra_output.bitrate, lookahead, low_latency, extra_video_codec_caps);
+        set_video_stream_parameters(extra_output.video_stream, extra_output.format_context, extra_output.codec_context);
+
+        extra_output.encoder = gsr_encoder_ffmpeg_create(extra_output.codec_context);
+        if(!extra_output.encoder) {
+            fprintf(stderr, "Error: failed to create video encoder for output '%s'\n", extra_output_filename);
+            _exit(1);
+        }
+
+        for(AudioTrack &audio_track : audio_tracks) {
+            AVStream *audio_stream = create_stream(extra_output.format_context, audio_track.codec_context);
+            avcodec_parameters_from_context(audio_stream->codecpar, audio_track.codec_context);
+        }
+
+        extra_output.reserved_moov_size = open_output_file(extra_output.format_context, extra_output_filename, low_latency, extra_output.is_livestream ? 0.0 : fragment_duration, reserved_moov_size);
     }
 
-    if(replay_buffer_size_secs == -1) {
-        AVDictionary *options = nullptr;
-        av_dict_set(&options, "strict", "experimental", 0);
-        //av_dict_set_int(&av_format_context->metadata, "video_full_range_flag", 1, 0);
+    // The recording in replay mode (-ro) gets the same packets as the replay buffer, so the video is only encoded once
+    AVFormatContext *record_format_context = nullptr;
+    if(record_filename) {
+        avformat_alloc_output_context2(&record_format_context, nullptr, is_livestream_path(record_filename) ? "flv" : nullptr, record_filename);
+        if(!record_format_context) {
+            fprintf(stderr, "Error: Failed to deduce container format from file extension of -ro output '%s'\n", record_filename);
+            _exit(1);
+        }
 
-        int ret = avformat_write_header(av_format_context, &options);
-        if (ret < 0) {
-            fprintf(stderr, "Error occurred when writing header to output file: %s\n", av_error_to_string(ret));
+        if(!is_video_codec_supported_by_container(video_codec, record_format_context)) {
+            fprintf(stderr, "Error: %s is not compatible with %s, use -k %s when recording to '%s' with -ro\n",
+                video_codec_to_string(video_codec), record_format_context->oformat->name, video_codec_to_string(get_container_fallback_video_codec(record_format_context, gpu_inf.vendor, encoder_caps)), record_filename);
             _exit(1);
         }
 
-        av_dict_free(&options);
+        if(!audio_tracks.empty() && !is_audio_supported_by_container(record_format_context->oformat)) {
+            fprintf(stderr, "Error: webm files can't have audio at the moment because webm only supports opus audio, which is disabled for now. Use a different container when recording to '%s' with -ro, for example mkv\n", record_filename);
+            _exit(1);
+        }
+
+        AVStream *record_video_stream = create_stream(record_format_context, video_codec_context);
+        set_video_stream_parameters(record_video_stream, record_format_context, video_codec_context);
+
+        for(AudioTrack &audio_track : audio_tracks) {
+            AVStream *audio_stream = create_stream(record_format_context, audio_track.codec_context);
+            avcodec_parameters_from_context(audio_stream->codecpar, audio_track.codec_context);
+        }
+
+        record_reserved_moov_size = open_output_file(record_format_context, record_filename, low_latency, is_livestream_path(record_filename) ? 0.0 : fragment_duration, reserved_moov_size);
     }
 
+    //av_dump_format(av_format_context, 0, filename, 1);
+
+    if(replay_buffer_size_secs == -1)
+        output_reserved_moov_size = open_output_file(av_format_context, filename, low_latency, is_livestream ? 0.0 : fragment_duration, reserved_moov_size);
+
     const double start_time_pts = clock_get_monotonic_seconds();
 
     double start_time = clock_get_monotonic_seconds(); // todo - target_fps to make first frame start immediately?
@@ -1747,8 +2521,100 @@ int main(int argc, char **argv) {
 
     const double record_start_time = clock_get_monotonic_seconds();
     std::deque<AVPacket> frame_data_queue;
+    std::deque<double> frame_data_queue_times; // When each packet in |frame_data_queue| was added, monotonic time in seconds
     bool frames_erased = false;
 
+    // Each encoder sends its packets to a list of sinks and each sink writes the packets in its own thread.
+    // Files wait for the sink (no packet is lost) while livestreams drop packets when the network can't keep up.
+    std::vector<std::unique_ptr<PacketSink>> packet_sinks;
+    std::vector<PacketSink*> video_sinks;
+    std::vector<PacketSink*> audio_sinks;
+    auto add_packet_sink = [&](const char *name, bool livestream, PacketSinkWriteCallback write) {
+        PacketSinkParams params;
+        params.name = name;
+        params.backpressure = livestream ? PacketSinkBackpressure::DROP_UNTIL_KEYFRAME : PacketSinkBackpressure::BLOCK;
+        if(livestream)
+            params.max_queued_packets = fps * 3 + audio_tracks.size() * 150; // About 3 seconds of video and audio
+        params.video_stream_index = VIDEO_STREAM_INDEX;
+        params.write = std::move(write);
+
+        packet_sinks.push_back(std::unique_ptr<PacketSink>(new PacketSink()));
+        packet_sink_start(packet_sinks.back().get(), params);
+        return packet_sinks.back().get();
+    };
+
+    // Livestream encoders lower their bitrate when the network can't keep up and request a keyframe when their sink had to drop packets.
+    // Encoders that can't change the bitrate while encoding (VAAPI) keep their starting bitrate and only request keyframes.
+    std::vector<LivestreamBitrateControl> livestream_bitrate_controls;
+
+    LatencyTrace latency_trace;
+    LatencyTrace *trace_ptr = trace ? &latency_trace : nullptr;
+    auto add_livestream_bitrate_control = [&](const char *name, gsr_encoder *encoder, AVFrame **codec_frame, PacketSink *sink) {
+        AdaptiveBitrateParams params;
+        params.max_bitrate = encoder->codec_context->bit_rate;
+        params.min_bitrate = encoder->codec_context->bit_rate / 8;
+
+        LivestreamBitrateControl control;
+        control.name = name;
+        control.encoder = encoder;
+        control.frame = codec_frame;
+        control.sink = sink;
+        adaptive_bitrate_init(&control.adaptive_bitrate, params, clock_get_monotonic_seconds());
+        livestream_bitrate_controls.push_back(std::move(control));
+    };
+
+    if(replay_buffer_size_secs == -1) {
+        PacketSink *output_sink = add_packet_sink(filename, is_livestream, muxer_write_callback(av_format_context, low_latency, trace_ptr, filename));
+        video_sinks.push_back(output_sink);
+        audio_sinks.push_back(output_sink);
+        if(is_livestream)
+            add_livestream_bitrate_control(filename, video_encoder, &frame, output_sink);
+    } else {
+        // The packets are kept in the encoder time base, they are rescaled when the replay is saved
+        // Packets older than the replay buffer size are removed, except from the last video keyframe before that. A saved replay starts at a keyframe,
+        // so this makes it at least as long as the replay buffer size (and at most one keyframe interval longer)
+        PacketSink *replay_sink = add_packet_sink("replay buffer", false, [&](AVPacket *av_packet, AVRational) {
+            std::lock_guard<std::mutex> lock(write_output_mutex);
+            const double time_now = clock_get_monotonic_seconds();
+
+            AVPacket new_pack;
+            av_packet_move_ref(&new_pack, av_packet);
+            frame_data_queue.push_back(std::move(new_pack));
+            frame_data_queue_times.push_back(time_now);
+
+            const double cutoff_time = time_now - replay_buffer_size_secs;
+            size_t num_packets_to_remove = 0;
+            for(size_t i = 1; i < frame_data_queue.size() && frame_data_queue_times[i] <= cutoff_time; ++i) {
+                const AVPacket &packet = frame_data_queue[i];
+                if((packet.flags & AV_PKT_FLAG_KEY) && packet.stream_index == VIDEO_STREAM_INDEX)
+                    num_packets_to_remove = i;
+            }
+
+            for(size_t i = 0; i < num_packets_to_remove; ++i) {
+                av_packet_unref(&frame_data_queue.front());
+                frame_data_queue.pop_front();
+                frame_data_queue_times.pop_front();
+                frames_erased = true;
+            }
+        });
+        video_sinks.push_back(replay_sink);
+        audio_sinks.push_back(replay_sink);
+    }
+
+    if(record_format_context) {
+        PacketSink *record_sink = add_packet_sink(record_filename, is_livestream_path(record_filename), muxer_write_callback(record_format_context, low_latency, trace_ptr, record_filename));
+        video_sinks.push_back(record_sink);
+        audio_sinks.push_back(record_sink);
+    }
+
+    for(ExtraOutput &extra_output : extra_outputs) {
+        PacketSink *extra_output_sink = add_packet_sink(extra_output.filename.c_str(), extra_output.is_livestream, muxer_write_callback(extra_output.format_context, low_latency, trace_ptr, extra_output.filename));
+        extra_output.video_sinks.push_back(extra_output_sink);
+        audio_sinks.push_back(extra_output_sink);
+        if(extra_output.is_livestream)
+            add_livestream_bitrate_control(extra_output.filename.c_str(), extra_output.encoder, &extra_output.frame, extra_output_sink);
+    }
+
     const size_t audio_buffer_size = 1024 * 4 * 2; // max 4 bytes/sample, 2 channels
     uint8_t *empty_audio = (uint8_t*)malloc(audio_buffer_size);
     if(!empty_audio) {
@@ -1842,7 +2708,7 @@ int main(int argc, char **argv) {
                                 ret = avcodec_send_frame(audio_track.codec_context, audio_track.frame);
                                 if(ret >= 0) {
                                     // TODO: Move to separate thread because this could write to network (for example when livestreaming)
-                                    receive_frames(audio_track.codec_context, audio_track.stream_index, audio_track.stream, audio_track.frame->pts, av_format_context, record_start_time, frame_data_queue, replay_buffer_size_secs, frames_erased, write_output_mutex);
+                                    receive_frames(audio_track.codec_context, audio_track.stream_index, audio_sinks);
                                 } else {
                                     fprintf(stderr, "Failed to encode audio!\n");
                                 }
@@ -1876,7 +2742,7 @@ int main(int argc, char **argv) {
                             ret = avcodec_send_frame(audio_track.codec_context, audio_track.frame);
                             if(ret >= 0) {
                                 // TODO: Move to separate thread because this could write to network (for example when livestreaming)
-                                receive_frames(audio_track.codec_context, audio_track.stream_index, audio_track.stream, audio_track.frame->pts, av_format_context, record_start_time, frame_data_queue, replay_buffer_size_secs, frames_erased, write_output_mutex);
+                                receive_frames(audio_track.codec_context, audio_track.stream_index, audio_sinks);
                             } else {
                                 fprintf(stderr, "Failed to encode audio!\n");
                             }
@@ -1931,7 +2797,7 @@ int main(int argc, char **argv) {
                     err = avcodec_send_frame(audio_track.codec_context, aframe);
                     if(err >= 0){
                         // TODO: Move to separate thread because this could write to network (for example when livestreaming)
-                        receive_frames(audio_track.codec_context, audio_track.stream_index, audio_track.stream, aframe->pts, av_format_context, record_start_time, frame_data_queue, replay_buffer_size_secs, frames_erased, write_output_mutex);
+                        receive_frames(audio_track.codec_context, audio_track.stream_index, audio_sinks);
                     } else {
                         fprintf(stderr, "Failed to encode audio!\n");
                     }
@@ -1960,8 +2826,31 @@ int main(int argc, char **argv) {
             const int64_t expected_frames = std::round((this_video_frame_time - start_time_pts) / target_fps);
             const int num_frames = framerate_mode == FramerateMode::CONSTANT ? std::max(0L, expected_frames - video_pts_counter) : 1;
 
-            if(num_frames > 0) {
-                gsr_capture_capture(capture, frame);
+            // In variable framerate mode nothing is encoded when the screen didn't change (only NvFBC reports that).
+            // In constant framerate mode the frame is encoded again, the encoder makes that a very small frame
+            const bool new_frame = num_frames > 0 && gsr_capture_capture(capture, frame) != GSR_CAPTURE_NO_NEW_FRAME;
+            if(num_frames > 0 && (new_frame || framerate_mode == FramerateMode::CONSTANT)) {
+
+                if(request_keyframe) {
+                    request_keyframe = 0;
+                    frame->pict_type = AV_PICTURE_TYPE_I;
+                    for(ExtraOutput &extra_output : extra_outputs) {
+                        extra_output.frame->pict_type = AV_PICTURE_TYPE_I;
+                    }
+                }
+
+                for(LivestreamBitrateControl &control : livestream_bitrate_controls) {
+                    bool sink_needs_keyframe = false;
+                    const PacketSinkStats sink_stats = packet_sink_get_stats(control.sink);
+                    if(adaptive_bitrate_update(&control.adaptive_bitrate, sink_stats, this_video_frame_time, &sink_needs_keyframe)
+                        && gsr_encoder_set_bitrate(control.encoder, control.adaptive_bitrate.bitrate) && verbose)
+                    {
+                        fprintf(stderr, "update bitrate: %ld kbps (%s)\n", (long)(control.adaptive_bitrate.bitrate / 1000), control.name.c_str());
+                    }
+
+                    if(sink_needs_keyframe)
+                        (*control.frame)->pict_type = AV_PICTURE_TYPE_I;
+                }
 
                 // TODO: Check if duplicate frame can be saved just by writing it with a different pts instead of sending it again
                 for(int i = 0; i < num_frames; ++i) {
@@ -1975,13 +2864,27 @@ int main(int argc, char **argv) {
                             continue;
                     }
 
-                    int ret = avcodec_send_frame(video_codec_context, frame);
+                    if(trace_ptr)
+                        latency_trace_add_frame(trace_ptr, frame->pts, this_video_frame_time);
+
+                    int ret = gsr_encoder_send_frame(video_encoder, frame);
+                    frame->pict_type = AV_PICTURE_TYPE_NONE;
                     if(ret == 0) {
                         // TODO: Move to separate thread because this could write to network (for example when livestreaming)
-                        receive_frames(video_codec_context, VIDEO_STREAM_INDEX, video_stream, frame->pts, av_format_context,
-                            record_start_time, frame_data_queue, replay_buffer_size_secs, frames_erased, write_output_mutex);
+                        receive_frames(video_encoder, VIDEO_STREAM_INDEX, video_sinks);
                     } else {
-                        fprintf(stderr, "Error: avcodec_send_frame failed, error: %s\n", av_error_to_string(ret));
+                        fprintf(stderr, "Error: failed to encode video frame, error: %s\n", av_error_to_string(ret));
+                    }
+
+                    for(ExtraOutput &extra_output : extra_outputs) {
+                        extra_output.frame->pts = frame->pts;
+                        ret = gsr_encoder_send_frame(extra_output.encoder, extra_output.frame);
+                        extra_output.frame->pict_type = AV_PICTURE_TYPE_NONE;
+                        if(ret == 0) {
+                            receive_frames(extra_output.encoder, VIDEO_STREAM_INDEX, extra_output.video_sinks);
+                        } else {
+                            fprintf(stderr, "Error: failed to encode video frame for output '%s', error: %s\n", extra_output.filename.c_str(), av_error_to_string(ret));
+                        }
                     }
                 }
                 video_pts_counter += num_frames;
@@ -2000,7 +2903,7 @@ int main(int argc, char **argv) {
 
         if(save_replay == 1 && !save_replay_thread.valid() && replay_buffer_size_secs != -1) {
             save_replay = 0;
-            save_replay_async(video_codec_context, VIDEO_STREAM_INDEX, audio_tracks, frame_data_queue, frames_erased, filename, container_format, file_extension, write_output_mutex);
+            save_replay_async(video_codec_context, VIDEO_STREAM_INDEX, audio_tracks, frame_data_queue, frames_erased, filename, container_format, file_extension, faststart_minutes > 0, write_output_mutex);
         }
 
         double frame_end = clock_get_monotonic_seconds();
@@ -2031,12 +2934,33 @@ int main(int argc, char **argv) {
 
     av_frame_free(&aframe);
 
-    if (replay_buffer_size_secs == -1 && av_write_trailer(av_format_context) != 0) {
-        fprintf(stderr, "Failed to write trailer\n");
+    // Encoders that reorder frames (b-frames) or look ahead still have frames that haven't been output as packets
+    if(gsr_encoder_send_frame(video_encoder, nullptr) == 0)
+        receive_frames(video_encoder, VIDEO_STREAM_INDEX, video_sinks);
+    for(ExtraOutput &extra_output : extra_outputs) {
+        if(gsr_encoder_send_frame(extra_output.encoder, nullptr) == 0)
+            receive_frames(extra_output.encoder, VIDEO_STREAM_INDEX, extra_output.video_sinks);
     }
 
-    if(replay_buffer_size_secs == -1 && !(output_format->flags & AVFMT_NOFILE))
-        avio_close(av_format_context->pb);
+    // Writes the packets that are still queued
+    for(std::unique_ptr<PacketSink> &packet_sink : packet_sinks) {
+        packet_sink_stop(packet_sink.get());
+    }
+
+    if(replay_buffer_size_secs == -1)
+        close_output_file(av_format_context, filename, output_reserved_moov_size);
+
+    if(record_format_context)
+        close_output_file(record_format_context, record_filename, record_reserved_moov_size);
+
+    for(ExtraOutput &extra_output : extra_outputs) {
+        close_output_file(extra_output.format_context, extra_output.filename.c_str(), extra_output.reserved_moov_size);
+    }
+
+    gsr_encoder_destroy(video_encoder);
+    for(ExtraOutput &extra_output : extra_outputs) {
+        gsr_encoder_destroy(extra_output.encoder);
+    }
 
     gsr_capture_destroy(capture, video_codec_context);
 
@@ -0,0 +1,146 @@
+#include "../include/packet_sink.hpp"
+#include <stdio.h>
+#include <errno.h>
+
+extern "C" {
+#include "../include/utils.h"
+}
+
+static void packet_sink_thread(PacketSink *sink) {
+    for(;;) {
+        PacketSinkEntry entry;
+        {
+            std::unique_lock<std::mutex> lock(sink->mutex);
+            sink->cond.wait(lock, [sink]{ return !sink->queue.empty() || !sink->running; });
+            // Stopped and all queued packets have been written
+            if(sink->queue.empty())
+                break;
+
+            entry = sink->queue.front();
+            sink->queue.pop_front();
+        }
+        // Wakes up the encoders that wait for room in the queue
+        sink->cond.notify_all();
+
+        sink->params.write(entry.packet, entry.time_base);
+        av_packet_free(&entry.packet);
+
+        const double latency = clock_get_monotonic_seconds() - entry.push_time;
+        std::lock_guard<std::mutex> lock(sink->mutex);
+        sink->write_latency = sink->write_latency * 0.9 + latency * 0.1;
+    }
+}
+
+void packet_sink_start(PacketSink *sink, const PacketSinkParams &params) {
+    sink->params = params;
+    if(sink->params.max_queued_packets == 0)
+        sink->params.max_queued_packets = 1;
+
+    sink->running = true;
+    sink->waiting_for_keyframe = false;
+    sink->num_dropped_packets = 0;
+    sink->write_latency = 0.0;
+    sink->thread = std::thread(packet_sink_thread, sink);
+}
+
+void packet_sink_stop(PacketSink *sink) {
+    {
+        std::lock_guard<std::mutex> lock(sink->mutex);
+        if(!sink->running)
+            return;
+        sink->running = false;
+    }
+    sink->cond.notify_all();
+    sink->thread.join();
+
+    if(sink->num_dropped_packets > 0)
+        fprintf(stderr, "Info: %ld packets were dropped for output '%s' because it couldn't keep up\n", (long)sink->num_dropped_packets, sink->params.name.c_str());
+}
+
+void packet_sink_push(PacketSink *sink, const AVPacket *packet, AVRational time_base) {
+    std::unique_lock<std::mutex> lock(sink->mutex);
+    if(!sink->running)
+        return;
+
+    switch(sink->params.backpressure) {
+        case PacketSinkBackpressure::BLOCK: {
+            sink->cond.wait(lock, [sink]{ return sink->queue.size() < sink->params.max_queued_packets || !sink->running; });
+            if(!sink->running)
+                return;
+            break;
+        }
+        case PacketSinkBackpressure::DROP_UNTIL_KEYFRAME: {
+            if(sink->queue.size() >= sink->params.max_queued_packets) {
+                if(!sink->waiting_for_keyframe)
+                    fprintf(stderr, "Warning: output '%s' can't keep up, dropping packets until the next keyframe\n", sink->params.name.c_str());
+                sink->waiting_for_keyframe = true;
+                ++sink->num_dropped_packets;
+                return;
+            }
+
+            // The video can only continue from a keyframe, other streams (audio) continue as soon as there is room
+            if(sink->waiting_for_keyframe && packet->stream_index == sink->params.video_stream_index) {
+                if(!(packet->flags & AV_PKT_FLAG_KEY)) {
+                    ++sink->num_dropped_packets;
+                    return;
+                }
+                sink->waiting_for_keyframe = false;
+            }
+            break;
+        }
+    }
+
+    AVPacket *packet_ref = av_packet_clone(packet);
+    if(!packet_ref) {
+        fprintf(stderr, "Error: failed to reference packet for output '%s'\n", sink->params.name.c_str());
+        return;
+    }
+
+    sink->queue.push_back({ packet_ref, time_base, clock_get_monotonic_seconds() });
+    lock.unlock();
+    sink->cond.notify_all();
+}
+
+void packet_sinks_push(const std::vector<PacketSink*> &sinks, const AVPacket *packet, AVRational time_base) {
+    for(PacketSink *sink : sinks) {
+        packet_sink_push(sink, packet, time_base);
+    }
+}
+
+void packet_sinks_receive_packets(const std::function<int(AVPacket*)> &receive_packet, AVRational time_base, int stream_index, const std::vector<PacketSink*> &sinks) {
+    for (;;) {
+        AVPacket *av_packet = av_packet_alloc();
+        if(!av_packet)
+            break;
+
+        av_packet->data = NULL;
+        av_packet->size = 0;
+        int res = receive_packet(av_packet);
+        if (res == 0) { // we have a packet, send the packet to the sinks
+            av_packet->stream_index = stream_index;
+            packet_sinks_push(sinks, av_packet, time_base);
+        } else if (res == AVERROR(EAGAIN)) { // we have no packet
+                                             // fprintf(stderr, "No packet!\n");
+            av_packet_free(&av_packet);
+            break;
+        } else if (res == AVERROR_EOF) { // this is the end of the stream, after the encoder has been flushed
+            av_packet_free(&av_packet);
+            break;
+        } else {
+            fprintf(stderr, "Unexpected error: %d\n", res);
+            av_packet_free(&av_packet);
+            break;
+        }
+        av_packet_free(&av_packet);
+    }
+}
+
+PacketSinkStats packet_sink_get_stats(PacketSink *sink) {
+    std::lock_guard<std::mutex> lock(sink->mutex);
+    PacketSinkStats stats;
+    stats.num_queued_packets = sink->queue.size();
+    stats.write_latency = sink->write_latency;
+    stats.num_dropped_packets = sink->num_dropped_packets;
+    stats.waiting_for_keyframe = sink->waiting_for_keyframe;
+    return stats;
+}
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <X11/extensions/Xcomposite.h>
 
 double clock_get_monotonic_seconds(void) {
     struct timespec ts;
@@ -65,6 +66,39 @@ bool get_monitor_by_name(Display *display, const char *name, gsr_monitor *monito
     return userdata.found_monitor;
 }
 
+Window get_compositor_window(Display *display) {
+    char cm_selection_name[32];
+    snprintf(cm_selection_name, sizeof(cm_selection_name), "_NET_WM_CM_S%d", DefaultScreen(display));
+    const Atom cm_selection_atom = XInternAtom(display, cm_selection_name, False);
+    /* Getting the overlay window without a compositor would map it on top of everything */
+    if(!cm_selection_atom || XGetSelectionOwner(display, cm_selection_atom) == None)
+        return None;
+
+    int event_base, error_base;
+    if(!XCompositeQueryExtension(display, &event_base, &error_base))
+        return None;
+
+    /* The overlay window is kept by the compositor after we release it */
+    const Window overlay_window = XCompositeGetOverlayWindow(display, DefaultRootWindow(display));
+    XCompositeReleaseOverlayWindow(display, DefaultRootWindow(display));
+    if(!overlay_window)
+        return None;
+
+    /* Some compositors draw to a window they create inside the overlay window (the topmost child) instead of the overlay window itself */
+    Window compositor_window = overlay_window;
+    Window root_return = None;
+    Window parent_return = None;
+    Window *children = NULL;
+    unsigned int num_children = 0;
+    if(XQueryTree(display, overlay_window, &root_return, &parent_return, &children, &num_children) && children) {
+        if(num_children > 0)
+            compositor_window = children[num_children - 1];
+        XFree(children);
+    }
+
+    return compositor_window;
+}
+
 bool gl_get_gpu_info(Display *dpy, gsr_gpu_info *info) {
     gsr_egl gl;
     if(!gsr_egl_load(&gl, dpy)) {
@@ -75,8 +109,10 @@ bool gl_get_gpu_info(Display *dpy, gsr_gpu_info *info) {
     bool supported = true;
     const unsigned char *gl_vendor = gl.glGetString(GL_VENDOR);
     const unsigned char *gl_renderer = gl.glGetString(GL_RENDERER);
+    const unsigned char *gl_version = gl.glGetString(GL_VERSION);
 
     info->gpu_version = 0;
+    snprintf(info->driver_version, sizeof(info->driver_version), "%s", gl_version ? (const char*)gl_version : "");
 
     if(!gl_vendor) {
         fprintf(stderr, "gsr error: failed to get gpu vendor\n");
@@ -114,3 +150,20 @@ bool gsr_get_valid_card_path(char *output) {
     }
     return false;
 }
+
+vec2i scale_keep_aspect_ratio(vec2i from, vec2i to) {
+    if(from.x == 0 || from.y == 0)
+        return (vec2i){0, 0};
+
+    const double height_to_width_ratio = (double)from.y / (double)from.x;
+    from.x = to.x;
+    from.y = from.x * height_to_width_ratio;
+
+    if(from.y > to.y) {
+        const double width_height_ratio = (double)from.x / (double)from.y;
+        from.y = to.y;
+        from.x = from.y * width_height_ratio;
+    }
+
+    return from;
+}
@@ -17,6 +17,8 @@ int window_texture_init(WindowTexture *window_texture, Display *display, Window
     window_texture->window = window;
     window_texture->pixmap = None;
     window_texture->texture_id = 0;
+    window_texture->texture_width = 0;
+    window_texture->texture_height = 0;
     window_texture->redirected = 0;
     window_texture->egl = egl;
     
@@ -99,6 +101,9 @@ int window_texture_on_resize(WindowTexture *self) {
         goto cleanup;
     }
 
+    self->egl->glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &self->texture_width);
+    self->egl->glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &self->texture_height);
+
     self->pixmap = pixmap;
     self->texture_id = texture_id;
 
@@ -109,8 +114,10 @@ int window_texture_on_resize(WindowTexture *self) {
         self->egl->eglDestroyImage(self->egl->egl_display, image);
 
     if(result != 0) {
+        /* |texture_id| can be the texture of the previous pixmap, which is then no longer valid */
         if(texture_id != 0)
             self->egl->glDeleteTextures(1, &texture_id);
+        self->texture_id = 0;
         if(pixmap)
             XFreePixmap(self->display, pixmap);
     }
@@ -0,0 +1,158 @@
+#include "../include/window_tracker.h"
+#include "../include/utils.h"
+#include <string.h>
+
+#define WINDOW_EVENT_MASK (StructureNotifyMask | ExposureMask)
+/* How long to wait before trying to acquire the window pixmap again after it failed */
+#define PIXMAP_RETRY_DELAY_SECONDS 0.5
+
+static int max_int(int a, int b) {
+    return a > b ? a : b;
+}
+
+static Window get_toplevel_window(Display *display, Window window) {
+    const Window root_window = DefaultRootWindow(display);
+    Window current_window = window;
+    for(;;) {
+        Window root = None;
+        Window parent = None;
+        Window *children = NULL;
+        unsigned int num_children = 0;
+        if(!XQueryTree(display, current_window, &root, &parent, &children, &num_children))
+            return current_window;
+
+        if(children)
+            XFree(children);
+
+        if(parent == None || parent == root_window)
+            return current_window;
+
+        current_window = parent;
+    }
+}
+
+static void gsr_window_tracker_update_attributes(gsr_window_tracker *self) {
+    XWindowAttributes attr;
+    memset(&attr, 0, sizeof(attr));
+    if(!XGetWindowAttributes(self->display, self->window, &attr)) {
+        self->viewable = false;
+        return;
+    }
+
+    self->size.x = max_int(attr.width, 0);
+    self->size.y = max_int(attr.height, 0);
+    self->viewable = attr.map_state == IsViewable;
+}
+
+static void gsr_window_tracker_update_toplevel(gsr_window_tracker *self) {
+    if(self->toplevel && self->toplevel != self->window)
+        XSelectInput(self->display, self->toplevel, 0);
+
+    self->toplevel = get_toplevel_window(self->display, self->window);
+    if(self->toplevel != self->window)
+        XSelectInput(self->display, self->toplevel, StructureNotifyMask);
+}
+
+void gsr_window_tracker_init(gsr_window_tracker *self, Display *display, Window window) {
+    memset(self, 0, sizeof(*self));
+    self->display = display;
+    self->window = window;
+    if(!window)
+        return;
+
+    XSelectInput(self->display, self->window, WINDOW_EVENT_MASK);
+    gsr_window_tracker_update_toplevel(self);
+    gsr_window_tracker_update_attributes(self);
+    self->pixmap_invalid = true;
+}
+
+void gsr_window_tracker_deinit(gsr_window_tracker *self) {
+    if(!self->display || !self->window)
+        return;
+
+    if(!self->destroyed) {
+        XSelectInput(self->display, self->window, 0);
+        if(self->toplevel && self->toplevel != self->window)
+            XSelectInput(self->display, self->toplevel, 0);
+    }
+
+    self->window = None;
+    self->toplevel = None;
+}
+
+bool gsr_window_tracker_process_event(gsr_window_tracker *self, XEvent *xev) {
+    if(!self->window)
+        return false;
+
+    switch(xev->type) {
+        case DestroyNotify: {
+            if(xev->xdestroywindow.window != self->window)
+                return false;
+            self->destroyed = true;
+            self->viewable = false;
+            return true;
+        }
+        case UnmapNotify: {
+            /* The last captured image is kept until the window is mapped again */
+            if(xev->xunmap.window != self->window && xev->xunmap.window != self->toplevel)
+                return false;
+            self->viewable = false;
+            return true;
+        }
+        case MapNotify: {
+            /* The window has a new pixmap after it's mapped again */
+            if(xev->xmap.window != self->window && xev->xmap.window != self->toplevel)
+                return false;
+            gsr_window_tracker_update_attributes(self);
+            self->pixmap_invalid = true;
+            self->pixmap_retry_time = 0.0;
+            return true;
+        }
+        case ReparentNotify: {
+            /* The window manager (re)decorated the window or the frame moved. The toplevel window changes and so does the pixmap */
+            if(xev->xreparent.window != self->window && xev->xreparent.window != self->toplevel)
+                return false;
+            gsr_window_tracker_update_toplevel(self);
+            gsr_window_tracker_update_attributes(self);
+            self->pixmap_invalid = true;
+            self->pixmap_retry_time = 0.0;
+            return true;
+        }
+        case ConfigureNotify: {
+            if(xev->xconfigure.window != self->window)
+                return false;
+            /* Window resized */
+            if(xev->xconfigure.width != self->size.x || xev->xconfigure.height != self->size.y) {
+                self->size.x = max_int(xev->xconfigure.width, 0);
+                self->size.y = max_int(xev->xconfigure.height, 0);
+                self->pixmap_invalid = true;
+            }
+            return true;
+        }
+        case Expose: {
+            if(xev->xexpose.window != self->window)
+                return false;
+            /* Requires window texture recreate */
+            if(xev->xexpose.count == 0)
+                self->pixmap_invalid = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool gsr_window_tracker_should_acquire_pixmap(const gsr_window_tracker *self) {
+    return self->window && !self->destroyed && self->pixmap_invalid && self->viewable && clock_get_monotonic_seconds() >= self->pixmap_retry_time;
+}
+
+void gsr_window_tracker_on_pixmap_acquired(gsr_window_tracker *self) {
+    self->pixmap_invalid = false;
+    self->pixmap_retry_time = 0.0;
+}
+
+void gsr_window_tracker_on_pixmap_acquire_failed(gsr_window_tracker *self) {
+    self->pixmap_invalid = true;
+    self->pixmap_retry_time = clock_get_monotonic_seconds() + PIXMAP_RETRY_DELAY_SECONDS;
+    /* Composite redirection or the map state might have changed without us getting an event for it */
+    gsr_window_tracker_update_attributes(self);
+}
@@ -0,0 +1,151 @@
+#include "test.h"
+#include "throttled_output.hpp"
+#include "../include/adaptive_bitrate.hpp"
+#include "../include/packet_sink.hpp"
+#include <algorithm>
+#include <unistd.h>
+
+extern "C" {
+#include "../include/utils.h"
+}
+
+static const AVRational time_base = { 1, 100 };
+static const int video_stream_index = 0;
+static const int audio_stream_index = 1;
+
+static void push_packet(PacketSink *sink, int size, bool keyframe, int stream_index) {
+    AVPacket *packet = av_packet_alloc();
+    TEST_ASSERT(packet);
+    TEST_ASSERT(av_new_packet(packet, size) == 0);
+    packet->stream_index = stream_index;
+    if(keyframe)
+        packet->flags |= AV_PKT_FLAG_KEY;
+    packet_sink_push(sink, packet, time_base);
+    av_packet_free(&packet);
+}
+
+static void wait_until_queue_is_empty(PacketSink *sink) {
+    while(packet_sink_get_stats(sink).num_queued_packets > 0) {
+        usleep(1000);
+    }
+}
+
+static PacketSinkParams create_livestream_sink_params(ThrottledOutput *output, size_t max_queued_packets) {
+    PacketSinkParams params;
+    params.name = "stand-in livestream";
+    params.backpressure = PacketSinkBackpressure::DROP_UNTIL_KEYFRAME;
+    params.max_queued_packets = max_queued_packets;
+    params.video_stream_index = video_stream_index;
+    params.write = throttled_output_write_callback(output);
+    return params;
+}
+
+static void test_drop_until_keyframe() {
+    ThrottledOutput output; // Stalled until the throughput is set
+    PacketSink sink;
+    packet_sink_start(&sink, create_livestream_sink_params(&output, 4));
+
+    // At most 5 packets fit, the one being written and 4 in the queue
+    push_packet(&sink, 1000, true, video_stream_index);
+    for(int i = 0; i < 20; ++i) {
+        push_packet(&sink, 1000, false, video_stream_index);
+    }
+
+    PacketSinkStats stats = packet_sink_get_stats(&sink);
+    TEST_ASSERT(stats.waiting_for_keyframe);
+    TEST_ASSERT(stats.num_dropped_packets >= 16);
+
+    // Only one keyframe is requested for each drop
+    AdaptiveBitrateParams params;
+    params.max_bitrate = 1000000;
+    params.min_bitrate = params.max_bitrate / 8;
+    AdaptiveBitrate adaptive_bitrate;
+    adaptive_bitrate_init(&adaptive_bitrate, params, 0.0);
+    bool request_keyframe = false;
+    adaptive_bitrate_update(&adaptive_bitrate, stats, 0.1, &request_keyframe);
+    TEST_ASSERT(request_keyframe);
+    adaptive_bitrate_update(&adaptive_bitrate, stats, 0.2, &request_keyframe);
+    TEST_ASSERT(!request_keyframe);
+
+    // The packets that were dropped also lower the bitrate
+    TEST_ASSERT(adaptive_bitrate_update(&adaptive_bitrate, stats, 1.0, &request_keyframe));
+    TEST_ASSERT_EQ_INT(adaptive_bitrate.bitrate, params.max_bitrate / 2);
+
+    // When the output keeps up again the video continues from the next keyframe, while audio continues right away
+    throttled_output_set_throughput(&output, 10 * 1000 * 1000);
+    wait_until_queue_is_empty(&sink);
+    const int64_t num_dropped_packets = packet_sink_get_stats(&sink).num_dropped_packets;
+
+    push_packet(&sink, 1000, false, video_stream_index);
+    TEST_ASSERT_EQ_INT(packet_sink_get_stats(&sink).num_dropped_packets, num_dropped_packets + 1);
+
+    push_packet(&sink, 100, false, audio_stream_index);
+    TEST_ASSERT_EQ_INT(packet_sink_get_stats(&sink).num_dropped_packets, num_dropped_packets + 1);
+
+    push_packet(&sink, 1000, true, video_stream_index);
+    push_packet(&sink, 1000, false, video_stream_index);
+    stats = packet_sink_get_stats(&sink);
+    TEST_ASSERT(!stats.waiting_for_keyframe);
+    TEST_ASSERT_EQ_INT(stats.num_dropped_packets, num_dropped_packets + 1);
+
+    adaptive_bitrate_update(&adaptive_bitrate, stats, 1.1, &request_keyframe);
+    TEST_ASSERT(!request_keyframe);
+
+    packet_sink_stop(&sink);
+    TEST_ASSERT_EQ_INT(throttled_output_get_num_written_keyframes(&output), 2);
+}
+
+static void test_congestion_and_recovery() {
+    const int fps = 100;
+    const int64_t max_bitrate = 800000; // 1000 bytes per frame
+    const int64_t congested_throughput = 50000; // Bytes per second, half of the max bitrate
+
+    ThrottledOutput output;
+    throttled_output_set_throughput(&output, congested_throughput);
+    PacketSink sink;
+    packet_sink_start(&sink, create_livestream_sink_params(&output, fps * 3));
+
+    AdaptiveBitrateParams params;
+    params.max_bitrate = max_bitrate;
+    params.min_bitrate = max_bitrate / 8;
+    params.max_write_latency = 0.1;
+    params.update_interval = 0.05;
+    params.raise_delay = 0.2;
+    AdaptiveBitrate adaptive_bitrate;
+    adaptive_bitrate_init(&adaptive_bitrate, params, clock_get_monotonic_seconds());
+
+    int64_t frame_index = 0;
+    int64_t lowest_bitrate = max_bitrate;
+    bool next_frame_is_keyframe = true;
+    // Encodes at the bitrate of the controller in real time, like the encoder of a livestream
+    auto encode_for = [&](double duration) {
+        const int num_frames = duration * fps;
+        for(int i = 0; i < num_frames; ++i, ++frame_index) {
+            bool request_keyframe = false;
+            adaptive_bitrate_update(&adaptive_bitrate, packet_sink_get_stats(&sink), clock_get_monotonic_seconds(), &request_keyframe);
+            lowest_bitrate = std::min(lowest_bitrate, adaptive_bitrate.bitrate);
+            if(request_keyframe || frame_index % fps == 0)
+                next_frame_is_keyframe = true;
+
+            push_packet(&sink, adaptive_bitrate.bitrate / 8 / fps, next_frame_is_keyframe, video_stream_index);
+            next_frame_is_keyframe = false;
+            usleep(1000000 / fps);
+        }
+    };
+
+    encode_for(2.0);
+    TEST_ASSERT(lowest_bitrate <= congested_throughput * 8);
+    TEST_ASSERT(adaptive_bitrate.bitrate < max_bitrate);
+
+    throttled_output_set_throughput(&output, 10 * 1000 * 1000);
+    encode_for(4.0);
+    TEST_ASSERT_EQ_INT(adaptive_bitrate.bitrate, max_bitrate);
+
+    packet_sink_stop(&sink);
+}
+
+int main() {
+    test_drop_until_keyframe();
+    test_congestion_and_recovery();
+    return 0;
+}
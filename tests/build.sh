@@ -0,0 +1,76 @@
+#!/bin/sh -e
+
+# Builds and runs the tests. Run from the root of the repository: ./tests/build.sh
+
+CC=${CC:-gcc}
+CXX=${CXX:-g++}
+
+opts="-O0 -g3 -Wall -Wextra"
+out=tests/bin
+mkdir -p "$out"
+
+run_test() {
+    echo "Running $1"
+    "$out/$1"
+}
+
+test_packet_sink() {
+    dependencies="libavcodec libavutil x11 xrandr xcomposite"
+    includes="$(pkg-config --cflags $dependencies)"
+    libs="$(pkg-config --libs $dependencies) -pthread"
+    $CC -c src/utils.c -o "$out/utils.o" $opts $includes
+    $CXX -o "$out/packet_sink_test" tests/packet_sink_test.cpp src/packet_sink.cpp "$out/utils.o" $opts $includes $libs
+    run_test packet_sink_test
+}
+
+test_adaptive_bitrate() {
+    dependencies="libavcodec libavutil x11 xrandr xcomposite"
+    includes="$(pkg-config --cflags $dependencies)"
+    libs="$(pkg-config --libs $dependencies) -pthread"
+    $CC -c src/utils.c -o "$out/utils.o" $opts $includes
+    $CXX -o "$out/adaptive_bitrate_test" tests/adaptive_bitrate_test.cpp tests/throttled_output.cpp src/adaptive_bitrate.cpp src/packet_sink.cpp "$out/utils.o" $opts $includes $libs
+    run_test adaptive_bitrate_test
+}
+
+test_muxing() {
+    dependencies="libavformat libavcodec libavutil x11 xrandr xcomposite"
+    includes="$(pkg-config --cflags $dependencies)"
+    libs="$(pkg-config --libs $dependencies) -pthread"
+    $CC -c src/utils.c -o "$out/utils.o" $opts $includes
+    $CXX -o "$out/muxing_test" tests/muxing_test.cpp src/packet_sink.cpp "$out/utils.o" $opts $includes $libs
+    run_test muxing_test
+}
+
+test_encoder() {
+    dependencies="libavcodec libavutil"
+    includes="$(pkg-config --cflags $dependencies)"
+    libs="$(pkg-config --libs $dependencies)"
+    $CC -o "$out/encoder_test" tests/encoder_test.c tests/mock_encoder.c src/encoder/encoder.c $opts $includes $libs
+    run_test encoder_test
+}
+
+test_cursor_unpremultiply() {
+    $CC -o "$out/cursor_unpremultiply_test" tests/cursor_unpremultiply_test.c src/cursor_unpremultiply.c $opts
+    run_test cursor_unpremultiply_test
+}
+
+test_color_conversion_quad() {
+    $CC -o "$out/color_conversion_quad_test" tests/color_conversion_quad_test.c src/color_conversion_quad.c $opts -lm
+    run_test color_conversion_quad_test
+}
+
+test_window_tracker() {
+    # The test provides fake Xlib functions, only the headers are used
+    includes="$(pkg-config --cflags x11 xrandr)"
+    $CC -o "$out/window_tracker_test" tests/window_tracker_test.c src/window_tracker.c $opts $includes
+    run_test window_tracker_test
+}
+
+test_packet_sink
+test_adaptive_bitrate
+test_muxing
+test_encoder
+test_cursor_unpremultiply
+test_window_tracker
+test_color_conversion_quad
+echo "All tests passed"
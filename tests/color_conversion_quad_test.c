@@ -0,0 +1,84 @@
+#include "test.h"
+#include "../include/color_conversion_quad.h"
+#include <math.h>
+
+#define ASSERT_NEAR(a, b) TEST_ASSERT(fabsf((a) - (b)) < 0.0001f)
+
+/* Vertex indices in the output of gsr_color_conversion_quad_get_vertices */
+enum { TOP_LEFT = 0, BOTTOM_LEFT = 1, BOTTOM_RIGHT = 2, TOP_RIGHT = 5 };
+
+static void assert_vertex(const float *vertices, int index, float x, float y, float u, float v) {
+    ASSERT_NEAR(vertices[index * 4 + 0], x);
+    ASSERT_NEAR(vertices[index * 4 + 1], y);
+    ASSERT_NEAR(vertices[index * 4 + 2], u);
+    ASSERT_NEAR(vertices[index * 4 + 3], v);
+}
+
+static void test_unrotated() {
+    float vertices[GSR_QUAD_NUM_VERTEX_FLOATS];
+    gsr_color_conversion_quad_get_vertices(vertices, (vec2i){ 200, 100 }, (vec2i){ 50, 25 }, (vec2i){ 100, 50 }, (vec2i){ 400, 200 }, (vec2i){ 100, 50 }, (vec2i){ 200, 100 }, 0.0f);
+    assert_vertex(vertices, TOP_LEFT,     -0.5f,  0.5f, 0.25f, 0.75f);
+    assert_vertex(vertices, BOTTOM_LEFT,  -0.5f, -0.5f, 0.25f, 0.25f);
+    assert_vertex(vertices, BOTTOM_RIGHT,  0.5f, -0.5f, 0.75f, 0.25f);
+    assert_vertex(vertices, TOP_RIGHT,     0.5f,  0.5f, 0.75f, 0.75f);
+}
+
+/* One rotated monitor that covers the whole target, the image turns inside the target like when the whole quad was rotated */
+static void test_rotated_single_monitor() {
+    float vertices[GSR_QUAD_NUM_VERTEX_FLOATS];
+    gsr_color_conversion_quad_get_vertices(vertices, (vec2i){ 1080, 1920 }, (vec2i){ 0, 0 }, (vec2i){ 1080, 1920 }, (vec2i){ 1920, 1080 }, (vec2i){ 0, 0 }, (vec2i){ 1080, 1920 }, M_PI * 0.5f);
+    assert_vertex(vertices, TOP_LEFT,     -1.0f,  1.0f, 1.0f, 1.0f);
+    assert_vertex(vertices, BOTTOM_LEFT,  -1.0f, -1.0f, 0.0f, 1.0f);
+    assert_vertex(vertices, BOTTOM_RIGHT,  1.0f, -1.0f, 0.0f, 0.0f);
+    assert_vertex(vertices, TOP_RIGHT,     1.0f,  1.0f, 1.0f, 0.0f);
+
+    gsr_color_conversion_quad_get_vertices(vertices, (vec2i){ 1920, 1080 }, (vec2i){ 0, 0 }, (vec2i){ 1920, 1080 }, (vec2i){ 1920, 1080 }, (vec2i){ 0, 0 }, (vec2i){ 1920, 1080 }, M_PI);
+    assert_vertex(vertices, TOP_LEFT,     -1.0f,  1.0f, 1.0f, 0.0f);
+    assert_vertex(vertices, BOTTOM_RIGHT,  1.0f, -1.0f, 0.0f, 1.0f);
+}
+
+/*
+    A landscape monitor at x=0 and a portrait (rotated 90 degrees) monitor at x=1920 in a 3000x1920 layout.
+    The rotated monitor has to stay in its own area, with the same texture coordinates as when it covers the whole target
+*/
+static void test_rotated_monitor_at_offset() {
+    const vec2i target_size = { 3000, 1920 };
+    float vertices[GSR_QUAD_NUM_VERTEX_FLOATS];
+
+    gsr_color_conversion_quad_get_vertices(vertices, target_size, (vec2i){ 0, 0 }, (vec2i){ 1920, 1080 }, (vec2i){ 1920, 1080 }, (vec2i){ 0, 0 }, (vec2i){ 1920, 1080 }, 0.0f);
+    const float landscape_right = -1.0f + 1920.0f * 2.0f / 3000.0f;
+    const float landscape_top = -1.0f + 1080.0f * 2.0f / 1920.0f;
+    assert_vertex(vertices, TOP_LEFT,     -1.0f,           landscape_top, 0.0f, 1.0f);
+    assert_vertex(vertices, BOTTOM_LEFT,  -1.0f,           -1.0f,         0.0f, 0.0f);
+    assert_vertex(vertices, BOTTOM_RIGHT, landscape_right, -1.0f,         1.0f, 0.0f);
+    assert_vertex(vertices, TOP_RIGHT,    landscape_right, landscape_top, 1.0f, 1.0f);
+
+    /* The plane of the rotated monitor isn't rotated (1920x1080), its size in the layout is 1080x1920 */
+    gsr_color_conversion_quad_get_vertices(vertices, target_size, (vec2i){ 1920, 0 }, (vec2i){ 1080, 1920 }, (vec2i){ 1920, 1080 }, (vec2i){ 0, 0 }, (vec2i){ 1080, 1920 }, M_PI * 0.5f);
+    const float portrait_left = -1.0f + 1920.0f * 2.0f / 3000.0f;
+    assert_vertex(vertices, TOP_LEFT,     portrait_left,  1.0f, 1.0f, 1.0f);
+    assert_vertex(vertices, BOTTOM_LEFT,  portrait_left, -1.0f, 0.0f, 1.0f);
+    assert_vertex(vertices, BOTTOM_RIGHT, 1.0f,          -1.0f, 0.0f, 0.0f);
+    assert_vertex(vertices, TOP_RIGHT,    1.0f,           1.0f, 1.0f, 0.0f);
+}
+
+/* Part of a rotated monitor (region capture), the area is given in the rotated orientation */
+static void test_rotated_region() {
+    float vertices[GSR_QUAD_NUM_VERTEX_FLOATS];
+    gsr_color_conversion_quad_get_vertices(vertices, (vec2i){ 540, 960 }, (vec2i){ 0, 0 }, (vec2i){ 540, 960 }, (vec2i){ 1920, 1080 }, (vec2i){ 0, 0 }, (vec2i){ 540, 960 }, M_PI * 1.5f);
+    /* The bottom left quarter of the rotated image is the bottom right quarter of the texture after turning it back */
+    assert_vertex(vertices, TOP_LEFT,     -1.0f,  1.0f, 0.5f, 0.0f);
+    assert_vertex(vertices, BOTTOM_LEFT,  -1.0f, -1.0f, 1.0f, 0.0f);
+    assert_vertex(vertices, BOTTOM_RIGHT,  1.0f, -1.0f, 1.0f, 0.5f);
+    assert_vertex(vertices, TOP_RIGHT,     1.0f,  1.0f, 0.5f, 0.5f);
+    TEST_ASSERT(gsr_rotation_is_sideways(M_PI * 1.5f));
+    TEST_ASSERT(!gsr_rotation_is_sideways(M_PI));
+}
+
+int main(void) {
+    test_unrotated();
+    test_rotated_single_monitor();
+    test_rotated_monitor_at_offset();
+    test_rotated_region();
+    return 0;
+}
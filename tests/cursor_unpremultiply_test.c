@@ -0,0 +1,93 @@
+#include "test.h"
+#include "../include/cursor_unpremultiply.h"
+
+#include <string.h>
+
+static uint8_t reference_unpremultiply(int color, int alpha) {
+    if(alpha == 0)
+        return 0;
+    const int value = color * 255 / alpha;
+    return value > 255 ? 255 : value;
+}
+
+static unsigned long make_pixel(int r, int g, int b, int a) {
+    return (unsigned long)r | ((unsigned long)g << 8) | ((unsigned long)b << 16) | ((unsigned long)a << 24);
+}
+
+/* Every alpha and color combination, including colors larger than alpha (invalid premultiplied colors that have to be clamped) */
+static void test_all_values(void) {
+    enum { WIDTH = 256, HEIGHT = 256 };
+    static unsigned long pixels[WIDTH * HEIGHT];
+    static uint8_t out[WIDTH * HEIGHT * 4];
+    for(int alpha = 0; alpha < HEIGHT; ++alpha) {
+        for(int color = 0; color < WIDTH; ++color) {
+            pixels[alpha * WIDTH + color] = make_pixel(color, 255 - color, color / 2, alpha);
+        }
+    }
+
+    TEST_ASSERT(gsr_cursor_unpremultiply(pixels, WIDTH, HEIGHT, out, WIDTH * 4));
+    for(int alpha = 0; alpha < HEIGHT; ++alpha) {
+        for(int color = 0; color < WIDTH; ++color) {
+            const uint8_t *pixel = out + (alpha * WIDTH + color) * 4;
+            TEST_ASSERT_EQ_INT(pixel[0], reference_unpremultiply(color, alpha));
+            TEST_ASSERT_EQ_INT(pixel[1], reference_unpremultiply(255 - color, alpha));
+            TEST_ASSERT_EQ_INT(pixel[2], reference_unpremultiply(color / 2, alpha));
+            TEST_ASSERT_EQ_INT(pixel[3], alpha);
+        }
+    }
+}
+
+/* Widths that are not a multiple of the vector width and an output stride with padding that must not be written to */
+static void test_odd_width_and_stride(void) {
+    enum { MAX_WIDTH = 11, HEIGHT = 3, STRIDE = (MAX_WIDTH + 2) * 4 };
+    unsigned long pixels[MAX_WIDTH * HEIGHT];
+    uint8_t out[STRIDE * HEIGHT];
+    for(int width = 1; width <= MAX_WIDTH; ++width) {
+        for(int i = 0; i < width * HEIGHT; ++i) {
+            const int alpha = 1 + (i * 37) % 255;
+            pixels[i] = make_pixel((i * 13) % (alpha + 1), (i * 7) % (alpha + 1), (i * 3) % (alpha + 1), alpha);
+        }
+
+        memset(out, 0xAB, sizeof(out));
+        TEST_ASSERT(gsr_cursor_unpremultiply(pixels, width, HEIGHT, out, STRIDE));
+        for(int y = 0; y < HEIGHT; ++y) {
+            for(int x = 0; x < width; ++x) {
+                const unsigned long pixel = pixels[y * width + x];
+                const int alpha = pixel >> 24;
+                const uint8_t *out_pixel = out + y * STRIDE + x * 4;
+                TEST_ASSERT_EQ_INT(out_pixel[0], reference_unpremultiply(pixel & 0xFF, alpha));
+                TEST_ASSERT_EQ_INT(out_pixel[1], reference_unpremultiply((pixel >> 8) & 0xFF, alpha));
+                TEST_ASSERT_EQ_INT(out_pixel[2], reference_unpremultiply((pixel >> 16) & 0xFF, alpha));
+                TEST_ASSERT_EQ_INT(out_pixel[3], alpha);
+            }
+            for(int x = width * 4; x < STRIDE; ++x) {
+                TEST_ASSERT_EQ_INT(out[y * STRIDE + x], 0xAB);
+            }
+        }
+    }
+}
+
+static void test_transparent(void) {
+    enum { WIDTH = 9, HEIGHT = 2 };
+    unsigned long pixels[WIDTH * HEIGHT];
+    uint8_t out[WIDTH * HEIGHT * 4];
+    /* Color without alpha is not visible either */
+    for(int i = 0; i < WIDTH * HEIGHT; ++i) {
+        pixels[i] = make_pixel(i, 255, 0, 0);
+    }
+    TEST_ASSERT(!gsr_cursor_unpremultiply(pixels, WIDTH, HEIGHT, out, WIDTH * 4));
+
+    /* A single visible pixel, both in the vectorized part and in the remainder of a row */
+    pixels[2] = make_pixel(0, 0, 0, 1);
+    TEST_ASSERT(gsr_cursor_unpremultiply(pixels, WIDTH, HEIGHT, out, WIDTH * 4));
+    pixels[2] = make_pixel(0, 0, 0, 0);
+    pixels[WIDTH - 1] = make_pixel(0, 0, 0, 1);
+    TEST_ASSERT(gsr_cursor_unpremultiply(pixels, WIDTH, HEIGHT, out, WIDTH * 4));
+}
+
+int main(void) {
+    test_all_values();
+    test_odd_width_and_stride();
+    test_transparent();
+    return 0;
+}
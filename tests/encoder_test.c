@@ -0,0 +1,131 @@
+#include "test.h"
+#include "mock_encoder.h"
+#include <libavcodec/avcodec.h>
+
+static AVCodecContext* create_codec_context(int64_t bitrate, int gop_size) {
+    AVCodecContext *codec_context = avcodec_alloc_context3(NULL);
+    TEST_ASSERT(codec_context);
+    codec_context->framerate = (AVRational){ 100, 1 };
+    codec_context->time_base = (AVRational){ 1, 100 };
+    codec_context->bit_rate = bitrate;
+    codec_context->gop_size = gop_size;
+    return codec_context;
+}
+
+static int send_frame(gsr_encoder *encoder, AVFrame *frame, int64_t pts, bool request_keyframe) {
+    frame->pts = pts;
+    frame->pict_type = request_keyframe ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+    return gsr_encoder_send_frame(encoder, frame);
+}
+
+static void test_send_and_receive(void) {
+    AVCodecContext *codec_context = create_codec_context(800000, 4);
+    const gsr_mock_encoder_params params = { .codec_context = codec_context, .delay = 2, .can_set_bitrate = true };
+    gsr_encoder *encoder = gsr_mock_encoder_create(&params);
+    TEST_ASSERT(encoder);
+    AVFrame *frame = av_frame_alloc();
+    AVPacket *packet = av_packet_alloc();
+    TEST_ASSERT(frame && packet);
+
+    TEST_ASSERT_EQ_INT(gsr_encoder_receive_packet(encoder, packet), AVERROR(EAGAIN));
+
+    /* The first packets come out after |delay| more frames have been sent */
+    TEST_ASSERT_EQ_INT(send_frame(encoder, frame, 0, false), 0);
+    TEST_ASSERT_EQ_INT(gsr_encoder_receive_packet(encoder, packet), AVERROR(EAGAIN));
+    TEST_ASSERT_EQ_INT(send_frame(encoder, frame, 1, false), 0);
+    TEST_ASSERT_EQ_INT(send_frame(encoder, frame, 2, false), 0);
+
+    /* The encoder is full until the packet is received */
+    TEST_ASSERT_EQ_INT(send_frame(encoder, frame, 3, false), AVERROR(EAGAIN));
+    TEST_ASSERT_EQ_INT(gsr_encoder_receive_packet(encoder, packet), 0);
+    TEST_ASSERT_EQ_INT(packet->pts, 0);
+    TEST_ASSERT_EQ_INT(packet->size, 800000 / 8 / 100);
+    TEST_ASSERT(packet->flags & AV_PKT_FLAG_KEY);
+    TEST_ASSERT_EQ_INT(gsr_encoder_receive_packet(encoder, packet), AVERROR(EAGAIN));
+
+    /* Keyframes every gop_size frames and when they are requested */
+    const bool expected_keyframes[] = { false, false, false, true, false, true, false, false, false, true };
+    const int num_frames = sizeof(expected_keyframes) / sizeof(expected_keyframes[0]);
+    int64_t next_pts = 1;
+    for(int64_t pts = 3; pts < 1 + num_frames; ++pts) {
+        TEST_ASSERT_EQ_INT(send_frame(encoder, frame, pts, pts == 6), 0);
+        TEST_ASSERT_EQ_INT(gsr_encoder_receive_packet(encoder, packet), 0);
+        TEST_ASSERT_EQ_INT(packet->pts, next_pts);
+        TEST_ASSERT_EQ_INT(!!(packet->flags & AV_PKT_FLAG_KEY), expected_keyframes[next_pts - 1]);
+        ++next_pts;
+    }
+
+    /* Flushing returns the frames that are still in the encoder and then end of file */
+    TEST_ASSERT_EQ_INT(gsr_encoder_send_frame(encoder, NULL), 0);
+    for(int i = 0; i < params.delay; ++i) {
+        TEST_ASSERT_EQ_INT(gsr_encoder_receive_packet(encoder, packet), 0);
+        TEST_ASSERT_EQ_INT(packet->pts, next_pts);
+        ++next_pts;
+    }
+    TEST_ASSERT_EQ_INT(gsr_encoder_receive_packet(encoder, packet), AVERROR_EOF);
+    TEST_ASSERT_EQ_INT(send_frame(encoder, frame, next_pts, false), AVERROR_EOF);
+    TEST_ASSERT_EQ_INT(gsr_mock_encoder_get_num_frames(encoder), next_pts);
+
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    gsr_encoder_destroy(encoder);
+    avcodec_free_context(&codec_context);
+}
+
+static void test_set_bitrate(void) {
+    AVCodecContext *codec_context = create_codec_context(800000, 0);
+    const gsr_mock_encoder_params params = { .codec_context = codec_context, .delay = 0, .can_set_bitrate = true };
+    gsr_encoder *encoder = gsr_mock_encoder_create(&params);
+    TEST_ASSERT(encoder);
+    AVFrame *frame = av_frame_alloc();
+    AVPacket *packet = av_packet_alloc();
+    TEST_ASSERT(frame && packet);
+
+    TEST_ASSERT_EQ_INT(send_frame(encoder, frame, 0, false), 0);
+    TEST_ASSERT_EQ_INT(gsr_encoder_receive_packet(encoder, packet), 0);
+    TEST_ASSERT_EQ_INT(packet->size, 1000);
+
+    /* The new bitrate is used starting at the next frame */
+    TEST_ASSERT(gsr_encoder_set_bitrate(encoder, 400000));
+    TEST_ASSERT_EQ_INT(codec_context->bit_rate, 400000);
+    TEST_ASSERT_EQ_INT(send_frame(encoder, frame, 1, false), 0);
+    TEST_ASSERT_EQ_INT(gsr_encoder_receive_packet(encoder, packet), 0);
+    TEST_ASSERT_EQ_INT(packet->size, 500);
+    TEST_ASSERT(!(packet->flags & AV_PKT_FLAG_KEY));
+
+    TEST_ASSERT(!gsr_encoder_set_bitrate(encoder, 0));
+    TEST_ASSERT_EQ_INT(codec_context->bit_rate, 400000);
+
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    gsr_encoder_destroy(encoder);
+    avcodec_free_context(&codec_context);
+}
+
+/* Encoders that can't change the bitrate while running, and constant qp */
+static void test_set_bitrate_unsupported(void) {
+    AVCodecContext *codec_context = create_codec_context(800000, 0);
+    gsr_mock_encoder_params params = { .codec_context = codec_context, .delay = 0, .can_set_bitrate = false };
+    gsr_encoder *encoder = gsr_mock_encoder_create(&params);
+    TEST_ASSERT(encoder);
+    TEST_ASSERT(!gsr_encoder_set_bitrate(encoder, 400000));
+    TEST_ASSERT_EQ_INT(codec_context->bit_rate, 800000);
+    gsr_encoder_destroy(encoder);
+
+    codec_context->bit_rate = 0;
+    params.can_set_bitrate = true;
+    encoder = gsr_mock_encoder_create(&params);
+    TEST_ASSERT(encoder);
+    TEST_ASSERT(!gsr_encoder_set_bitrate(encoder, 400000));
+    TEST_ASSERT_EQ_INT(codec_context->bit_rate, 0);
+    gsr_encoder_destroy(encoder);
+
+    avcodec_free_context(&codec_context);
+}
+
+int main(void) {
+    test_send_and_receive();
+    test_set_bitrate();
+    test_set_bitrate_unsupported();
+    return 0;
+}
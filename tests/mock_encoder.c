@@ -0,0 +1,118 @@
+#include "mock_encoder.h"
+#include <stdlib.h>
+#include <libavcodec/avcodec.h>
+
+#define MOCK_ENCODER_MAX_DELAY 16
+
+typedef struct {
+    int64_t pts;
+    int size;
+    bool keyframe;
+} MockFrame;
+
+typedef struct {
+    gsr_mock_encoder_params params;
+    MockFrame frames[MOCK_ENCODER_MAX_DELAY + 1]; /* Frames that haven't been received as packets yet, oldest first */
+    int num_frames_queued;
+    int num_frames;
+    int64_t frames_since_keyframe;
+    bool flushed;
+} gsr_mock_encoder;
+
+static int mock_encoder_get_packet_size(const gsr_mock_encoder *self) {
+    const AVCodecContext *codec_context = self->params.codec_context;
+    const double fps = codec_context->framerate.num > 0 && codec_context->framerate.den > 0 ? av_q2d(codec_context->framerate) : 60.0;
+    /* Constant qp, about the same size as 1 mbps */
+    const int64_t bitrate = codec_context->bit_rate > 0 ? codec_context->bit_rate : 1000000;
+    const int size = (int)(bitrate / 8 / fps);
+    return size > 0 ? size : 1;
+}
+
+static int gsr_mock_encoder_send_frame(gsr_encoder *encoder, AVFrame *frame) {
+    gsr_mock_encoder *self = encoder->priv;
+    if(self->flushed)
+        return AVERROR_EOF;
+
+    if(!frame) {
+        self->flushed = true;
+        return 0;
+    }
+
+    /* Like avcodec_send_frame, the packets have to be received before more frames can be sent */
+    if(self->num_frames_queued > self->params.delay)
+        return AVERROR(EAGAIN);
+
+    const int gop_size = self->params.codec_context->gop_size;
+    const bool keyframe = self->num_frames == 0 || frame->pict_type == AV_PICTURE_TYPE_I || (gop_size > 0 && self->frames_since_keyframe >= gop_size);
+    self->frames[self->num_frames_queued++] = (MockFrame){ .pts = frame->pts, .size = mock_encoder_get_packet_size(self), .keyframe = keyframe };
+    self->frames_since_keyframe = keyframe ? 1 : self->frames_since_keyframe + 1;
+    ++self->num_frames;
+    return 0;
+}
+
+static int gsr_mock_encoder_receive_packet(gsr_encoder *encoder, AVPacket *packet) {
+    gsr_mock_encoder *self = encoder->priv;
+    if(self->num_frames_queued == 0 || (!self->flushed && self->num_frames_queued <= self->params.delay))
+        return self->flushed ? AVERROR_EOF : AVERROR(EAGAIN);
+
+    const MockFrame frame = self->frames[0];
+    for(int i = 1; i < self->num_frames_queued; ++i) {
+        self->frames[i - 1] = self->frames[i];
+    }
+    --self->num_frames_queued;
+
+    av_packet_unref(packet);
+    const int ret = av_new_packet(packet, frame.size);
+    if(ret < 0)
+        return ret;
+
+    packet->pts = frame.pts;
+    packet->dts = frame.pts;
+    if(frame.keyframe)
+        packet->flags |= AV_PKT_FLAG_KEY;
+    return 0;
+}
+
+static bool gsr_mock_encoder_set_bitrate(gsr_encoder *encoder, int64_t bitrate) {
+    if(encoder->codec_context->bit_rate <= 0 || bitrate <= 0)
+        return false;
+    encoder->codec_context->bit_rate = bitrate;
+    return true;
+}
+
+static void gsr_mock_encoder_destroy(gsr_encoder *encoder) {
+    free(encoder->priv);
+    free(encoder);
+}
+
+gsr_encoder* gsr_mock_encoder_create(const gsr_mock_encoder_params *params) {
+    if(!params->codec_context || params->delay < 0 || params->delay > MOCK_ENCODER_MAX_DELAY)
+        return NULL;
+
+    gsr_encoder *encoder = calloc(1, sizeof(gsr_encoder));
+    if(!encoder)
+        return NULL;
+
+    gsr_mock_encoder *self = calloc(1, sizeof(gsr_mock_encoder));
+    if(!self) {
+        free(encoder);
+        return NULL;
+    }
+    self->params = *params;
+
+    *encoder = (gsr_encoder) {
+        .send_frame = gsr_mock_encoder_send_frame,
+        .receive_packet = gsr_mock_encoder_receive_packet,
+        .set_bitrate = params->can_set_bitrate ? gsr_mock_encoder_set_bitrate : NULL,
+        .destroy = gsr_mock_encoder_destroy,
+        .codec_context = params->codec_context,
+        .priv = self
+    };
+
+    return encoder;
+}
+
+int gsr_mock_encoder_get_num_frames(gsr_encoder *encoder) {
+    gsr_mock_encoder *self = encoder->priv;
+    return self->num_frames;
+}
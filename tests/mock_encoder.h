@@ -0,0 +1,21 @@
+#ifndef GSR_TEST_MOCK_ENCODER_H
+#define GSR_TEST_MOCK_ENCODER_H
+
+#include "../include/encoder/encoder.h"
+
+/*
+    A gsr_encoder for tests that doesn't encode anything. Each frame becomes a packet with the pts of the frame,
+    a size of bitrate / framerate (like an encoder that hits its bitrate exactly) and the keyframe flag set every gop_size frames
+    and when a keyframe is requested (pict_type AV_PICTURE_TYPE_I). The packets come out |delay| frames later, like with b-frames or lookahead.
+*/
+typedef struct {
+    AVCodecContext *codec_context; /* The framerate, bit_rate and gop_size are taken from this. Not owned by the encoder */
+    int delay;
+    bool can_set_bitrate; /* If false the encoder has no set_bitrate function, like the ffmpeg encoder for vaapi */
+} gsr_mock_encoder_params;
+
+gsr_encoder* gsr_mock_encoder_create(const gsr_mock_encoder_params *params);
+/* The number of frames given to gsr_encoder_send_frame, not counting the flush */
+int gsr_mock_encoder_get_num_frames(gsr_encoder *encoder);
+
+#endif /* GSR_TEST_MOCK_ENCODER_H */
@@ -0,0 +1,131 @@
+#include "test.h"
+#include "../include/packet_sink.hpp"
+#include <algorithm>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+static const AVRational encoder_time_base = { 1, 60 };
+static const int video_stream_index = 0;
+static const int num_b_frames = 2;
+static const int num_frames = 13;
+
+// The frames in the order an encoder with 2 b-frames outputs them: I0 P3 B1 B2 P6 B4 B5 ..., each p-frame is encoded before the b-frames that reference it
+static std::vector<int64_t> get_decode_order_pts() {
+    std::vector<int64_t> pts = { 0 };
+    for(int64_t anchor = num_b_frames + 1; anchor < num_frames; anchor += num_b_frames + 1) {
+        pts.push_back(anchor);
+        for(int64_t b = anchor - num_b_frames; b < anchor; ++b) {
+            pts.push_back(b);
+        }
+    }
+    return pts;
+}
+
+struct Muxer {
+    AVFormatContext *format_context = nullptr;
+    std::vector<int64_t> written_pts;
+    std::vector<int64_t> written_dts;
+};
+
+static void muxer_open(Muxer *muxer) {
+    TEST_ASSERT(avformat_alloc_output_context2(&muxer->format_context, nullptr, "matroska", nullptr) >= 0);
+    AVStream *stream = avformat_new_stream(muxer->format_context, nullptr);
+    TEST_ASSERT(stream);
+    stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    stream->codecpar->codec_id = AV_CODEC_ID_MPEG4;
+    stream->codecpar->width = 64;
+    stream->codecpar->height = 64;
+    stream->time_base = encoder_time_base;
+    TEST_ASSERT(avio_open_dyn_buf(&muxer->format_context->pb) >= 0);
+    TEST_ASSERT(avformat_write_header(muxer->format_context, nullptr) >= 0);
+}
+
+static void muxer_close(Muxer *muxer) {
+    TEST_ASSERT(av_write_trailer(muxer->format_context) >= 0);
+    uint8_t *data = nullptr;
+    const int size = avio_close_dyn_buf(muxer->format_context->pb, &data);
+    TEST_ASSERT(size > 0);
+    av_free(data);
+    muxer->format_context->pb = nullptr;
+    avformat_free_context(muxer->format_context);
+    muxer->format_context = nullptr;
+}
+
+// Like the muxer callback of the program, the muxer fails on non monotonic dts or pts < dts
+static PacketSinkWriteCallback muxer_write_callback(Muxer *muxer) {
+    return [muxer](AVPacket *packet, AVRational time_base) {
+        AVStream *stream = muxer->format_context->streams[packet->stream_index];
+        av_packet_rescale_ts(packet, time_base, stream->time_base);
+        muxer->written_pts.push_back(packet->pts);
+        muxer->written_dts.push_back(packet->dts);
+        TEST_ASSERT(av_interleaved_write_frame(muxer->format_context, packet) >= 0);
+    };
+}
+
+static void test_reordered_packets() {
+    Muxer muxer;
+    muxer_open(&muxer);
+
+    PacketSinkParams params;
+    params.name = "muxing test";
+    params.write = muxer_write_callback(&muxer);
+    PacketSink sink;
+    packet_sink_start(&sink, params);
+    const std::vector<PacketSink*> sinks = { &sink };
+
+    // The encoder has no packet in the middle, then the packets continue on the next call
+    const std::vector<int64_t> decode_order_pts = get_decode_order_pts();
+    const size_t num_packets_before_eagain = 4;
+    size_t decode_index = 0;
+    bool returned_eagain = false;
+    auto receive_packet = [&](AVPacket *packet) {
+        if(decode_index == decode_order_pts.size())
+            return AVERROR_EOF;
+
+        if(decode_index == num_packets_before_eagain && !returned_eagain) {
+            returned_eagain = true;
+            return AVERROR(EAGAIN);
+        }
+
+        TEST_ASSERT(av_new_packet(packet, 100) == 0);
+        packet->pts = decode_order_pts[decode_index];
+        // The dts starts before 0 so that it's never larger than the pts
+        packet->dts = (int64_t)decode_index - num_b_frames;
+        if(decode_index == 0)
+            packet->flags |= AV_PKT_FLAG_KEY;
+        ++decode_index;
+        return 0;
+    };
+
+    packet_sinks_receive_packets(receive_packet, encoder_time_base, video_stream_index, sinks);
+    TEST_ASSERT_EQ_INT(decode_index, num_packets_before_eagain);
+    packet_sinks_receive_packets(receive_packet, encoder_time_base, video_stream_index, sinks);
+    TEST_ASSERT_EQ_INT(decode_index, decode_order_pts.size());
+    packet_sink_stop(&sink);
+
+    TEST_ASSERT_EQ_INT(muxer.written_dts.size(), num_frames);
+    for(size_t i = 1; i < muxer.written_dts.size(); ++i) {
+        TEST_ASSERT(muxer.written_dts[i] > muxer.written_dts[i - 1]);
+    }
+
+    // The encoder timestamps are kept, only rescaled to the time base of the stream
+    const AVRational stream_time_base = muxer.format_context->streams[video_stream_index]->time_base;
+    for(size_t i = 0; i < muxer.written_pts.size(); ++i) {
+        TEST_ASSERT(muxer.written_pts[i] >= muxer.written_dts[i]);
+        TEST_ASSERT_EQ_INT(muxer.written_pts[i], av_rescale_q(decode_order_pts[i], encoder_time_base, stream_time_base));
+    }
+
+    std::vector<int64_t> presentation_order_pts = muxer.written_pts;
+    std::sort(presentation_order_pts.begin(), presentation_order_pts.end());
+    TEST_ASSERT(std::adjacent_find(presentation_order_pts.begin(), presentation_order_pts.end()) == presentation_order_pts.end());
+
+    muxer_close(&muxer);
+}
+
+int main() {
+    test_reordered_packets();
+    return 0;
+}
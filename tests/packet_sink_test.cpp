@@ -0,0 +1,156 @@
+#include "test.h"
+#include "../include/packet_sink.hpp"
+#include <atomic>
+#include <unistd.h>
+
+static const AVRational time_base = { 1, 100 };
+static const int video_stream_index = 0;
+static const int audio_stream_index = 1;
+
+struct WrittenPacket {
+    int stream_index;
+    int64_t pts;
+};
+
+// An output that doesn't write anything until it's opened, like a file on a stalled disk or a congested network
+struct GatedOutput {
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool open = false;
+    std::vector<WrittenPacket> written_packets;
+};
+
+static void gated_output_open(GatedOutput *output) {
+    {
+        std::lock_guard<std::mutex> lock(output->mutex);
+        output->open = true;
+    }
+    output->cond.notify_all();
+}
+
+static PacketSinkWriteCallback gated_output_write_callback(GatedOutput *output) {
+    return [output](AVPacket *packet, AVRational) {
+        std::unique_lock<std::mutex> lock(output->mutex);
+        output->cond.wait(lock, [output]{ return output->open; });
+        output->written_packets.push_back({ packet->stream_index, packet->pts });
+    };
+}
+
+static void push_packet(PacketSink *sink, int64_t pts, bool keyframe, int stream_index) {
+    AVPacket *packet = av_packet_alloc();
+    TEST_ASSERT(packet);
+    TEST_ASSERT(av_new_packet(packet, 100) == 0);
+    packet->pts = pts;
+    packet->dts = pts;
+    packet->stream_index = stream_index;
+    if(keyframe)
+        packet->flags |= AV_PKT_FLAG_KEY;
+    packet_sink_push(sink, packet, time_base);
+    av_packet_free(&packet);
+}
+
+// The thread of the sink has taken all packets from the queue, it's writing the last one
+static void wait_until_queue_is_empty(PacketSink *sink) {
+    while(packet_sink_get_stats(sink).num_queued_packets > 0) {
+        usleep(1000);
+    }
+}
+
+static PacketSinkParams create_sink_params(GatedOutput *output, PacketSinkBackpressure backpressure, size_t max_queued_packets) {
+    PacketSinkParams params;
+    params.name = "gated output";
+    params.backpressure = backpressure;
+    params.max_queued_packets = max_queued_packets;
+    params.video_stream_index = video_stream_index;
+    params.write = gated_output_write_callback(output);
+    return params;
+}
+
+// A full file sink makes the encoder wait instead of losing packets
+static void test_block() {
+    GatedOutput output;
+    PacketSink sink;
+    packet_sink_start(&sink, create_sink_params(&output, PacketSinkBackpressure::BLOCK, 4));
+
+    const int num_packets = 20;
+    std::atomic<int> num_pushed(0);
+    std::thread encoder([&]{
+        for(int i = 0; i < num_packets; ++i) {
+            push_packet(&sink, i, i == 0, video_stream_index);
+            ++num_pushed;
+        }
+    });
+
+    // One packet is being written and 4 are queued, the encoder waits in the next push
+    while(packet_sink_get_stats(&sink).num_queued_packets < 4) {
+        usleep(1000);
+    }
+    usleep(50 * 1000);
+    TEST_ASSERT_EQ_INT(num_pushed.load(), 5);
+    TEST_ASSERT_EQ_INT(packet_sink_get_stats(&sink).num_queued_packets, 4);
+
+    gated_output_open(&output);
+    encoder.join();
+    packet_sink_stop(&sink);
+
+    TEST_ASSERT_EQ_INT(packet_sink_get_stats(&sink).num_dropped_packets, 0);
+    TEST_ASSERT_EQ_INT(output.written_packets.size(), num_packets);
+    for(int i = 0; i < num_packets; ++i) {
+        TEST_ASSERT_EQ_INT(output.written_packets[i].pts, i);
+    }
+}
+
+// A full livestream sink drops packets, the video continues from the next keyframe and the audio as soon as there is room
+static void test_drop_until_keyframe() {
+    GatedOutput output;
+    PacketSink sink;
+    packet_sink_start(&sink, create_sink_params(&output, PacketSinkBackpressure::DROP_UNTIL_KEYFRAME, 2));
+
+    push_packet(&sink, 0, true, video_stream_index);
+    wait_until_queue_is_empty(&sink);
+    push_packet(&sink, 1, false, video_stream_index);
+    push_packet(&sink, 2, false, video_stream_index);
+    TEST_ASSERT(!packet_sink_get_stats(&sink).waiting_for_keyframe);
+
+    // The queue is full
+    push_packet(&sink, 3, false, video_stream_index);
+    push_packet(&sink, 100, false, audio_stream_index);
+    PacketSinkStats stats = packet_sink_get_stats(&sink);
+    TEST_ASSERT(stats.waiting_for_keyframe);
+    TEST_ASSERT_EQ_INT(stats.num_dropped_packets, 2);
+
+    gated_output_open(&output);
+    wait_until_queue_is_empty(&sink);
+
+    // There is room again, but the video can't continue without a keyframe
+    push_packet(&sink, 4, false, video_stream_index);
+    push_packet(&sink, 101, false, audio_stream_index);
+    TEST_ASSERT(packet_sink_get_stats(&sink).waiting_for_keyframe);
+    push_packet(&sink, 5, true, video_stream_index);
+    TEST_ASSERT(!packet_sink_get_stats(&sink).waiting_for_keyframe);
+    wait_until_queue_is_empty(&sink);
+    push_packet(&sink, 6, false, video_stream_index);
+    packet_sink_stop(&sink);
+
+    TEST_ASSERT_EQ_INT(packet_sink_get_stats(&sink).num_dropped_packets, 3);
+    const WrittenPacket expected[] = {
+        { video_stream_index, 0 },
+        { video_stream_index, 1 },
+        { video_stream_index, 2 },
+        { audio_stream_index, 101 },
+        { video_stream_index, 5 },
+        { video_stream_index, 6 }
+    };
+    const size_t num_expected = sizeof(expected) / sizeof(expected[0]);
+    TEST_ASSERT_EQ_INT(output.written_packets.size(), num_expected);
+    for(size_t i = 0; i < num_expected; ++i) {
+        TEST_ASSERT_EQ_INT(output.written_packets[i].stream_index, expected[i].stream_index);
+        TEST_ASSERT_EQ_INT(output.written_packets[i].pts, expected[i].pts);
+    }
+}
+
+int main() {
+    test_block();
+    test_drop_until_keyframe();
+    return 0;
+}
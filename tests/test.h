@@ -0,0 +1,24 @@
+#ifndef GSR_TEST_H
+#define GSR_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Exits the test program with a failure if |cond| is false */
+#define TEST_ASSERT(cond) do { \
+        if(!(cond)) { \
+            fprintf(stderr, "%s:%d: test failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while(0)
+
+#define TEST_ASSERT_EQ_INT(a, b) do { \
+        const long long test_a_ = (long long)(a); \
+        const long long test_b_ = (long long)(b); \
+        if(test_a_ != test_b_) { \
+            fprintf(stderr, "%s:%d: test failed: %s == %s (%lld != %lld)\n", __FILE__, __LINE__, #a, #b, test_a_, test_b_); \
+            exit(1); \
+        } \
+    } while(0)
+
+#endif /* GSR_TEST_H */
@@ -0,0 +1,33 @@
+#include "throttled_output.hpp"
+#include <unistd.h>
+
+void throttled_output_set_throughput(ThrottledOutput *output, int64_t throughput) {
+    {
+        std::lock_guard<std::mutex> lock(output->mutex);
+        output->throughput = throughput;
+    }
+    output->cond.notify_all();
+}
+
+int64_t throttled_output_get_num_written_keyframes(ThrottledOutput *output) {
+    std::lock_guard<std::mutex> lock(output->mutex);
+    return output->num_written_keyframes;
+}
+
+PacketSinkWriteCallback throttled_output_write_callback(ThrottledOutput *output) {
+    return [output](AVPacket *packet, AVRational) {
+        int64_t throughput = 0;
+        {
+            std::unique_lock<std::mutex> lock(output->mutex);
+            output->cond.wait(lock, [output]{ return output->throughput > 0; });
+            throughput = output->throughput;
+        }
+
+        usleep((int64_t)packet->size * 1000000 / throughput);
+
+        std::lock_guard<std::mutex> lock(output->mutex);
+        ++output->num_written_packets;
+        if(packet->flags & AV_PKT_FLAG_KEY)
+            ++output->num_written_keyframes;
+    };
+}
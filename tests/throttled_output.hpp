@@ -0,0 +1,26 @@
+#ifndef GSR_TEST_THROTTLED_OUTPUT_HPP
+#define GSR_TEST_THROTTLED_OUTPUT_HPP
+
+#include "../include/packet_sink.hpp"
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+/*
+    A local stand-in for a livestream output (an rtmp/tcp connection) for tests. Writing a packet takes as long as sending it
+    at the throughput would, so a throughput lower than the bitrate acts like a congested network.
+*/
+struct ThrottledOutput {
+    std::mutex mutex;
+    std::condition_variable cond;
+    int64_t throughput = 0; // Bytes per second. With 0 the output is stalled until the throughput is changed
+    int64_t num_written_packets = 0;
+    int64_t num_written_keyframes = 0;
+};
+
+void throttled_output_set_throughput(ThrottledOutput *output, int64_t throughput);
+int64_t throttled_output_get_num_written_keyframes(ThrottledOutput *output);
+// The write callback of a packet sink that writes to |output|
+PacketSinkWriteCallback throttled_output_write_callback(ThrottledOutput *output);
+
+#endif /* GSR_TEST_THROTTLED_OUTPUT_HPP */
@@ -0,0 +1,318 @@
+#include "test.h"
+#include "../include/window_tracker.h"
+
+#include <string.h>
+
+/*
+    The tracker is linked against the fake Xlib functions below instead of libX11, so the window tree, the window attributes
+    and the clock are controlled by the test. The tree is: ROOT_WINDOW -> FRAME_WINDOW (window manager decoration) -> CLIENT_WINDOW
+*/
+
+#define ROOT_WINDOW 1
+#define FRAME_WINDOW 2
+#define CLIENT_WINDOW 3
+#define NEW_FRAME_WINDOW 4
+#define OTHER_WINDOW 5
+#define NUM_WINDOWS 6
+
+typedef struct {
+    Window parent;
+    int width;
+    int height;
+    int map_state;
+    long event_mask;
+} FakeWindow;
+
+static FakeWindow fake_windows[NUM_WINDOWS];
+static double fake_time = 100.0;
+static Screen fake_screen;
+static __typeof__(*(_XPrivDisplay)NULL) fake_display;
+
+double clock_get_monotonic_seconds(void) {
+    return fake_time;
+}
+
+Status XQueryTree(Display *display, Window window, Window *root, Window *parent, Window **children, unsigned int *num_children) {
+    (void)display;
+    if(window <= 0 || window >= NUM_WINDOWS)
+        return 0;
+    *root = ROOT_WINDOW;
+    *parent = fake_windows[window].parent;
+    *children = NULL;
+    *num_children = 0;
+    return 1;
+}
+
+Status XGetWindowAttributes(Display *display, Window window, XWindowAttributes *attr) {
+    (void)display;
+    if(window <= 0 || window >= NUM_WINDOWS)
+        return 0;
+    attr->width = fake_windows[window].width;
+    attr->height = fake_windows[window].height;
+    attr->map_state = fake_windows[window].map_state;
+    return 1;
+}
+
+int XSelectInput(Display *display, Window window, long event_mask) {
+    (void)display;
+    if(window > 0 && window < NUM_WINDOWS)
+        fake_windows[window].event_mask = event_mask;
+    return 1;
+}
+
+int XFree(void *data) {
+    (void)data;
+    return 1;
+}
+
+static Display* fake_display_init(void) {
+    memset(fake_windows, 0, sizeof(fake_windows));
+    fake_windows[FRAME_WINDOW] = (FakeWindow){ .parent = ROOT_WINDOW, .width = 644, .height = 504, .map_state = IsViewable };
+    fake_windows[CLIENT_WINDOW] = (FakeWindow){ .parent = FRAME_WINDOW, .width = 640, .height = 480, .map_state = IsViewable };
+    fake_windows[NEW_FRAME_WINDOW] = (FakeWindow){ .parent = ROOT_WINDOW, .width = 644, .height = 504, .map_state = IsViewable };
+    fake_time = 100.0;
+
+    memset(&fake_screen, 0, sizeof(fake_screen));
+    fake_screen.root = ROOT_WINDOW;
+    memset(&fake_display, 0, sizeof(fake_display));
+    fake_display.screens = &fake_screen;
+    fake_display.nscreens = 1;
+    fake_display.default_screen = 0;
+    return (Display*)&fake_display;
+}
+
+static bool send_event(gsr_window_tracker *tracker, XEvent xev) {
+    return gsr_window_tracker_process_event(tracker, &xev);
+}
+
+static XEvent configure_event(Window window, int width, int height) {
+    XEvent xev = { .type = ConfigureNotify };
+    xev.xconfigure.window = window;
+    xev.xconfigure.width = width;
+    xev.xconfigure.height = height;
+    return xev;
+}
+
+static XEvent expose_event(Window window, int count) {
+    XEvent xev = { .type = Expose };
+    xev.xexpose.window = window;
+    xev.xexpose.count = count;
+    return xev;
+}
+
+static XEvent unmap_event(Window window) {
+    XEvent xev = { .type = UnmapNotify };
+    xev.xunmap.window = window;
+    return xev;
+}
+
+static XEvent map_event(Window window) {
+    XEvent xev = { .type = MapNotify };
+    xev.xmap.window = window;
+    return xev;
+}
+
+static XEvent reparent_event(Window window, Window parent) {
+    XEvent xev = { .type = ReparentNotify };
+    xev.xreparent.window = window;
+    xev.xreparent.parent = parent;
+    return xev;
+}
+
+static XEvent destroy_event(Window window) {
+    XEvent xev = { .type = DestroyNotify };
+    xev.xdestroywindow.window = window;
+    return xev;
+}
+
+static void test_init(void) {
+    Display *display = fake_display_init();
+    gsr_window_tracker tracker;
+    gsr_window_tracker_init(&tracker, display, CLIENT_WINDOW);
+
+    TEST_ASSERT_EQ_INT(tracker.toplevel, FRAME_WINDOW);
+    TEST_ASSERT_EQ_INT(tracker.size.x, 640);
+    TEST_ASSERT_EQ_INT(tracker.size.y, 480);
+    TEST_ASSERT(tracker.viewable);
+    TEST_ASSERT_EQ_INT(fake_windows[CLIENT_WINDOW].event_mask, StructureNotifyMask | ExposureMask);
+    TEST_ASSERT_EQ_INT(fake_windows[FRAME_WINDOW].event_mask, StructureNotifyMask);
+
+    /* The pixmap is acquired for the first time */
+    TEST_ASSERT(gsr_window_tracker_should_acquire_pixmap(&tracker));
+    gsr_window_tracker_on_pixmap_acquired(&tracker);
+    TEST_ASSERT(!gsr_window_tracker_should_acquire_pixmap(&tracker));
+
+    gsr_window_tracker_deinit(&tracker);
+    TEST_ASSERT_EQ_INT(fake_windows[CLIENT_WINDOW].event_mask, 0);
+    TEST_ASSERT_EQ_INT(fake_windows[FRAME_WINDOW].event_mask, 0);
+}
+
+static void test_resize_and_expose(void) {
+    Display *display = fake_display_init();
+    gsr_window_tracker tracker;
+    gsr_window_tracker_init(&tracker, display, CLIENT_WINDOW);
+    gsr_window_tracker_on_pixmap_acquired(&tracker);
+
+    /* Moving the window doesn't give it a new pixmap */
+    TEST_ASSERT(send_event(&tracker, configure_event(CLIENT_WINDOW, 640, 480)));
+    TEST_ASSERT(!gsr_window_tracker_should_acquire_pixmap(&tracker));
+
+    TEST_ASSERT(send_event(&tracker, configure_event(CLIENT_WINDOW, 800, 600)));
+    TEST_ASSERT_EQ_INT(tracker.size.x, 800);
+    TEST_ASSERT_EQ_INT(tracker.size.y, 600);
+    TEST_ASSERT(gsr_window_tracker_should_acquire_pixmap(&tracker));
+    gsr_window_tracker_on_pixmap_acquired(&tracker);
+
+    /* Only the last expose event of a series invalidates the pixmap */
+    TEST_ASSERT(send_event(&tracker, expose_event(CLIENT_WINDOW, 1)));
+    TEST_ASSERT(!gsr_window_tracker_should_acquire_pixmap(&tracker));
+    TEST_ASSERT(send_event(&tracker, expose_event(CLIENT_WINDOW, 0)));
+    TEST_ASSERT(gsr_window_tracker_should_acquire_pixmap(&tracker));
+    gsr_window_tracker_on_pixmap_acquired(&tracker);
+
+    /* Events for other windows are ignored */
+    TEST_ASSERT(!send_event(&tracker, configure_event(OTHER_WINDOW, 1, 1)));
+    TEST_ASSERT(!send_event(&tracker, configure_event(FRAME_WINDOW, 1, 1)));
+    TEST_ASSERT(!send_event(&tracker, expose_event(OTHER_WINDOW, 0)));
+    TEST_ASSERT(!send_event(&tracker, unmap_event(OTHER_WINDOW)));
+    TEST_ASSERT(!send_event(&tracker, destroy_event(FRAME_WINDOW)));
+    TEST_ASSERT(!gsr_window_tracker_should_acquire_pixmap(&tracker));
+    TEST_ASSERT(tracker.viewable);
+
+    gsr_window_tracker_deinit(&tracker);
+}
+
+static void test_unmap_and_map(void) {
+    Display *display = fake_display_init();
+    gsr_window_tracker tracker;
+    gsr_window_tracker_init(&tracker, display, CLIENT_WINDOW);
+    gsr_window_tracker_on_pixmap_acquired(&tracker);
+
+    /* The window manager unmaps the frame (switching workspace) */
+    fake_windows[FRAME_WINDOW].map_state = IsUnmapped;
+    fake_windows[CLIENT_WINDOW].map_state = IsUnviewable;
+    TEST_ASSERT(send_event(&tracker, unmap_event(FRAME_WINDOW)));
+    TEST_ASSERT(!tracker.viewable);
+
+    /* The pixmap can't be acquired while the window isn't viewable */
+    TEST_ASSERT(send_event(&tracker, expose_event(CLIENT_WINDOW, 0)));
+    TEST_ASSERT(!gsr_window_tracker_should_acquire_pixmap(&tracker));
+
+    fake_windows[FRAME_WINDOW].map_state = IsViewable;
+    fake_windows[CLIENT_WINDOW].map_state = IsViewable;
+    TEST_ASSERT(send_event(&tracker, map_event(FRAME_WINDOW)));
+    TEST_ASSERT(tracker.viewable);
+    TEST_ASSERT(gsr_window_tracker_should_acquire_pixmap(&tracker));
+    gsr_window_tracker_on_pixmap_acquired(&tracker);
+    TEST_ASSERT(!gsr_window_tracker_should_acquire_pixmap(&tracker));
+
+    gsr_window_tracker_deinit(&tracker);
+}
+
+static void test_pixmap_acquire_failed(void) {
+    Display *display = fake_display_init();
+    gsr_window_tracker tracker;
+    gsr_window_tracker_init(&tracker, display, CLIENT_WINDOW);
+
+    TEST_ASSERT(gsr_window_tracker_should_acquire_pixmap(&tracker));
+    gsr_window_tracker_on_pixmap_acquire_failed(&tracker);
+
+    /* Not tried again immediately */
+    TEST_ASSERT(!gsr_window_tracker_should_acquire_pixmap(&tracker));
+    fake_time += 0.25;
+    TEST_ASSERT(!gsr_window_tracker_should_acquire_pixmap(&tracker));
+    fake_time += 0.25;
+    TEST_ASSERT(gsr_window_tracker_should_acquire_pixmap(&tracker));
+
+    /* The window was unmapped without the tracker getting an event for it. It's noticed when acquiring the pixmap fails */
+    fake_windows[CLIENT_WINDOW].map_state = IsUnmapped;
+    gsr_window_tracker_on_pixmap_acquire_failed(&tracker);
+    TEST_ASSERT(!tracker.viewable);
+    fake_time += 10.0;
+    TEST_ASSERT(!gsr_window_tracker_should_acquire_pixmap(&tracker));
+
+    /* Mapping the window again tries again right away, without waiting for the retry delay */
+    gsr_window_tracker_on_pixmap_acquire_failed(&tracker);
+    fake_windows[CLIENT_WINDOW].map_state = IsViewable;
+    TEST_ASSERT(send_event(&tracker, map_event(CLIENT_WINDOW)));
+    TEST_ASSERT(gsr_window_tracker_should_acquire_pixmap(&tracker));
+    gsr_window_tracker_on_pixmap_acquired(&tracker);
+    TEST_ASSERT(!gsr_window_tracker_should_acquire_pixmap(&tracker));
+
+    gsr_window_tracker_deinit(&tracker);
+}
+
+static void test_reparent(void) {
+    Display *display = fake_display_init();
+    gsr_window_tracker tracker;
+    gsr_window_tracker_init(&tracker, display, CLIENT_WINDOW);
+    gsr_window_tracker_on_pixmap_acquired(&tracker);
+
+    /* The window manager decorates the window again with a new frame */
+    fake_windows[CLIENT_WINDOW].parent = NEW_FRAME_WINDOW;
+    TEST_ASSERT(send_event(&tracker, reparent_event(CLIENT_WINDOW, NEW_FRAME_WINDOW)));
+    TEST_ASSERT_EQ_INT(tracker.toplevel, NEW_FRAME_WINDOW);
+    TEST_ASSERT_EQ_INT(fake_windows[FRAME_WINDOW].event_mask, 0);
+    TEST_ASSERT_EQ_INT(fake_windows[NEW_FRAME_WINDOW].event_mask, StructureNotifyMask);
+    TEST_ASSERT(gsr_window_tracker_should_acquire_pixmap(&tracker));
+    gsr_window_tracker_on_pixmap_acquired(&tracker);
+
+    /* Events from the old frame are ignored and the new frame is followed */
+    TEST_ASSERT(!send_event(&tracker, unmap_event(FRAME_WINDOW)));
+    TEST_ASSERT(tracker.viewable);
+    TEST_ASSERT(send_event(&tracker, unmap_event(NEW_FRAME_WINDOW)));
+    TEST_ASSERT(!tracker.viewable);
+
+    /* Undecorated: the window is a child of the root window */
+    fake_windows[CLIENT_WINDOW].parent = ROOT_WINDOW;
+    TEST_ASSERT(send_event(&tracker, reparent_event(CLIENT_WINDOW, ROOT_WINDOW)));
+    TEST_ASSERT_EQ_INT(tracker.toplevel, CLIENT_WINDOW);
+    TEST_ASSERT_EQ_INT(fake_windows[NEW_FRAME_WINDOW].event_mask, 0);
+    TEST_ASSERT_EQ_INT(fake_windows[CLIENT_WINDOW].event_mask, StructureNotifyMask | ExposureMask);
+    TEST_ASSERT(tracker.viewable);
+    TEST_ASSERT(gsr_window_tracker_should_acquire_pixmap(&tracker));
+
+    gsr_window_tracker_deinit(&tracker);
+    TEST_ASSERT_EQ_INT(fake_windows[CLIENT_WINDOW].event_mask, 0);
+}
+
+static void test_destroy(void) {
+    Display *display = fake_display_init();
+    gsr_window_tracker tracker;
+    gsr_window_tracker_init(&tracker, display, CLIENT_WINDOW);
+    gsr_window_tracker_on_pixmap_acquired(&tracker);
+
+    TEST_ASSERT(send_event(&tracker, destroy_event(CLIENT_WINDOW)));
+    TEST_ASSERT(tracker.destroyed);
+    TEST_ASSERT(!tracker.viewable);
+
+    /* Nothing brings a destroyed window back */
+    TEST_ASSERT(send_event(&tracker, expose_event(CLIENT_WINDOW, 0)));
+    TEST_ASSERT(send_event(&tracker, map_event(CLIENT_WINDOW)));
+    TEST_ASSERT(!gsr_window_tracker_should_acquire_pixmap(&tracker));
+
+    /* The input of a destroyed window can't be changed anymore, the tracker doesn't try to */
+    fake_windows[CLIENT_WINDOW].event_mask = -1;
+    gsr_window_tracker_deinit(&tracker);
+    TEST_ASSERT_EQ_INT(fake_windows[CLIENT_WINDOW].event_mask, -1);
+}
+
+static void test_no_window(void) {
+    Display *display = fake_display_init();
+    gsr_window_tracker tracker;
+    gsr_window_tracker_init(&tracker, display, None);
+    TEST_ASSERT(!gsr_window_tracker_should_acquire_pixmap(&tracker));
+    TEST_ASSERT(!send_event(&tracker, map_event(CLIENT_WINDOW)));
+    gsr_window_tracker_deinit(&tracker);
+}
+
+int main(void) {
+    test_init();
+    test_resize_and_expose();
+    test_unmap_and_map();
+    test_pixmap_acquire_failed();
+    test_reparent();
+    test_destroy();
+    test_no_window();
+    return 0;
+}